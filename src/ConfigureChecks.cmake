@@ -88,6 +88,7 @@ check_function_exists("mmap"             HAVE_MMAP)
 check_function_exists("mprotect"         HAVE_MPROTECT)
 check_function_exists("mkdtemp"          HAVE_MKDTEMP)
 check_function_exists("mkstemp"          HAVE_MKSTEMP)
+check_function_exists("posix_fadvise"    HAVE_POSIX_FADVISE)
 check_function_exists("setresgid"        HAVE_SETRESGID)
 check_function_exists("setresuid"        HAVE_SETRESUID)
 check_function_exists("sysconf"          HAVE_SYSCONF)
@@ -121,4 +122,12 @@ check_c_source_compiles(
 	}"
 	HAVE_NL80211
 )
+check_c_source_compiles(
+	"#include <linux/if_packet.h>
+	int main() {
+		struct tpacket_req3 req;
+		int v = TPACKET_V3;
+	}"
+	HAVE_TPACKET3
+)
 
@@ -799,6 +799,22 @@ print_stats_table(const gchar *filename, capture_info *cf_info)
   printf("\n");
 }
 
+/*
+ * Do any of the requested infos need a pass over the packets?  If not,
+ * a file that records its packet count needn't be read at all.
+ */
+static gboolean
+need_packet_pass(void)
+{
+  return cap_file_encap || cap_snaplen || cap_data_size || cap_duration ||
+         cap_start_time || cap_end_time || cap_order || cap_data_rate_byte ||
+         cap_data_rate_bit || cap_packet_size || cap_packet_rate;
+}
+
+/* Records read at a time */
+#define CAPINFOS_BATCH_RECORDS  256
+#define CAPINFOS_BATCH_BYTES    (1024 * 1024)
+
 static int
 process_cap_file(wtap *wth, const char *filename)
 {
@@ -806,7 +822,8 @@ process_cap_file(wtap *wth, const char *filename)
   int                   err;
   gchar                *err_info;
   gint64                size;
-  gint64                data_offset;
+  wtap_batch           *batch;
+  guint                 i;
 
   guint32               packet = 0;
   gint64                bytes  = 0;
@@ -827,58 +844,66 @@ process_cap_file(wtap *wth, const char *filename)
 
   cf_info.encap_counts = g_new0(int,WTAP_NUM_ENCAP_TYPES);
 
+  /* Skip to the end if all we need of the packets is how many there are */
+  if (!need_packet_pass() && wtap_packet_count(wth) >= 0 &&
+      wtap_seek_to_packet(wth, (guint64)wtap_packet_count(wth), &err, &err_info))
+    packet = (guint32)wtap_packet_count(wth);
+
   /* Tally up data that we need to parse through the file to find */
-  while (wtap_read(wth, &err, &err_info, &data_offset))  {
-    phdr = wtap_phdr(wth);
-    if (phdr->presence_flags & WTAP_HAS_TS) {
-      prev_time = cur_time;
-      cur_time = nstime_to_sec(&phdr->ts);
-      if (packet == 0) {
-        start_time = cur_time;
-        stop_time  = cur_time;
-        prev_time  = cur_time;
-      }
-      if (cur_time < prev_time) {
-        order = NOT_IN_ORDER;
-      }
-      if (cur_time < start_time) {
-        start_time = cur_time;
-      }
-      if (cur_time > stop_time) {
-        stop_time = cur_time;
+  batch = wtap_batch_new(CAPINFOS_BATCH_RECORDS, CAPINFOS_BATCH_BYTES);
+  while (wtap_read_batch(wth, batch, CAPINFOS_BATCH_RECORDS, &err, &err_info)) {
+    for (i = 0; i < batch->count; i++) {
+      phdr = &batch->phdrs[i];
+      if (phdr->presence_flags & WTAP_HAS_TS) {
+        prev_time = cur_time;
+        cur_time = nstime_to_sec(&phdr->ts);
+        if (packet == 0) {
+          start_time = cur_time;
+          stop_time  = cur_time;
+          prev_time  = cur_time;
+        }
+        if (cur_time < prev_time) {
+          order = NOT_IN_ORDER;
+        }
+        if (cur_time < start_time) {
+          start_time = cur_time;
+        }
+        if (cur_time > stop_time) {
+          stop_time = cur_time;
+        }
+      } else {
+        have_times = FALSE; /* at least one packet has no time stamp */
+        if (order != NOT_IN_ORDER)
+          order = ORDER_UNKNOWN;
       }
-    } else {
-      have_times = FALSE; /* at least one packet has no time stamp */
-      if (order != NOT_IN_ORDER)
-        order = ORDER_UNKNOWN;
-    }
 
-    if (phdr->rec_type == REC_TYPE_PACKET) {
-      bytes+=phdr->len;
-      packet++;
-
-      /* If caplen < len for a rcd, then presumably           */
-      /* 'Limit packet capture length' was done for this rcd. */
-      /* Keep track as to the min/max actual snapshot lengths */
-      /*  seen for this file.                                 */
-      if (phdr->caplen < phdr->len) {
-        if (phdr->caplen < snaplen_min_inferred)
-          snaplen_min_inferred = phdr->caplen;
-        if (phdr->caplen > snaplen_max_inferred)
-          snaplen_max_inferred = phdr->caplen;
-      }
+      if (phdr->rec_type == REC_TYPE_PACKET) {
+        bytes+=phdr->len;
+        packet++;
+
+        /* If caplen < len for a rcd, then presumably           */
+        /* 'Limit packet capture length' was done for this rcd. */
+        /* Keep track as to the min/max actual snapshot lengths */
+        /*  seen for this file.                                 */
+        if (phdr->caplen < phdr->len) {
+          if (phdr->caplen < snaplen_min_inferred)
+            snaplen_min_inferred = phdr->caplen;
+          if (phdr->caplen > snaplen_max_inferred)
+            snaplen_max_inferred = phdr->caplen;
+        }
 
-      /* Per-packet encapsulation */
-      if (wtap_file_encap(wth) == WTAP_ENCAP_PER_PACKET) {
-        if ((phdr->pkt_encap > 0) && (phdr->pkt_encap < WTAP_NUM_ENCAP_TYPES)) {
-          cf_info.encap_counts[phdr->pkt_encap] += 1;
-        } else {
-          fprintf(stderr, "capinfos: Unknown per-packet encapsulation: %d [frame number: %d]\n", phdr->pkt_encap, packet);
+        /* Per-packet encapsulation */
+        if (wtap_file_encap(wth) == WTAP_ENCAP_PER_PACKET) {
+          if ((phdr->pkt_encap > 0) && (phdr->pkt_encap < WTAP_NUM_ENCAP_TYPES)) {
+            cf_info.encap_counts[phdr->pkt_encap] += 1;
+          } else {
+            fprintf(stderr, "capinfos: Unknown per-packet encapsulation: %d [frame number: %d]\n", phdr->pkt_encap, packet);
+          }
         }
       }
     }
-
   } /* while */
+  wtap_batch_free(batch);
 
   if (err != 0) {
     fprintf(stderr,
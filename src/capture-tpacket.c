@@ -0,0 +1,524 @@
+/* capture-tpacket.c
+ * Capture through Linux AF_PACKET sockets with TPACKET_V3 memory-mapped
+ * rings, rather than through libpcap
+ *
+ * Wireshark - Network traffic analyzer
+ * By Gerald Combs <gerald@wireshark.org>
+ * Copyright 1998 Gerald Combs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "capture-tpacket.h"
+
+#ifdef HAVE_TPACKET3
+
+/*
+ * With TPACKET_V3 the kernel puts packets into a ring of blocks that
+ * it shares with us, and hands a block over once it's full or has been
+ * open for the timeout, so we make a system call (poll()) at most once
+ * a block rather than once a packet, and packets are handed to our
+ * caller where the kernel put them.  A block is ours while its status
+ * has TP_STATUS_USER set; we give it back by setting it to
+ * TP_STATUS_KERNEL, and take the blocks in order.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+
+#define VLAN_TAG_LEN    4
+
+typedef struct {
+    int       fd;
+    guint8   *map;
+    gsize     map_len;
+    guint     block_size;
+    guint     block_nr;
+    guint     block;            /**< the next block we'll be handed */
+    guint8   *vlan_buf;         /**< packets with their VLAN tag put back */
+    guint64   received;         /**< PACKET_STATISTICS totals */
+    guint64   dropped;
+    char      errbuf[PCAP_ERRBUF_SIZE];
+} tpacket_sock_t;
+
+struct tpacket {
+    int             snaplen;
+    gboolean        loopback;
+    guint           nsocks;
+    tpacket_sock_t *socks;
+};
+
+static struct tpacket_block_desc *
+tpacket_block(tpacket_sock_t *ts)
+{
+    return (struct tpacket_block_desc *)(void *)(ts->map + (gsize)ts->block * ts->block_size);
+}
+
+static void
+tpacket_sock_close(tpacket_sock_t *ts)
+{
+    if (ts->map != NULL)
+        munmap(ts->map, ts->map_len);
+    if (ts->fd != -1)
+        close(ts->fd);
+    g_free(ts->vlan_buf);
+    ts->map = NULL;
+    ts->fd = -1;
+    ts->vlan_buf = NULL;
+}
+
+static gboolean
+tpacket_sock_open(tpacket_sock_t *ts, const char *iface, int ifindex,
+                  const tpacket_opts_t *opts, int fanout,
+                  char *errmsg, size_t errmsg_len)
+{
+    /* Nothing gets into the ring before the caller's filter is attached */
+    struct sock_filter  drop_all = BPF_STMT(BPF_RET|BPF_K, 0);
+    struct sock_fprog   prog;
+    struct tpacket_req3 req;
+    struct sockaddr_ll  sll;
+    struct packet_mreq  mr;
+    int                 version = TPACKET_V3;
+
+    ts->fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (ts->fd == -1) {
+        g_snprintf(errmsg, (gulong)errmsg_len, "socket: %s", g_strerror(errno));
+        return FALSE;
+    }
+
+    prog.len = 1;
+    prog.filter = &drop_all;
+    if (setsockopt(ts->fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof prog) == -1) {
+        g_snprintf(errmsg, (gulong)errmsg_len, "Can't set a filter on %s: %s",
+                   iface, g_strerror(errno));
+        return FALSE;
+    }
+    if (setsockopt(ts->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof version) == -1) {
+        g_snprintf(errmsg, (gulong)errmsg_len, "Can't use TPACKET_V3 on %s: %s",
+                   iface, g_strerror(errno));
+        return FALSE;
+    }
+
+    memset(&req, 0, sizeof req);
+    req.tp_block_size = ts->block_size;
+    req.tp_block_nr = ts->block_nr;
+    /* Packets in a V3 ring aren't in fixed-size frames; this just has to divide a block */
+    req.tp_frame_size = ts->block_size;
+    req.tp_frame_nr = ts->block_nr;
+    req.tp_retire_blk_tov = opts->timeout;
+    if (setsockopt(ts->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof req) == -1) {
+        g_snprintf(errmsg, (gulong)errmsg_len,
+                   "Can't set up a ring of %u blocks of %u bytes on %s: %s",
+                   ts->block_nr, ts->block_size, iface, g_strerror(errno));
+        return FALSE;
+    }
+    ts->map_len = (gsize)ts->block_size * ts->block_nr;
+    ts->map = (guint8 *)mmap(NULL, ts->map_len, PROT_READ|PROT_WRITE, MAP_SHARED, ts->fd, 0);
+    if (ts->map == MAP_FAILED) {
+        ts->map = NULL;
+        g_snprintf(errmsg, (gulong)errmsg_len, "Can't map the ring for %s: %s",
+                   iface, g_strerror(errno));
+        return FALSE;
+    }
+
+    memset(&sll, 0, sizeof sll);
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = ifindex;
+    if (bind(ts->fd, (struct sockaddr *)&sll, sizeof sll) == -1) {
+        g_snprintf(errmsg, (gulong)errmsg_len, "Can't bind to %s: %s",
+                   iface, g_strerror(errno));
+        return FALSE;
+    }
+
+    if (opts->promisc) {
+        memset(&mr, 0, sizeof mr);
+        mr.mr_ifindex = ifindex;
+        mr.mr_type = PACKET_MR_PROMISC;
+        if (setsockopt(ts->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr, sizeof mr) == -1) {
+            g_snprintf(errmsg, (gulong)errmsg_len, "Can't put %s into promiscuous mode: %s",
+                       iface, g_strerror(errno));
+            return FALSE;
+        }
+    }
+
+    if (fanout != -1 &&
+        setsockopt(ts->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof fanout) == -1) {
+        g_snprintf(errmsg, (gulong)errmsg_len, "Can't join fanout group %u on %s: %s",
+                   fanout & 0xffff, iface, g_strerror(errno));
+        return FALSE;
+    }
+
+    ts->vlan_buf = (guint8 *)g_malloc(ts->block_size + VLAN_TAG_LEN);
+    return TRUE;
+}
+
+tpacket_t *
+tpacket_open(const char *iface, const tpacket_opts_t *opts,
+             int *linktype, char *errmsg, size_t errmsg_len)
+{
+    tpacket_t    *tp;
+    struct ifreq  ifr;
+    int           ifindex, fd, fanout;
+    guint         i, block_size, min_block_size, fanout_mode;
+    guint64       block_nr;
+
+    ifindex = if_nametoindex(iface);
+    if (ifindex == 0) {
+        g_snprintf(errmsg, (gulong)errmsg_len, "There is no interface named %s", iface);
+        return NULL;
+    }
+
+    /* We give the packets to our caller as they are in the ring, so only
+       link-layer types that don't need rewriting are supported. */
+    fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd == -1) {
+        g_snprintf(errmsg, (gulong)errmsg_len, "socket: %s", g_strerror(errno));
+        return NULL;
+    }
+    memset(&ifr, 0, sizeof ifr);
+    g_strlcpy(ifr.ifr_name, iface, sizeof ifr.ifr_name);
+    if (ioctl(fd, SIOCGIFHWADDR, &ifr) == -1) {
+        g_snprintf(errmsg, (gulong)errmsg_len, "SIOCGIFHWADDR: %s", g_strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    if (ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER &&
+        ifr.ifr_hwaddr.sa_family != ARPHRD_LOOPBACK) {
+        g_snprintf(errmsg, (gulong)errmsg_len,
+                   "%s isn't an Ethernet or loopback interface, so it can't be captured on through TPACKET_V3",
+                   iface);
+        return NULL;
+    }
+    *linktype = DLT_EN10MB;
+
+    /* A block has to be big enough for the biggest packet, with the
+       headers the kernel puts in front of it */
+    min_block_size = MAX(opts->block_size,
+                         (guint)opts->snaplen + VLAN_TAG_LEN + TPACKET3_HDRLEN + 64);
+    block_size = (guint)sysconf(_SC_PAGESIZE);
+    while (block_size < min_block_size)
+        block_size <<= 1;
+    block_nr = opts->ring_size / MAX(opts->sockets, 1) / block_size;
+    block_nr = MAX(block_nr, 2);
+    block_nr = MIN(block_nr, G_MAXUINT32 / block_size);
+
+    fanout = -1;
+    if (opts->sockets > 1) {
+        fanout_mode = PACKET_FANOUT_HASH;
+#ifdef PACKET_FANOUT_FLAG_DEFRAG
+        /* so that all the fragments of a datagram go to the same socket */
+        fanout_mode |= PACKET_FANOUT_FLAG_DEFRAG;
+#endif
+        fanout = (int)((fanout_mode << 16) |
+                       ((opts->fanout_group != 0 ? opts->fanout_group : (guint)getpid()) & 0xffff));
+    }
+
+    tp = g_new0(tpacket_t, 1);
+    tp->snaplen = opts->snaplen;
+    tp->loopback = (ifr.ifr_hwaddr.sa_family == ARPHRD_LOOPBACK);
+    tp->nsocks = MAX(opts->sockets, 1);
+    tp->socks = g_new0(tpacket_sock_t, tp->nsocks);
+    for (i = 0; i < tp->nsocks; i++) {
+        tp->socks[i].fd = -1;
+        tp->socks[i].block_size = block_size;
+        tp->socks[i].block_nr = (guint)block_nr;
+    }
+    for (i = 0; i < tp->nsocks; i++) {
+        if (!tpacket_sock_open(&tp->socks[i], iface, ifindex, opts, fanout,
+                               errmsg, errmsg_len)) {
+            tpacket_close(tp);
+            return NULL;
+        }
+    }
+    return tp;
+}
+
+guint
+tpacket_sockets(tpacket_t *tp)
+{
+    return tp->nsocks;
+}
+
+gboolean
+tpacket_setfilter(tpacket_t *tp, const struct bpf_program *fcode)
+{
+    struct sock_fprog prog;
+    guint             i;
+
+    /* libpcap's struct bpf_insn is laid out as the kernel's struct sock_filter */
+    prog.len = fcode->bf_len;
+    prog.filter = (struct sock_filter *)(void *)fcode->bf_insns;
+    for (i = 0; i < tp->nsocks; i++) {
+        if (setsockopt(tp->socks[i].fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof prog) == -1) {
+            g_snprintf(tp->socks[0].errbuf, sizeof tp->socks[0].errbuf,
+                       "SO_ATTACH_FILTER: %s", g_strerror(errno));
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+int
+tpacket_poll(tpacket_t *tp, guint sock, int timeout)
+{
+    tpacket_sock_t *ts = &tp->socks[sock];
+    struct pollfd   pfd;
+    int             ret, err;
+    socklen_t       len;
+
+    if (g_atomic_int_get((volatile gint *)&tpacket_block(ts)->hdr.bh1.block_status) & TP_STATUS_USER)
+        return 1;
+
+    pfd.fd = ts->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    ret = poll(&pfd, 1, timeout);
+    if (ret == -1) {
+        err = errno;
+        g_snprintf(ts->errbuf, sizeof ts->errbuf, "poll: %s", g_strerror(err));
+        errno = err;
+        return -1;
+    }
+    if (ret > 0 && (pfd.revents & (POLLERR|POLLHUP|POLLNVAL))) {
+        err = 0;
+        len = sizeof err;
+        if (getsockopt(ts->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+            err = errno;
+        if (err == ENETDOWN) {
+            /* the message libpcap gives, which dumpcap knows not to
+               ask for a bug report about */
+            g_strlcpy(ts->errbuf, "The interface went down", sizeof ts->errbuf);
+        } else {
+            g_snprintf(ts->errbuf, sizeof ts->errbuf, "Error on the capture socket: %s",
+                       err != 0 ? g_strerror(err) : "POLLERR");
+        }
+        errno = err != 0 ? err : EIO;
+        return -1;
+    }
+    return (g_atomic_int_get((volatile gint *)&tpacket_block(ts)->hdr.bh1.block_status) & TP_STATUS_USER) ? 1 : 0;
+}
+
+/*
+ * The kernel takes 802.1Q tags out of the packets it captures; put
+ * the tag back, as libpcap does.
+ */
+static const u_char *
+tpacket_put_vlan_tag(tpacket_t *tp, tpacket_sock_t *ts, const struct tpacket3_hdr *ppd,
+                     struct pcap_pkthdr *hdr, const u_char *data)
+{
+    guint16 tpid = ETH_P_8021Q;
+    guint16 tag[2];
+
+    if (hdr->caplen < 2 * ETH_ALEN)
+        return data;
+#ifdef TP_STATUS_VLAN_TPID_VALID
+    if (ppd->tp_status & TP_STATUS_VLAN_TPID_VALID)
+        tpid = ppd->hv1.tp_vlan_tpid;
+#endif
+    tag[0] = htons(tpid);
+    tag[1] = htons(ppd->hv1.tp_vlan_tci);
+    memcpy(ts->vlan_buf, data, 2 * ETH_ALEN);
+    memcpy(ts->vlan_buf + 2 * ETH_ALEN, tag, VLAN_TAG_LEN);
+    memcpy(ts->vlan_buf + 2 * ETH_ALEN + VLAN_TAG_LEN, data + 2 * ETH_ALEN,
+           hdr->caplen - 2 * ETH_ALEN);
+    hdr->caplen += VLAN_TAG_LEN;
+    hdr->len += VLAN_TAG_LEN;
+    if (hdr->caplen > (bpf_u_int32)tp->snaplen)
+        hdr->caplen = tp->snaplen;
+    return ts->vlan_buf;
+}
+
+int
+tpacket_dispatch(tpacket_t *tp, guint sock, int max_blocks,
+                 pcap_handler callback, u_char *user)
+{
+    tpacket_sock_t            *ts = &tp->socks[sock];
+    struct tpacket_block_desc *bd;
+    struct tpacket3_hdr       *ppd;
+    const struct sockaddr_ll  *sll;
+    struct pcap_pkthdr         hdr;
+    const u_char              *data;
+    guint32                    i, num_pkts;
+    int                        blocks, packets;
+
+    for (blocks = 0, packets = 0; max_blocks < 0 || blocks < max_blocks; blocks++) {
+        bd = tpacket_block(ts);
+        if (!(g_atomic_int_get((volatile gint *)&bd->hdr.bh1.block_status) & TP_STATUS_USER))
+            break;
+
+        num_pkts = bd->hdr.bh1.num_pkts;
+        ppd = (struct tpacket3_hdr *)(void *)((guint8 *)bd + bd->hdr.bh1.offset_to_first_pkt);
+        for (i = 0; i < num_pkts; i++,
+             ppd = (struct tpacket3_hdr *)(void *)((guint8 *)ppd + ppd->tp_next_offset)) {
+            if (tp->loopback) {
+                /* We see packets sent on the loopback interface going
+                   out and coming back in; only keep the ones coming in. */
+                sll = (const struct sockaddr_ll *)(void *)
+                      ((guint8 *)ppd + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+                if (sll->sll_pkttype == PACKET_OUTGOING)
+                    continue;
+            }
+            hdr.ts.tv_sec = ppd->tp_sec;
+            hdr.ts.tv_usec = ppd->tp_nsec / 1000;
+            hdr.caplen = MIN(ppd->tp_snaplen, (bpf_u_int32)tp->snaplen);
+            hdr.len = ppd->tp_len;
+            data = (const u_char *)ppd + ppd->tp_mac;
+            if (ppd->hv1.tp_vlan_tci != 0 || (ppd->tp_status & TP_STATUS_VLAN_VALID))
+                data = tpacket_put_vlan_tag(tp, ts, ppd, &hdr, data);
+            callback(user, &hdr, data);
+            packets++;
+        }
+
+        g_atomic_int_set((volatile gint *)&bd->hdr.bh1.block_status, TP_STATUS_KERNEL);
+        ts->block = (ts->block + 1) % ts->block_nr;
+    }
+    return packets;
+}
+
+gboolean
+tpacket_stats(tpacket_t *tp, struct pcap_stat *ps)
+{
+    struct tpacket_stats_v3  st;
+    socklen_t                len;
+    guint64                  received = 0, dropped = 0;
+    guint                    i;
+
+    for (i = 0; i < tp->nsocks; i++) {
+        /* This resets the kernel's counts, so keep totals */
+        len = sizeof st;
+        if (getsockopt(tp->socks[i].fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == -1) {
+            g_snprintf(tp->socks[0].errbuf, sizeof tp->socks[0].errbuf,
+                       "PACKET_STATISTICS: %s", g_strerror(errno));
+            return FALSE;
+        }
+        /* tp_packets counts the ones dropped too */
+        tp->socks[i].received += st.tp_packets;
+        tp->socks[i].dropped += st.tp_drops;
+        received += tp->socks[i].received;
+        dropped += tp->socks[i].dropped;
+    }
+    ps->ps_recv = (u_int)received;
+    ps->ps_drop = (u_int)dropped;
+    ps->ps_ifdrop = 0;
+    return TRUE;
+}
+
+const char *
+tpacket_geterr(tpacket_t *tp)
+{
+    guint i;
+
+    for (i = 0; i < tp->nsocks; i++) {
+        if (tp->socks[i].errbuf[0] != '\0')
+            return tp->socks[i].errbuf;
+    }
+    return "";
+}
+
+void
+tpacket_close(tpacket_t *tp)
+{
+    guint i;
+
+    for (i = 0; i < tp->nsocks; i++)
+        tpacket_sock_close(&tp->socks[i]);
+    g_free(tp->socks);
+    g_free(tp);
+}
+
+#else /* HAVE_TPACKET3 */
+
+tpacket_t *
+tpacket_open(const char *iface _U_, const tpacket_opts_t *opts _U_,
+             int *linktype _U_, char *errmsg, size_t errmsg_len)
+{
+    g_snprintf(errmsg, (gulong)errmsg_len,
+               "Capturing through a TPACKET_V3 ring isn't supported on this platform");
+    return NULL;
+}
+
+guint
+tpacket_sockets(tpacket_t *tp _U_)
+{
+    return 0;
+}
+
+gboolean
+tpacket_setfilter(tpacket_t *tp _U_, const struct bpf_program *fcode _U_)
+{
+    return FALSE;
+}
+
+int
+tpacket_poll(tpacket_t *tp _U_, guint sock _U_, int timeout _U_)
+{
+    return -1;
+}
+
+int
+tpacket_dispatch(tpacket_t *tp _U_, guint sock _U_, int max_blocks _U_,
+                 pcap_handler callback _U_, u_char *user _U_)
+{
+    return -1;
+}
+
+gboolean
+tpacket_stats(tpacket_t *tp _U_, struct pcap_stat *ps _U_)
+{
+    return FALSE;
+}
+
+const char *
+tpacket_geterr(tpacket_t *tp _U_)
+{
+    return "";
+}
+
+void
+tpacket_close(tpacket_t *tp _U_)
+{
+}
+
+#endif /* HAVE_TPACKET3 */
+
+/*
+ * Editor modelines  -  http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 4
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=4 tabstop=8 expandtab:
+ * :indentSize=4:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,108 @@
+/* capture-tpacket.h
+ * Capture through Linux AF_PACKET sockets with TPACKET_V3 memory-mapped
+ * rings, rather than through libpcap
+ *
+ * Wireshark - Network traffic analyzer
+ * By Gerald Combs <gerald@wireshark.org>
+ * Copyright 1998 Gerald Combs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CAPTURE_TPACKET_H__
+#define __CAPTURE_TPACKET_H__
+
+#include <pcap.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* Default size of each block of a ring, in bytes */
+#define TPACKET_DEFAULT_BLOCK_SIZE  (256 * 1024)
+
+typedef struct tpacket tpacket_t;
+
+typedef struct {
+    int      snaplen;
+    gboolean promisc;
+    guint    block_size;    /**< rounded up to a power of 2 number of pages big enough for a snaplen packet */
+    guint64  ring_size;     /**< split between the sockets, each of which gets at least 2 blocks */
+    guint    sockets;       /**< if more than 1, they're put in a PACKET_FANOUT group */
+    guint    fanout_group;  /**< fanout group ID; 0 to pick one from the process ID */
+    int      timeout;       /**< milliseconds before a block that isn't full is handed over */
+} tpacket_opts_t;
+
+/*
+ * Open sockets on iface; if that fails, returns NULL and puts an error
+ * message in errmsg.  *linktype is set to the DLT_ value of the packets
+ * that'll be captured.  Nothing is captured until tpacket_setfilter()
+ * is called.
+ */
+tpacket_t *tpacket_open(const char *iface, const tpacket_opts_t *opts,
+                        int *linktype, char *errmsg, size_t errmsg_len);
+
+/* Number of sockets, numbered from 0, opened by tpacket_open() */
+guint tpacket_sockets(tpacket_t *tp);
+
+/* Attach the filter, as compiled by pcap_compile(), to all the sockets */
+gboolean tpacket_setfilter(tpacket_t *tp, const struct bpf_program *fcode);
+
+/*
+ * Wait up to timeout milliseconds for a block to be handed over on the
+ * socket.  Returns 1 if there is one, 0 if there isn't, and -1, with
+ * errno set, on an error (the error is EINTR if a signal came in).
+ */
+int tpacket_poll(tpacket_t *tp, guint sock, int timeout);
+
+/*
+ * Call callback for each packet in up to max_blocks blocks (all the
+ * ones that have been handed over, if it's -1), straight from the ring,
+ * then hand the blocks back to the kernel.  Returns the number of
+ * packets.  Sockets may be read from different threads, but each one
+ * from only one at a time.
+ */
+int tpacket_dispatch(tpacket_t *tp, guint sock, int max_blocks,
+                     pcap_handler callback, u_char *user);
+
+/*
+ * Fill in ps_recv and ps_drop with the totals for all the sockets since
+ * they were opened, as pcap_stats() would; ps_ifdrop is set to 0.
+ */
+gboolean tpacket_stats(tpacket_t *tp, struct pcap_stat *ps);
+
+/* Error message for the last call that failed, as pcap_geterr() would */
+const char *tpacket_geterr(tpacket_t *tp);
+
+void tpacket_close(tpacket_t *tp);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __CAPTURE_TPACKET_H__ */
+
+/*
+ * Editor modelines  -  http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 4
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=4 tabstop=8 expandtab:
+ * :indentSize=4:tabSize=8:noTabs=true:
+ */
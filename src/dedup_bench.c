@@ -0,0 +1,262 @@
+/* dedup_bench.c
+ * Compares editcap's duplicate detection with the linear window scan
+ * it replaced
+ *
+ * Wireshark - Network traffic analyzer
+ * By Gerald Combs <gerald@wireshark.org>
+ * Copyright 1998 Gerald Combs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Usage: dedup_bench [<packets> [<window>...]]
+ *
+ * A synthetic trace of <packets> frames, of which about a quarter repeat
+ * a recent frame, is run through frame_dedup with each <window> in
+ * frames (-D) and in microseconds, one frame a microsecond (-w).  The
+ * old MD5 and linear scan code is run on as much of the trace as it
+ * gets through in reasonable time, and its decisions are checked
+ * against the new ones.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <wsutil/md5.h>
+#include <wsutil/nstime.h>
+
+#include "frame_dedup.h"
+
+#define DEFAULT_PACKETS     2000000
+#define MAX_FRAME           1514
+#define OLD_MAX_WORK        G_GUINT64_CONSTANT(2000000000)  /* frame comparisons */
+
+/* editcap's old duplicate detection, as it was */
+typedef struct {
+    md5_byte_t digest[16];
+    guint32    len;
+    nstime_t   time;
+} old_fd_hash_t;
+
+static old_fd_hash_t *old_fd_hash;
+static int            old_dup_window;
+static int            old_cur_dup_entry;
+static nstime_t       old_time_window;
+
+static gboolean
+old_is_duplicate(const guint8 *fd, guint32 len)
+{
+    int i;
+    md5_state_t ms;
+
+    old_cur_dup_entry++;
+    if (old_cur_dup_entry >= old_dup_window)
+        old_cur_dup_entry = 0;
+
+    md5_init(&ms);
+    md5_append(&ms, fd, len);
+    md5_finish(&ms, old_fd_hash[old_cur_dup_entry].digest);
+    old_fd_hash[old_cur_dup_entry].len = len;
+
+    for (i = 0; i < old_dup_window; i++) {
+        if (i == old_cur_dup_entry)
+            continue;
+        if (old_fd_hash[i].len == old_fd_hash[old_cur_dup_entry].len
+            && memcmp(old_fd_hash[i].digest, old_fd_hash[old_cur_dup_entry].digest, 16) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static gboolean
+old_is_duplicate_rel_time(const guint8 *fd, guint32 len, const nstime_t *current)
+{
+    int i;
+    md5_state_t ms;
+
+    old_cur_dup_entry++;
+    if (old_cur_dup_entry >= old_dup_window)
+        old_cur_dup_entry = 0;
+
+    md5_init(&ms);
+    md5_append(&ms, fd, len);
+    md5_finish(&ms, old_fd_hash[old_cur_dup_entry].digest);
+    old_fd_hash[old_cur_dup_entry].len = len;
+    old_fd_hash[old_cur_dup_entry].time = *current;
+
+    for (i = old_cur_dup_entry - 1;; i--) {
+        nstime_t delta;
+
+        if (i < 0)
+            i = old_dup_window - 1;
+        if (i == old_cur_dup_entry || nstime_is_unset(&old_fd_hash[i].time))
+            break;
+        nstime_delta(&delta, current, &old_fd_hash[i].time);
+        if (delta.secs < 0 || delta.nsecs < 0)
+            continue;
+        if (nstime_cmp(&delta, &old_time_window) > 0)
+            break;
+        if (old_fd_hash[i].len == old_fd_hash[old_cur_dup_entry].len
+            && memcmp(old_fd_hash[i].digest, old_fd_hash[old_cur_dup_entry].digest, 16) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static void
+old_reset(int window)
+{
+    int i;
+
+    old_dup_window = window;
+    old_cur_dup_entry = 0;
+    g_free(old_fd_hash);
+    old_fd_hash = g_new0(old_fd_hash_t, MAX(window, 1));
+    for (i = 0; i < window; i++)
+        nstime_set_unset(&old_fd_hash[i].time);
+}
+
+/*
+ * Frame n of the trace: either new, or a copy of one of the last 1000
+ * frames.  Frames are told apart by their first 8 bytes.
+ */
+static guint32
+make_frame(guint32 n, guint8 *buf)
+{
+    guint32 id = n, len;
+    guint32 r = g_random_int();
+
+    if (n > 1000 && r % 4 == 0)
+        id = n - 1 - (r >> 8) % 1000;
+    len = 60 + id * 7919 % (MAX_FRAME - 60);
+    memset(buf, (int)id, len);
+    memcpy(buf, &id, sizeof id);
+    return len;
+}
+
+static void
+run(guint32 npackets, guint32 window, gboolean by_time, guint8 *frames,
+    guint32 *lens, guint8 *dups)
+{
+    frame_dedup_t *fdd;
+    GTimer        *timer;
+    nstime_t       ts, time_window;
+    guint32        i, nold, ndup = 0, mismatches = 0;
+    gboolean       dup;
+    double         t_new, t_old;
+
+    time_window.secs = window / 1000000;
+    time_window.nsecs = (window % 1000000) * 1000;
+    fdd = by_time ? frame_dedup_new_rel_time(&time_window, 1000000)
+                  : frame_dedup_new(window);
+
+    timer = g_timer_new();
+    g_timer_start(timer);
+    for (i = 0; i < npackets; i++) {
+        ts.secs = i / 1000000;
+        ts.nsecs = (i % 1000000) * 1000;
+        dups[i] = frame_dedup_check(fdd, frames + (gsize)i * MAX_FRAME, lens[i], &ts);
+        ndup += dups[i];
+    }
+    t_new = g_timer_elapsed(timer, NULL);
+    frame_dedup_free(fdd);
+
+    /* The old code scans the whole window per frame. */
+    nold = (guint32)MIN((guint64)npackets, OLD_MAX_WORK / MAX(window, 1));
+    nold = MAX(nold, MIN(npackets, 10000));
+    old_reset(by_time ? 1000000 : (int)window);
+    old_time_window = time_window;
+    g_timer_start(timer);
+    for (i = 0; i < nold; i++) {
+        ts.secs = i / 1000000;
+        ts.nsecs = (i % 1000000) * 1000;
+        dup = by_time ? old_is_duplicate_rel_time(frames + (gsize)i * MAX_FRAME, lens[i], &ts)
+                      : old_is_duplicate(frames + (gsize)i * MAX_FRAME, lens[i]);
+        if (dup != dups[i])
+            mismatches++;
+    }
+    t_old = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+
+    printf("%-3s %8u %10u %12.0f %12.0f %9u %s\n", by_time ? "-w" : "-D",
+           window, ndup, npackets / t_new, nold / t_old, nold,
+           mismatches ? "MISMATCH" : "ok");
+}
+
+int
+main(int argc, char **argv)
+{
+    static const guint32 default_windows[] = { 5, 1000, 100000, 1000000 };
+    guint32  npackets = DEFAULT_PACKETS;
+    guint32 *windows, nwindows, i;
+    guint8  *frames, *dups;
+    guint32 *lens;
+
+    if (argc > 1)
+        npackets = (guint32)strtoul(argv[1], NULL, 10);
+    if (npackets == 0) {
+        fprintf(stderr, "Usage: dedup_bench [<packets> [<window>...]]\n");
+        return 1;
+    }
+    if (argc > 2) {
+        nwindows = argc - 2;
+        windows = g_new(guint32, nwindows);
+        for (i = 0; i < nwindows; i++)
+            windows[i] = (guint32)strtoul(argv[i + 2], NULL, 10);
+    } else {
+        nwindows = G_N_ELEMENTS(default_windows);
+        windows = g_memdup(default_windows, sizeof default_windows);
+    }
+
+    g_random_set_seed(1);
+    frames = (guint8 *)g_malloc((gsize)npackets * MAX_FRAME);
+    lens = g_new(guint32, npackets);
+    dups = (guint8 *)g_malloc(npackets);
+    for (i = 0; i < npackets; i++)
+        lens[i] = make_frame(i, frames + (gsize)i * MAX_FRAME);
+
+    printf("%u packets\n", npackets);
+    printf("%-3s %8s %10s %12s %12s %9s\n", "", "window", "duplicates",
+           "new pkts/s", "old pkts/s", "old pkts");
+    for (i = 0; i < nwindows; i++) {
+        run(npackets, windows[i], FALSE, frames, lens, dups);
+        run(npackets, windows[i], TRUE, frames, lens, dups);
+    }
+
+    g_free(dups);
+    g_free(lens);
+    g_free(frames);
+    g_free(windows);
+    return 0;
+}
+
+/*
+ * Editor modelines  -  http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 4
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=4 tabstop=8 expandtab:
+ * :indentSize=4:tabSize=8:noTabs=true:
+ */
+
@@ -124,6 +124,7 @@
 #include "wsutil/file_util.h"
 
 #include "ws80211_utils.h"
+#include "capture-tpacket.h"
 
 /*
  * Get information about libpcap format from "wiretap/libpcap.h".
@@ -146,12 +147,17 @@ FILE *debug_log;   /* for logging debug messages to  */
                    /*  is defined                    */
 #endif
 
-static GAsyncQueue *pcap_queue;
-static gint64 pcap_queue_bytes;
-static gint64 pcap_queue_packets;
 static gint64 pcap_queue_byte_limit = 0;
 static gint64 pcap_queue_packet_limit = 0;
 
+/*
+ * When the writer finds nothing to write, it sets writer_waiting and
+ * waits on writer_wakeup, and the next capture thread to queue a packet
+ * pushes something onto it; while packets keep coming, nobody locks.
+ */
+static GAsyncQueue *writer_wakeup;
+static volatile gint writer_waiting;
+
 static gboolean capture_child = FALSE; /* FALSE: standalone call, TRUE: this is an Wireshark capture child */
 #ifdef _WIN32
 static gchar *sig_pipe_name = NULL;
@@ -272,11 +278,37 @@ typedef enum {
     PIPNEXIST
 } cap_pipe_err_t;
 
+/*
+ * Packets captured on an interface, on their way from the interface's
+ * thread to the writer.  The ring is filled only by that thread and
+ * emptied only by the writer, so each of them just publishes how far it
+ * has got; packets are copied into a slab allocated when the capture
+ * starts.  Each packet is a struct pcap_pkthdr followed by the data,
+ * padded to PCAP_RING_ALIGN.  One that won't fit before the end of the
+ * slab goes at the start, and the space it skips is marked with a header
+ * whose caplen is PCAP_RING_SKIP if there's room for one.
+ */
+#define PCAP_RING_ALIGN     8
+#define PCAP_RING_SKIP      G_MAXUINT32
+#define PCAP_RING_REC_SIZE(caplen) \
+    (((guint)sizeof(struct pcap_pkthdr) + (caplen) + PCAP_RING_ALIGN - 1) & ~(PCAP_RING_ALIGN - 1))
+
+typedef struct _pcap_ring {
+    guint8        *slab;
+    guint          size;            /**< size of slab, a power of 2 */
+    guint          packet_limit;    /**< most packets it may hold; 0 for no limit */
+    volatile gint  head;            /**< bytes put into it, mod 2^32; set by the capture thread */
+    volatile gint  tail;            /**< bytes taken out of it, mod 2^32; set by the writer */
+    volatile gint  packets_in;      /**< set by the capture thread */
+    volatile gint  packets_out;     /**< set by the writer */
+} pcap_ring;
+
 typedef struct _pcap_options {
     guint32                      received;
     guint32                      dropped;
     guint32                      flushed;
     pcap_t                      *pcap_h;
+    tpacket_t                   *tpacket;                /**< if --tpacket; pcap_h is then only for compiling filters */
 #ifdef MUST_DO_SELECT
     int                          pcap_fd;                /**< pcap file descriptor */
 #endif
@@ -307,6 +339,7 @@ typedef struct _pcap_options {
 #endif
     cap_pipe_state_t cap_pipe_state;
     cap_pipe_err_t cap_pipe_err;
+    pcap_ring                    ring;                   /**< packets on their way to the writer, if use_threads */
 
 #if defined(_WIN32)
     GMutex                      *cap_pipe_read_mtx;
@@ -332,12 +365,6 @@ typedef struct _loop_data {
     guint32   autostop_files;
 } loop_data;
 
-typedef struct _pcap_queue_element {
-    pcap_options       *pcap_opts;
-    struct pcap_pkthdr  phdr;
-    u_char             *pd;
-} pcap_queue_element;
-
 /*
  * Standard secondary message for unexpected errors.
  */
@@ -388,6 +415,11 @@ static gboolean need_timeout_workaround;
 
 #define WRITER_THREAD_TIMEOUT 100000 /* usecs */
 
+/* long options that aren't in capture_opts.h */
+#define LONGOPT_NUM_TPACKET             3
+#define LONGOPT_NUM_TPACKET_BLOCK_SIZE  4
+#define LONGOPT_NUM_TPACKET_FANOUT      5
+
 static void
 console_log_handler(const char *log_domain, GLogLevelFlags log_level,
                     const char *message, gpointer user_data _U_);
@@ -398,6 +430,27 @@ static gboolean quiet = FALSE;
 static gboolean use_threads = FALSE;
 static guint64 start_time;
 
+/* --tpacket options */
+static gboolean use_tpacket = FALSE;
+static guint    tpacket_block_size = TPACKET_DEFAULT_BLOCK_SIZE;
+static guint    tpacket_fanout = 1;
+static guint    tpacket_fanout_group = 0;
+
+/*
+ * With --tpacket-fanout, each of the interface's sockets has a thread
+ * that writes what it reads itself, a block at a time, holding
+ * tpacket_write_mtx; the main loop takes it only to look at the file,
+ * to flush, switch or close it.
+ */
+typedef struct _tpacket_thread {
+    pcap_options *pcap_opts;
+    guint         sock;
+    GThread      *tid;
+} tpacket_thread;
+
+static GMutex *tpacket_write_mtx;
+static gint    tpacket_written;     /**< packets written since the main loop last looked; atomic */
+
 static void capture_loop_write_packet_cb(u_char *pcap_opts_p, const struct pcap_pkthdr *phdr,
                                          const u_char *pd);
 static void capture_loop_queue_packet_cb(u_char *pcap_opts_p, const struct pcap_pkthdr *phdr,
@@ -542,6 +595,16 @@ print_usage(gboolean print_ver)
     fprintf(output, "  -C <byte_limit>          maximum number of bytes used for buffering packets\n");
     fprintf(output, "                           within dumpcap\n");
     fprintf(output, "  -t                       use a separate thread per interface\n");
+#ifdef HAVE_TPACKET3
+    fprintf(output, "  --tpacket                capture from TPACKET_V3 rings rather than with\n");
+    fprintf(output, "                           libpcap (-B sets the size of the ring)\n");
+    fprintf(output, "  --tpacket-block-size <size>\n");
+    fprintf(output, "                           size of a block of the ring, in KB (def: %u)\n",
+            TPACKET_DEFAULT_BLOCK_SIZE / 1024);
+    fprintf(output, "  --tpacket-fanout <sockets>[:<group>]\n");
+    fprintf(output, "                           spread the interface's packets over this many\n");
+    fprintf(output, "                           sockets, each written by its own thread\n");
+#endif
     fprintf(output, "  -q                       don't report packet capture counts\n");
     fprintf(output, "  -v                       print version information and exit\n");
     fprintf(output, "  -h                       display this help and exit\n");
@@ -763,6 +826,48 @@ open_capture_device(interface_options *interface_opts,
     return pcap_h;
 }
 
+/*
+ * Open an interface to capture on through TPACKET_V3 rings rather than
+ * libpcap.  The pcap_t returned is a "dead" one, for getting the link-layer
+ * type and snapshot length from and compiling filters with; the packets
+ * come from pcap_opts->tpacket.
+ */
+static pcap_t *
+open_tpacket_device(interface_options *interface_opts, pcap_options *pcap_opts,
+                    char (*open_err_str)[PCAP_ERRBUF_SIZE])
+{
+    tpacket_opts_t  opts;
+    int             linktype;
+    pcap_t         *pcap_h;
+
+    opts.snaplen = interface_opts->snaplen;
+    opts.promisc = interface_opts->promisc_mode;
+    opts.block_size = tpacket_block_size;
+#ifdef HAVE_PCAP_CREATE
+    opts.ring_size = (guint64)interface_opts->buffer_size * 1024 * 1024;
+#else
+    opts.ring_size = (guint64)DEFAULT_CAPTURE_BUFFER_SIZE * 1024 * 1024;
+#endif
+    opts.sockets = tpacket_fanout;
+    opts.fanout_group = tpacket_fanout_group;
+    opts.timeout = CAP_READ_TIMEOUT;
+    pcap_opts->tpacket = tpacket_open(interface_opts->name, &opts, &linktype,
+                                      *open_err_str, sizeof *open_err_str);
+    g_log(LOG_DOMAIN_CAPTURE_CHILD, G_LOG_LEVEL_DEBUG,
+          "tpacket_open() returned %p.", (void *)pcap_opts->tpacket);
+    if (pcap_opts->tpacket == NULL)
+        return NULL;
+
+    pcap_h = pcap_open_dead(linktype, interface_opts->snaplen);
+    if (pcap_h == NULL) {
+        g_strlcpy(*open_err_str, "Can't allocate a pcap_t for compiling filters",
+                  sizeof *open_err_str);
+        tpacket_close(pcap_opts->tpacket);
+        pcap_opts->tpacket = NULL;
+    }
+    return pcap_h;
+}
+
 static void
 get_capture_device_open_failure_messages(const char *open_err_str,
                                          const char *iface,
@@ -2604,6 +2709,7 @@ capture_loop_open_input(capture_options *capture_opts, loop_data *ld,
         pcap_opts->dropped = 0;
         pcap_opts->flushed = 0;
         pcap_opts->pcap_h = NULL;
+        pcap_opts->tpacket = NULL;
 #ifdef MUST_DO_SELECT
         pcap_opts->pcap_fd = -1;
 #endif
@@ -2630,6 +2736,7 @@ capture_loop_open_input(capture_options *capture_opts, loop_data *ld,
         pcap_opts->cap_pipe_bytes_read = 0;
         pcap_opts->cap_pipe_state = STATE_EXPECT_REC_HDR;
         pcap_opts->cap_pipe_err = PIPOK;
+        memset(&pcap_opts->ring, 0, sizeof(pcap_ring));
 #ifdef _WIN32
 #if GLIB_CHECK_VERSION(2,31,0)
         pcap_opts->cap_pipe_read_mtx = g_malloc(sizeof(GMutex));
@@ -2643,7 +2750,11 @@ capture_loop_open_input(capture_options *capture_opts, loop_data *ld,
         g_array_append_val(ld->pcaps, pcap_opts);
 
         g_log(LOG_DOMAIN_CAPTURE_CHILD, G_LOG_LEVEL_DEBUG, "capture_loop_open_input : %s", interface_opts.name);
-        pcap_opts->pcap_h = open_capture_device(&interface_opts, &open_err_str);
+        if (use_tpacket) {
+            pcap_opts->pcap_h = open_tpacket_device(&interface_opts, pcap_opts, &open_err_str);
+        } else {
+            pcap_opts->pcap_h = open_capture_device(&interface_opts, &open_err_str);
+        }
 
         if (pcap_opts->pcap_h != NULL) {
             /* we've opened "iface" as a network device */
@@ -2795,6 +2906,12 @@ static void capture_loop_close_input(loop_data *ld)
             pcap_close(pcap_opts->pcap_h);
             pcap_opts->pcap_h = NULL;
         }
+        if (pcap_opts->tpacket != NULL) {
+            tpacket_close(pcap_opts->tpacket);
+            pcap_opts->tpacket = NULL;
+        }
+        g_free(pcap_opts->ring.slab);
+        pcap_opts->ring.slab = NULL;
     }
 
     ld->go = FALSE;
@@ -2805,12 +2922,31 @@ static void capture_loop_close_input(loop_data *ld)
 #endif
 }
 
+/* The error from the last thing that failed on the interface */
+static const char *
+capture_loop_geterr(pcap_options *pcap_opts)
+{
+    if (pcap_opts->tpacket != NULL)
+        return tpacket_geterr(pcap_opts->tpacket);
+    return pcap_geterr(pcap_opts->pcap_h);
+}
+
+/* pcap_stats() for the interface, however it's being captured on */
+static int
+capture_loop_stats(pcap_options *pcap_opts, struct pcap_stat *stats)
+{
+    if (pcap_opts->tpacket != NULL)
+        return tpacket_stats(pcap_opts->tpacket, stats) ? 0 : -1;
+    return pcap_stats(pcap_opts->pcap_h, stats);
+}
+
 
 /* init the capture filter */
 static initfilter_status_t
-capture_loop_init_filter(pcap_t *pcap_h, gboolean from_cap_pipe,
+capture_loop_init_filter(pcap_t *pcap_h, tpacket_t *tpacket, gboolean from_cap_pipe,
                          const gchar * name, const gchar * cfilter)
 {
+    gboolean           successful;
     struct bpf_program fcode;
 
     g_log(LOG_DOMAIN_CAPTURE_CHILD, G_LOG_LEVEL_DEBUG, "capture_loop_init_filter: %s", cfilter);
@@ -2824,7 +2960,13 @@ capture_loop_init_filter(pcap_t *pcap_h, gboolean from_cap_pipe,
                the display and capture filter syntaxes are different. */
             return INITFILTER_BAD_FILTER;
         }
-        if (pcap_setfilter(pcap_h, &fcode) < 0) {
+        if (tpacket != NULL) {
+            /* even an empty filter, as it's what truncates packets to the snaplen */
+            successful = tpacket_setfilter(tpacket, &fcode);
+        } else {
+            successful = (pcap_setfilter(pcap_h, &fcode) >= 0);
+        }
+        if (!successful) {
 #ifdef HAVE_PCAP_FREECODE
             pcap_freecode(&fcode);
 #endif
@@ -2971,7 +3113,7 @@ capture_loop_close_output(capture_options *capture_opts, loop_data *ld, int *err
                     guint64 isb_ifrecv, isb_ifdrop;
                     struct pcap_stat stats;
 
-                    if (pcap_stats(pcap_opts->pcap_h, &stats) >= 0) {
+                    if (capture_loop_stats(pcap_opts, &stats) >= 0) {
                         isb_ifrecv = pcap_opts->received;
                         isb_ifdrop = stats.ps_drop + pcap_opts->dropped + pcap_opts->flushed;
                    } else {
@@ -3051,6 +3193,26 @@ capture_loop_dispatch(loop_data *ld,
         }
 #endif
     }
+    else if (pcap_opts->tpacket != NULL)
+    {
+        /* dispatch from the TPACKET_V3 ring, whatever's been handed over */
+        int tp_ret;
+
+#ifdef LOG_CAPTURE_VERBOSE
+        g_log(LOG_DOMAIN_CAPTURE_CHILD, G_LOG_LEVEL_DEBUG, "capture_loop_dispatch: from TPACKET_V3 ring");
+#endif
+        tp_ret = tpacket_poll(pcap_opts->tpacket, 0, CAP_READ_TIMEOUT);
+        if (tp_ret > 0) {
+            if (use_threads) {
+                inpkts = tpacket_dispatch(pcap_opts->tpacket, 0, -1, capture_loop_queue_packet_cb, (u_char *)pcap_opts);
+            } else {
+                inpkts = tpacket_dispatch(pcap_opts->tpacket, 0, -1, capture_loop_write_packet_cb, (u_char *)pcap_opts);
+            }
+        } else if (tp_ret < 0 && errno != EINTR) {
+            pcap_opts->pcap_err = TRUE;
+            ld->go = FALSE;
+        }
+    }
     else
     {
         /* dispatch from pcap */
@@ -3351,7 +3513,7 @@ do_file_switch_or_stop(capture_options *capture_opts,
         if (cnd_autostop_files != NULL &&
             cnd_eval(cnd_autostop_files, ++global_ld.autostop_files)) {
             /* no files left: stop here */
-            global_ld.go = FALSE;
+            g_atomic_int_set(&global_ld.go, FALSE);
             return FALSE;
         }
 
@@ -3405,7 +3567,7 @@ do_file_switch_or_stop(capture_options *capture_opts,
             if (!successful) {
                 fclose(global_ld.pdh);
                 global_ld.pdh = NULL;
-                global_ld.go = FALSE;
+                g_atomic_int_set(&global_ld.go, FALSE);
                 return FALSE;
             }
             if (cnd_autostop_size)
@@ -3419,17 +3581,286 @@ do_file_switch_or_stop(capture_options *capture_opts,
             report_new_capture_file(capture_opts->save_file);
         } else {
             /* File switch failed: stop here */
-            global_ld.go = FALSE;
+            g_atomic_int_set(&global_ld.go, FALSE);
             return FALSE;
         }
     } else {
         /* single file, stop now */
-        global_ld.go = FALSE;
+        g_atomic_int_set(&global_ld.go, FALSE);
         return FALSE;
     }
     return TRUE;
 }
 
+/*
+ * Wait up to WRITER_THREAD_TIMEOUT for a capture thread to wake us up;
+ * the caller's set writer_waiting.
+ */
+static void
+writer_wait(void)
+{
+#if GLIB_CHECK_VERSION(2,31,18)
+    g_async_queue_timeout_pop(writer_wakeup, WRITER_THREAD_TIMEOUT);
+#else
+    GTimeVal write_thread_time;
+
+    g_get_current_time(&write_thread_time);
+    g_time_val_add(&write_thread_time, WRITER_THREAD_TIMEOUT);
+    g_async_queue_timed_pop(writer_wakeup, &write_thread_time);
+#endif
+}
+
+/* Called by capture threads after they've made something for the writer */
+static void
+writer_wake(void)
+{
+    /* Only the first thread to get here wakes it */
+    if (g_atomic_int_get(&writer_waiting) &&
+        g_atomic_int_compare_and_exchange(&writer_waiting, 1, 0))
+        g_async_queue_push(writer_wakeup, GINT_TO_POINTER(1));
+}
+
+/*
+ * Largest ring an interface gets without -C.  The ring is allocated up
+ * front, so sizing it for -N packets of the biggest size it can capture
+ * would take that much memory however small the packets really are.
+ */
+#define PCAP_RING_DEFAULT_MAX   (16 * 1024 * 1024)
+
+/*
+ * Give each interface its share of the -C and -N limits, as a ring big
+ * enough for at least two of the biggest packets it can capture.
+ */
+static gboolean
+pcap_rings_init(loop_data *ld, char *errmsg, int errmsg_len)
+{
+    pcap_options *pcap_opts;
+    guint         i, n, max_rec;
+    guint64       bytes, packets;
+
+    n = ld->pcaps->len;
+    for (i = 0; i < n; i++) {
+        pcap_opts = g_array_index(ld->pcaps, pcap_options *, i);
+        if (pcap_opts->from_cap_pipe ||
+            pcap_opts->snaplen <= 0 || pcap_opts->snaplen > WTAP_MAX_PACKET_SIZE)
+            max_rec = PCAP_RING_REC_SIZE(WTAP_MAX_PACKET_SIZE);
+        else
+            max_rec = PCAP_RING_REC_SIZE((guint)pcap_opts->snaplen);
+        bytes = (guint64)pcap_queue_byte_limit / n;
+        packets = 0;
+        if (pcap_queue_packet_limit > 0)
+            packets = MAX((guint64)pcap_queue_packet_limit / n, 1);
+        if (bytes == 0)
+            bytes = MIN(packets * max_rec, PCAP_RING_DEFAULT_MAX);
+        bytes = MAX(bytes, 2 * (guint64)max_rec);
+        bytes = MIN(bytes, G_GUINT64_CONSTANT(1) << 30);
+
+        pcap_opts->ring.size = 1;
+        while (pcap_opts->ring.size < bytes)
+            pcap_opts->ring.size <<= 1;
+        pcap_opts->ring.packet_limit = (guint)packets;
+        pcap_opts->ring.head = pcap_opts->ring.tail = 0;
+        pcap_opts->ring.packets_in = pcap_opts->ring.packets_out = 0;
+        pcap_opts->ring.slab = (guint8 *)g_try_malloc(pcap_opts->ring.size);
+        if (pcap_opts->ring.slab == NULL) {
+            g_snprintf(errmsg, errmsg_len,
+                       "Could not allocate memory.");
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Called only by the interface's capture thread */
+static gboolean
+pcap_ring_put(pcap_ring *ring, const struct pcap_pkthdr *phdr, const u_char *pd)
+{
+    struct pcap_pkthdr *rec;
+    guint               head, tail, offset, skip, rec_size;
+
+    if (ring->packet_limit != 0 &&
+        (guint)ring->packets_in - (guint)g_atomic_int_get(&ring->packets_out) >= ring->packet_limit)
+        return FALSE;
+    if (phdr->caplen > ring->size)
+        return FALSE;
+
+    rec_size = PCAP_RING_REC_SIZE(phdr->caplen);
+    head = (guint)ring->head;
+    tail = (guint)g_atomic_int_get(&ring->tail);
+    offset = head & (ring->size - 1);
+    skip = 0;
+    if (rec_size > ring->size - offset)
+        skip = ring->size - offset;
+    if (skip + rec_size > ring->size - (head - tail))
+        return FALSE;
+
+    if (skip != 0) {
+        if (skip >= sizeof(struct pcap_pkthdr))
+            ((struct pcap_pkthdr *)(void *)(ring->slab + offset))->caplen = PCAP_RING_SKIP;
+        offset = 0;
+    }
+    rec = (struct pcap_pkthdr *)(void *)(ring->slab + offset);
+    *rec = *phdr;
+    memcpy(rec + 1, pd, phdr->caplen);
+    g_atomic_int_set(&ring->head, (gint)(head + skip + rec_size));
+    g_atomic_int_set(&ring->packets_in, (gint)((guint)ring->packets_in + 1));
+    return TRUE;
+}
+
+/* Called only by the writer; returns the oldest packet in the ring, if any */
+static struct pcap_pkthdr *
+pcap_ring_peek(pcap_ring *ring)
+{
+    struct pcap_pkthdr *rec;
+    guint               head, tail, offset;
+
+    head = (guint)g_atomic_int_get(&ring->head);
+    tail = (guint)ring->tail;
+    if (head == tail)
+        return NULL;
+
+    offset = tail & (ring->size - 1);
+    rec = (struct pcap_pkthdr *)(void *)(ring->slab + offset);
+    if (ring->size - offset < sizeof(struct pcap_pkthdr) || rec->caplen == PCAP_RING_SKIP) {
+        /* The packet went at the start of the slab */
+        g_atomic_int_set(&ring->tail, (gint)(tail + ring->size - offset));
+        rec = (struct pcap_pkthdr *)(void *)ring->slab;
+    }
+    return rec;
+}
+
+static void
+pcap_ring_pop(pcap_ring *ring, const struct pcap_pkthdr *rec)
+{
+    g_atomic_int_set(&ring->tail, (gint)((guint)ring->tail + PCAP_RING_REC_SIZE(rec->caplen)));
+    g_atomic_int_set(&ring->packets_out, (gint)((guint)ring->packets_out + 1));
+}
+
+/*
+ * Write the queued packet with the earliest time stamp; packets captured
+ * on different interfaces are only put in order if they're queued by the
+ * time the writer gets to them.  If nothing's queued, and wait is TRUE,
+ * wait up to WRITER_THREAD_TIMEOUT for something to be.  Returns the
+ * number of packets written.
+ */
+static int
+pcap_rings_write_next(gboolean wait)
+{
+    pcap_options       *pcap_opts, *first_opts;
+    struct pcap_pkthdr *rec, *first_rec;
+    guint64             ts, first_ts = 0;
+    guint               i;
+
+    first_opts = NULL;
+    first_rec = NULL;
+    for (i = 0; i < global_ld.pcaps->len; i++) {
+        pcap_opts = g_array_index(global_ld.pcaps, pcap_options *, i);
+        rec = pcap_ring_peek(&pcap_opts->ring);
+        if (rec == NULL)
+            continue;
+        ts = (guint64)rec->ts.tv_sec * 1000000000 +
+             (pcap_opts->ts_nsec ? (guint64)rec->ts.tv_usec : (guint64)rec->ts.tv_usec * 1000);
+        if (first_opts == NULL || ts < first_ts) {
+            first_opts = pcap_opts;
+            first_rec = rec;
+            first_ts = ts;
+        }
+    }
+
+    if (first_opts == NULL) {
+        if (wait) {
+            g_atomic_int_set(&writer_waiting, 1);
+            /* Something may have been queued before we said we're waiting */
+            for (i = 0; i < global_ld.pcaps->len; i++) {
+                pcap_opts = g_array_index(global_ld.pcaps, pcap_options *, i);
+                if (g_atomic_int_get(&pcap_opts->ring.head) != pcap_opts->ring.tail)
+                    break;
+            }
+            if (i == global_ld.pcaps->len)
+                writer_wait();
+            g_atomic_int_set(&writer_waiting, 0);
+        }
+        return 0;
+    }
+
+#if defined(DEBUG_DUMPCAP) || defined(DEBUG_CHILD_DUMPCAP)
+    g_log(LOG_DOMAIN_CAPTURE_CHILD, G_LOG_LEVEL_INFO,
+          "Dequeued a packet of length %d captured on interface %d.",
+          first_rec->caplen, first_opts->interface_id);
+#endif
+    capture_loop_write_packet_cb((u_char *)first_opts, first_rec, (const u_char *)(first_rec + 1));
+    pcap_ring_pop(&first_opts->ring, first_rec);
+    return 1;
+}
+
+/* Thread reading one of an interface's --tpacket-fanout sockets */
+static void *
+tpacket_write_handler(void *arg)
+{
+    tpacket_thread *tt = (tpacket_thread *)arg;
+    pcap_options   *pcap_opts = tt->pcap_opts;
+    int             ret, n;
+
+    g_log(LOG_DOMAIN_CAPTURE_CHILD, G_LOG_LEVEL_INFO, "Started thread for socket %u of interface %d.",
+          tt->sock, pcap_opts->interface_id);
+
+    while (g_atomic_int_get(&global_ld.go)) {
+        ret = tpacket_poll(pcap_opts->tpacket, tt->sock, CAP_READ_TIMEOUT);
+        if (ret > 0) {
+            g_mutex_lock(tpacket_write_mtx);
+            n = tpacket_dispatch(pcap_opts->tpacket, tt->sock, 1,
+                                 capture_loop_write_packet_cb, (u_char *)pcap_opts);
+            g_mutex_unlock(tpacket_write_mtx);
+            if (n > 0)
+                g_atomic_int_add(&tpacket_written, n);
+            writer_wake();
+        } else if (ret < 0 && errno != EINTR) {
+            /* the main loop looks at pcap_err only after joining us */
+            pcap_opts->pcap_err = TRUE;
+            g_atomic_int_set(&global_ld.go, FALSE);
+            writer_wake();
+        }
+    }
+
+    g_log(LOG_DOMAIN_CAPTURE_CHILD, G_LOG_LEVEL_INFO, "Stopped thread for socket %u of interface %d.",
+          tt->sock, pcap_opts->interface_id);
+    return NULL;
+}
+
+/*
+ * Wait for the --tpacket-fanout threads to write something, and return
+ * how many packets they've written.
+ */
+static int
+tpacket_wait_written(void)
+{
+    int inpkts;
+
+    g_atomic_int_set(&writer_waiting, 1);
+    if (g_atomic_int_get(&tpacket_written) == 0 && g_atomic_int_get(&global_ld.go))
+        writer_wait();
+    g_atomic_int_set(&writer_waiting, 0);
+    do {
+        inpkts = g_atomic_int_get(&tpacket_written);
+    } while (!g_atomic_int_compare_and_exchange(&tpacket_written, inpkts, 0));
+    return inpkts;
+}
+
+/* Keep the --tpacket-fanout threads from writing, if there are any */
+static void
+tpacket_lock_writes(void)
+{
+    if (tpacket_write_mtx != NULL)
+        g_mutex_lock(tpacket_write_mtx);
+}
+
+static void
+tpacket_unlock_writes(void)
+{
+    if (tpacket_write_mtx != NULL)
+        g_mutex_unlock(tpacket_write_mtx);
+}
+
 static void *
 pcap_read_handler(void* arg)
 {
@@ -3475,6 +3906,8 @@ capture_loop_start(capture_options *capture_opts, gboolean *stats_known, struct
     pcap_options      *pcap_opts;
     interface_options  interface_opts;
     guint              i, error_index        = 0;
+    tpacket_thread    *tpacket_threads       = NULL;
+    guint              n_tpacket_threads     = 0;
 
     *errmsg           = '\0';
     *secondary_errmsg = '\0';
@@ -3515,7 +3948,8 @@ capture_loop_start(capture_options *capture_opts, gboolean *stats_known, struct
          * is NULL. This might be a bug in WPCap. Therefore we provide an empty
          * string.
          */
-        switch (capture_loop_init_filter(pcap_opts->pcap_h, pcap_opts->from_cap_pipe,
+        switch (capture_loop_init_filter(pcap_opts->pcap_h, pcap_opts->tpacket,
+                                         pcap_opts->from_cap_pipe,
                                          interface_opts.name,
                                          interface_opts.cfilter?interface_opts.cfilter:"")) {
 
@@ -3530,7 +3964,7 @@ capture_loop_start(capture_options *capture_opts, gboolean *stats_known, struct
 
         case INITFILTER_OTHER_ERROR:
             g_snprintf(errmsg, sizeof(errmsg), "Can't install filter (%s).",
-                       pcap_geterr(pcap_opts->pcap_h));
+                       capture_loop_geterr(pcap_opts));
             g_snprintf(secondary_errmsg, sizeof(secondary_errmsg), "%s", please_report);
             goto error;
         }
@@ -3567,6 +4001,10 @@ capture_loop_start(capture_options *capture_opts, gboolean *stats_known, struct
         report_new_capture_file(capture_opts->save_file);
     }
 
+    if (use_threads && !pcap_rings_init(&global_ld, errmsg, sizeof(errmsg))) {
+        goto error;
+    }
+
     /* initialize capture stop (and alike) conditions */
     init_capture_stop_conditions();
     /* create stop conditions */
@@ -3603,9 +4041,8 @@ capture_loop_start(capture_options *capture_opts, gboolean *stats_known, struct
     /* WOW, everything is prepared! */
     /* please fasten your seat belts, we will enter now the actual capture loop */
     if (use_threads) {
-        pcap_queue = g_async_queue_new();
-        pcap_queue_bytes = 0;
-        pcap_queue_packets = 0;
+        writer_wakeup = g_async_queue_new();
+        writer_waiting = 0;
         for (i = 0; i < global_ld.pcaps->len; i++) {
             pcap_opts = g_array_index(global_ld.pcaps, pcap_options *, i);
 #if GLIB_CHECK_VERSION(2,31,0)
@@ -3615,42 +4052,38 @@ capture_loop_start(capture_options *capture_opts, gboolean *stats_known, struct
             pcap_opts->tid = g_thread_create(pcap_read_handler, pcap_opts, TRUE, NULL);
 #endif
         }
-    }
-    while (global_ld.go) {
-        /* dispatch incoming packets */
-        if (use_threads) {
-            pcap_queue_element *queue_element;
-#if GLIB_CHECK_VERSION(2,31,18)
-
-            g_async_queue_lock(pcap_queue);
-            queue_element = (pcap_queue_element *)g_async_queue_timeout_pop_unlocked(pcap_queue, WRITER_THREAD_TIMEOUT);
+    } else {
+        pcap_opts = g_array_index(global_ld.pcaps, pcap_options *, 0);
+        if (pcap_opts->tpacket != NULL && tpacket_sockets(pcap_opts->tpacket) > 1) {
+            writer_wakeup = g_async_queue_new();
+            writer_waiting = 0;
+            tpacket_written = 0;
+#if GLIB_CHECK_VERSION(2,31,0)
+            tpacket_write_mtx = g_new(GMutex, 1);
+            g_mutex_init(tpacket_write_mtx);
 #else
-            GTimeVal write_thread_time;
-
-            g_get_current_time(&write_thread_time);
-            g_time_val_add(&write_thread_time, WRITER_THREAD_TIMEOUT);
-            g_async_queue_lock(pcap_queue);
-            queue_element = (pcap_queue_element *)g_async_queue_timed_pop_unlocked(pcap_queue, &write_thread_time);
+            tpacket_write_mtx = g_mutex_new();
+#endif
+            n_tpacket_threads = tpacket_sockets(pcap_opts->tpacket);
+            tpacket_threads = g_new0(tpacket_thread, n_tpacket_threads);
+            for (i = 0; i < n_tpacket_threads; i++) {
+                tpacket_threads[i].pcap_opts = pcap_opts;
+                tpacket_threads[i].sock = i;
+#if GLIB_CHECK_VERSION(2,31,0)
+                tpacket_threads[i].tid = g_thread_new("Capture write", tpacket_write_handler, &tpacket_threads[i]);
+#else
+                tpacket_threads[i].tid = g_thread_create(tpacket_write_handler, &tpacket_threads[i], TRUE, NULL);
 #endif
-            if (queue_element) {
-                pcap_queue_bytes -= queue_element->phdr.caplen;
-                pcap_queue_packets -= 1;
-            }
-            g_async_queue_unlock(pcap_queue);
-            if (queue_element) {
-                g_log(LOG_DOMAIN_CAPTURE_CHILD, G_LOG_LEVEL_INFO,
-                      "Dequeued a packet of length %d captured on interface %d.",
-                      queue_element->phdr.caplen, queue_element->pcap_opts->interface_id);
-
-                capture_loop_write_packet_cb((u_char *) queue_element->pcap_opts,
-                                             &queue_element->phdr,
-                                             queue_element->pd);
-                g_free(queue_element->pd);
-                g_free(queue_element);
-                inpkts = 1;
-            } else {
-                inpkts = 0;
             }
+        }
+    }
+    while (g_atomic_int_get(&global_ld.go)) {
+        /* dispatch incoming packets */
+        if (use_threads) {
+            inpkts = pcap_rings_write_next(TRUE);
+        } else if (tpacket_threads != NULL) {
+            /* the threads have done the writing */
+            inpkts = tpacket_wait_written();
         } else {
             pcap_opts = g_array_index(global_ld.pcaps, pcap_options *, 0);
             inpkts = capture_loop_dispatch(&global_ld, errmsg,
@@ -3668,24 +4101,28 @@ capture_loop_start(capture_options *capture_opts, gboolean *stats_known, struct
 #ifdef _WIN32
         /* any news from our parent (signal pipe)? -> just stop the capture */
         if (!signal_pipe_check_running()) {
-            global_ld.go = FALSE;
+            g_atomic_int_set(&global_ld.go, FALSE);
         }
 #endif
 
         if (inpkts > 0) {
             global_ld.inpkts_to_sync_pipe += inpkts;
 
+            tpacket_lock_writes();
             /* check capture size condition */
             if (cnd_autostop_size != NULL &&
                 cnd_eval(cnd_autostop_size, global_ld.bytes_written)) {
                 /* Capture size limit reached, do we have another file? */
                 if (!do_file_switch_or_stop(capture_opts, cnd_autostop_files,
-                                            cnd_autostop_size, cnd_file_duration))
+                                            cnd_autostop_size, cnd_file_duration)) {
+                    tpacket_unlock_writes();
                     continue;
+                }
             } /* cnd_autostop_size */
             if (capture_opts->output_to_pipe) {
                 fflush(global_ld.pdh);
             }
+            tpacket_unlock_writes();
         } /* inpkts */
 
         /* Only update once every 500ms so as not to overload slow displays.
@@ -3713,7 +4150,9 @@ capture_loop_start(capture_options *capture_opts, gboolean *stats_known, struct
             /* Let the parent process know. */
             if (global_ld.inpkts_to_sync_pipe) {
                 /* do sync here */
+                tpacket_lock_writes();
                 fflush(global_ld.pdh);
+                tpacket_unlock_writes();
 
                 /* Send our parent a message saying we've written out
                    "global_ld.inpkts_to_sync_pipe" packets to the capture file. */
@@ -3726,24 +4165,26 @@ capture_loop_start(capture_options *capture_opts, gboolean *stats_known, struct
             /* check capture duration condition */
             if (cnd_autostop_duration != NULL && cnd_eval(cnd_autostop_duration)) {
                 /* The maximum capture time has elapsed; stop the capture. */
-                global_ld.go = FALSE;
+                g_atomic_int_set(&global_ld.go, FALSE);
                 continue;
             }
 
             /* check capture file duration condition */
             if (cnd_file_duration != NULL && cnd_eval(cnd_file_duration)) {
                 /* duration limit reached, do we have another file? */
+                tpacket_lock_writes();
                 if (!do_file_switch_or_stop(capture_opts, cnd_autostop_files,
-                                            cnd_autostop_size, cnd_file_duration))
+                                            cnd_autostop_size, cnd_file_duration)) {
+                    tpacket_unlock_writes();
                     continue;
+                }
+                tpacket_unlock_writes();
             } /* cnd_file_duration */
         }
     }
 
     g_log(LOG_DOMAIN_CAPTURE_CHILD, G_LOG_LEVEL_INFO, "Capture loop stopping ...");
     if (use_threads) {
-        pcap_queue_element *queue_element;
-
         for (i = 0; i < global_ld.pcaps->len; i++) {
             pcap_opts = g_array_index(global_ld.pcaps, pcap_options *, i);
             g_log(LOG_DOMAIN_CAPTURE_CHILD, G_LOG_LEVEL_INFO, "Waiting for thread of interface %u...",
@@ -3752,30 +4193,36 @@ capture_loop_start(capture_options *capture_opts, gboolean *stats_known, struct
             g_log(LOG_DOMAIN_CAPTURE_CHILD, G_LOG_LEVEL_INFO, "Thread of interface %u terminated.",
                   pcap_opts->interface_id);
         }
-        while (1) {
-            g_async_queue_lock(pcap_queue);
-            queue_element = (pcap_queue_element *)g_async_queue_try_pop_unlocked(pcap_queue);
-            if (queue_element) {
-                pcap_queue_bytes -= queue_element->phdr.caplen;
-                pcap_queue_packets -= 1;
-            }
-            g_async_queue_unlock(pcap_queue);
-            if (queue_element == NULL) {
-                break;
-            }
-            g_log(LOG_DOMAIN_CAPTURE_CHILD, G_LOG_LEVEL_INFO,
-                  "Dequeued a packet of length %d captured on interface %d.",
-                  queue_element->phdr.caplen, queue_element->pcap_opts->interface_id);
-            capture_loop_write_packet_cb((u_char *)queue_element->pcap_opts,
-                                         &queue_element->phdr,
-                                         queue_element->pd);
-            g_free(queue_element->pd);
-            g_free(queue_element);
+        while (pcap_rings_write_next(FALSE)) {
             global_ld.inpkts_to_sync_pipe += 1;
             if (capture_opts->output_to_pipe) {
                 fflush(global_ld.pdh);
             }
         }
+        g_async_queue_unref(writer_wakeup);
+        writer_wakeup = NULL;
+    }
+    if (tpacket_threads != NULL) {
+        for (i = 0; i < n_tpacket_threads; i++) {
+            g_thread_join(tpacket_threads[i].tid);
+        }
+        g_log(LOG_DOMAIN_CAPTURE_CHILD, G_LOG_LEVEL_INFO, "Threads of interface's %u sockets terminated.",
+              n_tpacket_threads);
+        /* what they wrote since we last looked */
+        global_ld.inpkts_to_sync_pipe += g_atomic_int_get(&tpacket_written);
+        if (capture_opts->output_to_pipe) {
+            fflush(global_ld.pdh);
+        }
+        g_free(tpacket_threads);
+#if GLIB_CHECK_VERSION(2,31,0)
+        g_mutex_clear(tpacket_write_mtx);
+        g_free(tpacket_write_mtx);
+#else
+        g_mutex_free(tpacket_write_mtx);
+#endif
+        tpacket_write_mtx = NULL;
+        g_async_queue_unref(writer_wakeup);
+        writer_wakeup = NULL;
     }
 
 
@@ -3806,9 +4253,9 @@ capture_loop_start(capture_options *capture_opts, gboolean *stats_known, struct
                On OpenBSD, you get "read: I/O error" (EIO) in the same case.
 
                These should *not* be reported to the Wireshark developers. */
-            char *cap_err_str;
+            const char *cap_err_str;
 
-            cap_err_str = pcap_geterr(pcap_opts->pcap_h);
+            cap_err_str = capture_loop_geterr(pcap_opts);
             if (strcmp(cap_err_str, "recvfrom: Network is down") == 0 ||
                 strcmp(cap_err_str, "The interface went down") == 0 ||
                 strcmp(cap_err_str, "read: Device not configured") == 0 ||
@@ -3887,14 +4334,14 @@ capture_loop_start(capture_options *capture_opts, gboolean *stats_known, struct
              * platforms; initialize it to 0 to handle that.
              */
             stats->ps_ifdrop = 0;
-            if (pcap_stats(pcap_opts->pcap_h, stats) >= 0) {
+            if (capture_loop_stats(pcap_opts, stats) >= 0) {
                 *stats_known = TRUE;
                 /* Let the parent process know. */
                 pcap_dropped += stats->ps_drop;
             } else {
                 g_snprintf(errmsg, sizeof(errmsg),
                            "Can't get packet-drop statistics: %s",
-                           pcap_geterr(pcap_opts->pcap_h));
+                           capture_loop_geterr(pcap_opts));
                 report_capture_error(errmsg, please_report);
             }
         }
@@ -3955,7 +4402,7 @@ capture_loop_stop(void)
             pcap_breakloop(pcap_opts->pcap_h);
     }
 #endif
-    global_ld.go = FALSE;
+    g_atomic_int_set(&global_ld.go, FALSE);
 }
 
 
@@ -4016,7 +4463,7 @@ capture_loop_write_packet_cb(u_char *pcap_opts_p, const struct pcap_pkthdr *phdr
     /* We may be called multiple times from pcap_dispatch(); if we've set
        the "stop capturing" flag, ignore this packet, as we're not
        supposed to be saving any more packets. */
-    if (!global_ld.go) {
+    if (!g_atomic_int_get(&global_ld.go)) {
         pcap_opts->flushed++;
         return;
     }
@@ -4044,7 +4491,7 @@ capture_loop_write_packet_cb(u_char *pcap_opts_p, const struct pcap_pkthdr *phdr
                                               &global_ld.bytes_written, &err);
         }
         if (!successful) {
-            global_ld.go = FALSE;
+            g_atomic_int_set(&global_ld.go, FALSE);
             global_ld.err = err;
             pcap_opts->dropped++;
         } else {
@@ -4057,7 +4504,7 @@ capture_loop_write_packet_cb(u_char *pcap_opts_p, const struct pcap_pkthdr *phdr
             pcap_opts->received++;
             /* if the user told us to stop after x packets, do we already have enough? */
             if ((global_ld.packet_max > 0) && (global_ld.packet_count >= global_ld.packet_max)) {
-                global_ld.go = FALSE;
+                g_atomic_int_set(&global_ld.go, FALSE);
             }
         }
     }
@@ -4069,8 +4516,6 @@ capture_loop_queue_packet_cb(u_char *pcap_opts_p, const struct pcap_pkthdr *phdr
                              const u_char *pd)
 {
     pcap_options       *pcap_opts = (pcap_options *) (void *) pcap_opts_p;
-    pcap_queue_element *queue_element;
-    gboolean            limit_reached;
 
     /* We may be called multiple times from pcap_dispatch(); if we've set
        the "stop capturing" flag, ignore this packet, as we're not
@@ -4080,49 +4525,23 @@ capture_loop_queue_packet_cb(u_char *pcap_opts_p, const struct pcap_pkthdr *phdr
         return;
     }
 
-    queue_element = (pcap_queue_element *)g_malloc(sizeof(pcap_queue_element));
-    if (queue_element == NULL) {
-       pcap_opts->dropped++;
-       return;
-    }
-    queue_element->pcap_opts = pcap_opts;
-    queue_element->phdr = *phdr;
-    queue_element->pd = (u_char *)g_malloc(phdr->caplen);
-    if (queue_element->pd == NULL) {
-        pcap_opts->dropped++;
-        g_free(queue_element);
-        return;
-    }
-    memcpy(queue_element->pd, pd, phdr->caplen);
-    g_async_queue_lock(pcap_queue);
-    if (((pcap_queue_byte_limit == 0) || (pcap_queue_bytes < pcap_queue_byte_limit)) &&
-        ((pcap_queue_packet_limit == 0) || (pcap_queue_packets < pcap_queue_packet_limit))) {
-        limit_reached = FALSE;
-        g_async_queue_push_unlocked(pcap_queue, queue_element);
-        pcap_queue_bytes += phdr->caplen;
-        pcap_queue_packets += 1;
-    } else {
-        limit_reached = TRUE;
-    }
-    g_async_queue_unlock(pcap_queue);
-    if (limit_reached) {
+    if (!pcap_ring_put(&pcap_opts->ring, phdr, pd)) {
         pcap_opts->dropped++;
-        g_free(queue_element->pd);
-        g_free(queue_element);
+#if defined(DEBUG_DUMPCAP) || defined(DEBUG_CHILD_DUMPCAP)
         g_log(LOG_DOMAIN_CAPTURE_CHILD, G_LOG_LEVEL_INFO,
               "Dropped a packet of length %d captured on interface %u.",
               phdr->caplen, pcap_opts->interface_id);
-    } else {
-        pcap_opts->received++;
-        g_log(LOG_DOMAIN_CAPTURE_CHILD, G_LOG_LEVEL_INFO,
-              "Queued a packet of length %d captured on interface %u.",
-              phdr->caplen, pcap_opts->interface_id);
+#endif
+        return;
     }
-    /* I don't want to hold the mutex over the debug output. So the
-       output may be wrong */
+    pcap_opts->received++;
+#if defined(DEBUG_DUMPCAP) || defined(DEBUG_CHILD_DUMPCAP)
     g_log(LOG_DOMAIN_CAPTURE_CHILD, G_LOG_LEVEL_INFO,
-          "Queue size is now %" G_GINT64_MODIFIER "d bytes (%" G_GINT64_MODIFIER "d packets)",
-          pcap_queue_bytes, pcap_queue_packets);
+          "Queued a packet of length %d captured on interface %u.",
+          phdr->caplen, pcap_opts->interface_id);
+#endif
+
+    writer_wake();
 }
 
 static int
@@ -4178,6 +4597,11 @@ main(int argc, char *argv[])
     int               opt;
     struct option     long_options[] = {
         {(char *)"capture-comment", required_argument, NULL, LONGOPT_NUM_CAP_COMMENT },
+#ifdef HAVE_TPACKET3
+        {(char *)"tpacket", no_argument, NULL, LONGOPT_NUM_TPACKET },
+        {(char *)"tpacket-block-size", required_argument, NULL, LONGOPT_NUM_TPACKET_BLOCK_SIZE },
+        {(char *)"tpacket-fanout", required_argument, NULL, LONGOPT_NUM_TPACKET_FANOUT },
+#endif
         {0, 0, 0, 0 }
     };
 
@@ -4607,6 +5031,38 @@ main(int argc, char *argv[])
         case 't':
             use_threads = TRUE;
             break;
+#ifdef HAVE_TPACKET3
+        case LONGOPT_NUM_TPACKET:
+            use_tpacket = TRUE;
+            break;
+        case LONGOPT_NUM_TPACKET_BLOCK_SIZE:
+            tpacket_block_size = get_positive_int(optarg, "tpacket block size");
+            if (tpacket_block_size > 1024 * 1024) {
+                cmdarg_err("The tpacket block size must be no more than 1048576 KB.");
+                exit_main(1);
+            }
+            tpacket_block_size *= 1024;
+            use_tpacket = TRUE;
+            break;
+        case LONGOPT_NUM_TPACKET_FANOUT:
+        {
+            gchar *colonp;
+
+            colonp = strchr(optarg, ':');
+            if (colonp != NULL)
+                *colonp++ = '\0';
+            tpacket_fanout = get_positive_int(optarg, "tpacket fanout socket count");
+            if (colonp != NULL) {
+                tpacket_fanout_group = get_positive_int(colonp, "tpacket fanout group");
+                if (tpacket_fanout_group > 65535) {
+                    cmdarg_err("The tpacket fanout group must be no more than 65535.");
+                    exit_main(1);
+                }
+            }
+            use_tpacket = TRUE;
+            break;
+        }
+#endif
             /*** all non capture option specific ***/
         case 'D':        /* Print a list of capture devices and exit */
             list_interfaces = TRUE;
@@ -4700,6 +5156,15 @@ main(int argc, char *argv[])
             global_capture_opts.use_pcapng = TRUE;
         }
 
+        if (tpacket_fanout > 1) {
+            /* The fanout threads write the packets themselves. */
+            if (global_capture_opts.ifaces->len > 1) {
+                cmdarg_err("--tpacket-fanout can only be used when capturing on one interface.");
+                exit_main(1);
+            }
+            use_threads = FALSE;
+        }
+
         if (global_capture_opts.capture_comment &&
             (!global_capture_opts.use_pcapng || global_capture_opts.multi_files_on)) {
             /* XXX - for ringbuffer, should we apply the comment to each file? */
@@ -4802,6 +5267,27 @@ main(int argc, char *argv[])
         exit_main(status);
     }
 
+#ifdef HAVE_TPACKET3
+    /* The pcap_t we get with --tpacket is a dead one, just for compiling
+       filters, so it can't be put in monitor mode or given a link-layer
+       type. */
+    if (use_tpacket && run_once_args == 0) {
+        for (j = 0; j < global_capture_opts.ifaces->len; j++) {
+            interface_options interface_opts;
+
+            interface_opts = g_array_index(global_capture_opts.ifaces, interface_options, j);
+            if (interface_opts.linktype != -1) {
+                cmdarg_err("A link-layer header type can't be set with --tpacket.");
+                exit_main(1);
+            }
+            if (interface_opts.monitor_mode) {
+                cmdarg_err("Monitor mode can't be used with --tpacket.");
+                exit_main(1);
+            }
+        }
+    }
+#endif
+
     /* Let the user know what interfaces were chosen. */
     if (capture_child) {
         for (j = 0; j < global_capture_opts.ifaces->len; j++) {
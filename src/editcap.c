@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
 
 /*
  * Just make sure we include the prototype for strptime as well
@@ -77,12 +78,14 @@
 #include <wsutil/filesystem.h>
 #include <wsutil/report_err.h>
 #include <wsutil/strnatcmp.h>
-#include <wsutil/md5.h>
+#include <wsutil/crc32-ieee.h>
+#include <wsutil/pint.h>
 #include <wsutil/plugins.h>
 
 #include "version.h"
 
 #include "ringbuffer.h" /* For RINGBUFFER_MAX_NUM_FILES */
+#include "frame_dedup.h"
 
 /*
  * Some globals so we can pass things to various routines
@@ -96,18 +99,11 @@ struct select_item {
 /*
  * Duplicate frame detection
  */
-typedef struct _fd_hash_t {
-    md5_byte_t digest[16];
-    guint32    len;
-    nstime_t   time;
-} fd_hash_t;
-
 #define DEFAULT_DUP_DEPTH       5   /* Used with -d */
-#define MAX_DUP_DEPTH     1000000   /* the maximum window (and actual size of fd_hash[]) for de-duplication */
+#define MAX_DUP_DEPTH     1000000   /* the maximum window for de-duplication */
 
-static fd_hash_t fd_hash[MAX_DUP_DEPTH];
-static int       dup_window    = DEFAULT_DUP_DEPTH;
-static int       cur_dup_entry = 0;
+static frame_dedup_t *fd_dedup;
+static int            dup_window    = DEFAULT_DUP_DEPTH;
 
 #define ONE_MILLION    1000000
 #define ONE_BILLION 1000000000
@@ -149,6 +145,7 @@ static int                    out_file_type_subtype     = WTAP_FILE_TYPE_SUBTYPE
 static int                    out_file_type_subtype     = WTAP_FILE_TYPE_SUBTYPE_PCAP; /* default to pcap     */
 #endif
 static int                    out_frame_type            = -2; /* Leave frame type alone */
+static wtap_compression_type  out_compression_type      = WTAP_UNCOMPRESSED;
 static int                    verbose                   = 0;  /* Not so verbose         */
 static struct time_adjustment time_adj                  = {{0, 0}, 0}; /* no adjustment */
 static nstime_t               relative_time_window      = {0, 0}; /* de-dup time window */
@@ -163,6 +160,27 @@ static int                    do_strict_time_adjustment = FALSE;
 static struct time_adjustment strict_time_adj           = {{0, 0}, 0}; /* strict time adjustment */
 static nstime_t               previous_time             = {0, 0}; /* previous time */
 
+static wtap_hwgen_params_t    hwgen_params;                     /* hw-gen line model (-G, -R) */
+static wtap_hwgen_encap_t     hwgen_encap;                      /* hw-gen header rewriting (-m, -q) */
+static gboolean               hwgen_encap_set           = FALSE;
+static char                   rate_target_unit          = 0;    /* -R: 'x', 'G' or 'p'; 0 if not given */
+static double                 rate_target               = 0.0;
+static int                    flow_shards               = 0;    /* -P: number of output files; 0 if not given */
+static gboolean               direct_io                 = FALSE; /* -O: bypass the page cache */
+
+#define MAX_FLOW_SHARDS 256
+
+/*
+ * Multi-file conversion (-M): each <infile> <outfile> pair given on the
+ * command line is converted independently by a worker thread.
+ */
+typedef struct _convert_job_t {
+    const char *in_filename;
+    const char *out_filename;
+    guint32     snaplen;
+    gboolean    failed;
+} convert_job_t;
+
 static int find_dct2000_real_data(guint8 *buf);
 static void handle_chopping(chop_t chop, struct wtap_pkthdr *out_phdr,
                             const struct wtap_pkthdr *in_phdr, guint8 **buf,
@@ -311,6 +329,57 @@ selected(int recno)
   return 0;
 }
 
+/* Lowest selected record number >= recno, or 0 if there is none. */
+
+static unsigned int
+next_selected(unsigned int recno)
+{
+    int          i;
+    unsigned int next = 0;
+
+    for (i = 0; i <= max_selected; i++) {
+        int first = selectfrm[i].first;
+        int last  = selectfrm[i].inclusive ? selectfrm[i].second : first;
+
+        if (last < (int)recno)
+            continue;
+        if (first < (int)recno)
+            first = recno;
+        if (next == 0 || (unsigned int)first < next)
+            next = first;
+    }
+
+    return next;
+}
+
+/*
+ * With -r, skip the records between here and the next selected one,
+ * seeking straight to it if the input format can do that.  Returns
+ * FALSE, with *err set to 0, once no later record is selected.
+ */
+
+static gboolean
+skip_to_selected(wtap *wth, gboolean *can_seek, unsigned int *count,
+                 int *err, gchar **err_info)
+{
+    unsigned int next;
+
+    *err = 0;
+    next = next_selected(*count);
+    if (next == 0)
+        return FALSE;
+
+    if (*can_seek && next > *count) {
+        if (wtap_seek_to_packet(wth, next - 1, err, err_info))
+            *count = next;
+        else if (*err != 0)
+            return FALSE;
+        else
+            *can_seek = FALSE;
+    }
+    return TRUE;
+}
+
 static void
 set_time_adjustment(char *optarg_str_p)
 {
@@ -523,138 +592,1083 @@ set_rel_time(char *optarg_str_p)
     relative_time_window.nsecs = (int)val;
 }
 
-static gboolean
-is_duplicate(guint8* fd, guint32 len) {
-    int i;
-    md5_state_t ms;
+/*
+ * Parse <Gb/s>[:<word bytes>[:<min gap>[:<max gap>]]] and make it the
+ * line model for the hw-gen files we write.
+ */
+static void
+set_hwgen_line(char *optarg_str_p)
+{
+    double              gbps;
+    unsigned int        field[3];   /* word bytes, min gap, max gap */
+    unsigned long       val;
+    char               *p;
+    gboolean            ok;
+    guint               n;
+
+    field[0] = hwgen_params.word_width;
+    field[1] = hwgen_params.min_ifg;
+    field[2] = hwgen_params.max_ifg;
+
+    /* Each field starts with a digit: no sign, which strtoul() would
+       wrap a negative value around with. */
+    ok = g_ascii_isdigit(*optarg_str_p) || *optarg_str_p == '.';
+    gbps = strtod(optarg_str_p, &p);
+    ok = ok && p != optarg_str_p && gbps > 0.0 && gbps * 1e6 <= (double)G_MAXUINT64;
+    for (n = 0; ok && *p == ':' && n < G_N_ELEMENTS(field); n++) {
+        ok = g_ascii_isdigit(p[1]);
+        if (ok) {
+            errno = 0;
+            val = strtoul(p + 1, &p, 10);
+            ok = errno == 0 && val <= G_MAXUINT;
+            field[n] = (unsigned int)val;
+        }
+    }
+    if (!ok || *p != '\0') {
+        fprintf(stderr, "editcap: \"%s\" isn't a valid hw-gen line specification\n",
+                optarg_str_p);
+        exit(1);
+    }
 
-    cur_dup_entry++;
-    if (cur_dup_entry >= dup_window)
-        cur_dup_entry = 0;
+    /* The line rate is kept in kbit/s. */
+    hwgen_params.line_rate  = (guint64)(gbps * 1e6 + 0.5);
+    hwgen_params.word_width = field[0];
+    hwgen_params.min_ifg    = field[1];
+    hwgen_params.max_ifg    = field[2];
+    if (!wtap_hwgen_params_valid(&hwgen_params)) {
+        fprintf(stderr, "editcap: \"%s\" is out of range: the line rate must be up to 1000 Gb/s,\n",
+                optarg_str_p);
+        fprintf(stderr, "editcap: the word 1 to 64 bytes wide and 0 < min gap <= max gap\n");
+        exit(1);
+    }
+}
 
-    /* Calculate our digest */
-    md5_init(&ms);
-    md5_append(&ms, fd, len);
-    md5_finish(&ms, fd_hash[cur_dup_entry].digest);
+/* Parse the argument of -z, a compression we can write. */
+static void
+set_compression_type(const char *optarg_str_p)
+{
+    if (strcmp(optarg_str_p, "gzip") == 0)
+        out_compression_type = WTAP_GZIP_COMPRESSED;
+    else if (strcmp(optarg_str_p, "bgzf") == 0)
+        out_compression_type = WTAP_BGZF_COMPRESSED;
+    else if (strcmp(optarg_str_p, "zstd") == 0)
+        out_compression_type = WTAP_ZSTD_COMPRESSED;
+    else if (strcmp(optarg_str_p, "lz4") == 0)
+        out_compression_type = WTAP_LZ4_COMPRESSED;
+    else {
+        fprintf(stderr, "editcap: \"%s\" isn't gzip, bgzf, zstd or lz4\n",
+                optarg_str_p);
+        exit(1);
+    }
+    if (!wtap_can_write_compression_type(out_compression_type)) {
+        fprintf(stderr, "editcap: This version of editcap can't write %s output\n",
+                optarg_str_p);
+        exit(1);
+    }
+}
 
-    fd_hash[cur_dup_entry].len = len;
+/* Parse a MAC address in the xx:xx:xx:xx:xx:xx form; returns the end of it. */
+static const char *
+parse_mac(const char *str, guint8 *mac)
+{
+    unsigned int b[6];
+    int          i, n = 0;
+
+    if (sscanf(str, "%2x:%2x:%2x:%2x:%2x:%2x%n",
+               &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &n) < 6 || n == 0)
+        return NULL;
+    for (i = 0; i < 6; i++)
+        mac[i] = (guint8)b[i];
+    return str + n;
+}
 
-    /* Look for duplicates */
-    for (i = 0; i < dup_window; i++) {
-        if (i == cur_dup_entry)
-            continue;
+/*
+ * Parse <dst MAC>[,<src MAC>], the addresses of the Ethernet headers
+ * hw-gen writers put on frames of other link types.
+ */
+static void
+set_hwgen_macs(char *optarg_str_p)
+{
+    const char *p;
+
+    p = parse_mac(optarg_str_p, hwgen_encap.dst_mac);
+    if (p != NULL && *p == ',')
+        p = parse_mac(p + 1, hwgen_encap.src_mac);
+    if (p == NULL || *p != '\0') {
+        fprintf(stderr, "editcap: \"%s\" isn't a valid <dst MAC>[,<src MAC>]\n",
+                optarg_str_p);
+        exit(1);
+    }
+    hwgen_encap_set = TRUE;
+}
 
-        if (fd_hash[i].len == fd_hash[cur_dup_entry].len
-            && memcmp(fd_hash[i].digest, fd_hash[cur_dup_entry].digest, 16) == 0) {
-            return TRUE;
+/*
+ * Parse <VLAN ID>[:<priority>][,<VLAN ID>[:<priority>]], the VLAN tags
+ * hw-gen writers push onto every frame, outermost first.
+ */
+static void
+set_hwgen_vlans(char *optarg_str_p)
+{
+    char         *p = optarg_str_p;
+    unsigned long vid, pcp;
+    guint         n = 0;
+
+    while (n < WTAP_HWGEN_MAX_VLAN_TAGS && g_ascii_isdigit(*p)) {
+        pcp = 0;
+        vid = strtoul(p, &p, 10);
+        if (*p == ':' && g_ascii_isdigit(p[1]))
+            pcp = strtoul(p + 1, &p, 10);
+        if (vid > 4095 || pcp > 7 || (*p != ',' && *p != '\0'))
+            break;
+        hwgen_encap.vlan_tci[n++] = (guint16)(pcp << 13 | vid);
+        if (*p == '\0') {
+            hwgen_encap.n_vlan_tags = n;
+            hwgen_encap_set = TRUE;
+            return;
         }
+        p++;
+    }
+    fprintf(stderr, "editcap: \"%s\" isn't a valid list of up to %d VLAN tags;\n",
+            optarg_str_p, WTAP_HWGEN_MAX_VLAN_TAGS);
+    fprintf(stderr, "editcap: use <VLAN ID>[:<priority>][,<VLAN ID>[:<priority>]]\n");
+    exit(1);
+}
+
+/* Parse the -R rate: <factor>x, <Gb/s>G or <packets/s>p. */
+static void
+set_rate_target(char *optarg_str_p)
+{
+    char *p;
+
+    rate_target = strtod(optarg_str_p, &p);
+    if (p == optarg_str_p || rate_target <= 0.0
+        || (*p != 'x' && *p != 'G' && *p != 'p') || p[1] != '\0') {
+        fprintf(stderr, "editcap: \"%s\" isn't a valid rate; use <factor>x, <Gb/s>G or <packets/s>p\n",
+                optarg_str_p);
+        exit(1);
     }
+    rate_target_unit = *p;
+}
+
+/*
+ * Measure the average rate of a capture file from its first and last
+ * time stamps, counting frames as hw-gen writes them: with an FCS and
+ * padded to the Ethernet minimum.
+ */
+static gboolean
+measure_rate(const char *filename, double *bps, double *pps)
+{
+    wtap                     *wth;
+    int                       err;
+    gchar                    *err_info;
+    gint64                    data_offset;
+    const struct wtap_pkthdr *phdr;
+    guint64                   frames = 0, bytes = 0;
+    nstime_t                  first, last;
+    double                    duration;
+
+    wth = wtap_open_offline(filename, WTAP_TYPE_AUTO, &err, &err_info, FALSE);
+    if (!wth) {
+        fprintf(stderr, "editcap: Can't open %s: %s\n", filename,
+                wtap_strerror(err));
+        return FALSE;
+    }
+    (void)wtap_set_hwgen_read_params(wth, &hwgen_params);
+
+    nstime_set_unset(&first);
+    nstime_set_unset(&last);
+    while (wtap_read(wth, &err, &err_info, &data_offset)) {
+        phdr = wtap_phdr(wth);
+        if (!(phdr->presence_flags & WTAP_HAS_TS))
+            continue;
+        if (nstime_is_unset(&first))
+            first = phdr->ts;
+        last = phdr->ts;
+        frames++;
+        bytes += MAX(phdr->len + 4, 64);
+    }
+    wtap_close(wth);
+
+    if (err != 0) {
+        fprintf(stderr, "editcap: An error occurred while reading \"%s\": %s.\n",
+                filename, wtap_strerror(err));
+        return FALSE;
+    }
+
+    duration = nstime_is_unset(&first) ? 0.0 : nstime_to_sec(&last) - nstime_to_sec(&first);
+    if (duration <= 0.0) {
+        fprintf(stderr, "editcap: Can't measure the rate of %s: its packets span no time\n",
+                filename);
+        return FALSE;
+    }
+
+    *bps = bytes * 8.0 / duration;
+    *pps = frames / duration;
+    return TRUE;
+}
+
+/*
+ * wtap_dump_open_ng() for the output file type, with our line model and
+ * header rewriting if it's hw-gen.
+ */
+static wtap_dumper *
+open_output(const char *filename, int frame_type, int snaplen,
+            wtapng_section_t *shb_hdr, wtapng_iface_descriptions_t *idb_inf, int *err)
+{
+    return wtap_dump_open_hwgen(filename, out_file_type_subtype, frame_type, snaplen,
+                                out_compression_type, shb_hdr, idb_inf, &hwgen_params,
+                                &hwgen_encap, err);
+}
+
+/*
+ * Tell how a hw-gen file we're about to close will play on the
+ * generator, and whether the trace was too fast for the line.  Frames
+ * it had to leave out are always reported.
+ */
+static void
+report_hwgen_rate(wtap_dumper *pdh, const char *filename)
+{
+    wtap_hwgen_stats_t stats;
+
+    if (!wtap_dump_hwgen_stats(pdh, &stats))
+        return;
+
+    if (stats.skipped > 0)
+        fprintf(stderr, "editcap: warning: %" G_GINT64_MODIFIER "u frames left out of %s: they carry nothing an Ethernet frame can\n",
+                stats.skipped, filename);
+    if (!(verbose || rate_target_unit != 0))
+        return;
+
+    fprintf(stderr, "%s: %" G_GINT64_MODIFIER "u frames in %.6f s, average %.3f Gb/s (%.0f packets/s), peak %.3f Gb/s\n",
+            filename, stats.frames, stats.duration, stats.avg_bps / 1e9,
+            stats.avg_pps, stats.peak_bps / 1e9);
+    if (stats.saturated > 0)
+        fprintf(stderr, "editcap: warning: %" G_GINT64_MODIFIER "u gaps in %s are at the minimum: those frames are already back to back, so they play slower than asked for\n",
+                stats.saturated, filename);
+}
 
+/*
+ * Switch a freshly opened output file to O_DIRECT if -O was given, so
+ * that multi-gigabyte hw_gen traces don't wipe out the page cache.
+ */
+static gboolean
+set_direct_io(wtap_dumper *pdh, const char *filename)
+{
+    int err;
+
+    if (!direct_io || wtap_dump_set_direct_io(pdh, &err))
+        return TRUE;
+
+    fprintf(stderr, "editcap: Can't write %s with direct I/O: %s\n",
+            filename, wtap_strerror(err));
     return FALSE;
 }
 
+/*
+ * Flow sharding (-P).  Both directions of a flow must land in the same
+ * output file, so the hash key is the 5-tuple with the two endpoints in
+ * a canonical order.  IP fragments are keyed on the addresses and the
+ * protocol only, as only the first one has the ports; other Ethernet
+ * frames are keyed on their MAC addresses.  The IP header is found the
+ * way the hw-gen writers find it, under any of the link-layer headers
+ * they take.
+ */
+#define SHARD_ETHERTYPE_IPv4    0x0800
+#define SHARD_ETHERTYPE_IPv6    0x86dd
+
 static gboolean
-is_duplicate_rel_time(guint8* fd, guint32 len, const nstime_t *current) {
-    int i;
-    md5_state_t ms;
+shard_has_ports(guint8 proto)
+{
+    /* TCP, UDP, SCTP and UDP-Lite all start with the two ports. */
+    return proto == 6 || proto == 17 || proto == 132 || proto == 136;
+}
+
+static guint
+flow_shard(const struct wtap_pkthdr *phdr, const guint8 *buf, guint nshards)
+{
+    guint8        key[2 * 16 + 2 * 2 + 1];
+    const guint8 *addr_a, *addr_b, *tmp, *mac;
+    guint32       off;
+    guint         addr_len, l4 = 0, n;
+    guint         len = phdr->caplen;
+    guint16       port_a = 0, port_b = 0, ethertype, tmp_port;
+    guint8        proto = 0;
+    gboolean      has_l4 = FALSE;
+    int           cmp;
+
+    if (!wtap_hwgen_l3_offset(phdr, buf, &off, &ethertype, &mac)) {
+        /* Nothing we can find a flow in. */
+        return 0;
+    }
+    if (mac != NULL) {
+        /* Not IP: fall back to the MAC addresses. */
+        addr_a = mac + 6;
+        addr_b = mac;
+        addr_len = 6;
+    } else {
+        addr_a = addr_b = buf;
+        addr_len = 0;
+    }
 
-    cur_dup_entry++;
-    if (cur_dup_entry >= dup_window)
-        cur_dup_entry = 0;
+    if (ethertype == SHARD_ETHERTYPE_IPv4 && len >= off + 20 && (buf[off] >> 4) == 4) {
+        guint ihl = (buf[off] & 0x0f) * 4;
+
+        proto = buf[off + 9];
+        addr_a = buf + off + 12;
+        addr_b = buf + off + 16;
+        addr_len = 4;
+        /* Unfragmented: no MF flag and a zero fragment offset. */
+        if (ihl >= 20 && (pntoh16(buf + off + 6) & 0x3fff) == 0) {
+            l4 = off + ihl;
+            has_l4 = TRUE;
+        }
+    } else if (ethertype == SHARD_ETHERTYPE_IPv6 && len >= off + 40 && (buf[off] >> 4) == 6) {
+        proto = buf[off + 6];
+        addr_a = buf + off + 8;
+        addr_b = buf + off + 24;
+        addr_len = 16;
+        l4 = off + 40;
+        has_l4 = TRUE;
+        /* Hop-by-hop, routing, destination options and AH headers. */
+        for (n = 0; n < 8 && (proto == 0 || proto == 43 || proto == 60 || proto == 51); n++) {
+            if (len < l4 + 2) {
+                has_l4 = FALSE;
+                break;
+            }
+            proto = buf[l4];
+            l4 += (proto == 51) ? (buf[l4 + 1] + 2) * 4 : (buf[l4 + 1] + 1) * 8;
+        }
+        /* A fragment header, or too many extension headers. */
+        if (proto == 44 || proto == 0 || proto == 43 || proto == 60 || proto == 51)
+            has_l4 = FALSE;
+    } else if (addr_len == 0) {
+        return 0;
+    }
 
-    /* Calculate our digest */
-    md5_init(&ms);
-    md5_append(&ms, fd, len);
-    md5_finish(&ms, fd_hash[cur_dup_entry].digest);
+    if (has_l4 && shard_has_ports(proto) && len >= l4 + 4) {
+        port_a = pntoh16(buf + l4);
+        port_b = pntoh16(buf + l4 + 2);
+    }
 
-    fd_hash[cur_dup_entry].len = len;
-    fd_hash[cur_dup_entry].time.secs = current->secs;
-    fd_hash[cur_dup_entry].time.nsecs = current->nsecs;
+    cmp = memcmp(addr_a, addr_b, addr_len);
+    if (cmp > 0 || (cmp == 0 && port_a > port_b)) {
+        tmp = addr_a; addr_a = addr_b; addr_b = tmp;
+        tmp_port = port_a; port_a = port_b; port_b = tmp_port;
+    }
+    memcpy(key, addr_a, addr_len);
+    memcpy(key + addr_len, addr_b, addr_len);
+    n = 2 * addr_len;
+    key[n++] = port_a >> 8;
+    key[n++] = port_a & 0xff;
+    key[n++] = port_b >> 8;
+    key[n++] = port_b & 0xff;
+    key[n++] = proto;
+
+    return crc32_ieee(key, n) % nshards;
+}
 
-    /*
-     * Look for relative time related duplicates.
-     * This is hopefully a reasonably efficient mechanism for
-     * finding duplicates by rel time in the fd_hash[] cache.
-     * We check starting from the most recently added hash
-     * entries and work backwards towards older packets.
-     * This approach allows the dup test to be terminated
-     * when the relative time of a cached entry is found to
-     * be beyond the dup time window.
-     *
-     * Of course this assumes that the input trace file is
-     * "well-formed" in the sense that the packet timestamps are
-     * in strict chronologically increasing order (which is NOT
-     * always the case!!).
-     *
-     * The fd_hash[] table was deliberately created large (1,000,000).
-     * Looking for time related duplicates in large trace files with
-     * non-fractional dup time window values can potentially take
-     * a long time to complete.
-     */
+/*
+ * Open the -P output files, named like the -c and -i ones with the port
+ * number in place of the file number.  They are all written in the same
+ * pass over the input, so each has its own dumper, and with hw-gen output
+ * its own gaps, computed from the packets it gets.
+ */
+static wtap_dumper **
+open_shard_files(const char *out_filename, const struct wtap_pkthdr *phdr,
+                 int snapshot_length, wtapng_section_t *shb_hdr,
+                 wtapng_iface_descriptions_t *idb_inf, gchar ***filenames)
+{
+    wtap_dumper **pdhs;
+    gchar        *fprefix, *fsuffix;
+    int           i, err;
 
-    for (i = cur_dup_entry - 1;; i--) {
-        nstime_t delta;
-        int cmp;
+    if (!fileset_extract_prefix_suffix(out_filename, &fprefix, &fsuffix))
+        exit(2);
 
-        if (i < 0)
-            i = dup_window - 1;
+    pdhs = g_new(wtap_dumper *, flow_shards);
+    *filenames = g_new(gchar *, flow_shards);
+    for (i = 0; i < flow_shards; i++) {
+        (*filenames)[i] = fileset_get_filename_by_pattern(i, phdr, fprefix, fsuffix);
+        pdhs[i] = open_output((*filenames)[i], out_frame_type, snapshot_length,
+                              shb_hdr, idb_inf, &err);
+        if (pdhs[i] == NULL) {
+            fprintf(stderr, "editcap: Can't open or create %s: %s\n",
+                    (*filenames)[i], wtap_strerror(err));
+            exit(2);
+        }
+        if (!set_direct_io(pdhs[i], (*filenames)[i]))
+            exit(2);
+        if (verbose)
+            fprintf(stderr, "Writing port %d to %s\n", i, (*filenames)[i]);
+    }
 
-        if (i == cur_dup_entry) {
-            /*
-             * We've decremented back to where we started.
-             * Check no more!
-             */
+    g_free(fprefix);
+    g_free(fsuffix);
+    return pdhs;
+}
+
+static void
+print_dup_hash(const char *what, guint32 count, guint32 len)
+{
+    const guint8 *digest = frame_dedup_digest(fd_dedup);
+    int           i;
+
+    fprintf(stderr, "%s: %u, Len: %u, Hash: ", what, count, len);
+    for (i = 0; i < 16; i++)
+        fprintf(stderr, "%02x", digest[i]);
+    fprintf(stderr, "\n");
+}
+
+/*
+ * Convert one file of a multi-file run.  Only the file type (-F),
+ * encapsulation (-T) and snapshot length (-s) are applied; all of the
+ * reader and writer state lives in the wtap and wtap_dumper, so any
+ * number of these can run at once.
+ */
+static void
+convert_file(gpointer data, gpointer user_data _U_)
+{
+    convert_job_t               *job = (convert_job_t *)data;
+    wtap                        *wth;
+    wtap_dumper                 *pdh;
+    int                          err;
+    gchar                       *err_info;
+    gint64                       data_offset;
+    int                          frame_type;
+    guint32                      read_count = 0;
+    const struct wtap_pkthdr    *phdr;
+    struct wtap_pkthdr           snap_phdr;
+    wtapng_iface_descriptions_t *idb_inf;
+    wtapng_section_t            *shb_hdr;
+
+    job->failed = TRUE;
+
+    wth = wtap_open_offline(job->in_filename, WTAP_TYPE_AUTO, &err, &err_info, FALSE);
+    if (!wth) {
+        fprintf(stderr, "editcap: Can't open %s: %s\n", job->in_filename,
+                wtap_strerror(err));
+        switch (err) {
+        case WTAP_ERR_UNSUPPORTED:
+        case WTAP_ERR_UNSUPPORTED_ENCAP:
+        case WTAP_ERR_BAD_FILE:
+            fprintf(stderr, "(%s)\n", err_info);
+            g_free(err_info);
             break;
         }
+        return;
+    }
+    (void)wtap_set_hwgen_read_params(wth, &hwgen_params);
 
-        if (nstime_is_unset(&(fd_hash[i].time))) {
-            /*
-             * We've decremented to an unused fd_hash[] entry.
-             * Check no more!
-             */
+    if (verbose) {
+        fprintf(stderr, "File %s is a %s capture file.\n", job->in_filename,
+                wtap_file_type_subtype_string(wtap_file_type_subtype(wth)));
+    }
+
+    shb_hdr = wtap_file_get_shb_info(wth);
+    idb_inf = wtap_file_get_idb_info(wth);
+
+    /* If we don't have an application name add Editcap */
+    if (shb_hdr->shb_user_appl == NULL) {
+        shb_hdr->shb_user_appl = "Editcap " VERSION;
+    }
+
+    frame_type = (out_frame_type == -2) ? wtap_file_encap(wth) : out_frame_type;
+
+    pdh = open_output(job->out_filename, frame_type,
+                      job->snaplen ? MIN(job->snaplen, wtap_snapshot_length(wth)) : wtap_snapshot_length(wth),
+                      shb_hdr, idb_inf, &err);
+    if (pdh == NULL) {
+        fprintf(stderr, "editcap: Can't open or create %s: %s\n",
+                job->out_filename, wtap_strerror(err));
+        g_free(idb_inf);
+        g_free(shb_hdr);
+        wtap_close(wth);
+        return;
+    }
+    if (!set_direct_io(pdh, job->out_filename)) {
+        wtap_dump_close(pdh, &err);
+        g_free(idb_inf);
+        g_free(shb_hdr);
+        wtap_close(wth);
+        return;
+    }
+
+    while (wtap_read(wth, &err, &err_info, &data_offset)) {
+        read_count++;
+
+        phdr = wtap_phdr(wth);
+        if (job->snaplen != 0 && phdr->caplen > job->snaplen) {
+            snap_phdr = *phdr;
+            snap_phdr.caplen = job->snaplen;
+            phdr = &snap_phdr;
+        }
+
+        if (!wtap_dump(pdh, phdr, wtap_buf_ptr(wth), &err)) {
+            fprintf(stderr, "editcap: Error writing frame %u of \"%s\" to %s: %s\n",
+                    read_count, job->in_filename, job->out_filename,
+                    wtap_strerror(err));
+            wtap_dump_close(pdh, &err);
+            g_free(idb_inf);
+            g_free(shb_hdr);
+            wtap_close(wth);
+            return;
+        }
+    }
+
+    if (err != 0) {
+        fprintf(stderr,
+                "editcap: An error occurred while reading \"%s\": %s.\n",
+                job->in_filename, wtap_strerror(err));
+        switch (err) {
+        case WTAP_ERR_UNSUPPORTED:
+        case WTAP_ERR_UNSUPPORTED_ENCAP:
+        case WTAP_ERR_BAD_FILE:
+            fprintf(stderr, "(%s)\n", err_info);
+            g_free(err_info);
             break;
         }
+    } else {
+        job->failed = FALSE;
+    }
+
+    g_free(idb_inf);
+
+    report_hwgen_rate(pdh, job->out_filename);
+    if (!wtap_dump_close(pdh, &err)) {
+        fprintf(stderr, "editcap: Error writing to %s: %s\n",
+                job->out_filename, wtap_strerror(err));
+        job->failed = TRUE;
+    }
+    g_free(shb_hdr);
+    wtap_close(wth);
+
+    if (verbose)
+        fprintf(stderr, "%u packet%s converted from %s to %s\n", read_count,
+                plurality(read_count, "", "s"), job->in_filename, job->out_filename);
+}
+
+/*
+ * The single-file loop runs as a pipeline.  A reader thread reads (and
+ * decompresses) the input into batches of records; a pool of worker
+ * threads applies everything that depends on nothing but the record
+ * itself (-s, -C, -E, and the frame digests, flow hashes and hw-gen
+ * records that the rest needs); and the main thread takes the batches
+ * back in input order for everything that depends on the records before
+ * it (-S, -t, -d, -D, -w, -c, -i) and for the writing.  Only
+ * EDIT_BATCHES_PER_THREAD batches per worker exist, so a reader or
+ * worker that gets ahead waits for the writer.
+ *
+ * Without -j the same steps are run one batch at a time on the main
+ * thread, so the output doesn't depend on the number of threads.
+ */
+#define EDIT_BATCH_RECORDS       512
+#define EDIT_BATCH_BYTES         (1024 * 1024)   /* a batch is handed on once its frames fill this */
+#define EDIT_BATCHES_PER_THREAD  4
+#define MAX_EDIT_THREADS         256
+
+typedef struct _edit_rec_t {
+    struct wtap_pkthdr phdr;            /* as read */
+    struct wtap_pkthdr out_phdr;        /* after -s and -C */
+    unsigned int       count;           /* record number, as -r counts */
+    gboolean           keep;            /* in the time frame (-A, -B) and selected */
+    gsize              data_off;        /* frame as read, in the batch's data */
+    guint8            *buf;             /* frame after -s, -C and -E */
+    guint8             digest[FRAME_DEDUP_DIGEST_LEN]; /* -d, -D, -w */
+    guint              shard;           /* -P */
+    guint8            *hwgen_rec;       /* hw-gen output: the record, in the batch's hwgen, */
+    gint               hwgen_len;       /* its length (see wtap_hwgen_build_record()), */
+    int                hwgen_err;       /* and the error if it can't be written */
+} edit_rec_t;
+
+typedef struct _edit_batch_t {
+    guint64      seq;                   /* position in the input */
+    guint        nrecs;
+    edit_rec_t   recs[EDIT_BATCH_RECORDS];
+    guint8      *data;                  /* the frames */
+    gsize        data_len;
+    gsize        data_size;
+    guint8      *hwgen;                 /* the hw-gen records */
+    gsize        hwgen_size;
+    gboolean     eof;                   /* the last batch; if set, the fields below are valid */
+    unsigned int count;                 /* record number after the last record */
+    int          err;
+    gchar       *err_info;
+} edit_batch_t;
+
+/* What the workers need that doesn't live in a global */
+typedef struct _edit_xform_t {
+    guint32   snaplen;
+    gboolean  adjlen;
+    chop_t    chop;
+    gboolean  dct2000;                  /* protect the DCT2000 meta-data from -E */
+    gboolean  hwgen_records;            /* build hw-gen records... */
+    const wtap_hwgen_encap_t *hwgen_encap; /* ...with the header rewriting the output is opened with */
+} edit_xform_t;
+
+typedef struct _edit_reader_t {
+    wtap         *wth;
+    gboolean      skip_unselected;      /* see skip_to_selected() */
+    gboolean      can_seek;
+    gboolean      skip_out_of_time;     /* see skip_to_start_time() */
+    gint64        stop_count;           /* no record from here on is before -B; -1 if unknown */
+    unsigned int  count;
+    guint64       seq;
+    gboolean      eof;
+    wtap_batch   *records;              /* read ahead, unless skip_unselected... */
+    guint         rec;                  /* ...and the one read_record() returned last */
+} edit_reader_t;
+
+typedef struct _edit_pipe_t {
+    edit_reader_t  *reader;
+    edit_xform_t   *xform;
+    GThreadPool    *workers;            /* NULL without -j */
+    GThread        *reader_thread;
+    GAsyncQueue    *free_q;             /* batches for the reader to fill */
+    GAsyncQueue    *done_q;             /* transformed batches, in any order */
+    edit_batch_t  **pending;            /* transformed batches, by seq % nbatches */
+    guint           nbatches;
+    guint64         next_seq;           /* the batch the writer wants next */
+    edit_batch_t   *cur;                /* the batch the writer is on... */
+    guint           cur_rec;            /* ...and its next record */
+} edit_pipe_t;
+
+static guint64 err_seed;                /* -E */
+
+/*
+ * Random numbers for -E (SplitMix64).  Each record gets a sequence of its
+ * own, seeded from its record number, so that what happens to it doesn't
+ * depend on the thread that mutates it.
+ */
+#define ERR_RAND_MAX 0x7FFFFFFF
+
+static int
+err_rand(guint64 *state)
+{
+    guint64 z = (*state += G_GUINT64_CONSTANT(0x9e3779b97f4a7c15));
+
+    z = (z ^ (z >> 30)) * G_GUINT64_CONSTANT(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * G_GUINT64_CONSTANT(0x94d049bb133111eb);
+    return (int)((z ^ (z >> 31)) >> 33);
+}
+
+/* Random error mutation */
+static void
+mutate_frame(guint8 *buf, guint32 caplen, unsigned int count, gboolean dct2000)
+{
+    guint64 state = err_seed ^ ((guint64)count << 32 | count);
+    int     real_data_start = 0;
+    int     err_type;
+    int     i, j;
+
+    /* Protect non-protocol data */
+    if (dct2000)
+        real_data_start = find_dct2000_real_data(buf);
+
+    for (i = real_data_start; i < (int) caplen; i++) {
+        if (err_rand(&state) <= err_prob * ERR_RAND_MAX) {
+            err_type = err_rand(&state) / (ERR_RAND_MAX / ERR_WT_TOTAL + 1);
+
+            if (err_type < ERR_WT_BIT) {
+                buf[i] ^= 1 << (err_rand(&state) / (ERR_RAND_MAX / 8 + 1));
+                err_type = ERR_WT_TOTAL;
+            } else {
+                err_type -= ERR_WT_BYTE;
+            }
+
+            if (err_type < ERR_WT_BYTE) {
+                buf[i] = err_rand(&state) / (ERR_RAND_MAX / 255 + 1);
+                err_type = ERR_WT_TOTAL;
+            } else {
+                err_type -= ERR_WT_BYTE;
+            }
+
+            if (err_type < ERR_WT_ALNUM) {
+                buf[i] = ALNUM_CHARS[err_rand(&state) / (ERR_RAND_MAX / ALNUM_LEN + 1)];
+                err_type = ERR_WT_TOTAL;
+            } else {
+                err_type -= ERR_WT_ALNUM;
+            }
+
+            if (err_type < ERR_WT_FMT) {
+                if ((unsigned int)i < caplen - 2)
+                    g_strlcpy((char*) &buf[i], "%s", 2);
+                err_type = ERR_WT_TOTAL;
+            } else {
+                err_type -= ERR_WT_FMT;
+            }
+
+            if (err_type < ERR_WT_AA) {
+                for (j = i; j < (int) caplen; j++)
+                    buf[j] = 0xAA;
+                i = caplen;
+            }
+        }
+    }
+}
+
+static edit_batch_t *
+edit_batch_new(void)
+{
+    return g_new0(edit_batch_t, 1);
+}
+
+static void
+edit_batch_free(edit_batch_t *batch)
+{
+    g_free(batch->data);
+    g_free(batch->hwgen);
+    g_free(batch);
+}
+
+/*
+ * With -A or -B, and an index sidecar for the input file, skip the
+ * records that all come before the start time, and note where the ones
+ * that all come at or after the stop time begin.
+ */
+static gboolean
+skip_to_start_time(edit_reader_t *reader, int *err, gchar **err_info)
+{
+    nstime_t ts;
+    guint64  packet_num;
+
+    ts.secs = stoptime;
+    ts.nsecs = 0;
+    reader->stop_count = wtap_time_stop_packet(reader->wth, &ts);
+
+    ts.secs = starttime;
+    ts.nsecs = 0;
+    if (wtap_seek_to_time(reader->wth, &ts, &packet_num, err, err_info))
+        reader->count = (unsigned int)packet_num + 1;   /* counted from 1 */
+    return *err == 0;
+}
+
+/*
+ * Get the next record.  It comes from the reader's batch of records,
+ * unless unselected records are skipped, as that moves the input on
+ * under a batch.
+ */
+static gboolean
+read_record(edit_reader_t *reader, const struct wtap_pkthdr **phdr,
+            const guint8 **pd, int *err, gchar **err_info)
+{
+    gint64 data_offset;
+
+    if (reader->skip_unselected) {
+        if (!skip_to_selected(reader->wth, &reader->can_seek, &reader->count,
+                              err, err_info) ||
+            !wtap_read(reader->wth, err, err_info, &data_offset))
+            return FALSE;
+        *phdr = wtap_phdr(reader->wth);
+        *pd = wtap_buf_ptr(reader->wth);
+        return TRUE;
+    }
+
+    if (reader->records->count == 0 || ++reader->rec == reader->records->count) {
+        reader->rec = 0;
+        if (!wtap_read_batch(reader->wth, reader->records, EDIT_BATCH_RECORDS,
+                             err, err_info))
+            return FALSE;
+    }
+    *phdr = &reader->records->phdrs[reader->rec];
+    *pd = reader->records->data[reader->rec];
+    return TRUE;
+}
+
+/*
+ * Read the next batch of records.  Only the selected records are kept;
+ * the others are still passed on, without their data, as they can start
+ * a new output file.
+ */
+static void
+read_batch(edit_reader_t *reader, edit_batch_t *batch)
+{
+    const struct wtap_pkthdr *phdr;
+    const guint8             *pd;
+    edit_rec_t               *rec;
+    gboolean                  ts_okay;
+
+    batch->seq = reader->seq++;
+    batch->nrecs = 0;
+    batch->data_len = 0;
+    batch->eof = FALSE;
+    batch->err = 0;
+
+    if (reader->skip_out_of_time) {
+        reader->skip_out_of_time = FALSE;
+        if (!skip_to_start_time(reader, &batch->err, &batch->err_info)) {
+            batch->eof = TRUE;
+            batch->count = reader->count;
+            reader->eof = TRUE;
+            return;
+        }
+    }
+
+    while (batch->nrecs < EDIT_BATCH_RECORDS && batch->data_len < EDIT_BATCH_BYTES) {
+        /* stop_count is counted from 0, reader->count from 1 */
+        if ((reader->stop_count >= 0 && reader->count - 1 >= reader->stop_count) ||
+            !read_record(reader, &phdr, &pd, &batch->err, &batch->err_info)) {
+            batch->eof = TRUE;
+            batch->count = reader->count;
+            reader->eof = TRUE;
+            return;
+        }
 
-        nstime_delta(&delta, current, &fd_hash[i].time);
+        rec = &batch->recs[batch->nrecs++];
+        rec->phdr = *phdr;
+        if (phdr->pkt_encap == WTAP_ENCAP_K12) {
+            /* That's in the file's state, gone by the time the record is
+               written; no writer uses it. */
+            rec->phdr.pseudo_header.k12.extra_info = NULL;
+            rec->phdr.pseudo_header.k12.extra_length = 0;
+        }
+        rec->count = reader->count++;
 
-        if (delta.secs < 0 || delta.nsecs < 0) {
+        if (check_startstop) {
+            /*
+             * Is the packet in the selected timeframe?
+             * If the packet has no time stamp, the answer is "no".
+             */
+            if (phdr->presence_flags & WTAP_HAS_TS)
+                ts_okay = (phdr->ts.secs >= starttime) && (phdr->ts.secs < stoptime);
+            else
+                ts_okay = FALSE;
+        } else {
             /*
-             * A negative delta implies that the current packet
-             * has an absolute timestamp less than the cached packet
-             * that it is being compared to.  This is NOT a normal
-             * situation since trace files usually have packets in
-             * chronological order (oldest to newest).
-             *
-             * There are several possible ways to deal with this:
-             * 1. 'continue' dup checking with the next cached frame.
-             * 2. 'break' from looking for a duplicate of the current frame.
-             * 3. Take the absolute value of the delta and see if that
-             * falls within the specifed dup time window.
-             *
-             * Currently this code does option 1.  But it would pretty
-             * easy to add yet-another-editcap-option to select one of
-             * the other behaviors for dealing with out-of-sequence
-             * packets.
+             * No selected timeframe, so all packets are "in the
+             * selected timeframe".
              */
+            ts_okay = TRUE;
+        }
+        rec->keep = ts_okay && ((!selected(rec->count) && !keep_em)
+                                || (selected(rec->count) && keep_em));
+        if (!rec->keep)
             continue;
+
+        if (batch->data_len + phdr->caplen > batch->data_size) {
+            batch->data_size = MAX(batch->data_len + phdr->caplen,
+                                   EDIT_BATCH_BYTES + WTAP_MAX_PACKET_SIZE);
+            batch->data = (guint8 *)g_realloc(batch->data, batch->data_size);
         }
+        rec->data_off = batch->data_len;
+        memcpy(batch->data + batch->data_len, pd, phdr->caplen);
+        batch->data_len += phdr->caplen;
+    }
+}
+
+/* Apply the per-record transforms to a batch */
+static void
+transform_batch(edit_batch_t *batch, const edit_xform_t *xform)
+{
+    const struct wtap_pkthdr *phdr;
+    struct wtap_pkthdr        snap_phdr;
+    edit_rec_t               *rec;
+    gsize                     hwgen_need = 0;
+    guint                     i;
+
+    for (i = 0; i < batch->nrecs; i++) {
+        rec = &batch->recs[i];
+        if (!rec->keep)
+            continue;
 
-        cmp = nstime_cmp(&delta, &relative_time_window);
+        /* We simply write it, perhaps after truncating it; we could
+         * do other things, like modify it. */
 
-        if (cmp > 0) {
-            /*
-             * The delta time indicates that we are now looking at
-             * cached packets beyond the specified dup time window.
-             * Check no more!
-             */
-            break;
-        } else if (fd_hash[i].len == fd_hash[cur_dup_entry].len
-                   && memcmp(fd_hash[i].digest, fd_hash[cur_dup_entry].digest, 16) == 0) {
-            return TRUE;
+        phdr = &rec->phdr;
+        rec->buf = batch->data + rec->data_off;
+
+        if (xform->snaplen != 0) {
+            if (phdr->caplen > xform->snaplen) {
+                snap_phdr = *phdr;
+                snap_phdr.caplen = xform->snaplen;
+                phdr = &snap_phdr;
+            }
+            if (xform->adjlen && phdr->len > xform->snaplen) {
+                snap_phdr = *phdr;
+                snap_phdr.len = xform->snaplen;
+                phdr = &snap_phdr;
+            }
         }
+
+        /* CHOP */
+        rec->out_phdr = *phdr;
+        handle_chopping(xform->chop, &rec->out_phdr, phdr, &rec->buf, xform->adjlen);
+        phdr = &rec->out_phdr;
+
+        /* The duplicate checks look at the frame as it is before -E. */
+        if (dup_detect || dup_detect_by_time)
+            frame_dedup_hash(rec->buf, phdr->caplen, rec->digest);
+
+        if (err_prob > 0.0)
+            mutate_frame(rec->buf, phdr->caplen, rec->count, xform->dct2000);
+
+        if (flow_shards > 0)
+            rec->shard = flow_shard(phdr, rec->buf, flow_shards);
+
+        if (xform->hwgen_records)
+            hwgen_need += WTAP_HWGEN_RECORD_MAX(phdr->len);
     }
 
-    return FALSE;
+    if (!xform->hwgen_records)
+        return;
+
+    if (hwgen_need > batch->hwgen_size) {
+        batch->hwgen_size = hwgen_need;
+        batch->hwgen = (guint8 *)g_realloc(batch->hwgen, batch->hwgen_size);
+    }
+    hwgen_need = 0;
+    for (i = 0; i < batch->nrecs; i++) {
+        rec = &batch->recs[i];
+        if (!rec->keep)
+            continue;
+        rec->hwgen_rec = batch->hwgen + hwgen_need;
+        rec->hwgen_len = wtap_hwgen_build_record(xform->hwgen_encap, &rec->out_phdr, rec->buf,
+                                                 rec->hwgen_rec, &rec->hwgen_err);
+        if (rec->hwgen_len > 0)
+            hwgen_need += rec->hwgen_len;
+    }
+}
+
+static gpointer
+edit_read_thread(gpointer data)
+{
+    edit_pipe_t  *pipe = (edit_pipe_t *)data;
+    edit_batch_t *batch;
+
+    do {
+        batch = (edit_batch_t *)g_async_queue_pop(pipe->free_q);
+        read_batch(pipe->reader, batch);
+        g_thread_pool_push(pipe->workers, batch, NULL);
+    } while (!batch->eof);
+    return NULL;
+}
+
+static void
+edit_transform_job(gpointer data, gpointer user_data)
+{
+    edit_batch_t *batch = (edit_batch_t *)data;
+    edit_pipe_t  *pipe = (edit_pipe_t *)user_data;
+
+    transform_batch(batch, pipe->xform);
+    g_async_queue_push(pipe->done_q, batch);
+}
+
+/* Start the pipeline; "threads" is the number of workers, 0 for none. */
+static edit_pipe_t *
+edit_pipe_new(edit_reader_t *reader, edit_xform_t *xform, int threads)
+{
+    edit_pipe_t *pipe = g_new0(edit_pipe_t, 1);
+    guint        i;
+
+    pipe->reader = reader;
+    pipe->xform = xform;
+    if (threads == 0) {
+        pipe->nbatches = 1;
+        pipe->pending = g_new0(edit_batch_t *, 1);
+        pipe->pending[0] = edit_batch_new();
+        return pipe;
+    }
+
+#if !GLIB_CHECK_VERSION(2,31,0)
+    g_thread_init(NULL);
+#endif
+    pipe->nbatches = threads * EDIT_BATCHES_PER_THREAD;
+    pipe->pending = g_new0(edit_batch_t *, pipe->nbatches);
+    pipe->free_q = g_async_queue_new();
+    pipe->done_q = g_async_queue_new();
+    for (i = 0; i < pipe->nbatches; i++)
+        g_async_queue_push(pipe->free_q, edit_batch_new());
+    pipe->workers = g_thread_pool_new(edit_transform_job, pipe, threads, TRUE, NULL);
+#if GLIB_CHECK_VERSION(2,31,0)
+    pipe->reader_thread = g_thread_new("editcap reader", edit_read_thread, pipe);
+#else
+    pipe->reader_thread = g_thread_create(edit_read_thread, pipe, TRUE, NULL);
+#endif
+    return pipe;
+}
+
+/* The next batch, in input order; it is the caller's until the next call. */
+static edit_batch_t *
+edit_pipe_next(edit_pipe_t *pipe)
+{
+    edit_batch_t *batch;
+    guint         slot;
+
+    if (pipe->workers == NULL) {
+        batch = pipe->pending[0];
+        read_batch(pipe->reader, batch);
+        transform_batch(batch, pipe->xform);
+        return batch;
+    }
+
+    /* Hand back the one taken last time. */
+    if (pipe->next_seq > 0) {
+        slot = (guint)((pipe->next_seq - 1) % pipe->nbatches);
+        g_async_queue_push(pipe->free_q, pipe->pending[slot]);
+        pipe->pending[slot] = NULL;
+    }
+
+    slot = (guint)(pipe->next_seq % pipe->nbatches);
+    while (pipe->pending[slot] == NULL) {
+        batch = (edit_batch_t *)g_async_queue_pop(pipe->done_q);
+        pipe->pending[batch->seq % pipe->nbatches] = batch;
+    }
+    pipe->next_seq++;
+    return pipe->pending[slot];
+}
+
+/*
+ * The next record, in input order, or NULL at the end of the input;
+ * pipe->cur is then the last batch, with the outcome of the read.
+ */
+static edit_rec_t *
+edit_pipe_next_rec(edit_pipe_t *pipe)
+{
+    while (pipe->cur == NULL || pipe->cur_rec == pipe->cur->nrecs) {
+        if (pipe->cur != NULL && pipe->cur->eof)
+            return NULL;
+        pipe->cur = edit_pipe_next(pipe);
+        pipe->cur_rec = 0;
+    }
+    return &pipe->cur->recs[pipe->cur_rec++];
+}
+
+/* Write a record that has been through transform_batch(). */
+static gboolean
+edit_write_rec(wtap_dumper *pdh, const struct wtap_pkthdr *phdr,
+               const edit_rec_t *rec, const edit_xform_t *xform, int *err)
+{
+    if (!xform->hwgen_records)
+        return wtap_dump(pdh, phdr, rec->buf, err);
+
+    /* The frame is already in the record, FCS and all. */
+    if (rec->hwgen_len < 0) {
+        *err = rec->hwgen_err;
+        return FALSE;
+    }
+    return wtap_dump_hwgen_record(pdh, phdr, rec->hwgen_rec, rec->hwgen_len, err);
+}
+
+static void
+edit_pipe_free(edit_pipe_t *pipe)
+{
+    edit_batch_t *batch;
+    guint         i;
+
+    if (pipe->workers != NULL) {
+        /* The reader has stopped at the last batch. */
+        g_thread_join(pipe->reader_thread);
+        g_thread_pool_free(pipe->workers, FALSE, TRUE);
+        while ((batch = (edit_batch_t *)g_async_queue_try_pop(pipe->free_q)) != NULL)
+            edit_batch_free(batch);
+        g_async_queue_unref(pipe->free_q);
+        g_async_queue_unref(pipe->done_q);
+    }
+    for (i = 0; i < pipe->nbatches; i++) {
+        if (pipe->pending[i] != NULL)
+            edit_batch_free(pipe->pending[i]);
+    }
+    g_free(pipe->pending);
+    g_free(pipe);
 }
 
 static void
@@ -692,7 +1706,7 @@ usage(gboolean is_error)
     fprintf(output, "  -D <dup window>        remove packet if duplicate; configurable <dup window>\n");
     fprintf(output, "                         Valid <dup window> values are 0 to %d.\n", MAX_DUP_DEPTH);
     fprintf(output, "                         NOTE: A <dup window> of 0 with -v (verbose option) is\n");
-    fprintf(output, "                         useful to print MD5 hashes.\n");
+    fprintf(output, "                         useful to print packet hashes.\n");
     fprintf(output, "  -w <dup time window>   remove packet if duplicate packet is found EQUAL TO OR\n");
     fprintf(output, "                         LESS THAN <dup time window> prior to current packet.\n");
     fprintf(output, "                         A <dup time window> is specified in relative seconds\n");
@@ -740,13 +1754,45 @@ usage(gboolean is_error)
     fprintf(output, "  -T <encap type>        set the output file encapsulation type; default is the\n");
     fprintf(output, "                         same as the input file. An empty \"-T\" option will\n");
     fprintf(output, "                         list the encapsulation types.\n");
+    fprintf(output, "  -P <ports>             split the packet output to <ports> files, one per\n");
+    fprintf(output, "                         generator port, by a hash of each packet's flow, so\n");
+    fprintf(output, "                         that both directions of a flow go to the same file.\n");
+    fprintf(output, "  -M <jobs>              convert several files at once: the arguments are\n");
+    fprintf(output, "                         <infile> <outfile> pairs, converted concurrently by\n");
+    fprintf(output, "                         up to <jobs> threads. Only -F, -T, -s, -G, -m, -O,\n");
+    fprintf(output, "                         -q, -R and -z apply.\n");
+    fprintf(output, "  -G <Gb/s>[:<word>[:<min gap>[:<max gap>]]]\n");
+    fprintf(output, "                         line model used to compute the inter-frame gaps of\n");
+    fprintf(output, "                         hw_gen output: the generator's line rate in Gb/s, the\n");
+    fprintf(output, "                         width in bytes of its words and the smallest and\n");
+    fprintf(output, "                         largest gap in words; default is 10:4:3:100000.\n");
+    fprintf(output, "  -R <rate>              replay the trace at another rate in hw_gen output:\n");
+    fprintf(output, "                         <factor>x speeds it up by <factor>, <Gb/s>G and\n");
+    fprintf(output, "                         <packets/s>p scale it to that average rate. Reports\n");
+    fprintf(output, "                         the average and peak rate of each output file.\n");
+    fprintf(output, "  -m <dst MAC>[,<src MAC>]\n");
+    fprintf(output, "                         addresses of the Ethernet header given to frames of\n");
+    fprintf(output, "                         other link types (Linux cooked, PPP, null/loopback,\n");
+    fprintf(output, "                         raw IP, ERF) in hw_gen output.\n");
+    fprintf(output, "  -q <VLAN ID>[:<priority>][,<VLAN ID>[:<priority>]]\n");
+    fprintf(output, "                         push one VLAN tag, or an 802.1ad and an 802.1Q tag,\n");
+    fprintf(output, "                         onto every frame in hw_gen output.\n");
+    fprintf(output, "  -O                     write hw_gen output with direct I/O (O_DIRECT),\n");
+    fprintf(output, "                         bypassing the page cache.\n");
+    fprintf(output, "  -z <compression>       compress the output file(s) with gzip, bgzf (gzip in\n");
+    fprintf(output, "                         blocks that can be read in parallel), zstd or lz4;\n");
+    fprintf(output, "                         not when writing to the standard output.\n");
     fprintf(output, "\n");
     fprintf(output, "Miscellaneous:\n");
+    fprintf(output, "  -j <threads>           read, edit and write in a pipeline: a thread reads,\n");
+    fprintf(output, "                         <threads> threads apply -s, -C and -E and build\n");
+    fprintf(output, "                         hw_gen records, and another writes; the output is\n");
+    fprintf(output, "                         the same as without -j.\n");
     fprintf(output, "  -h                     display this help and exit.\n");
     fprintf(output, "  -v                     verbose output.\n");
     fprintf(output, "                         If -v is used with any of the 'Duplicate Packet\n");
     fprintf(output, "                         Removal' options (-d, -D or -w) then Packet lengths\n");
-    fprintf(output, "                         and MD5 hashes are printed to standard-error.\n");
+    fprintf(output, "                         and hashes are printed to standard-error.\n");
     fprintf(output, "\n");
 }
 
@@ -833,7 +1879,7 @@ int
 main(int argc, char *argv[])
 {
     wtap         *wth;
-    int           i, j, err;
+    int           i, err;
     gchar        *err_info;
     int           opt;
 
@@ -844,24 +1890,28 @@ main(int argc, char *argv[])
     wtap_dumper  *pdh                = NULL;
     unsigned int  count              = 1;
     unsigned int  duplicate_count    = 0;
-    gint64        data_offset;
-    int           err_type;
-    guint8       *buf;
     guint32       read_count         = 0;
     int           split_packet_count = 0;
     int           written_count      = 0;
     char         *filename           = NULL;
-    gboolean      ts_okay;
     int           secs_per_block     = 0;
     int           block_cnt          = 0;
     nstime_t      block_start;
     gchar        *fprefix            = NULL;
     gchar        *fsuffix            = NULL;
+    int           convert_jobs       = 0;
+    int           edit_threads       = 0;
+    wtap_dumper **shard_pdh          = NULL;
+    gchar       **shard_filename     = NULL;
 
     const struct wtap_pkthdr    *phdr;
     struct wtap_pkthdr           snap_phdr;
     wtapng_iface_descriptions_t *idb_inf;
     wtapng_section_t            *shb_hdr;
+    edit_reader_t                reader;
+    edit_xform_t                 xform;
+    edit_pipe_t                 *pipe;
+    edit_rec_t                  *rec;
 
 #ifdef HAVE_PLUGINS
     char* init_progfile_dir_error;
@@ -899,7 +1949,9 @@ main(int argc, char *argv[])
 #endif
 
     /* Process the options */
-    while ((opt = getopt(argc, argv, "A:B:c:C:dD:E:F:hi:Lrs:S:t:T:vw:")) != -1) {
+    wtap_hwgen_params_init(&hwgen_params);
+    wtap_hwgen_encap_init(&hwgen_encap);
+    while ((opt = getopt(argc, argv, "A:B:c:C:dD:E:F:G:hi:j:LM:m:OP:q:rR:s:S:t:T:vw:z:")) != -1) {
         switch (opt) {
         case 'A':
         {
@@ -1016,7 +2068,7 @@ main(int argc, char *argv[])
                         optarg);
                 exit(1);
             }
-            srand( (unsigned int) (time(NULL) + getpid()) );
+            err_seed = (guint64)(time(NULL) + getpid());
             break;
 
         case 'F':
@@ -1029,6 +2081,14 @@ main(int argc, char *argv[])
             }
             break;
 
+        case 'G':
+            set_hwgen_line(optarg);
+            break;
+
+        case 'R':
+            set_rate_target(optarg);
+            break;
+
         case 'h':
             usage(FALSE);
             exit(0);
@@ -1043,10 +2103,49 @@ main(int argc, char *argv[])
             }
             break;
 
+        case 'j':
+            edit_threads = (int)strtol(optarg, &p, 10);
+            if (p == optarg || *p != '\0' || edit_threads <= 0 || edit_threads > MAX_EDIT_THREADS) {
+                fprintf(stderr, "editcap: \"%s\" isn't a valid number of threads; it must be 1 to %d\n",
+                        optarg, MAX_EDIT_THREADS);
+                exit(1);
+            }
+            break;
+
         case 'L':
             adjlen = TRUE;
             break;
 
+        case 'M':
+            convert_jobs = (int)strtol(optarg, &p, 10);
+            if (p == optarg || *p != '\0' || convert_jobs <= 0) {
+                fprintf(stderr, "editcap: \"%s\" isn't a valid number of jobs\n",
+                        optarg);
+                exit(1);
+            }
+            break;
+
+        case 'm':
+            set_hwgen_macs(optarg);
+            break;
+
+        case 'O':
+            direct_io = TRUE;
+            break;
+
+        case 'P':
+            flow_shards = (int)strtol(optarg, &p, 10);
+            if (p == optarg || *p != '\0' || flow_shards <= 0 || flow_shards > MAX_FLOW_SHARDS) {
+                fprintf(stderr, "editcap: \"%s\" isn't a valid number of ports; it must be 1 to %d\n",
+                        optarg, MAX_FLOW_SHARDS);
+                exit(1);
+            }
+            break;
+
+        case 'q':
+            set_hwgen_vlans(optarg);
+            break;
+
         case 'r':
             keep_em = !keep_em;  /* Just invert */
             break;
@@ -1090,6 +2189,10 @@ main(int argc, char *argv[])
             set_rel_time(optarg);
             break;
 
+        case 'z':
+            set_compression_type(optarg);
+            break;
+
         case '?':              /* Bad options if GNU getopt */
             switch(optopt) {
             case'F':
@@ -1141,6 +2244,142 @@ main(int argc, char *argv[])
         exit(1);
     }
 
+    if (edit_threads > 0 && convert_jobs > 0) {
+        fprintf(stderr, "editcap: -j can't be used with -M\n");
+        exit(1);
+    }
+
+    if (flow_shards > 0 && convert_jobs > 0) {
+        fprintf(stderr, "editcap: -P can't be used with -M\n");
+        exit(1);
+    }
+
+    if (flow_shards > 0 && (split_packet_count > 0 || secs_per_block > 0)) {
+        fprintf(stderr, "editcap: can't split by flow and by packet count or time interval\n");
+        fprintf(stderr, "editcap: at the same time\n");
+        exit(1);
+    }
+
+    if (flow_shards > 0 && (argc - optind) >= 2 && strcmp(argv[optind+1], "-") == 0) {
+        fprintf(stderr, "editcap: -P needs an output file name to number the files after\n");
+        exit(1);
+    }
+
+    if (hwgen_encap_set
+        && out_file_type_subtype != WTAP_FILE_TYPE_SUBTYPE_HWGEN_V1
+        && out_file_type_subtype != WTAP_FILE_TYPE_SUBTYPE_HWGEN_V2) {
+        fprintf(stderr, "editcap: -m and -q only apply to hw_gen and hw_gen_v2 output\n");
+        exit(1);
+    }
+
+    if (out_compression_type != WTAP_UNCOMPRESSED) {
+        if (!wtap_dump_can_compress(out_file_type_subtype)) {
+            fprintf(stderr, "editcap: %s files can't be written compressed\n",
+                    wtap_file_type_subtype_short_string(out_file_type_subtype));
+            exit(1);
+        }
+        if (direct_io) {
+            fprintf(stderr, "editcap: -O can't be used with -z\n");
+            exit(1);
+        }
+        if (convert_jobs == 0 && (argc - optind) >= 2 && strcmp(argv[optind+1], "-") == 0) {
+            fprintf(stderr, "editcap: -z can't be used when writing to the standard output\n");
+            exit(1);
+        }
+    }
+
+    if (direct_io) {
+        if (out_file_type_subtype != WTAP_FILE_TYPE_SUBTYPE_HWGEN_V1
+            && out_file_type_subtype != WTAP_FILE_TYPE_SUBTYPE_HWGEN_V2) {
+            fprintf(stderr, "editcap: -O only applies to hw_gen and hw_gen_v2 output\n");
+            exit(1);
+        }
+        if (convert_jobs == 0 && (argc - optind) >= 2 && strcmp(argv[optind+1], "-") == 0) {
+            fprintf(stderr, "editcap: -O can't be used when writing to the standard output\n");
+            exit(1);
+        }
+    }
+
+    if (rate_target_unit != 0) {
+        double speedup = rate_target;
+
+        if (out_file_type_subtype != WTAP_FILE_TYPE_SUBTYPE_HWGEN_V1
+            && out_file_type_subtype != WTAP_FILE_TYPE_SUBTYPE_HWGEN_V2) {
+            fprintf(stderr, "editcap: -R only applies to hw_gen and hw_gen_v2 output\n");
+            exit(1);
+        }
+        if (rate_target_unit != 'x') {
+            double bps, pps;
+
+            /* A target rate needs the rate of the trace. */
+            if (convert_jobs > 0) {
+                fprintf(stderr, "editcap: only a <factor>x rate can be used with -M\n");
+                exit(1);
+            }
+            if (strcmp(argv[optind], "-") == 0) {
+                fprintf(stderr, "editcap: only a <factor>x rate can be used when reading the standard input\n");
+                exit(1);
+            }
+            if (!measure_rate(argv[optind], &bps, &pps))
+                exit(2);
+            speedup = (rate_target_unit == 'G') ? rate_target * 1e9 / bps
+                                                : rate_target / pps;
+            if (verbose)
+                fprintf(stderr, "%s averages %.3f Gb/s (%.0f packets/s); replaying it %.4fx faster\n",
+                        argv[optind], bps / 1e9, pps, speedup);
+        }
+
+        hwgen_params.speedup = (guint64)(speedup * 1e6 + 0.5);
+        if (!wtap_hwgen_params_valid(&hwgen_params)) {
+            fprintf(stderr, "editcap: a %gx speed-up is out of range\n", speedup);
+            exit(1);
+        }
+    }
+
+    if (convert_jobs > 0) {
+        GThreadPool   *pool;
+        convert_job_t *jobs;
+        int            njobs;
+        int            failed = 0;
+
+        if ((argc - optind) < 2 || (argc - optind) % 2 != 0) {
+            fprintf(stderr, "editcap: -M needs <infile> <outfile> pairs\n");
+            exit(1);
+        }
+        if (dup_detect || dup_detect_by_time || split_packet_count > 0
+            || secs_per_block > 0 || check_startstop || keep_em || adjlen
+            || do_strict_time_adjustment || err_prob > 0.0
+            || time_adj.tv.tv_sec != 0 || time_adj.tv.tv_usec != 0
+            || chop.len_begin != 0 || chop.len_end != 0) {
+            fprintf(stderr, "editcap: only -F, -T, -s, -G, -m, -O, -q, -R and -v can be used with -M\n");
+            exit(1);
+        }
+
+#if !GLIB_CHECK_VERSION(2,31,0)
+        g_thread_init(NULL);
+#endif
+
+        njobs = (argc - optind) / 2;
+        jobs = g_new0(convert_job_t, njobs);
+        pool = g_thread_pool_new(convert_file, NULL, MIN(convert_jobs, njobs),
+                                 TRUE, NULL);
+        for (i = 0; i < njobs; i++) {
+            jobs[i].in_filename  = argv[optind + 2 * i];
+            jobs[i].out_filename = argv[optind + 2 * i + 1];
+            jobs[i].snaplen      = snaplen;
+            g_thread_pool_push(pool, &jobs[i], NULL);
+        }
+        /* Wait for every queued conversion to finish. */
+        g_thread_pool_free(pool, FALSE, TRUE);
+
+        for (i = 0; i < njobs; i++) {
+            if (jobs[i].failed)
+                failed++;
+        }
+        g_free(jobs);
+        return failed ? 2 : 0;
+    }
+
     wth = wtap_open_offline(argv[optind], WTAP_TYPE_AUTO, &err, &err_info, FALSE);
 
     if (!wth) {
@@ -1157,6 +2396,10 @@ main(int argc, char *argv[])
         exit(2);
     }
 
+    /* hw-gen files that don't say what line they were written for are
+       read as if for ours. */
+    (void)wtap_set_hwgen_read_params(wth, &hwgen_params);
+
     if (verbose) {
         fprintf(stderr, "File %s is a %s capture file.\n", argv[optind],
                 wtap_file_type_subtype_string(wtap_file_type_subtype(wth)));
@@ -1178,20 +2421,71 @@ main(int argc, char *argv[])
             if (add_selection(argv[i]) == FALSE)
                 break;
 
-        if (dup_detect || dup_detect_by_time) {
-            for (i = 0; i < dup_window; i++) {
-                memset(&fd_hash[i].digest, 0, 16);
-                fd_hash[i].len = 0;
-                nstime_set_unset(&fd_hash[i].time);
-            }
+        if (dup_detect)
+            fd_dedup = frame_dedup_new(dup_window);
+        else if (dup_detect_by_time)
+            fd_dedup = frame_dedup_new_rel_time(&relative_time_window, dup_window);
+
+        /*
+         * With -r, records that aren't selected can't affect the output,
+         * unless they mark the start of a time-based block or name the
+         * first split or per-port files.
+         */
+        reader.wth = wth;
+        reader.skip_unselected = keep_em && secs_per_block == 0 && split_packet_count == 0 &&
+                                 flow_shards == 0;
+        reader.can_seek = TRUE;
+        /* Likewise for records outside -A and -B. */
+        reader.skip_out_of_time = check_startstop && secs_per_block == 0 &&
+                                  split_packet_count == 0 && flow_shards == 0;
+        reader.stop_count = -1;
+        reader.count = count;
+        reader.seq = 0;
+        reader.eof = FALSE;
+        reader.records = wtap_batch_new(EDIT_BATCH_RECORDS, EDIT_BATCH_BYTES);
+        reader.rec = 0;
+
+        xform.snaplen = snaplen;
+        xform.adjlen = adjlen;
+        xform.chop = chop;
+        xform.dct2000 = wtap_file_type_subtype(wth) == WTAP_FILE_TYPE_SUBTYPE_CATAPULT_DCT2000;
+        xform.hwgen_records = out_file_type_subtype == WTAP_FILE_TYPE_SUBTYPE_HWGEN_V1
+                              || out_file_type_subtype == WTAP_FILE_TYPE_SUBTYPE_HWGEN_V2;
+        xform.hwgen_encap = &hwgen_encap;
+
+        /*
+         * The pseudo-headers of K12 and DCT2000 packets point into the
+         * state of the file they were read from, which a reader thread
+         * would change under the writer (the DCT2000 writer looks the
+         * line prefix up in the file's table), so those are read on
+         * this thread.
+         */
+        if (edit_threads > 0 &&
+            (wtap_file_encap(wth) == WTAP_ENCAP_K12 ||
+             wtap_file_encap(wth) == WTAP_ENCAP_CATAPULT_DCT2000)) {
+            if (verbose)
+                fprintf(stderr, "editcap: -j is ignored for %s input\n",
+                        wtap_encap_string(wtap_file_encap(wth)));
+            edit_threads = 0;
         }
 
-        while (wtap_read(wth, &err, &err_info, &data_offset)) {
+        pipe = edit_pipe_new(&reader, &xform, edit_threads);
+
+        while ((rec = edit_pipe_next_rec(pipe)) != NULL) {
             read_count++;
 
-            phdr = wtap_phdr(wth);
+            phdr = &rec->phdr;
+
+            if (read_count == 1 && flow_shards > 0) {  /* the first packet */
+                /* If we don't have an application name add Editcap */
+                if (shb_hdr->shb_user_appl == NULL) {
+                    shb_hdr->shb_user_appl = "Editcap " VERSION;
+                }
 
-            if (read_count == 1) {  /* the first packet */
+                shard_pdh = open_shard_files(argv[optind+1], phdr,
+                                             snaplen ? MIN(snaplen, wtap_snapshot_length(wth)) : wtap_snapshot_length(wth),
+                                             shb_hdr, idb_inf, &shard_filename);
+            } else if (read_count == 1) {  /* the first packet */
                 if (split_packet_count > 0 || secs_per_block > 0) {
                     if (!fileset_extract_prefix_suffix(argv[optind+1], &fprefix, &fsuffix))
                         exit(2);
@@ -1207,19 +2501,19 @@ main(int argc, char *argv[])
                     shb_hdr->shb_user_appl = "Editcap " VERSION;
                 }
 
-                pdh = wtap_dump_open_ng(filename, out_file_type_subtype, out_frame_type,
-                                        snaplen ? MIN(snaplen, wtap_snapshot_length(wth)) : wtap_snapshot_length(wth),
-                                        FALSE /* compressed */, shb_hdr, idb_inf, &err);
+                pdh = open_output(filename, out_frame_type,
+                                  snaplen ? MIN(snaplen, wtap_snapshot_length(wth)) : wtap_snapshot_length(wth),
+                                  shb_hdr, idb_inf, &err);
 
                 if (pdh == NULL) {
                     fprintf(stderr, "editcap: Can't open or create %s: %s\n",
                             filename, wtap_strerror(err));
                     exit(2);
                 }
+                if (!set_direct_io(pdh, filename))
+                    exit(2);
             }
 
-            buf = wtap_buf_ptr(wth);
-
             /*
              * Not all packets have time stamps. Only process the time
              * stamp if we have one.
@@ -1235,6 +2529,7 @@ main(int argc, char *argv[])
                            || (phdr->ts.secs - block_start.secs == secs_per_block
                                && phdr->ts.nsecs >= block_start.nsecs )) { /* time for the next file */
 
+                        report_hwgen_rate(pdh, filename);
                         if (!wtap_dump_close(pdh, &err)) {
                             fprintf(stderr, "editcap: Error writing to %s: %s\n",
                                     filename, wtap_strerror(err));
@@ -1248,15 +2543,17 @@ main(int argc, char *argv[])
                         if (verbose)
                             fprintf(stderr, "Continuing writing in file %s\n", filename);
 
-                        pdh = wtap_dump_open_ng(filename, out_file_type_subtype, out_frame_type,
-                                                snaplen ? MIN(snaplen, wtap_snapshot_length(wth)) : wtap_snapshot_length(wth),
-                                                FALSE /* compressed */, shb_hdr, idb_inf, &err);
+                        pdh = open_output(filename, out_frame_type,
+                                          snaplen ? MIN(snaplen, wtap_snapshot_length(wth)) : wtap_snapshot_length(wth),
+                                          shb_hdr, idb_inf, &err);
 
                         if (pdh == NULL) {
                             fprintf(stderr, "editcap: Can't open or create %s: %s\n",
                                     filename, wtap_strerror(err));
                             exit(2);
                         }
+                        if (!set_direct_io(pdh, filename))
+                            exit(2);
                     }
                 }
             }
@@ -1264,6 +2561,7 @@ main(int argc, char *argv[])
             if (split_packet_count > 0) {
                 /* time for the next file? */
                 if (written_count > 0 && written_count % split_packet_count == 0) {
+                    report_hwgen_rate(pdh, filename);
                     if (!wtap_dump_close(pdh, &err)) {
                         fprintf(stderr, "editcap: Error writing to %s: %s\n",
                                 filename, wtap_strerror(err));
@@ -1277,62 +2575,27 @@ main(int argc, char *argv[])
                     if (verbose)
                         fprintf(stderr, "Continuing writing in file %s\n", filename);
 
-                    pdh = wtap_dump_open_ng(filename, out_file_type_subtype, out_frame_type,
-                                            snaplen ? MIN(snaplen, wtap_snapshot_length(wth)) : wtap_snapshot_length(wth),
-                                            FALSE /* compressed */, shb_hdr, idb_inf, &err);
+                    pdh = open_output(filename, out_frame_type,
+                                      snaplen ? MIN(snaplen, wtap_snapshot_length(wth)) : wtap_snapshot_length(wth),
+                                      shb_hdr, idb_inf, &err);
                     if (pdh == NULL) {
                         fprintf(stderr, "editcap: Can't open or create %s: %s\n",
                                 filename, wtap_strerror(err));
                         exit(2);
                     }
+                    if (!set_direct_io(pdh, filename))
+                        exit(2);
                 }
             }
 
-            if (check_startstop) {
-                /*
-                 * Is the packet in the selected timeframe?
-                 * If the packet has no time stamp, the answer is "no".
-                 */
-                if (phdr->presence_flags & WTAP_HAS_TS)
-                    ts_okay = (phdr->ts.secs >= starttime) && (phdr->ts.secs < stoptime);
-                else
-                    ts_okay = FALSE;
-	    } else {
-	        /*
-	         * No selected timeframe, so all packets are "in the
-	         * selected timeframe".
-	         */
-	        ts_okay = TRUE;
-	    }
-
-            if (ts_okay && ((!selected(count) && !keep_em)
-                            || (selected(count) && keep_em))) {
+            /* In the time frame and selected; see read_batch(). */
+            if (rec->keep) {
 
                 if (verbose && !dup_detect && !dup_detect_by_time)
-                    fprintf(stderr, "Packet: %u\n", count);
+                    fprintf(stderr, "Packet: %u\n", rec->count);
 
-                /* We simply write it, perhaps after truncating it; we could
-                 * do other things, like modify it. */
-
-                phdr = wtap_phdr(wth);
-
-                if (snaplen != 0) {
-                    if (phdr->caplen > snaplen) {
-                        snap_phdr = *phdr;
-                        snap_phdr.caplen = snaplen;
-                        phdr = &snap_phdr;
-                    }
-                    if (adjlen && phdr->len > snaplen) {
-                        snap_phdr = *phdr;
-                        snap_phdr.len = snaplen;
-                        phdr = &snap_phdr;
-                    }
-                }
-
-                /* CHOP */
-                snap_phdr = *phdr;
-                handle_chopping(chop, &snap_phdr, phdr, &buf, adjlen);
-                phdr = &snap_phdr;
+                /* -s, -C and -E have been applied by transform_batch(). */
+                phdr = &rec->out_phdr;
 
                 if (phdr->presence_flags & WTAP_HAS_TS) {
                     /* Do we adjust timestamps to ensure strict chronological
@@ -1428,114 +2691,38 @@ main(int argc, char *argv[])
 
                 /* suppress duplicates by packet window */
                 if (dup_detect) {
-                    if (is_duplicate(buf, phdr->caplen)) {
-                        if (verbose) {
-                            fprintf(stderr, "Skipped: %u, Len: %u, MD5 Hash: ",
-                                    count, phdr->caplen);
-                            for (i = 0; i < 16; i++)
-                                fprintf(stderr, "%02x",
-                                        (unsigned char)fd_hash[cur_dup_entry].digest[i]);
-                            fprintf(stderr, "\n");
-                        }
+                    if (frame_dedup_check_digest(fd_dedup, rec->digest, phdr->caplen, NULL)) {
+                        if (verbose)
+                            print_dup_hash("Skipped", rec->count, phdr->caplen);
                         duplicate_count++;
-                        count++;
                         continue;
                     } else {
-                        if (verbose) {
-                            fprintf(stderr, "Packet: %u, Len: %u, MD5 Hash: ",
-                                    count, phdr->caplen);
-                            for (i = 0; i < 16; i++)
-                                fprintf(stderr, "%02x",
-                                        (unsigned char)fd_hash[cur_dup_entry].digest[i]);
-                            fprintf(stderr, "\n");
-                        }
+                        if (verbose)
+                            print_dup_hash("Packet", rec->count, phdr->caplen);
                     }
                 }
 
                 if (phdr->presence_flags & WTAP_HAS_TS) {
                     /* suppress duplicates by time window */
                     if (dup_detect_by_time) {
-                        nstime_t current;
-
-                        current.secs  = phdr->ts.secs;
-                        current.nsecs = phdr->ts.nsecs;
-
-                        if (is_duplicate_rel_time(buf, phdr->caplen, &current)) {
-                            if (verbose) {
-                                fprintf(stderr, "Skipped: %u, Len: %u, MD5 Hash: ",
-                                        count, phdr->caplen);
-                                for (i = 0; i < 16; i++)
-                                    fprintf(stderr, "%02x",
-                                            (unsigned char)fd_hash[cur_dup_entry].digest[i]);
-                                fprintf(stderr, "\n");
-                            }
+                        if (frame_dedup_check_digest(fd_dedup, rec->digest, phdr->caplen, &phdr->ts)) {
+                            if (verbose)
+                                print_dup_hash("Skipped", rec->count, phdr->caplen);
                             duplicate_count++;
-                            count++;
                             continue;
                         } else {
-                            if (verbose) {
-                                fprintf(stderr, "Packet: %u, Len: %u, MD5 Hash: ",
-                                        count, phdr->caplen);
-                                for (i = 0; i < 16; i++)
-                                    fprintf(stderr, "%02x",
-                                            (unsigned char)fd_hash[cur_dup_entry].digest[i]);
-                                fprintf(stderr, "\n");
-                            }
+                            if (verbose)
+                                print_dup_hash("Packet", rec->count, phdr->caplen);
                         }
                     }
                 }
 
-                /* Random error mutation */
-                if (err_prob > 0.0) {
-                    int real_data_start = 0;
-
-                    /* Protect non-protocol data */
-                    if (wtap_file_type_subtype(wth) == WTAP_FILE_TYPE_SUBTYPE_CATAPULT_DCT2000)
-                        real_data_start = find_dct2000_real_data(buf);
-
-                    for (i = real_data_start; i < (int) phdr->caplen; i++) {
-                        if (rand() <= err_prob * RAND_MAX) {
-                            err_type = rand() / (RAND_MAX / ERR_WT_TOTAL + 1);
-
-                            if (err_type < ERR_WT_BIT) {
-                                buf[i] ^= 1 << (rand() / (RAND_MAX / 8 + 1));
-                                err_type = ERR_WT_TOTAL;
-                            } else {
-                                err_type -= ERR_WT_BYTE;
-                            }
-
-                            if (err_type < ERR_WT_BYTE) {
-                                buf[i] = rand() / (RAND_MAX / 255 + 1);
-                                err_type = ERR_WT_TOTAL;
-                            } else {
-                                err_type -= ERR_WT_BYTE;
-                            }
-
-                            if (err_type < ERR_WT_ALNUM) {
-                                buf[i] = ALNUM_CHARS[rand() / (RAND_MAX / ALNUM_LEN + 1)];
-                                err_type = ERR_WT_TOTAL;
-                            } else {
-                                err_type -= ERR_WT_ALNUM;
-                            }
-
-                            if (err_type < ERR_WT_FMT) {
-                                if ((unsigned int)i < phdr->caplen - 2)
-                                    g_strlcpy((char*) &buf[i], "%s", 2);
-                                err_type = ERR_WT_TOTAL;
-                            } else {
-                                err_type -= ERR_WT_FMT;
-                            }
-
-                            if (err_type < ERR_WT_AA) {
-                                for (j = i; j < (int) phdr->caplen; j++)
-                                    buf[j] = 0xAA;
-                                i = phdr->caplen;
-                            }
-                        }
-                    }
+                if (flow_shards > 0) {
+                    pdh = shard_pdh[rec->shard];
+                    filename = shard_filename[rec->shard];
                 }
 
-                if (!wtap_dump(pdh, phdr, buf, &err)) {
+                if (!edit_write_rec(pdh, phdr, rec, &xform, &err)) {
                     switch (err) {
                     case WTAP_ERR_UNSUPPORTED_ENCAP:
                         /*
@@ -1572,9 +2759,14 @@ main(int argc, char *argv[])
                 }
                 written_count++;
             }
-            count++;
         }
 
+        count = pipe->cur->count;
+        err = pipe->cur->err;
+        err_info = pipe->cur->err_info;
+        edit_pipe_free(pipe);
+        wtap_batch_free(reader.records);
+
         g_free(fprefix);
         g_free(fsuffix);
 
@@ -1594,29 +2786,59 @@ main(int argc, char *argv[])
             }
         }
 
-        if (!pdh) {
+        if (flow_shards > 0) {
+            if (shard_pdh == NULL) {
+                /* No packets; still give every port an empty file. */
+                struct wtap_pkthdr no_phdr;
+
+                memset(&no_phdr, 0, sizeof no_phdr);
+                shard_pdh = open_shard_files(argv[optind+1], &no_phdr,
+                                             snaplen ? MIN(snaplen, wtap_snapshot_length(wth)) : wtap_snapshot_length(wth),
+                                             shb_hdr, idb_inf, &shard_filename);
+            }
+            /* The names belong to shard_filename. */
+            pdh = NULL;
+            filename = NULL;
+        } else if (!pdh) {
             /* No valid packages found, open the outfile so we can write an
              * empty header */
             g_free (filename);
             filename = g_strdup(argv[optind+1]);
 
-            pdh = wtap_dump_open_ng(filename, out_file_type_subtype, out_frame_type,
-                                    snaplen ? MIN(snaplen, wtap_snapshot_length(wth)): wtap_snapshot_length(wth),
-                                    FALSE /* compressed */, shb_hdr, idb_inf, &err);
+            pdh = open_output(filename, out_frame_type,
+                              snaplen ? MIN(snaplen, wtap_snapshot_length(wth)): wtap_snapshot_length(wth),
+                              shb_hdr, idb_inf, &err);
             if (pdh == NULL) {
                 fprintf(stderr, "editcap: Can't open or create %s: %s\n",
                         filename, wtap_strerror(err));
                 exit(2);
             }
+            if (!set_direct_io(pdh, filename))
+                exit(2);
         }
 
         g_free(idb_inf);
         idb_inf = NULL;
 
-        if (!wtap_dump_close(pdh, &err)) {
-            fprintf(stderr, "editcap: Error writing to %s: %s\n", filename,
-                    wtap_strerror(err));
-            exit(2);
+        if (flow_shards > 0) {
+            for (i = 0; i < flow_shards; i++) {
+                report_hwgen_rate(shard_pdh[i], shard_filename[i]);
+                if (!wtap_dump_close(shard_pdh[i], &err)) {
+                    fprintf(stderr, "editcap: Error writing to %s: %s\n", shard_filename[i],
+                            wtap_strerror(err));
+                    exit(2);
+                }
+                g_free(shard_filename[i]);
+            }
+            g_free(shard_pdh);
+            g_free(shard_filename);
+        } else {
+            report_hwgen_rate(pdh, filename);
+            if (!wtap_dump_close(pdh, &err)) {
+                fprintf(stderr, "editcap: Error writing to %s: %s\n", filename,
+                        wtap_strerror(err));
+                exit(2);
+            }
         }
         g_free(shb_hdr);
         g_free(filename);
@@ -1633,6 +2855,8 @@ main(int argc, char *argv[])
                 (long)relative_time_window.secs,
                 (long int)relative_time_window.nsecs);
     }
+    if (fd_dedup != NULL)
+        frame_dedup_free(fd_dedup);
 
     return 0;
 }
@@ -1722,9 +2946,11 @@ handle_chopping(chop_t chop, struct wtap_pkthdr *out_phdr,
         *out_phdr = *in_phdr;
 
         if (chop.off_begin_pos > 0) {
+            /* Only what follows the chopped bytes; the frame may not
+             * be the last thing in the buffer. */
             memmove(*buf + chop.off_begin_pos,
                     *buf + chop.off_begin_pos + chop.len_begin,
-                    out_phdr->caplen - chop.len_begin);
+                    out_phdr->caplen - chop.off_begin_pos - chop.len_begin);
         } else {
             *buf += chop.len_begin;
         }
@@ -30,6 +30,7 @@
 #include <glib.h>
 #include <epan/tvbuff.h>
 #include <wsutil/crc32.h>
+#include <wsutil/crc32-ieee.h>
 #include <epan/crc32-tvb.h>
 
 
@@ -41,7 +42,7 @@ crc32_ccitt_tvb(tvbuff_t *tvb, guint len)
 	tvb_ensure_bytes_exist(tvb, 0, len);  /* len == -1 not allowed */
 	buf = tvb_get_ptr(tvb, 0, len);
 
-	return ( crc32_ccitt_seed(buf, len, CRC32_CCITT_SEED) );
+	return ( ~crc32_ieee_update(CRC32_CCITT_SEED, buf, len) );
 }
 
 guint32
@@ -52,7 +53,7 @@ crc32_ccitt_tvb_offset(tvbuff_t *tvb, guint offset, guint len)
 	tvb_ensure_bytes_exist(tvb, offset, len);  /* len == -1 not allowed */
 	buf = tvb_get_ptr(tvb, offset, len);
 
-	return ( crc32_ccitt(buf, len) );
+	return ( ~crc32_ieee_update(CRC32_CCITT_SEED, buf, len) );
 }
 
 guint32
@@ -63,7 +64,7 @@ crc32_ccitt_tvb_seed(tvbuff_t *tvb, guint len, guint32 seed)
 	tvb_ensure_bytes_exist(tvb, 0, len);  /* len == -1 not allowed */
 	buf = tvb_get_ptr(tvb, 0, len);
 
-	return ( crc32_ccitt_seed(buf, len, seed) );
+	return ( ~crc32_ieee_update(seed, buf, len) );
 }
 
 guint32
@@ -75,7 +76,7 @@ crc32_ccitt_tvb_offset_seed(tvbuff_t *tvb, guint offset, guint len,
 	tvb_ensure_bytes_exist(tvb, offset, len);  /* len == -1 not allowed */
 	buf = tvb_get_ptr(tvb, offset, len);
 
-	return ( crc32_ccitt_seed(buf, len, seed) );
+	return ( ~crc32_ieee_update(seed, buf, len) );
 }
 
 /*
@@ -1420,7 +1420,7 @@ cf_merge_files(char **out_filenamep, int in_file_count,
     pdh = wtap_dump_fdopen_ng(out_fd, file_type,
                               selected_frame_type,
                               merge_max_snapshot_length(in_file_count, in_files),
-                              FALSE /* compressed */, shb_hdr, idb_inf /* wtapng_iface_descriptions_t *idb_inf */, &open_err);
+                              WTAP_UNCOMPRESSED, shb_hdr, idb_inf /* wtapng_iface_descriptions_t *idb_inf */, &open_err);
 
     if (pdh == NULL) {
       ws_close(out_fd);
@@ -1436,7 +1436,7 @@ cf_merge_files(char **out_filenamep, int in_file_count,
     pdh = wtap_dump_fdopen(out_fd, file_type,
                            selected_frame_type,
                            merge_max_snapshot_length(in_file_count, in_files),
-                           FALSE /* compressed */, &open_err);
+                           WTAP_UNCOMPRESSED, &open_err);
     if (pdh == NULL) {
       ws_close(out_fd);
       merge_close_in_files(in_file_count, in_files);
@@ -4681,10 +4681,12 @@ cf_save_records(capture_file *cf, const char *fname, guint save_format,
          from which we're reading the packets that we're writing!) */
       fname_new = g_strdup_printf("%s~", fname);
       pdh = wtap_dump_open_ng(fname_new, save_format, encap, cf->snap,
-                              compressed, shb_hdr, idb_inf, &err);
+                              compressed ? WTAP_GZIP_COMPRESSED : WTAP_UNCOMPRESSED,
+                              shb_hdr, idb_inf, &err);
     } else {
       pdh = wtap_dump_open_ng(fname, save_format, encap, cf->snap,
-                              compressed, shb_hdr, idb_inf, &err);
+                              compressed ? WTAP_GZIP_COMPRESSED : WTAP_UNCOMPRESSED,
+                              shb_hdr, idb_inf, &err);
     }
     g_free(idb_inf);
     idb_inf = NULL;
@@ -4910,10 +4912,12 @@ cf_export_specified_packets(capture_file *cf, const char *fname,
        from which we're reading the packets that we're writing!) */
     fname_new = g_strdup_printf("%s~", fname);
     pdh = wtap_dump_open_ng(fname_new, save_format, encap, cf->snap,
-                            compressed, shb_hdr, idb_inf, &err);
+                            compressed ? WTAP_GZIP_COMPRESSED : WTAP_UNCOMPRESSED,
+                            shb_hdr, idb_inf, &err);
   } else {
     pdh = wtap_dump_open_ng(fname, save_format, encap, cf->snap,
-                            compressed, shb_hdr, idb_inf, &err);
+                            compressed ? WTAP_GZIP_COMPRESSED : WTAP_UNCOMPRESSED,
+                            shb_hdr, idb_inf, &err);
   }
   g_free(idb_inf);
   idb_inf = NULL;
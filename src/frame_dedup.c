@@ -0,0 +1,223 @@
+/* frame_dedup.c
+ * Duplicate frame detection
+ *
+ * Wireshark - Network traffic analyzer
+ * By Gerald Combs <gerald@wireshark.org>
+ * Copyright 1998 Gerald Combs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <wsutil/siphash.h>
+
+#include "frame_dedup.h"
+
+typedef struct {
+    guint8   digest[FRAME_DEDUP_DIGEST_LEN];
+    guint32  len;
+    nstime_t time;
+} fd_entry_t;
+
+/*
+ * The frames are kept in a ring, in the order they were added, so that
+ * the oldest can be dropped; the hash table maps a digest to the newest
+ * frame in the ring that has it, and counts the frames that do.
+ */
+struct frame_dedup_s {
+    fd_entry_t *ring;
+    guint       size;
+    guint       first;          /* oldest frame */
+    guint       count;
+    GHashTable *table;          /* fd_entry_t * -> GUINT_TO_POINTER(count) */
+    gboolean    by_time;
+    nstime_t    time_window;
+};
+
+/*
+ * The key is fixed so that the digests printed by "editcap -v" are the
+ * same from one run to the next.
+ */
+static const guint8 fd_key[SIPHASH_KEY_LEN] = {
+    0x65, 0x64, 0x69, 0x74, 0x63, 0x61, 0x70, 0x20,
+    0x64, 0x75, 0x70, 0x6c, 0x69, 0x63, 0x61, 0x74
+};
+
+static guint
+fd_entry_hash(gconstpointer key)
+{
+    const fd_entry_t *e = (const fd_entry_t *)key;
+
+    /* The digest is as good a hash as any. */
+    return (guint)e->digest[0] | (guint)e->digest[1] << 8 |
+           (guint)e->digest[2] << 16 | (guint)e->digest[3] << 24;
+}
+
+static gboolean
+fd_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const fd_entry_t *ea = (const fd_entry_t *)a;
+    const fd_entry_t *eb = (const fd_entry_t *)b;
+
+    return ea->len == eb->len && memcmp(ea->digest, eb->digest, FRAME_DEDUP_DIGEST_LEN) == 0;
+}
+
+static frame_dedup_t *
+frame_dedup_alloc(guint size)
+{
+    frame_dedup_t *fdd = g_new0(frame_dedup_t, 1);
+
+    fdd->size = MAX(size, 1);
+    fdd->ring = g_new(fd_entry_t, fdd->size);
+    fdd->table = g_hash_table_new(fd_entry_hash, fd_entry_equal);
+    return fdd;
+}
+
+frame_dedup_t *
+frame_dedup_new(guint window)
+{
+    return frame_dedup_alloc(window);
+}
+
+frame_dedup_t *
+frame_dedup_new_rel_time(const nstime_t *time_window, guint max_frames)
+{
+    frame_dedup_t *fdd = frame_dedup_alloc(max_frames);
+
+    fdd->by_time = TRUE;
+    fdd->time_window = *time_window;
+    return fdd;
+}
+
+void
+frame_dedup_free(frame_dedup_t *fdd)
+{
+    g_hash_table_destroy(fdd->table);
+    g_free(fdd->ring);
+    g_free(fdd);
+}
+
+/* Is "then" more than the time window before "now"? */
+static gboolean
+fd_too_old(const frame_dedup_t *fdd, const nstime_t *then, const nstime_t *now)
+{
+    nstime_t delta;
+
+    nstime_delta(&delta, now, then);
+    return nstime_cmp(&delta, &fdd->time_window) > 0;
+}
+
+static void
+fd_drop_oldest(frame_dedup_t *fdd)
+{
+    fd_entry_t *e = &fdd->ring[fdd->first];
+    gpointer    key, value;
+
+    if (g_hash_table_lookup_extended(fdd->table, e, &key, &value)) {
+        if (GPOINTER_TO_UINT(value) == 1)
+            g_hash_table_remove(fdd->table, key);
+        else
+            g_hash_table_insert(fdd->table, key, GUINT_TO_POINTER(GPOINTER_TO_UINT(value) - 1));
+    }
+    fdd->first = (fdd->first + 1) % fdd->size;
+    fdd->count--;
+}
+
+void
+frame_dedup_hash(const guint8 *fd, guint32 len, guint8 *digest)
+{
+    siphash128(fd_key, fd, len, digest);
+}
+
+gboolean
+frame_dedup_check(frame_dedup_t *fdd, const guint8 *fd, guint32 len,
+                  const nstime_t *ts)
+{
+    guint8 digest[FRAME_DEDUP_DIGEST_LEN];
+
+    frame_dedup_hash(fd, len, digest);
+    return frame_dedup_check_digest(fdd, digest, len, ts);
+}
+
+gboolean
+frame_dedup_check_digest(frame_dedup_t *fdd, const guint8 *digest, guint32 len,
+                         const nstime_t *ts)
+{
+    fd_entry_t *e;
+    gpointer    key, value;
+    gboolean    dup = FALSE;
+    guint       n = 0;
+
+    /*
+     * Make room, and drop what is out of the time window.  This stops at
+     * a frame that is later than this one, so a trace that isn't in
+     * chronological order keeps more frames than it needs to, not fewer.
+     */
+    while (fdd->count != 0 &&
+           (fdd->count == fdd->size ||
+            (fdd->by_time && fd_too_old(fdd, &fdd->ring[fdd->first].time, ts))))
+        fd_drop_oldest(fdd);
+
+    e = &fdd->ring[(fdd->first + fdd->count) % fdd->size];
+    memcpy(e->digest, digest, FRAME_DEDUP_DIGEST_LEN);
+    e->len = len;
+    if (fdd->by_time)
+        e->time = *ts;
+    else
+        nstime_set_unset(&e->time);
+
+    if (g_hash_table_lookup_extended(fdd->table, e, &key, &value)) {
+        n = GPOINTER_TO_UINT(value);
+        dup = TRUE;
+        if (fdd->by_time) {
+            /*
+             * Frames that aren't in chronological order are compared by
+             * how far apart they are either way.
+             */
+            const fd_entry_t *prev = (const fd_entry_t *)key;
+
+            dup = !fd_too_old(fdd, &prev->time, ts) && !fd_too_old(fdd, ts, &prev->time);
+        }
+    }
+
+    /* This is now the newest frame with that digest. */
+    g_hash_table_replace(fdd->table, e, GUINT_TO_POINTER(n + 1));
+    fdd->count++;
+    return dup;
+}
+
+const guint8 *
+frame_dedup_digest(const frame_dedup_t *fdd)
+{
+    return fdd->ring[(fdd->first + fdd->count + fdd->size - 1) % fdd->size].digest;
+}
+
+/*
+ * Editor modelines  -  http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 4
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=4 tabstop=8 expandtab:
+ * :indentSize=4:tabSize=8:noTabs=true:
+ */
+
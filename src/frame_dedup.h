@@ -0,0 +1,66 @@
+/* frame_dedup.h
+ * Definitions for duplicate frame detection
+ *
+ * Wireshark - Network traffic analyzer
+ * By Gerald Combs <gerald@wireshark.org>
+ * Copyright 1998 Gerald Combs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __FRAME_DEDUP_H__
+#define __FRAME_DEDUP_H__
+
+#include <glib.h>
+#include <wsutil/nstime.h>
+
+/*
+ * A set of the digests of the last frames seen, in which a frame can be
+ * looked up in constant time however many frames it holds.  Frames are
+ * dropped from it, oldest first, when it is full or, for a set made with
+ * frame_dedup_new_rel_time(), when they are further back in time than
+ * the window.
+ */
+typedef struct frame_dedup_s frame_dedup_t;
+
+/** Find duplicates among the last "window" - 1 frames. */
+frame_dedup_t *frame_dedup_new(guint window);
+
+/** Find duplicates at most "time_window" apart, among the last
+ *  "max_frames" - 1 frames. */
+frame_dedup_t *frame_dedup_new_rel_time(const nstime_t *time_window, guint max_frames);
+
+/** Add a frame to the set; returns TRUE if it was a duplicate of one in
+ *  it.  "ts" is only used by sets with a time window. */
+gboolean frame_dedup_check(frame_dedup_t *fdd, const guint8 *fd, guint32 len,
+                           const nstime_t *ts);
+
+#define FRAME_DEDUP_DIGEST_LEN  16
+
+/** Compute the digest frame_dedup_check() uses for a frame.  It depends
+ *  on nothing but the frame, so it can be computed on any thread. */
+void frame_dedup_hash(const guint8 *fd, guint32 len, guint8 *digest);
+
+/** Like frame_dedup_check(), for a frame whose digest has already been
+ *  computed with frame_dedup_hash(). */
+gboolean frame_dedup_check_digest(frame_dedup_t *fdd, const guint8 *digest,
+                                  guint32 len, const nstime_t *ts);
+
+/** The FRAME_DEDUP_DIGEST_LEN-byte digest of the frame last added. */
+const guint8 *frame_dedup_digest(const frame_dedup_t *fdd);
+
+void frame_dedup_free(frame_dedup_t *fdd);
+
+#endif /* frame_dedup.h */
@@ -0,0 +1,326 @@
+/* merge_bench.c
+ * Times merge_read_packet() against the linear scan it replaced
+ *
+ * Wireshark - Network traffic analyzer
+ * By Gerald Combs <gerald@wireshark.org>
+ * Copyright 1998 Gerald Combs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Usage: merge_bench [<packets> [<inputs>...]]
+ *
+ * For each <inputs> count, <packets> 64-byte frames are dealt out at
+ * random to that many pcap files in a temporary directory, with time
+ * stamps that often tie across files, and the files are merged with
+ * merge_read_packet().  The old scan of every file per packet is run
+ * on as much of the merge as it gets through in reasonable time, and
+ * the order in which it picks packets is checked against the new one.
+ *
+ * Merging thousands of files needs as many file descriptors; the soft
+ * limit is raised to the hard one, and input counts that still don't
+ * fit are skipped.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "wtap.h"
+#include <wsutil/file_util.h>
+#include <wsutil/tempfile.h>
+#include <wiretap/merge.h>
+
+#define DEFAULT_PACKETS     1000000
+#define FRAME_SIZE          64
+#define OLD_MAX_WORK        G_GUINT64_CONSTANT(2000000000)  /* file visits */
+
+/* merge_read_packet() as it was */
+static gboolean
+old_is_earlier(nstime_t *l, nstime_t *r)
+{
+  if (l->secs > r->secs) {
+    return FALSE;
+  } else if (l->secs < r->secs) {
+    return TRUE;
+  } else if (l->nsecs > r->nsecs) {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static merge_in_file_t *
+old_merge_read_packet(int in_file_count, merge_in_file_t in_files[],
+                      int *err, gchar **err_info)
+{
+  int i;
+  int ei = -1;
+  nstime_t tv = { sizeof(time_t) > sizeof(int) ? LONG_MAX : INT_MAX, INT_MAX };
+  struct wtap_pkthdr *phdr;
+
+  for (i = 0; i < in_file_count; i++) {
+    if (in_files[i].state == PACKET_NOT_PRESENT) {
+      if (!wtap_read(in_files[i].wth, err, err_info, &in_files[i].data_offset)) {
+        if (*err != 0) {
+          in_files[i].state = GOT_ERROR;
+          return &in_files[i];
+        }
+        in_files[i].state = AT_EOF;
+      } else
+        in_files[i].state = PACKET_PRESENT;
+    }
+
+    if (in_files[i].state == PACKET_PRESENT) {
+      phdr = wtap_phdr(in_files[i].wth);
+      if (old_is_earlier(&phdr->ts, &tv)) {
+        tv = phdr->ts;
+        ei = i;
+      }
+    }
+  }
+
+  if (ei == -1) {
+    *err = 0;
+    return NULL;
+  }
+  in_files[ei].state = PACKET_NOT_PRESENT;
+  in_files[ei].packet_num++;
+  *err = 0;
+  return &in_files[ei];
+}
+
+static gboolean
+make_inputs(const char *dir, guint32 npackets, guint ninputs, char **names)
+{
+  wtap_dumper        **pdh;
+  struct wtap_pkthdr   phdr;
+  guint8               frame[FRAME_SIZE];
+  guint32              i;
+  guint                j;
+  int                  err;
+  gboolean             ok = TRUE;
+
+  pdh = g_new0(wtap_dumper *, ninputs);
+  for (j = 0; j < ninputs; j++) {
+    names[j] = g_strdup_printf("%s" G_DIR_SEPARATOR_S "in%05u.pcap", dir, j);
+    pdh[j] = wtap_dump_open(names[j], WTAP_FILE_TYPE_SUBTYPE_PCAP_NSEC,
+                            WTAP_ENCAP_ETHERNET, FRAME_SIZE, WTAP_UNCOMPRESSED, &err);
+    if (pdh[j] == NULL) {
+      fprintf(stderr, "merge_bench: Can't create %s: %s\n", names[j],
+              wtap_strerror(err));
+      ok = FALSE;
+      break;
+    }
+  }
+
+  memset(&phdr, 0, sizeof phdr);
+  phdr.rec_type = REC_TYPE_PACKET;
+  phdr.presence_flags = WTAP_HAS_TS;
+  phdr.pkt_encap = WTAP_ENCAP_ETHERNET;
+  phdr.caplen = FRAME_SIZE;
+  phdr.len = FRAME_SIZE;
+  memset(frame, 0, sizeof frame);
+  for (i = 0; ok && i < npackets; i++) {
+    /* Two packets a microsecond, so that about half of them tie. */
+    phdr.ts.secs = i / 2000000;
+    phdr.ts.nsecs = (i / 2 % 1000000) * 1000;
+    memcpy(frame, &i, sizeof i);
+    j = (guint)g_random_int_range(0, (gint32)ninputs);
+    if (!wtap_dump(pdh[j], &phdr, frame, &err)) {
+      fprintf(stderr, "merge_bench: Can't write %s: %s\n", names[j],
+              wtap_strerror(err));
+      ok = FALSE;
+    }
+  }
+
+  for (j = 0; j < ninputs && pdh[j] != NULL; j++) {
+    if (!wtap_dump_close(pdh[j], &err) && ok) {
+      fprintf(stderr, "merge_bench: Can't close %s: %s\n", names[j],
+              wtap_strerror(err));
+      ok = FALSE;
+    }
+  }
+  g_free(pdh);
+  return ok;
+}
+
+static void
+run(const char *dir, guint32 npackets, guint ninputs)
+{
+  char             **names;
+  merge_in_file_t   *in_files, *in_file;
+  guint32           *order;
+  guint32            n, nnew = 0, nold, mismatches = 0;
+  GTimer            *timer;
+  double             t_new, t_old;
+  int                err, err_fileno;
+  gchar             *err_info;
+  guint              j;
+
+  names = g_new0(char *, ninputs);
+  if (!make_inputs(dir, npackets, ninputs, names))
+    goto out;
+
+  /* As mergecap does, so that thousands of inputs fit in memory. */
+  wtap_set_read_buffer_size(ninputs > 64 ? 64 * 1024 : 0);
+
+  order = g_new(guint32, npackets);
+  if (!merge_open_in_files(ninputs, names, &in_files, &err, &err_info,
+                           &err_fileno)) {
+    fprintf(stderr, "merge_bench: Can't open %s: %s\n", names[err_fileno],
+            wtap_strerror(err));
+    g_free(in_files);
+    g_free(order);
+    goto out;
+  }
+  timer = g_timer_new();
+  g_timer_start(timer);
+  while ((in_file = merge_read_packet(ninputs, in_files, &err, &err_info)) != NULL
+         && err == 0)
+    order[nnew++] = (guint32)(in_file - in_files);
+  t_new = g_timer_elapsed(timer, NULL);
+  merge_close_in_files(ninputs, in_files);
+  g_free(in_files);
+
+  /* The old code visits every file per packet. */
+  nold = (guint32)MIN((guint64)nnew, OLD_MAX_WORK / ninputs);
+  nold = MAX(nold, MIN(nnew, 10000));
+  if (merge_open_in_files(ninputs, names, &in_files, &err, &err_info,
+                          &err_fileno)) {
+    g_timer_start(timer);
+    for (n = 0; n < nold; n++) {
+      in_file = old_merge_read_packet(ninputs, in_files, &err, &err_info);
+      if (in_file == NULL || err != 0 || (guint32)(in_file - in_files) != order[n])
+        mismatches++;
+    }
+    t_old = g_timer_elapsed(timer, NULL);
+    merge_close_in_files(ninputs, in_files);
+  } else {
+    nold = 0;
+    t_old = 1;
+  }
+  g_free(in_files);
+  g_timer_destroy(timer);
+
+  printf("%6u %9u %12.0f %12.0f %9u %s\n", ninputs, nnew, nnew / t_new,
+         nold / t_old, nold,
+         (mismatches || nnew != npackets) ? "MISMATCH" : "ok");
+  g_free(order);
+
+out:
+  for (j = 0; j < ninputs && names[j] != NULL; j++) {
+    ws_unlink(names[j]);
+    g_free(names[j]);
+  }
+  g_free(names);
+}
+
+/* Returns the number of files we may have open at once, or 0 if unknown. */
+static guint
+max_open_files(void)
+{
+#ifndef _WIN32
+  struct rlimit rl;
+
+  if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+    return 0;
+  if (rl.rlim_cur != rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    getrlimit(RLIMIT_NOFILE, &rl);
+  }
+  if (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > G_MAXUINT)
+    return G_MAXUINT;
+  return (guint)rl.rlim_cur;
+#else
+  return 0;
+#endif
+}
+
+int
+main(int argc, char **argv)
+{
+  static const guint default_inputs[] = { 1, 16, 256, 4096 };
+  guint32      npackets = DEFAULT_PACKETS;
+  guint       *inputs, ninputs, i, max_files;
+  char        *dir;
+
+  if (argc > 1)
+    npackets = (guint32)strtoul(argv[1], NULL, 10);
+  if (npackets == 0) {
+    fprintf(stderr, "Usage: merge_bench [<packets> [<inputs>...]]\n");
+    return 1;
+  }
+  if (argc > 2) {
+    ninputs = argc - 2;
+    inputs = g_new(guint, ninputs);
+    for (i = 0; i < ninputs; i++)
+      inputs[i] = (guint)strtoul(argv[i + 2], NULL, 10);
+  } else {
+    ninputs = G_N_ELEMENTS(default_inputs);
+    inputs = (guint *)g_memdup(default_inputs, sizeof default_inputs);
+  }
+
+  if (create_tempdir(&dir, "merge_bench") == NULL) {
+    fprintf(stderr, "merge_bench: Can't create a temporary directory\n");
+    return 1;
+  }
+  max_files = max_open_files();
+
+  g_random_set_seed(1);
+  printf("%u packets\n", npackets);
+  printf("%6s %9s %12s %12s %9s\n", "inputs", "packets", "new pkts/s",
+         "old pkts/s", "old pkts");
+  for (i = 0; i < ninputs; i++) {
+    if (inputs[i] == 0)
+      continue;
+    /* Leave some room for stdio and the C library. */
+    if (max_files != 0 && inputs[i] > max_files - MIN(max_files, 16)) {
+      printf("%6u skipped, only %u files can be open\n", inputs[i], max_files);
+      continue;
+    }
+    run(dir, npackets, inputs[i]);
+  }
+
+  ws_remove(dir);
+  g_free(inputs);
+  return 0;
+}
+
+/*
+ * Editor modelines  -  http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 2
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=2 tabstop=8 expandtab:
+ * :indentSize=2:tabSize=8:noTabs=true:
+ */
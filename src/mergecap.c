@@ -60,6 +60,10 @@
 #include <wsutil/unicode-utils.h>
 #endif /* _WIN32 */
 
+/* Read buffers shared by the input files open at once */
+#define READ_BUFFER_BUDGET  (64 * 1024 * 1024)
+#define MIN_READ_BUFFER     (64 * 1024)
+
 static int
 get_natural_int(const char *string, const char *name)
 {
@@ -136,6 +140,10 @@ usage(gboolean is_error)
   fprintf(output, "                    an empty \"-T\" option will list the encapsulation types.\n");
   fprintf(output, "\n");
   fprintf(output, "Miscellaneous:\n");
+  fprintf(output, "  -m <max files>    open no more than <max files> input files at once;\n");
+  fprintf(output, "                    more are merged in steps through temporary files.\n");
+  fprintf(output, "  -p                read each input file ahead in a thread of its own.\n");
+  fprintf(output, "  -t <directory>    put the temporary files of -m in <directory>.\n");
   fprintf(output, "  -h                display this help and exit.\n");
   fprintf(output, "  -v                verbose output.\n");
 }
@@ -213,7 +221,14 @@ main(int argc, char *argv[])
   int                 opt;
   gboolean            do_append          = FALSE;
   gboolean            verbose            = FALSE;
+  gboolean            prefetch           = FALSE;
   int                 in_file_count      = 0;
+  int                 max_open           = 0;
+  int                 open_count;
+  const char         *tmpdir             = NULL;
+  char *const        *in_file_names;
+  int                 in_name_count;
+  gboolean            in_runs;
   guint               snaplen            = 0;
 #ifdef PCAP_NG_DEFAULT
   int                 file_type          = WTAP_FILE_TYPE_SUBTYPE_PCAPNG; /* default to pcap format */
@@ -239,7 +254,7 @@ main(int argc, char *argv[])
 #endif /* _WIN32 */
 
   /* Process the options first */
-  while ((opt = getopt(argc, argv, "aF:hs:T:vw:")) != -1) {
+  while ((opt = getopt(argc, argv, "aF:hm:ps:t:T:vw:")) != -1) {
 
     switch (opt) {
     case 'a':
@@ -261,10 +276,26 @@ main(int argc, char *argv[])
       exit(0);
       break;
 
+    case 'm':
+      max_open = get_positive_int(optarg, "maximum number of open files");
+      if (max_open < 2) {
+        fprintf(stderr, "mergecap: At least 2 files must be allowed to be open at once\n");
+        exit(1);
+      }
+      break;
+
+    case 'p':
+      prefetch = TRUE;
+      break;
+
     case 's':
       snaplen = get_positive_int(optarg, "snapshot length");
       break;
 
+    case 't':
+      tmpdir = optarg;
+      break;
+
     case 'T':
       frame_type = wtap_short_string_to_encap(optarg);
       if (frame_type < 0) {
@@ -313,11 +344,28 @@ main(int argc, char *argv[])
     return 1;
   }
 
-  /* open the input files */
-  if (!merge_open_in_files(in_file_count, &argv[optind], &in_files,
-                           &open_err, &err_info, &err_fileno)) {
-    fprintf(stderr, "mergecap: Can't open %s: %s\n", argv[optind + err_fileno],
-            wtap_strerror(open_err));
+  /* the more files are open at once, the smaller their read buffers */
+  open_count = (max_open != 0 && max_open < in_file_count) ? max_open : in_file_count;
+  if (open_count > READ_BUFFER_BUDGET / WTAP_DEFAULT_READ_BUFFER_SIZE)
+    wtap_set_read_buffer_size(MAX(MIN_READ_BUFFER, READ_BUFFER_BUDGET / open_count));
+
+  /* open the input files, merging them in steps if there are too many */
+  in_file_names = &argv[optind];
+  in_name_count = in_file_count;
+  in_runs = max_open != 0 && in_file_count > max_open;
+  if (verbose && in_runs)
+    fprintf(stderr, "mergecap: merging %d files through temporary files in %s\n",
+            in_file_count, tmpdir != NULL ? tmpdir : g_get_tmp_dir());
+  if (!merge_open_in_files_in_runs(&in_file_count, in_file_names, max_open,
+                                   tmpdir, do_append, &in_files,
+                                   &open_err, &err_info, &err_fileno)) {
+    if (err_fileno == -1)
+      fprintf(stderr, "mergecap: Can't merge through temporary files in %s: %s\n",
+              tmpdir != NULL ? tmpdir : g_get_tmp_dir(), wtap_strerror(open_err));
+    else
+      fprintf(stderr, "mergecap: Can't %s %s: %s\n",
+              in_runs ? "open or read" : "open",
+              in_file_names[err_fileno], wtap_strerror(open_err));
     switch (open_err) {
 
     case WTAP_ERR_UNSUPPORTED:
@@ -330,7 +378,7 @@ main(int argc, char *argv[])
     return 2;
   }
 
-  if (verbose) {
+  if (verbose && !in_runs) {
     for (i = 0; i < in_file_count; i++)
       fprintf(stderr, "mergecap: %s is type %s.\n", argv[optind + i],
               wtap_file_type_subtype_string(wtap_file_type_subtype(in_files[i].wth)));
@@ -381,6 +429,10 @@ main(int argc, char *argv[])
     }
   }
 
+  /* from here on, only packets are read from the input files */
+  if (prefetch)
+    merge_prefetch_in_files(in_file_count, in_files);
+
   /* open the outfile */
   if (strncmp(out_filename, "-", 2) == 0) {
     /* use stdout as the outfile */
@@ -403,8 +455,8 @@ main(int argc, char *argv[])
     shb_hdr = g_new(wtapng_section_t,1);
     comment_gstr = g_string_new("File created by merging: \n");
 
-    for (i = 0; i < in_file_count; i++) {
-      g_string_append_printf(comment_gstr, "File%d: %s \n",i+1,in_files[i].filename);
+    for (i = 0; i < in_name_count; i++) {
+      g_string_append_printf(comment_gstr, "File%d: %s \n",i+1,in_file_names[i]);
     }
     shb_hdr->section_length = -1;
     /* options */
@@ -414,10 +466,10 @@ main(int argc, char *argv[])
     shb_hdr->shb_user_appl = "mergecap";        /* NULL if not available, UTF-8 string containing the name of the application used to create this section. */
 
     pdh = wtap_dump_fdopen_ng(out_fd, file_type, frame_type, snaplen,
-                              FALSE /* compressed */, shb_hdr, NULL /* wtapng_iface_descriptions_t *idb_inf */, &open_err);
+                              WTAP_UNCOMPRESSED, shb_hdr, NULL /* wtapng_iface_descriptions_t *idb_inf */, &open_err);
     g_string_free(comment_gstr, TRUE);
   } else {
-    pdh = wtap_dump_fdopen(out_fd, file_type, frame_type, snaplen, FALSE /* compressed */, &open_err);
+    pdh = wtap_dump_fdopen(out_fd, file_type, frame_type, snaplen, WTAP_UNCOMPRESSED, &open_err);
   }
   if (pdh == NULL) {
     merge_close_in_files(in_file_count, in_files);
@@ -0,0 +1,213 @@
+/* open_bench.c
+ * Times wtap_open_offline() on small files, with and without the
+ * magic number dispatch
+ *
+ * Wireshark - Network traffic analyzer
+ * By Gerald Combs <gerald@wireshark.org>
+ * Copyright 1998 Gerald Combs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Usage: open_bench [<opens> [<packets>]]
+ *
+ * A file of <packets> 64-byte frames is written in each of a few formats
+ * to a temporary directory, as a ring buffer file would be, and opened
+ * and closed <opens> times with every open routine tried in turn, then
+ * with only the ones whose magic numbers the file starts with.  The
+ * file type found each way is checked to be the one written.  One file
+ * in no format at all is opened too, as that's the worst case for both.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "wtap.h"
+#include <wsutil/file_util.h>
+#include <wsutil/tempfile.h>
+
+#define DEFAULT_OPENS       20000
+#define DEFAULT_PACKETS     10
+#define FRAME_SIZE          64
+
+typedef struct {
+  const char            *name;
+  int                    file_type_subtype;
+  wtap_compression_type  compression;
+} bench_format_t;
+
+static const bench_format_t formats[] = {
+  { "pcap",         WTAP_FILE_TYPE_SUBTYPE_PCAP,       WTAP_UNCOMPRESSED },
+  { "pcap.gz",      WTAP_FILE_TYPE_SUBTYPE_PCAP,       WTAP_GZIP_COMPRESSED },
+  { "pcap.bgz",     WTAP_FILE_TYPE_SUBTYPE_PCAP,       WTAP_BGZF_COMPRESSED },
+  { "pcapng",       WTAP_FILE_TYPE_SUBTYPE_PCAPNG,     WTAP_UNCOMPRESSED },
+  { "snoop",        WTAP_FILE_TYPE_SUBTYPE_SNOOP,      WTAP_UNCOMPRESSED },
+  { "netmon2",      WTAP_FILE_TYPE_SUBTYPE_NETMON_2_x, WTAP_UNCOMPRESSED },
+  { "erf",          WTAP_FILE_TYPE_SUBTYPE_ERF,        WTAP_UNCOMPRESSED },
+  { "k12text",      WTAP_FILE_TYPE_SUBTYPE_K12TEXT,    WTAP_UNCOMPRESSED },
+  { "unknown",      WTAP_FILE_TYPE_SUBTYPE_UNKNOWN,    WTAP_UNCOMPRESSED }
+};
+
+static gboolean
+make_file(const char *path, const bench_format_t *fmt, guint32 npackets)
+{
+  wtap_dumper        *pdh;
+  struct wtap_pkthdr  phdr;
+  guint8              frame[FRAME_SIZE];
+  guint32             i;
+  int                 err;
+  FILE               *fp;
+
+  if (fmt->file_type_subtype == WTAP_FILE_TYPE_SUBTYPE_UNKNOWN) {
+    /* Text that no heuristic should take for a capture. */
+    if ((fp = ws_fopen(path, "w")) == NULL)
+      return FALSE;
+    for (i = 0; i < npackets; i++)
+      fprintf(fp, "line %u of a file that isn't a capture file\n", i);
+    fclose(fp);
+    return TRUE;
+  }
+
+  pdh = wtap_dump_open(path, fmt->file_type_subtype, WTAP_ENCAP_ETHERNET,
+                       FRAME_SIZE, fmt->compression, &err);
+  if (pdh == NULL)
+    return FALSE;
+
+  memset(&phdr, 0, sizeof phdr);
+  phdr.rec_type = REC_TYPE_PACKET;
+  phdr.presence_flags = WTAP_HAS_TS|WTAP_HAS_CAP_LEN;
+  phdr.pkt_encap = WTAP_ENCAP_ETHERNET;
+  phdr.caplen = FRAME_SIZE;
+  phdr.len = FRAME_SIZE;
+  memset(frame, 0, sizeof frame);
+  for (i = 0; i < npackets; i++) {
+    phdr.ts.secs = 1400000000 + i;
+    memcpy(frame + 14, &i, sizeof i);
+    if (!wtap_dump(pdh, &phdr, frame, &err)) {
+      wtap_dump_close(pdh, &err);
+      return FALSE;
+    }
+  }
+  return wtap_dump_close(pdh, &err);
+}
+
+/*
+ * Opens and closes path opens times; returns the time taken, and puts
+ * the file type found into *file_type_subtype.
+ */
+static double
+time_opens(const char *path, guint32 opens, int *file_type_subtype)
+{
+  GTimer  *timer;
+  wtap    *wth;
+  guint32  n;
+  int      err;
+  gchar   *err_info;
+  double   elapsed;
+
+  *file_type_subtype = WTAP_FILE_TYPE_SUBTYPE_UNKNOWN;
+  timer = g_timer_new();
+  g_timer_start(timer);
+  for (n = 0; n < opens; n++) {
+    err_info = NULL;
+    wth = wtap_open_offline(path, WTAP_TYPE_AUTO, &err, &err_info, FALSE);
+    g_free(err_info);
+    if (wth == NULL)
+      continue;
+    *file_type_subtype = wtap_file_type_subtype(wth);
+    wtap_close(wth);
+  }
+  elapsed = g_timer_elapsed(timer, NULL);
+  g_timer_destroy(timer);
+  return elapsed;
+}
+
+int
+main(int argc, char **argv)
+{
+  guint32  opens = DEFAULT_OPENS, npackets = DEFAULT_PACKETS;
+  char    *dir, *path;
+  guint    i;
+  double   t_old, t_new;
+  int      type_old, type_new;
+
+  if (argc > 1)
+    opens = (guint32)strtoul(argv[1], NULL, 10);
+  if (argc > 2)
+    npackets = (guint32)strtoul(argv[2], NULL, 10);
+  if (opens == 0) {
+    fprintf(stderr, "Usage: open_bench [<opens> [<packets>]]\n");
+    return 1;
+  }
+
+  /* So that a sidecar from an earlier run doesn't change what's timed. */
+  wtap_set_index_sidecar(FALSE);
+
+  if (create_tempdir(&dir, "open_bench") == NULL) {
+    fprintf(stderr, "open_bench: Can't create a temporary directory\n");
+    return 1;
+  }
+
+  printf("%u opens of files of %u packets\n", opens, npackets);
+  printf("%-10s %12s %12s %8s %s\n", "format", "old us/open", "new us/open",
+         "speedup", "type");
+  for (i = 0; i < G_N_ELEMENTS(formats); i++) {
+    path = g_strdup_printf("%s" G_DIR_SEPARATOR_S "ring_%05u.%s", dir, i,
+                           formats[i].name);
+    if (!make_file(path, &formats[i], npackets)) {
+      printf("%-10s skipped, can't be written\n", formats[i].name);
+      g_free(path);
+      continue;
+    }
+
+    wtap_set_magic_dispatch(FALSE);
+    t_old = time_opens(path, opens, &type_old);
+    wtap_set_magic_dispatch(TRUE);
+    t_new = time_opens(path, opens, &type_new);
+
+    printf("%-10s %12.2f %12.2f %7.1fx %s\n", formats[i].name,
+           t_old * 1e6 / opens, t_new * 1e6 / opens, t_old / t_new,
+           (type_old == type_new &&
+            type_new == formats[i].file_type_subtype) ? "ok" : "MISMATCH");
+    ws_unlink(path);
+    g_free(path);
+  }
+
+  ws_remove(dir);
+  return 0;
+}
+
+/*
+ * Editor modelines  -  http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 2
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=2 tabstop=8 expandtab:
+ * :indentSize=2:tabSize=8:noTabs=true:
+ */
@@ -561,7 +561,7 @@ main(int argc, char **argv)
 
 
 	dump = wtap_dump_open(produce_filename, WTAP_FILE_TYPE_SUBTYPE_PCAP,
-		example->sample_wtap_encap, produce_max_bytes, FALSE /* compressed */, &err);
+		example->sample_wtap_encap, produce_max_bytes, WTAP_UNCOMPRESSED, &err);
 	if (!dump) {
 		fprintf(stderr,
 		    "randpkt: Error writing to %s\n", produce_filename);
@@ -33,6 +33,7 @@
 #endif
 
 #include "wtap.h"
+#include "wiretap/merge.h"
 
 #ifndef HAVE_GETOPT_LONG
 #include "wsutil/wsgetopt.h"
@@ -62,6 +63,17 @@ static void usage(gboolean is_error)
     fprintf(output, "\n");
     fprintf(output, "Options:\n");
     fprintf(output, "  -n        don't write to output file if the input file is ordered.\n");
+    fprintf(output, "  -w <frames>\n");
+    fprintf(output, "            reorder in one pass, holding back at most <frames> frames;\n");
+    fprintf(output, "            for frames no more than <frames> frames out of order.\n");
+    fprintf(output, "  -W <seconds>\n");
+    fprintf(output, "            reorder in one pass, holding back frames for <seconds>;\n");
+    fprintf(output, "            for frames no more than <seconds> out of order.\n");
+    fprintf(output, "  -e <frames>\n");
+    fprintf(output, "            sort in one pass, in runs of <frames> frames kept in memory\n");
+    fprintf(output, "            and spilled to temporary files; for inputs of any size.\n");
+    fprintf(output, "  -t <directory>\n");
+    fprintf(output, "            put the temporary files of -e in <directory>.\n");
     fprintf(output, "  -h        display this help and exit.\n");
 }
 
@@ -71,8 +83,15 @@ typedef struct FrameRecord_t {
     guint        num;
 
     nstime_t     time;
+
+    /* A copy of the frame, for the modes that read the input only once */
+    struct wtap_pkthdr *phdr;
+    guint8             *data;
 } FrameRecord_t;
 
+/* Most temporary files that -e merges at once */
+#define MAX_OPEN_RUNS   64
+
 
 /**************************************************/
 /* Debugging only                                 */
@@ -88,6 +107,36 @@ typedef struct FrameRecord_t {
 /**************************************************/
 
 
+static void
+print_read_error(const char *what, const char *infile, int err,
+                 gchar *err_info)
+{
+    fprintf(stderr, "reordercap: An error occurred while %s \"%s\": %s.\n",
+            what, infile, wtap_strerror(err));
+    switch (err) {
+
+    case WTAP_ERR_UNSUPPORTED:
+    case WTAP_ERR_UNSUPPORTED_ENCAP:
+    case WTAP_ERR_BAD_FILE:
+        fprintf(stderr, "(%s)\n", err_info);
+        g_free(err_info);
+        break;
+    }
+}
+
+static void
+dump_or_exit(wtap_dumper *pdh, const struct wtap_pkthdr *phdr,
+             const guint8 *pd)
+{
+    int err;
+
+    if (!wtap_dump(pdh, phdr, pd, &err)) {
+        fprintf(stderr, "reordercap: Error (%s) writing frame to outfile\n",
+                wtap_strerror(err));
+        exit(1);
+    }
+}
+
 static void
 frame_write(FrameRecord_t *frame, wtap *wth, wtap_dumper *pdh, Buffer *buf,
             const char *infile)
@@ -96,6 +145,11 @@ frame_write(FrameRecord_t *frame, wtap *wth, wtap_dumper *pdh, Buffer *buf,
     gchar  *err_info;
     struct wtap_pkthdr phdr;
 
+    if (frame->phdr != NULL) {
+        dump_or_exit(pdh, frame->phdr, frame->data);
+        return;
+    }
+
     memset(&phdr, 0, sizeof(struct wtap_pkthdr));
 
     DEBUG_PRINT("\nDumping frame (offset=%" G_GINT64_MODIFIER "u)\n",
@@ -106,18 +160,7 @@ frame_write(FrameRecord_t *frame, wtap *wth, wtap_dumper *pdh, Buffer *buf,
     if (!wtap_seek_read(wth, frame->offset, &phdr, buf, &err, &err_info)) {
         if (err != 0) {
             /* Print a message noting that the read failed somewhere along the line. */
-            fprintf(stderr,
-                    "reordercap: An error occurred while re-reading \"%s\": %s.\n",
-                    infile, wtap_strerror(err));
-            switch (err) {
-
-            case WTAP_ERR_UNSUPPORTED:
-            case WTAP_ERR_UNSUPPORTED_ENCAP:
-            case WTAP_ERR_BAD_FILE:
-                fprintf(stderr, "(%s)\n", err_info);
-                g_free(err_info);
-                break;
-            }
+            print_read_error("re-reading", infile, err, err_info);
             exit(1);
         }
     }
@@ -127,11 +170,7 @@ frame_write(FrameRecord_t *frame, wtap *wth, wtap_dumper *pdh, Buffer *buf,
     phdr.ts = frame->time;
 
     /* Dump frame to outfile */
-    if (!wtap_dump(pdh, &phdr, buffer_start_ptr(buf), &err)) {
-        fprintf(stderr, "reordercap: Error (%s) writing frame to outfile\n",
-                wtap_strerror(err));
-        exit(1);
-    }
+    dump_or_exit(pdh, &phdr, buffer_start_ptr(buf));
 }
 
 /* Comparing timestamps between 2 frames.
@@ -147,11 +186,306 @@ frames_compare(gconstpointer a, gconstpointer b)
 
     const nstime_t *time1 = &frame1->time;
     const nstime_t *time2 = &frame2->time;
+    int             cmp;
+
+    /* Frames with the same time stamp stay in the order they were read */
+    cmp = nstime_cmp(time1, time2);
+    if (cmp == 0 && frame1->num != frame2->num)
+        cmp = frame1->num < frame2->num ? -1 : 1;
+    return cmp;
+}
+
+/* Make a record of the frame just read, with a copy of the frame */
+static FrameRecord_t *
+frame_copy(wtap *wth, guint num, gint64 data_offset, const char *infile)
+{
+    const struct wtap_pkthdr *phdr = wtap_phdr(wth);
+    FrameRecord_t *frame;
+
+    /* These pseudo-headers point at the reader's state for the frame,
+       which the next read replaces. */
+    if (phdr->pkt_encap == WTAP_ENCAP_K12 ||
+        phdr->pkt_encap == WTAP_ENCAP_CATAPULT_DCT2000) {
+        fprintf(stderr, "reordercap: %s frames in \"%s\" can only be reordered without -w, -W or -e\n",
+                wtap_encap_string(phdr->pkt_encap), infile);
+        exit(1);
+    }
+
+    frame = g_slice_new(FrameRecord_t);
+    frame->num = num;
+    frame->offset = data_offset;
+    if (phdr->presence_flags & WTAP_HAS_TS) {
+        frame->time = phdr->ts;
+    } else {
+        nstime_set_unset(&frame->time);
+    }
+    frame->phdr = (struct wtap_pkthdr *)g_memdup(phdr, sizeof *phdr);
+    frame->phdr->opt_comment = g_strdup(phdr->opt_comment);
+    frame->data = (guint8 *)g_memdup(wtap_buf_ptr(wth), phdr->caplen);
+    return frame;
+}
+
+static void
+frame_free(FrameRecord_t *frame)
+{
+    if (frame->phdr != NULL) {
+        g_free(frame->phdr->opt_comment);
+        g_free(frame->phdr);
+        g_free(frame->data);
+    }
+    g_slice_free(FrameRecord_t, frame);
+}
+
+/* Binary min-heap of frames, by frames_compare(), for -w and -W */
+static void
+heap_push(GPtrArray *heap, FrameRecord_t *frame)
+{
+    guint i, parent;
+
+    g_ptr_array_add(heap, frame);
+    for (i = heap->len - 1; i > 0; i = parent) {
+        parent = (i - 1) / 2;
+        if (frames_compare(&heap->pdata[parent], &frame) <= 0)
+            break;
+        heap->pdata[i] = heap->pdata[parent];
+    }
+    heap->pdata[i] = frame;
+}
+
+static FrameRecord_t *
+heap_pop(GPtrArray *heap)
+{
+    FrameRecord_t *top = (FrameRecord_t *)heap->pdata[0];
+    gpointer       last;
+    guint          i, child;
+
+    last = heap->pdata[heap->len - 1];
+    g_ptr_array_set_size(heap, heap->len - 1);
+    if (heap->len == 0)
+        return top;
+    for (i = 0; (child = 2 * i + 1) < heap->len; i = child) {
+        if (child + 1 < heap->len &&
+            frames_compare(&heap->pdata[child + 1], &heap->pdata[child]) < 0)
+            child++;
+        if (frames_compare(&last, &heap->pdata[child]) <= 0)
+            break;
+        heap->pdata[i] = heap->pdata[child];
+    }
+    heap->pdata[i] = last;
+    return top;
+}
+
+/*
+ * Reorder frames in a single pass, holding back the frames read in a heap
+ * until there are more than window_frames of them, or the earliest is more
+ * than window_time older than the latest frame read.  Frames that come
+ * after a later frame has already been written are written out of order,
+ * and counted in *late_count.
+ */
+static guint
+reorder_window(wtap *wth, wtap_dumper *pdh, const char *infile,
+               guint window_frames, const nstime_t *window_time,
+               guint *frame_count, guint *late_count)
+{
+    GPtrArray     *heap;
+    FrameRecord_t *frame;
+    nstime_t       latest, deadline, last_written;
+    nstime_t       prev_time;
+    gboolean       written = FALSE;
+    guint          wrong_order_count = 0;
+    gint64         data_offset;
+    int            err;
+    gchar         *err_info;
+
+    heap = g_ptr_array_sized_new(window_frames != 0 ? window_frames + 1 : 1024);
+    nstime_set_unset(&latest);
+    *frame_count = 0;
+    *late_count = 0;
+    while (wtap_read(wth, &err, &err_info, &data_offset)) {
+        frame = frame_copy(wth, ++*frame_count, data_offset, infile);
+
+        if (*frame_count > 1 && nstime_cmp(&frame->time, &prev_time) < 0) {
+            wrong_order_count++;
+        }
+        prev_time = frame->time;
+        if (written && nstime_cmp(&frame->time, &last_written) < 0) {
+            (*late_count)++;
+        }
+        if (nstime_cmp(&frame->time, &latest) > 0) {
+            latest = frame->time;
+        }
+        heap_push(heap, frame);
+
+        /* Write the frames that have been held back long enough */
+        while (heap->len > 0) {
+            frame = (FrameRecord_t *)heap->pdata[0];
+            if (window_frames == 0 || heap->len <= window_frames) {
+                /* Frames without a time stamp sort first, and go at once */
+                if (window_time == NULL)
+                    break;
+                if (!nstime_is_unset(&frame->time)) {
+                    nstime_sum(&deadline, &frame->time, window_time);
+                    if (nstime_cmp(&deadline, &latest) >= 0)
+                        break;
+                }
+            }
+            frame = heap_pop(heap);
+            dump_or_exit(pdh, frame->phdr, frame->data);
+            last_written = frame->time;
+            written = TRUE;
+            frame_free(frame);
+        }
+    }
+    if (err != 0) {
+        print_read_error("reading", infile, err, err_info);
+    }
+
+    while (heap->len > 0) {
+        frame = heap_pop(heap);
+        dump_or_exit(pdh, frame->phdr, frame->data);
+        frame_free(frame);
+    }
+    g_ptr_array_free(heap, TRUE);
+    return wrong_order_count;
+}
+
+/* Sort the frames and write them to a new run */
+static void
+spill_run(GPtrArray *frames, merge_runs_t *runs, const char *tmpdir)
+{
+    FrameRecord_t *frame;
+    guint          i;
+    int            err;
+    gchar         *err_info = NULL;
+    gboolean       ok;
+
+    g_ptr_array_sort(frames, frames_compare);
+    ok = merge_runs_start(runs, &err);
+    for (i = 0; ok && i < frames->len; i++) {
+        frame = (FrameRecord_t *)frames->pdata[i];
+        ok = merge_runs_write(runs, frame->phdr, frame->data, &err, &err_info);
+    }
+    if (ok)
+        ok = merge_runs_end(runs, &err);
+    if (!ok) {
+        fprintf(stderr, "reordercap: Can't write a temporary file in %s: %s\n",
+                tmpdir != NULL ? tmpdir : g_get_tmp_dir(), wtap_strerror(err));
+        if (err_info != NULL) {
+            fprintf(stderr, "(%s)\n", err_info);
+            g_free(err_info);
+        }
+        merge_runs_free(runs);
+        exit(1);
+    }
+    for (i = 0; i < frames->len; i++) {
+        frame_free((FrameRecord_t *)frames->pdata[i]);
+    }
+    g_ptr_array_set_size(frames, 0);
+}
+
+/*
+ * Sort the frames in a single pass, however many there are: read them in
+ * runs of run_frames frames, sort each run and spill it to a temporary
+ * file, and merge the runs.  If they all fit in one run, it's sorted and
+ * written without a temporary file.
+ */
+static guint
+reorder_external(wtap *wth, wtap_dumper *pdh, const char *infile,
+                 guint run_frames, const char *tmpdir,
+                 gboolean write_output_regardless, guint *frame_count)
+{
+    GPtrArray       *frames;
+    FrameRecord_t   *frame;
+    nstime_t         prev_time;
+    merge_runs_t    *runs = NULL;
+    merge_in_file_t *in_files, *in_file;
+    int              in_file_count;
+    guint            wrong_order_count = 0;
+    guint            i;
+    gint64           data_offset;
+    int              err;
+    gchar           *err_info;
+
+    frames = g_ptr_array_sized_new(run_frames);
+    *frame_count = 0;
+    while (wtap_read(wth, &err, &err_info, &data_offset)) {
+        frame = frame_copy(wth, ++*frame_count, data_offset, infile);
+        if (*frame_count > 1 && nstime_cmp(&frame->time, &prev_time) < 0) {
+            wrong_order_count++;
+        }
+        prev_time = frame->time;
+        g_ptr_array_add(frames, frame);
+
+        if (frames->len == run_frames) {
+            if (runs == NULL)
+                runs = merge_runs_new(tmpdir, wtap_file_encap(wth), wtap_snapshot_length(wth));
+            spill_run(frames, runs, tmpdir);
+        }
+    }
+    if (err != 0) {
+        print_read_error("reading", infile, err, err_info);
+    }
+
+    if (runs == NULL) {
+        /* They all fit in memory */
+        g_ptr_array_sort(frames, frames_compare);
+        for (i = 0; i < frames->len; i++) {
+            frame = (FrameRecord_t *)frames->pdata[i];
+            if (write_output_regardless || (wrong_order_count > 0)) {
+                dump_or_exit(pdh, frame->phdr, frame->data);
+            }
+            frame_free(frame);
+        }
+        g_ptr_array_free(frames, TRUE);
+        return wrong_order_count;
+    }
+
+    if (frames->len > 0)
+        spill_run(frames, runs, tmpdir);
+    g_ptr_array_free(frames, TRUE);
 
-    return nstime_cmp(time1, time2);
+    if (write_output_regardless || (wrong_order_count > 0)) {
+        if (!merge_runs_open(runs, MAX_OPEN_RUNS, &in_file_count, &in_files,
+                             &err, &err_info)) {
+            fprintf(stderr, "reordercap: Can't merge the temporary files in %s: %s\n",
+                    tmpdir != NULL ? tmpdir : g_get_tmp_dir(), wtap_strerror(err));
+            merge_runs_free(runs);
+            exit(1);
+        }
+        while ((in_file = merge_read_packet(in_file_count, in_files, &err,
+                                            &err_info)) != NULL) {
+            if (err != 0) {
+                print_read_error("reading back the temporary file", in_file->filename,
+                                 err, err_info);
+                merge_close_in_files(in_file_count, in_files);
+                merge_runs_free(runs);
+                exit(1);
+            }
+            dump_or_exit(pdh, wtap_phdr(in_file->wth), wtap_buf_ptr(in_file->wth));
+        }
+        merge_close_in_files(in_file_count, in_files);
+        g_free(in_files);
+    }
+    merge_runs_free(runs);
+    return wrong_order_count;
 }
 
 
+static guint
+get_frame_count(const char *string, const char *option)
+{
+    unsigned long number;
+    char *p;
+
+    number = strtoul(string, &p, 10);
+    if (p == string || *p != '\0' || *string == '-' || number == 0 || number > G_MAXUINT) {
+        fprintf(stderr, "reordercap: The number of frames for %s must be a positive number, not \"%s\"\n",
+                option, string);
+        exit(1);
+    }
+    return (guint)number;
+}
+
 /********************************************************************/
 /* Main function.                                                   */
 /********************************************************************/
@@ -172,6 +506,14 @@ int main(int argc, char *argv[])
 
     GPtrArray *frames;
     FrameRecord_t *prevFrame = NULL;
+    guint frame_count, late_count = 0;
+    guint window_frames = 0;
+    nstime_t window_time;
+    gboolean have_window_time = FALSE;
+    guint run_frames = 0;
+    const char *tmpdir = NULL;
+    double seconds;
+    char *p;
 
     int opt;
     int file_count;
@@ -179,11 +521,31 @@ int main(int argc, char *argv[])
     char *outfile;
 
     /* Process the options first */
-    while ((opt = getopt(argc, argv, "hn")) != -1) {
+    while ((opt = getopt(argc, argv, "e:hnt:w:W:")) != -1) {
         switch (opt) {
+            case 'e':
+                run_frames = get_frame_count(optarg, "-e");
+                break;
             case 'n':
                 write_output_regardless = FALSE;
                 break;
+            case 't':
+                tmpdir = optarg;
+                break;
+            case 'w':
+                window_frames = get_frame_count(optarg, "-w");
+                break;
+            case 'W':
+                seconds = strtod(optarg, &p);
+                if (p == optarg || *p != '\0' || !(seconds >= 0.0 && seconds < G_MAXINT32)) {
+                    fprintf(stderr, "reordercap: The time for -W must be a number of seconds, not \"%s\"\n",
+                            optarg);
+                    exit(1);
+                }
+                window_time.secs = (time_t)seconds;
+                window_time.nsecs = (int)((seconds - (double)window_time.secs) * 1000000000.0);
+                have_window_time = TRUE;
+                break;
             case 'h':
                 usage(FALSE);
                 exit(0);
@@ -203,11 +565,22 @@ int main(int argc, char *argv[])
         usage(TRUE);
         exit(1);
     }
+    if ((window_frames != 0 || have_window_time) && run_frames != 0) {
+        fprintf(stderr, "reordercap: -e can't be used with -w or -W\n");
+        exit(1);
+    }
+    if ((window_frames != 0 || have_window_time) && !write_output_regardless) {
+        /* The frames are written before we know whether they were in order */
+        fprintf(stderr, "reordercap: -n can't be used with -w or -W\n");
+        exit(1);
+    }
 
     /* Open infile */
     /* TODO: if reordercap is ever changed to give the user a choice of which
        open_routine reader to use, then the following needs to change. */
-    wth = wtap_open_offline(infile, WTAP_TYPE_AUTO, &err, &err_info, TRUE);
+    /* Only the default mode re-reads frames, so the others work on pipes. */
+    wth = wtap_open_offline(infile, WTAP_TYPE_AUTO, &err, &err_info,
+                            window_frames == 0 && !have_window_time && run_frames == 0);
     if (wth == NULL) {
         fprintf(stderr, "reordercap: Can't open %s: %s\n", infile,
                 wtap_strerror(err));
@@ -229,7 +602,7 @@ int main(int argc, char *argv[])
 
     /* Open outfile (same filetype/encap as input file) */
     pdh = wtap_dump_open_ng(outfile, wtap_file_type_subtype(wth), wtap_file_encap(wth),
-                            65535, FALSE, shb_hdr, idb_inf, &err);
+                            65535, WTAP_UNCOMPRESSED, shb_hdr, idb_inf, &err);
     g_free(idb_inf);
     if (pdh == NULL) {
         fprintf(stderr, "reordercap: Failed to open output file: (%s) - error %s\n",
@@ -238,8 +611,33 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
-    /* Allocate the array of frame pointers. */
-    frames = g_ptr_array_new();
+    if (window_frames != 0 || have_window_time) {
+        wrong_order_count = reorder_window(wth, pdh, infile, window_frames,
+                                           have_window_time ? &window_time : NULL,
+                                           &frame_count, &late_count);
+        printf("%u frames, %u out of order\n", frame_count, wrong_order_count);
+        if (late_count > 0) {
+            fprintf(stderr, "reordercap: %u frames were further out of order than the window, and were written out of order\n",
+                    late_count);
+        }
+        goto close;
+    }
+    if (run_frames != 0) {
+        wrong_order_count = reorder_external(wth, pdh, infile, run_frames, tmpdir,
+                                             write_output_regardless, &frame_count);
+        printf("%u frames, %u out of order\n", frame_count, wrong_order_count);
+        if (!write_output_regardless && (wrong_order_count == 0)) {
+            printf("Not writing output file because input file is already in order!\n");
+        }
+        goto close;
+    }
+
+    /* Allocate the array of frame pointers, sized up front if the file
+       says how many frames there are. */
+    if (wtap_packet_count(wth) > 0)
+        frames = g_ptr_array_sized_new((guint)wtap_packet_count(wth));
+    else
+        frames = g_ptr_array_new();
 
     /* Read each frame from infile */
     while (wtap_read(wth, &err, &err_info, &data_offset)) {
@@ -250,6 +648,8 @@ int main(int argc, char *argv[])
         newFrameRecord = g_slice_new(FrameRecord_t);
         newFrameRecord->num = frames->len + 1;
         newFrameRecord->offset = data_offset;
+        newFrameRecord->phdr = NULL;
+        newFrameRecord->data = NULL;
         if (phdr->presence_flags & WTAP_HAS_TS) {
             newFrameRecord->time = phdr->ts;
         } else {
@@ -265,18 +665,7 @@ int main(int argc, char *argv[])
     }
     if (err != 0) {
       /* Print a message noting that the read failed somewhere along the line. */
-      fprintf(stderr,
-              "reordercap: An error occurred while reading \"%s\": %s.\n",
-              infile, wtap_strerror(err));
-      switch (err) {
-
-      case WTAP_ERR_UNSUPPORTED:
-      case WTAP_ERR_UNSUPPORTED_ENCAP:
-      case WTAP_ERR_BAD_FILE:
-          fprintf(stderr, "(%s)\n", err_info);
-          g_free(err_info);
-          break;
-      }
+      print_read_error("reading", infile, err, err_info);
     }
 
     printf("%u frames, %u out of order\n", frames->len, wrong_order_count);
@@ -306,6 +695,7 @@ int main(int argc, char *argv[])
     /* Free the whole array */
     g_ptr_array_free(frames, TRUE);
 
+close:
     /* Close outfile */
     if (!wtap_dump_close(pdh, &err)) {
         fprintf(stderr, "reordercap: Error closing %s: %s\n", outfile,
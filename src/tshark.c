@@ -3018,7 +3018,7 @@ process_packet_first_pass(capture_file *cf, epan_dissect_t *edt,
 
 static gboolean
 process_packet_second_pass(capture_file *cf, epan_dissect_t *edt, frame_data *fdata,
-               struct wtap_pkthdr *phdr, Buffer *buf,
+               struct wtap_pkthdr *phdr, const guint8 *pd,
                guint tap_flags)
 {
   column_info    *cinfo;
@@ -3063,7 +3063,7 @@ process_packet_second_pass(capture_file *cf, epan_dissect_t *edt, frame_data *fd
       ref = &ref_frame;
     }
 
-    epan_dissect_run_with_taps(edt, cf->cd_t, phdr, frame_tvbuff_new_buffer(fdata, buf), fdata, cinfo);
+    epan_dissect_run_with_taps(edt, cf->cd_t, phdr, frame_tvbuff_new(fdata, pd), fdata, cinfo);
 
     /* Run the read/display filter if we have one. */
     if (cf->dfcode)
@@ -3116,6 +3116,24 @@ process_packet_second_pass(capture_file *cf, epan_dissect_t *edt, frame_data *fd
   return passed || fdata->flags.dependent_of_displayed;
 }
 
+/* Records read from the file at a time */
+#define LOAD_BATCH_RECORDS  256
+#define LOAD_BATCH_BYTES    (1024 * 1024)
+
+/*
+ * Step *rec on to the next record in batch, reading the next batch if
+ * this one's used up.  Start with the batch empty.
+ */
+static gboolean
+read_next_record(wtap *wth, wtap_batch *batch, guint *rec, int *err,
+                 gchar **err_info)
+{
+  if (batch->count != 0 && ++*rec < batch->count)
+    return TRUE;
+  *rec = 0;
+  return wtap_read_batch(wth, batch, LOAD_BATCH_RECORDS, err, err_info);
+}
+
 static int
 load_cap_file(capture_file *cf, char *save_file, int out_file_type,
     gboolean out_file_name_res, int max_packet_count, gint64 max_byte_count)
@@ -3127,6 +3145,8 @@ load_cap_file(capture_file *cf, char *save_file, int out_file_type,
   int          err;
   gchar       *err_info = NULL;
   gint64       data_offset;
+  wtap_batch  *batch;
+  guint        rec = 0;
   char        *save_file_string = NULL;
   gboolean     filtering_tap_listeners;
   guint        tap_flags;
@@ -3135,6 +3155,7 @@ load_cap_file(capture_file *cf, char *save_file, int out_file_type,
   char         appname[100];
   struct wtap_pkthdr phdr;
   Buffer       buf;
+  const guint8 *pd;
   epan_dissect_t *edt = NULL;
 
   memset(&phdr, 0, sizeof(struct wtap_pkthdr));
@@ -3169,10 +3190,10 @@ load_cap_file(capture_file *cf, char *save_file, int out_file_type,
     if (linktype != WTAP_ENCAP_PER_PACKET &&
         out_file_type == WTAP_FILE_TYPE_SUBTYPE_PCAP)
         pdh = wtap_dump_open(save_file, out_file_type, linktype,
-            snapshot_length, FALSE /* compressed */, &err);
+            snapshot_length, WTAP_UNCOMPRESSED, &err);
     else
         pdh = wtap_dump_open_ng(save_file, out_file_type, linktype,
-            snapshot_length, FALSE /* compressed */, shb_hdr, idb_inf, &err);
+            snapshot_length, WTAP_UNCOMPRESSED, shb_hdr, idb_inf, &err);
 
     g_free(idb_inf);
     idb_inf = NULL;
@@ -3246,9 +3267,11 @@ load_cap_file(capture_file *cf, char *save_file, int out_file_type,
       edt = epan_dissect_new(cf->epan, create_proto_tree, FALSE);
     }
 
-    while (wtap_read(cf->wth, &err, &err_info, &data_offset)) {
-      if (process_packet_first_pass(cf, edt, data_offset, wtap_phdr(cf->wth),
-                         wtap_buf_ptr(cf->wth))) {
+    batch = wtap_batch_new(LOAD_BATCH_RECORDS, LOAD_BATCH_BYTES);
+    while (read_next_record(cf->wth, batch, &rec, &err, &err_info)) {
+      data_offset = batch->offsets[rec];
+      if (process_packet_first_pass(cf, edt, data_offset, &batch->phdrs[rec],
+                         batch->data[rec])) {
         /* Stop reading if we have the maximum number of packets;
          * When the -c option has not been used, max_packet_count
          * starts at 0, which practically means, never stop reading.
@@ -3260,6 +3283,7 @@ load_cap_file(capture_file *cf, char *save_file, int out_file_type,
         }
       }
     }
+    wtap_batch_free(batch);
 
     if (edt) {
       epan_dissect_free(edt);
@@ -3295,15 +3319,15 @@ load_cap_file(capture_file *cf, char *save_file, int out_file_type,
 
     for (framenum = 1; err == 0 && framenum <= cf->count; framenum++) {
       fdata = frame_data_sequence_find(cf->frames, framenum);
-      if (wtap_seek_read(cf->wth, fdata->file_off, &phdr, &buf, &err,
-                         &err_info)) {
-        if (process_packet_second_pass(cf, edt, fdata, &phdr, &buf,
+      if (wtap_seek_read_mapped(cf->wth, fdata->file_off, &phdr, &buf, &pd,
+                                &err, &err_info)) {
+        if (process_packet_second_pass(cf, edt, fdata, &phdr, pd,
                                        tap_flags)) {
           /* Either there's no read filtering or this packet passed the
              filter, so, if we're writing to a capture file, write
              this packet out. */
           if (pdh != NULL) {
-            if (!wtap_dump(pdh, &phdr, buffer_start_ptr(&buf), &err)) {
+            if (!wtap_dump(pdh, &phdr, pd, &err)) {
               /* Error writing to a capture file */
               switch (err) {
 
@@ -3376,17 +3400,19 @@ load_cap_file(capture_file *cf, char *save_file, int out_file_type,
       edt = epan_dissect_new(cf->epan, create_proto_tree, print_packet_info && print_details);
     }
 
-    while (wtap_read(cf->wth, &err, &err_info, &data_offset)) {
+    batch = wtap_batch_new(LOAD_BATCH_RECORDS, LOAD_BATCH_BYTES);
+    while (read_next_record(cf->wth, batch, &rec, &err, &err_info)) {
       framenum++;
+      data_offset = batch->offsets[rec];
 
-      if (process_packet(cf, edt, data_offset, wtap_phdr(cf->wth),
-                         wtap_buf_ptr(cf->wth),
+      if (process_packet(cf, edt, data_offset, &batch->phdrs[rec],
+                         batch->data[rec],
                          tap_flags)) {
         /* Either there's no read filtering or this packet passed the
            filter, so, if we're writing to a capture file, write
            this packet out. */
         if (pdh != NULL) {
-          if (!wtap_dump(pdh, wtap_phdr(cf->wth), wtap_buf_ptr(cf->wth), &err)) {
+          if (!wtap_dump(pdh, &batch->phdrs[rec], batch->data[rec], &err)) {
             /* Error writing to a capture file */
             switch (err) {
 
@@ -3434,6 +3460,7 @@ load_cap_file(capture_file *cf, char *save_file, int out_file_type,
         break;
       }
     }
+    wtap_batch_free(batch);
 
     if (edt) {
       epan_dissect_free(edt);
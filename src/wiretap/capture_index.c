@@ -0,0 +1,629 @@
+/* capture_index.c
+ * Index sidecars, so that records can be found without reading up to them
+ *
+ * Wiretap Library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * The first time a capture file is read from start to end, we note
+ * where every Nth record is and the range of the time stamps from there
+ * to the next one, and, along with the seek points the compressed-file
+ * code gathered, write that to a sidecar named after the file.  Opening
+ * the file again loads it, provided the file's size, modification time
+ * and a hash of its first and last 64 KiB still match; then the record
+ * count is known up front, wtap_seek_to_packet() works for formats that
+ * have no index of their own, and wtap_seek_to_time() can skip records
+ * by their time stamps, even in compressed files.
+ *
+ * The sidecar is little-endian:
+ *
+ *	header, as laid out by the CAPTURE_INDEX_HDR_ offsets below
+ *	nsamples samples, CAPTURE_INDEX_SAMPLE_SIZE bytes each: the
+ *	    data offset of record i * interval, and the earliest and latest
+ *	    time stamps of the records from there to the next sample
+ *	the compressed-file seek points, as file_fast_seek_save() has them
+ *
+ * Reading from a sample's offset on is only right for formats whose
+ * reader keeps no state from one record to the next but what it got
+ * when the file was opened; for pcapng, that holds only until the first
+ * interface description that follows a packet, so samples from there on
+ * are kept for their time stamps alone.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <wsutil/file_util.h>
+#include <wsutil/pint.h>
+#include <wsutil/sha1.h>
+
+#include "wtap-int.h"
+#include "file_wrappers.h"
+#include "capture_index.h"
+
+#define CAPTURE_INDEX_MAGIC		"WTAPIDX1"
+#define CAPTURE_INDEX_VERSION		1
+#define CAPTURE_INDEX_INTERVAL		1024
+#define CAPTURE_INDEX_HASH_SPAN		65536	/* bytes hashed at each end */
+
+#define CAPTURE_INDEX_HDR_MAGIC		0	/* 8 bytes */
+#define CAPTURE_INDEX_HDR_VERSION	8	/* guint32 */
+#define CAPTURE_INDEX_HDR_INTERVAL	12	/* guint32 */
+#define CAPTURE_INDEX_HDR_FILE_SIZE	16	/* guint64 */
+#define CAPTURE_INDEX_HDR_MTIME		24	/* gint64 */
+#define CAPTURE_INDEX_HDR_DIGEST	32	/* SHA-1 of the ends of the file */
+#define CAPTURE_INDEX_HDR_TYPE		52	/* guint32 file_type_subtype */
+#define CAPTURE_INDEX_HDR_RECORDS	56	/* guint64 */
+#define CAPTURE_INDEX_HDR_SAMPLES	64	/* guint32 */
+#define CAPTURE_INDEX_HDR_SEEKABLE	68	/* guint32 samples reads can start at */
+#define CAPTURE_INDEX_HDR_SIZE		72
+
+#define CAPTURE_INDEX_SAMPLE_SIZE	32	/* offset, then min and max as
+						   gint64 secs, gint32 nsecs */
+
+#define SHA1_DIGEST_LEN			20
+
+/* Wider than nstime_t, so that there's room for -inf and +inf */
+struct index_ts {
+	gint64 secs;
+	gint32 nsecs;
+};
+
+static const struct index_ts ts_minus_inf = { G_MININT64, 0 };
+static const struct index_ts ts_plus_inf = { G_MAXINT64, 0 };
+
+struct index_sample {
+	gint64 offset;		/* of its first record, as wtap_read() gave it */
+	struct index_ts min;	/* of the records up to the next sample; a */
+	struct index_ts max;	/* record without a time stamp makes them -inf and +inf */
+};
+
+struct capture_index {
+	gchar *filename;	/* of the capture file */
+	guint interval;
+	gint64 file_size;	/* of the capture file, when it was opened */
+	gint64 mtime;
+	GArray *samples;	/* struct index_sample */
+	guint nseekable;	/* samples a read can start at */
+	gboolean resumable;	/* reads can start at a record at all */
+	guint nifaces;		/* interfaces known when the file was opened */
+	gint64 cur;		/* record wtap_read() returns next; -1 if unknown */
+	gboolean building;	/* reading through from the first record */
+	guint64 nrecords;	/* once known */
+	struct index_ts *prefix_max;	/* prefix_max[i]: latest before sample i */
+	struct index_ts *suffix_min;	/* suffix_min[i]: earliest from sample i on */
+};
+
+/* Programs say whether they want sidecars; until then, the environment does */
+static gint index_sidecar = -1;	/* -1 if not yet known */
+
+void
+wtap_set_index_sidecar(gboolean on)
+{
+	index_sidecar = on ? 1 : 0;
+}
+
+gboolean
+capture_index_enabled(void)
+{
+	if (index_sidecar == -1)
+		index_sidecar = getenv("WIRESHARK_INDEX_SIDECAR") != NULL;
+	return index_sidecar;
+}
+
+static int
+ts_cmp(const struct index_ts *a, const struct index_ts *b)
+{
+	if (a->secs != b->secs)
+		return a->secs < b->secs ? -1 : 1;
+	if (a->nsecs != b->nsecs)
+		return a->nsecs < b->nsecs ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Can a read start at any record of this format, without having read
+ * the ones before it?
+ */
+static gboolean
+format_is_resumable(int file_type_subtype)
+{
+	switch (file_type_subtype) {
+
+	case WTAP_FILE_TYPE_SUBTYPE_PCAP:
+	case WTAP_FILE_TYPE_SUBTYPE_PCAP_NSEC:
+	case WTAP_FILE_TYPE_SUBTYPE_PCAP_AIX:
+	case WTAP_FILE_TYPE_SUBTYPE_PCAP_SS991029:
+	case WTAP_FILE_TYPE_SUBTYPE_PCAP_NOKIA:
+	case WTAP_FILE_TYPE_SUBTYPE_PCAP_SS990417:
+	case WTAP_FILE_TYPE_SUBTYPE_PCAP_SS990915:
+	case WTAP_FILE_TYPE_SUBTYPE_PCAPNG:
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+
+static gboolean
+read_at(int fd, gint64 off, guint8 *buf, guint len)
+{
+	if (ws_lseek64(fd, off, SEEK_SET) == -1)
+		return FALSE;
+	return ws_read(fd, buf, len) == (int)len;
+}
+
+/* Hash the first and last CAPTURE_INDEX_HASH_SPAN bytes of the file */
+static gboolean
+file_digest(const char *filename, gint64 size, guint8 *digest)
+{
+	sha1_context ctx;
+	guint8 *buf;
+	guint len;
+	int fd;
+	gboolean ok;
+
+	if ((fd = ws_open(filename, O_RDONLY|O_BINARY, 0000)) == -1)
+		return FALSE;
+	buf = (guint8 *)g_malloc(CAPTURE_INDEX_HASH_SPAN);
+	len = (guint)MIN(size, CAPTURE_INDEX_HASH_SPAN);
+	sha1_starts(&ctx);
+	ok = read_at(fd, 0, buf, len);
+	if (ok) {
+		sha1_update(&ctx, buf, len);
+		ok = read_at(fd, size - len, buf, len);
+	}
+	if (ok) {
+		sha1_update(&ctx, buf, len);
+		sha1_finish(&ctx, digest);
+	}
+	g_free(buf);
+	ws_close(fd);
+	return ok;
+}
+
+static gboolean
+file_stat(const char *filename, gint64 *size, gint64 *mtime)
+{
+	ws_statb64 statb;
+
+	if (ws_stat64(filename, &statb) != 0)
+		return FALSE;
+	*size = statb.st_size;
+	*mtime = statb.st_mtime;
+	return TRUE;
+}
+
+/* Work out what time seeks go by, once the samples are all there */
+static void
+index_complete(struct capture_index *idx, guint64 nrecords)
+{
+	struct index_sample *s = (struct index_sample *)(void *)idx->samples->data;
+	guint n = idx->samples->len, i;
+
+	idx->nrecords = nrecords;
+	idx->prefix_max = g_new(struct index_ts, n + 1);
+	idx->suffix_min = g_new(struct index_ts, n + 1);
+	idx->prefix_max[0] = ts_minus_inf;
+	for (i = 0; i < n; i++)
+		idx->prefix_max[i + 1] = ts_cmp(&s[i].max, &idx->prefix_max[i]) > 0 ?
+		    s[i].max : idx->prefix_max[i];
+	idx->suffix_min[n] = ts_plus_inf;
+	for (i = n; i-- > 0; )
+		idx->suffix_min[i] = ts_cmp(&s[i].min, &idx->suffix_min[i + 1]) < 0 ?
+		    s[i].min : idx->suffix_min[i + 1];
+}
+
+static void
+put_le32(guint8 *p, guint32 v)
+{
+	p[0] = (guint8)v;
+	p[1] = (guint8)(v >> 8);
+	p[2] = (guint8)(v >> 16);
+	p[3] = (guint8)(v >> 24);
+}
+
+static void
+put_le64(guint8 *p, guint64 v)
+{
+	put_le32(p, (guint32)v);
+	put_le32(p + 4, (guint32)(v >> 32));
+}
+
+static void
+put_ts(guint8 *p, const struct index_ts *ts)
+{
+	put_le64(p, (guint64)ts->secs);
+	put_le32(p + 8, (guint32)ts->nsecs);
+}
+
+static void
+get_ts(const guint8 *p, struct index_ts *ts)
+{
+	ts->secs = (gint64)pletoh64(p);
+	ts->nsecs = (gint32)pletoh32(p + 8);
+}
+
+static gboolean
+index_load(wtap *wth, struct capture_index *idx)
+{
+	gchar *path, *contents;
+	gsize len;
+	const guint8 *p;
+	guint8 digest[SHA1_DIGEST_LEN];
+	guint32 interval, nsamples, nseekable, i;
+	guint64 nrecords;
+	struct index_sample *s;
+	GPtrArray *points;
+	gboolean ok = FALSE;
+
+	path = g_strconcat(idx->filename, CAPTURE_INDEX_SUFFIX, NULL);
+	ok = g_file_get_contents(path, &contents, &len, NULL);
+	g_free(path);
+	if (!ok)
+		return FALSE;
+	ok = FALSE;
+	p = (const guint8 *)contents;
+	if (len < CAPTURE_INDEX_HDR_SIZE ||
+	    memcmp(p + CAPTURE_INDEX_HDR_MAGIC, CAPTURE_INDEX_MAGIC, 8) != 0 ||
+	    pletoh32(p + CAPTURE_INDEX_HDR_VERSION) != CAPTURE_INDEX_VERSION)
+		goto done;
+
+	/* is it still this file's? */
+	if ((gint64)pletoh64(p + CAPTURE_INDEX_HDR_FILE_SIZE) != idx->file_size ||
+	    (gint64)pletoh64(p + CAPTURE_INDEX_HDR_MTIME) != idx->mtime ||
+	    (int)pletoh32(p + CAPTURE_INDEX_HDR_TYPE) != wth->file_type_subtype ||
+	    !file_digest(idx->filename, idx->file_size, digest) ||
+	    memcmp(p + CAPTURE_INDEX_HDR_DIGEST, digest, SHA1_DIGEST_LEN) != 0)
+		goto done;
+
+	interval = pletoh32(p + CAPTURE_INDEX_HDR_INTERVAL);
+	nrecords = pletoh64(p + CAPTURE_INDEX_HDR_RECORDS);
+	nsamples = pletoh32(p + CAPTURE_INDEX_HDR_SAMPLES);
+	nseekable = pletoh32(p + CAPTURE_INDEX_HDR_SEEKABLE);
+	if (interval == 0 || nrecords > G_MAXINT64 ||
+	    nsamples != (nrecords + interval - 1) / interval ||
+	    nseekable > nsamples ||
+	    (len - CAPTURE_INDEX_HDR_SIZE) / CAPTURE_INDEX_SAMPLE_SIZE < nsamples)
+		goto done;
+	p += CAPTURE_INDEX_HDR_SIZE;
+	len -= CAPTURE_INDEX_HDR_SIZE;
+
+	g_array_set_size(idx->samples, nsamples);
+	s = (struct index_sample *)(void *)idx->samples->data;
+	for (i = 0; i < nsamples; i++, p += CAPTURE_INDEX_SAMPLE_SIZE) {
+		s[i].offset = (gint64)pletoh64(p);
+		get_ts(p + 8, &s[i].min);
+		get_ts(p + 20, &s[i].max);
+		if (s[i].offset < 0 || (i > 0 && s[i].offset <= s[i - 1].offset))
+			goto done;
+	}
+	len -= (gsize)nsamples * CAPTURE_INDEX_SAMPLE_SIZE;
+
+	/* a file this build can't decompress is no use to us anyway */
+	if ((points = file_fast_seek_load(p, len)) == NULL)
+		goto done;
+	if (wth->fast_seek != NULL) {
+		for (i = 0; i < wth->fast_seek->len; i++)
+			g_free(wth->fast_seek->pdata[i]);
+		g_ptr_array_set_size(wth->fast_seek, 0);
+		for (i = 0; i < points->len; i++)
+			g_ptr_array_add(wth->fast_seek, points->pdata[i]);
+		g_ptr_array_free(points, TRUE);
+	} else {
+		for (i = 0; i < points->len; i++)
+			g_free(points->pdata[i]);
+		g_ptr_array_free(points, TRUE);
+	}
+
+	idx->interval = interval;
+	idx->nseekable = idx->resumable ? nseekable : 0;
+	index_complete(idx, nrecords);
+	if (wth->packet_count == -1)
+		wth->packet_count = (gint64)nrecords;
+	ok = TRUE;
+
+done:
+	if (!ok)
+		g_array_set_size(idx->samples, 0);
+	g_free(contents);
+	return ok;
+}
+
+static void
+index_save(wtap *wth, struct capture_index *idx)
+{
+	gchar *path;
+	GByteArray *buf;
+	guint8 digest[SHA1_DIGEST_LEN];
+	guint8 *p;
+	struct index_sample *s = (struct index_sample *)(void *)idx->samples->data;
+	gint64 size, mtime;
+	guint i;
+
+	/* don't index a file that was still being written to */
+	if (!file_stat(idx->filename, &size, &mtime) ||
+	    size != idx->file_size || mtime != idx->mtime ||
+	    !file_digest(idx->filename, size, digest))
+		return;
+
+	buf = g_byte_array_sized_new(CAPTURE_INDEX_HDR_SIZE +
+	    idx->samples->len * CAPTURE_INDEX_SAMPLE_SIZE);
+	g_byte_array_set_size(buf, CAPTURE_INDEX_HDR_SIZE +
+	    idx->samples->len * CAPTURE_INDEX_SAMPLE_SIZE);
+	p = buf->data;
+	memcpy(p + CAPTURE_INDEX_HDR_MAGIC, CAPTURE_INDEX_MAGIC, 8);
+	put_le32(p + CAPTURE_INDEX_HDR_VERSION, CAPTURE_INDEX_VERSION);
+	put_le32(p + CAPTURE_INDEX_HDR_INTERVAL, idx->interval);
+	put_le64(p + CAPTURE_INDEX_HDR_FILE_SIZE, (guint64)size);
+	put_le64(p + CAPTURE_INDEX_HDR_MTIME, (guint64)mtime);
+	memcpy(p + CAPTURE_INDEX_HDR_DIGEST, digest, SHA1_DIGEST_LEN);
+	put_le32(p + CAPTURE_INDEX_HDR_TYPE, (guint32)wth->file_type_subtype);
+	put_le64(p + CAPTURE_INDEX_HDR_RECORDS, idx->nrecords);
+	put_le32(p + CAPTURE_INDEX_HDR_SAMPLES, idx->samples->len);
+	put_le32(p + CAPTURE_INDEX_HDR_SEEKABLE, idx->nseekable);
+	p += CAPTURE_INDEX_HDR_SIZE;
+	for (i = 0; i < idx->samples->len; i++, p += CAPTURE_INDEX_SAMPLE_SIZE) {
+		put_le64(p, (guint64)s[i].offset);
+		put_ts(p + 8, &s[i].min);
+		put_ts(p + 20, &s[i].max);
+	}
+	if (wth->fast_seek != NULL)
+		file_fast_seek_save(wth->fast_seek, buf);
+	else
+		g_byte_array_append(buf, (const guint8 *)"\0\0\0\0", 4);
+
+	/*
+	 * It's only an index; if we can't write it next to the file, we
+	 * just won't have it next time.
+	 */
+	path = g_strconcat(idx->filename, CAPTURE_INDEX_SUFFIX, NULL);
+	(void)g_file_set_contents(path, (const gchar *)buf->data, buf->len,
+	    NULL);
+	g_free(path);
+	g_byte_array_free(buf, TRUE);
+}
+
+void
+capture_index_open(wtap *wth, const char *filename)
+{
+	struct capture_index *idx;
+
+	if (!capture_index_enabled())
+		return;
+
+	idx = g_new0(struct capture_index, 1);
+	if (!file_stat(filename, &idx->file_size, &idx->mtime)) {
+		g_free(idx);
+		return;
+	}
+	idx->filename = g_strdup(filename);
+	idx->interval = CAPTURE_INDEX_INTERVAL;
+	idx->samples = g_array_new(FALSE, FALSE, sizeof(struct index_sample));
+	idx->resumable = format_is_resumable(wth->file_type_subtype);
+	idx->nifaces = wth->interface_data->len;
+	idx->cur = 0;
+	wth->index = idx;
+
+	if (!index_load(wth, idx))
+		idx->building = TRUE;
+}
+
+void
+capture_index_add(wtap *wth, const struct wtap_pkthdr *phdr,
+    gint64 data_offset)
+{
+	struct capture_index *idx = wth->index;
+	struct index_sample *s;
+	struct index_ts ts;
+
+	if (idx == NULL)
+		return;
+
+	if (idx->building) {
+		if (idx->cur % idx->interval == 0) {
+			g_array_set_size(idx->samples, idx->samples->len + 1);
+			s = &g_array_index(idx->samples, struct index_sample,
+			    idx->samples->len - 1);
+			s->offset = data_offset;
+			s->min = ts_plus_inf;
+			s->max = ts_minus_inf;
+
+			/* a read can't start past an interface added since opening */
+			if (idx->resumable &&
+			    idx->nseekable == idx->samples->len - 1 &&
+			    wth->interface_data->len == idx->nifaces)
+				idx->nseekable = idx->samples->len;
+		} else
+			s = &g_array_index(idx->samples, struct index_sample,
+			    idx->samples->len - 1);
+
+		if (phdr->presence_flags & WTAP_HAS_TS) {
+			ts.secs = phdr->ts.secs;
+			ts.nsecs = phdr->ts.nsecs;
+			if (ts_cmp(&ts, &s->min) < 0)
+				s->min = ts;
+			if (ts_cmp(&ts, &s->max) > 0)
+				s->max = ts;
+		} else {
+			s->min = ts_minus_inf;
+			s->max = ts_plus_inf;
+		}
+	}
+	if (idx->cur != -1)
+		idx->cur++;
+}
+
+void
+capture_index_eof(wtap *wth)
+{
+	struct capture_index *idx = wth->index;
+
+	if (idx == NULL || !idx->building)
+		return;
+
+	idx->building = FALSE;
+	index_complete(idx, (guint64)idx->cur);
+
+	/* a file too small to skip through isn't worth a sidecar */
+	if (idx->samples->len > 1 ||
+	    (wth->fast_seek != NULL && wth->fast_seek->len > 1))
+		index_save(wth, idx);
+}
+
+void
+capture_index_moved(wtap *wth, gint64 packet_num)
+{
+	struct capture_index *idx = wth->index;
+
+	if (idx == NULL)
+		return;
+
+	/* the samples so far still hold, but there won't be any more */
+	if (idx->cur != packet_num)
+		idx->building = FALSE;
+	idx->cur = packet_num;
+}
+
+gboolean
+capture_index_seek_packet(wtap *wth, guint64 packet_num, int *err,
+    gchar **err_info)
+{
+	struct capture_index *idx = wth->index;
+	struct index_sample *s;
+	guint64 from;
+	guint i;
+	gint64 data_offset;
+
+	*err = 0;
+	if (idx == NULL || idx->nseekable == 0)
+		return FALSE;
+
+	/* start from the sample before it, unless we're closer already */
+	i = (guint)MIN(packet_num / idx->interval, idx->nseekable - 1);
+	from = (guint64)i * idx->interval;
+	if (idx->cur == -1 || (guint64)idx->cur > packet_num ||
+	    (guint64)idx->cur < from) {
+		s = &g_array_index(idx->samples, struct index_sample, i);
+		if (file_seek(wth->fh, s->offset, SEEK_SET, err) == -1) {
+			capture_index_moved(wth, -1);
+			return FALSE;
+		}
+		capture_index_moved(wth, (gint64)from);
+	}
+
+	while ((guint64)idx->cur < packet_num) {
+		if (!wtap_read(wth, err, err_info, &data_offset)) {
+			if (*err != 0) {
+				capture_index_moved(wth, -1);
+				return FALSE;
+			}
+			break;	/* it's past the end, so we're at the end */
+		}
+	}
+	return TRUE;
+}
+
+gboolean
+capture_index_seek_time(wtap *wth, const nstime_t *ts, guint64 *packet_num,
+    int *err, gchar **err_info)
+{
+	struct capture_index *idx = wth->index;
+	struct index_ts t;
+	guint lo, hi, mid;
+
+	*err = 0;
+	if (idx == NULL || idx->prefix_max == NULL)
+		return FALSE;
+
+	/* the last sample everything before which is earlier than ts */
+	t.secs = ts->secs;
+	t.nsecs = ts->nsecs;
+	for (lo = 0, hi = idx->samples->len; lo < hi; ) {
+		mid = lo + (hi - lo + 1) / 2;
+		if (ts_cmp(&idx->prefix_max[mid], &t) < 0)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	*packet_num = lo == idx->samples->len ? idx->nrecords :
+	    (guint64)lo * idx->interval;
+	return wtap_seek_to_packet(wth, *packet_num, err, err_info);
+}
+
+gint64
+capture_index_time_stop_packet(wtap *wth, const nstime_t *ts)
+{
+	struct capture_index *idx = wth->index;
+	struct index_ts t;
+	guint lo, hi, mid;
+
+	if (idx == NULL || idx->suffix_min == NULL)
+		return -1;
+
+	/* the first sample everything from which on is at or after ts */
+	t.secs = ts->secs;
+	t.nsecs = ts->nsecs;
+	for (lo = 0, hi = idx->samples->len; lo < hi; ) {
+		mid = lo + (hi - lo) / 2;
+		if (ts_cmp(&idx->suffix_min[mid], &t) >= 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo == idx->samples->len ? (gint64)idx->nrecords :
+	    (gint64)lo * idx->interval;
+}
+
+void
+capture_index_free(wtap *wth)
+{
+	struct capture_index *idx = wth->index;
+
+	if (idx == NULL)
+		return;
+
+	g_free(idx->filename);
+	g_array_free(idx->samples, TRUE);
+	g_free(idx->prefix_max);
+	g_free(idx->suffix_min);
+	g_free(idx);
+	wth->index = NULL;
+}
+
+/*
+ * Editor modelines  -  http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -0,0 +1,57 @@
+/* capture_index.h
+ * Index sidecars, so that records can be found without reading up to them
+ *
+ * Wiretap Library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __CAPTURE_INDEX_H__
+#define __CAPTURE_INDEX_H__
+
+#include <glib.h>
+#include "wtap.h"
+
+/* Suffix added to a capture file's name to get its sidecar's */
+#define CAPTURE_INDEX_SUFFIX	".wtidx"
+
+gboolean capture_index_enabled(void);
+
+/*
+ * Called once the file's format is known; loads the sidecar if there's
+ * one that matches the file, and otherwise starts building one.
+ */
+void capture_index_open(wtap *wth, const char *filename);
+
+/* Called for each record wtap_read() returns, and at its EOF */
+void capture_index_add(wtap *wth, const struct wtap_pkthdr *phdr,
+    gint64 data_offset);
+void capture_index_eof(wtap *wth);
+
+/*
+ * Called when the sequential reader has been put at record packet_num,
+ * other than by reading up to it; -1 if it's not known where it is.
+ */
+void capture_index_moved(wtap *wth, gint64 packet_num);
+
+gboolean capture_index_seek_packet(wtap *wth, guint64 packet_num, int *err,
+    gchar **err_info);
+gboolean capture_index_seek_time(wtap *wth, const nstime_t *ts,
+    guint64 *packet_num, int *err, gchar **err_info);
+gint64 capture_index_time_stop_packet(wtap *wth, const nstime_t *ts);
+
+void capture_index_free(wtap *wth);
+
+#endif /* __CAPTURE_INDEX_H__ */
@@ -18,6 +18,11 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+/* Before any header, or it may be too late; otherwise O_DIRECT won't be defined */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include "config.h"
 
 #include <stdio.h>
@@ -38,6 +43,7 @@
 
 #include "wtap-int.h"
 #include "file_wrappers.h"
+#include "capture_index.h"
 #include <wsutil/buffer.h>
 #include "lanalyzer.h"
 #include "ngsniffer.h"
@@ -286,6 +292,93 @@ GSList *wtap_get_all_file_extensions_list(void)
 	return extensions;
 }
 
+/*
+ * What the files each of the routines with a fixed magic number at the
+ * start of the file handles start with, in both byte orders where the
+ * format has both.  The routines check these themselves as well.
+ */
+static const struct open_info_magic pcap_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("\xa1\xb2\xc3\xd4"),	/* PCAP_MAGIC */
+	OPEN_INFO_MAGIC_BYTES("\xd4\xc3\xb2\xa1"),
+	OPEN_INFO_MAGIC_BYTES("\xa1\xb2\xcd\x34"),	/* PCAP_MODIFIED_MAGIC */
+	OPEN_INFO_MAGIC_BYTES("\x34\xcd\xb2\xa1"),
+	OPEN_INFO_MAGIC_BYTES("\xa1\xb2\x3c\x4d"),	/* PCAP_NSEC_MAGIC */
+	OPEN_INFO_MAGIC_BYTES("\x4d\x3c\xb2\xa1"),
+	{ NULL, 0 }
+};
+static const struct open_info_magic pcapng_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("\x0a\x0d\x0d\x0a"),	/* Section Header Block */
+	{ NULL, 0 }
+};
+static const struct open_info_magic ngsniffer_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("TRSNIFF data    \x1a"),
+	{ NULL, 0 }
+};
+static const struct open_info_magic snoop_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("snoop\0\0\0"),
+	{ NULL, 0 }
+};
+static const struct open_info_magic iptrace_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("iptrace 1.0"),
+	OPEN_INFO_MAGIC_BYTES("iptrace 2.0"),
+	{ NULL, 0 }
+};
+static const struct open_info_magic netmon_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("RTSS"),
+	OPEN_INFO_MAGIC_BYTES("GMBU"),
+	{ NULL, 0 }
+};
+static const struct open_info_magic netxray_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("XCP\0"),
+	OPEN_INFO_MAGIC_BYTES("VL\0\0"),
+	{ NULL, 0 }
+};
+static const struct open_info_magic nettl_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("\x00\x00\x00\x01\x00\x00\x00\x00\x00\x07\xd0\x00"),
+	OPEN_INFO_MAGIC_BYTES("\x54\x52\x00\x64\x00\x00\x00\x00\x00\x00\x00\x80"),
+	{ NULL, 0 }
+};
+static const struct open_info_magic visual_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("\x05VNF"),
+	{ NULL, 0 }
+};
+static const struct open_info_magic _5views_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("\xaa\xaa\xaa\xaa"),
+	{ NULL, 0 }
+};
+static const struct open_info_magic network_instruments_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("ObserverPktBuffer"),
+	{ NULL, 0 }
+};
+static const struct open_info_magic peektagged_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("\177ver"),
+	{ NULL, 0 }
+};
+static const struct open_info_magic k12_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("\x00\x00\x02\x00\x12\x05\x00\x10"),
+	{ NULL, 0 }
+};
+static const struct open_info_magic aethra_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("V0208"),
+	{ NULL, 0 }
+};
+static const struct open_info_magic btsnoop_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("btsnoop\0"),
+	{ NULL, 0 }
+};
+static const struct open_info_magic eyesdn_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("EyeSDN"),
+	{ NULL, 0 }
+};
+static const struct open_info_magic tnef_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("\x78\x9f\x3e\x22"),	/* TNEF_SIGNATURE */
+	{ NULL, 0 }
+};
+static const struct open_info_magic hwgen_v2_magics[] = {
+	OPEN_INFO_MAGIC_BYTES("HWG2"),
+	{ NULL, 0 }
+};
+
 /* The open_file_* routines should return:
  *
  *	-1 on an I/O error;
@@ -314,39 +407,40 @@ GSList *wtap_get_all_file_extensions_list(void)
  */
 
 static struct open_info open_info_base[] = {
-    { "Wireshark/tcpdump/... - pcap",           OPEN_INFO_MAGIC,     libpcap_open,             "pcap",     NULL, NULL },
-    { "Wireshark/... - pcapng",                 OPEN_INFO_MAGIC,     pcapng_open,              "pcapng",   NULL, NULL },
-    { "Sniffer (DOS)",                          OPEN_INFO_MAGIC,     ngsniffer_open,           NULL,       NULL, NULL },
-    { "Snoop, Shomiti/Finisar Surveyor",        OPEN_INFO_MAGIC,     snoop_open,               NULL,       NULL, NULL },
-    { "AIX iptrace",                            OPEN_INFO_MAGIC,     iptrace_open,             NULL,       NULL, NULL },
-    { "Microsoft Network Monitor",              OPEN_INFO_MAGIC,     netmon_open,              NULL,       NULL, NULL },
-    { "Cinco NetXray/Sniffer (Windows)",        OPEN_INFO_MAGIC,     netxray_open,             NULL,       NULL, NULL },
-    { "RADCOM WAN/LAN analyzer",                OPEN_INFO_MAGIC,     radcom_open,              NULL,       NULL, NULL },
-    { "HP-UX nettl trace",                      OPEN_INFO_MAGIC,     nettl_open,               NULL,       NULL, NULL },
-    { "Visual Networks traffic capture",        OPEN_INFO_MAGIC,     visual_open,              NULL,       NULL, NULL },
-    { "InfoVista 5View capture",                OPEN_INFO_MAGIC,     _5views_open,             NULL,       NULL, NULL },
-    { "Network Instruments Observer",           OPEN_INFO_MAGIC,     network_instruments_open, NULL,       NULL, NULL },
-    { "WildPackets tagged",                     OPEN_INFO_MAGIC,     peektagged_open,          NULL,       NULL, NULL },
-    { "DBS Etherwatch (VMS)",                   OPEN_INFO_MAGIC,     dbs_etherwatch_open,      NULL,       NULL, NULL },
-    { "Tektronix K12xx 32-bit .rf5 format",     OPEN_INFO_MAGIC,     k12_open,                 NULL,       NULL, NULL },
-    { "Catapult DCT2000 trace (.out format)",   OPEN_INFO_MAGIC,     catapult_dct2000_open,    NULL,       NULL, NULL },
-    { "Aethra .aps file",                       OPEN_INFO_MAGIC,     aethra_open,              NULL,       NULL, NULL },
-    { "Symbian OS btsnoop",                     OPEN_INFO_MAGIC,     btsnoop_open,             "log",      NULL, NULL },
-    { "EyeSDN USB S0/E1 ISDN trace format",     OPEN_INFO_MAGIC,     eyesdn_open,              NULL,       NULL, NULL },
-    { "Transport-Neutral Encapsulation Format", OPEN_INFO_MAGIC,     tnef_open,                NULL,       NULL, NULL },
-    { "MIME Files Format",                      OPEN_INFO_MAGIC,     mime_file_open,           NULL,       NULL, NULL },
-    { "Novell LANalyzer",                       OPEN_INFO_HEURISTIC, lanalyzer_open,           "tr1",      NULL, NULL },
+    { "Wireshark/tcpdump/... - pcap",           OPEN_INFO_MAGIC,     libpcap_open,             "pcap",     NULL, NULL, pcap_magics },
+    { "Wireshark/... - pcapng",                 OPEN_INFO_MAGIC,     pcapng_open,              "pcapng",   NULL, NULL, pcapng_magics },
+    { "Sniffer (DOS)",                          OPEN_INFO_MAGIC,     ngsniffer_open,           NULL,       NULL, NULL, ngsniffer_magics },
+    { "Snoop, Shomiti/Finisar Surveyor",        OPEN_INFO_MAGIC,     snoop_open,               NULL,       NULL, NULL, snoop_magics },
+    { "AIX iptrace",                            OPEN_INFO_MAGIC,     iptrace_open,             NULL,       NULL, NULL, iptrace_magics },
+    { "Microsoft Network Monitor",              OPEN_INFO_MAGIC,     netmon_open,              NULL,       NULL, NULL, netmon_magics },
+    { "Cinco NetXray/Sniffer (Windows)",        OPEN_INFO_MAGIC,     netxray_open,             NULL,       NULL, NULL, netxray_magics },
+    { "RADCOM WAN/LAN analyzer",                OPEN_INFO_MAGIC,     radcom_open,              NULL,       NULL, NULL, NULL },
+    { "HP-UX nettl trace",                      OPEN_INFO_MAGIC,     nettl_open,               NULL,       NULL, NULL, nettl_magics },
+    { "Visual Networks traffic capture",        OPEN_INFO_MAGIC,     visual_open,              NULL,       NULL, NULL, visual_magics },
+    { "InfoVista 5View capture",                OPEN_INFO_MAGIC,     _5views_open,             NULL,       NULL, NULL, _5views_magics },
+    { "Network Instruments Observer",           OPEN_INFO_MAGIC,     network_instruments_open, NULL,       NULL, NULL, network_instruments_magics },
+    { "WildPackets tagged",                     OPEN_INFO_MAGIC,     peektagged_open,          NULL,       NULL, NULL, peektagged_magics },
+    { "DBS Etherwatch (VMS)",                   OPEN_INFO_MAGIC,     dbs_etherwatch_open,      NULL,       NULL, NULL, NULL },
+    { "Tektronix K12xx 32-bit .rf5 format",     OPEN_INFO_MAGIC,     k12_open,                 NULL,       NULL, NULL, k12_magics },
+    { "Catapult DCT2000 trace (.out format)",   OPEN_INFO_MAGIC,     catapult_dct2000_open,    NULL,       NULL, NULL, NULL },
+    { "Aethra .aps file",                       OPEN_INFO_MAGIC,     aethra_open,              NULL,       NULL, NULL, aethra_magics },
+    { "Symbian OS btsnoop",                     OPEN_INFO_MAGIC,     btsnoop_open,             "log",      NULL, NULL, btsnoop_magics },
+    { "EyeSDN USB S0/E1 ISDN trace format",     OPEN_INFO_MAGIC,     eyesdn_open,              NULL,       NULL, NULL, eyesdn_magics },
+    { "Transport-Neutral Encapsulation Format", OPEN_INFO_MAGIC,     tnef_open,                NULL,       NULL, NULL, tnef_magics },
+    { "MIME Files Format",                      OPEN_INFO_MAGIC,     mime_file_open,           NULL,       NULL, NULL, NULL },
+    { "HW FPGA generator format v2",            OPEN_INFO_MAGIC,     hwgen_v2_open,            "simple",   NULL, NULL, hwgen_v2_magics },
+    { "Novell LANalyzer",                       OPEN_INFO_HEURISTIC, lanalyzer_open,           "tr1",      NULL, NULL, NULL },
     /*
      * PacketLogger must come before MPEG, because its files
      * are sometimes grabbed by mpeg_open.
      */
-    { "OS X PacketLogger",                      OPEN_INFO_HEURISTIC, packetlogger_open,        "pklg",     NULL, NULL },
+    { "OS X PacketLogger",                      OPEN_INFO_HEURISTIC, packetlogger_open,        "pklg",     NULL, NULL, NULL },
     /* Some MPEG files have magic numbers, others just have heuristics. */
-    { "MPEG",                                   OPEN_INFO_HEURISTIC, mpeg_open,                "mpg;mp3",  NULL, NULL },
-    { "Gammu DCT3 trace",                       OPEN_INFO_HEURISTIC, dct3trace_open,           "xml",      NULL, NULL },
-    { "Daintree SNA",                           OPEN_INFO_HEURISTIC, daintree_sna_open,        "dcf",      NULL, NULL },
-    { "STANAG 4607 Format",                     OPEN_INFO_HEURISTIC, stanag4607_open,          NULL,       NULL, NULL },
-    { "ASN.1 Basic Encoding Rules",             OPEN_INFO_HEURISTIC, ber_open,                 NULL,       NULL, NULL },
+    { "MPEG",                                   OPEN_INFO_HEURISTIC, mpeg_open,                "mpg;mp3",  NULL, NULL, NULL },
+    { "Gammu DCT3 trace",                       OPEN_INFO_HEURISTIC, dct3trace_open,           "xml",      NULL, NULL, NULL },
+    { "Daintree SNA",                           OPEN_INFO_HEURISTIC, daintree_sna_open,        "dcf",      NULL, NULL, NULL },
+    { "STANAG 4607 Format",                     OPEN_INFO_HEURISTIC, stanag4607_open,          NULL,       NULL, NULL, NULL },
+    { "ASN.1 Basic Encoding Rules",             OPEN_INFO_HEURISTIC, ber_open,                 NULL,       NULL, NULL, NULL },
     /* I put NetScreen *before* erf, because there were some
      * false positives with my test-files (Sake Blok, July 2007)
      *
@@ -359,29 +453,29 @@ static struct open_info open_info_base[] = {
      * because there were some cases where files of those types were
      * misidentified as vwr files (Guy Harris, December 2013)
      */
-    { "NetScreen snoop text file",              OPEN_INFO_HEURISTIC, netscreen_open,           "txt",      NULL, NULL },
-    { "Endace ERF capture",                     OPEN_INFO_HEURISTIC, erf_open,                 "erf",      NULL, NULL },
-    { "IPFIX File Format",                      OPEN_INFO_HEURISTIC, ipfix_open,               "pfx;ipfix",NULL, NULL },
-    { "K12 text file",                          OPEN_INFO_HEURISTIC, k12text_open,             "txt",      NULL, NULL },
-    { "WildPackets classic",                    OPEN_INFO_HEURISTIC, peekclassic_open,         "pkt;tpc;apc;wpz", NULL, NULL },
-    { "pppd log (pppdump format)",              OPEN_INFO_HEURISTIC, pppdump_open,             NULL,       NULL, NULL },
-    { "IBM iSeries comm. trace",                OPEN_INFO_HEURISTIC, iseries_open,             "txt",      NULL, NULL },
-    { "I4B ISDN trace",                         OPEN_INFO_HEURISTIC, i4btrace_open,            NULL,       NULL, NULL },
-    { "MPEG2 transport stream",                 OPEN_INFO_HEURISTIC, mp2t_open,                "ts;mpg",   NULL, NULL },
-    { "CSIDS IPLog",                            OPEN_INFO_HEURISTIC, csids_open,               NULL,       NULL, NULL },
-    { "TCPIPtrace (VMS)",                       OPEN_INFO_HEURISTIC, vms_open,                 "txt",      NULL, NULL },
-    { "CoSine IPSX L2 capture",                 OPEN_INFO_HEURISTIC, cosine_open,              "txt",      NULL, NULL },
-    { "Bluetooth HCI dump",                     OPEN_INFO_HEURISTIC, hcidump_open,             NULL,       NULL, NULL },
-    { "TamoSoft CommView",                      OPEN_INFO_HEURISTIC, commview_open,            "ncf",      NULL, NULL },
-    { "NetScaler",                              OPEN_INFO_HEURISTIC, nstrace_open,             "cap",      NULL, NULL },
-    { "Android Logcat Binary format",           OPEN_INFO_HEURISTIC, logcat_open,              "logcat",   NULL, NULL },
+    { "NetScreen snoop text file",              OPEN_INFO_HEURISTIC, netscreen_open,           "txt",      NULL, NULL, NULL },
+    { "Endace ERF capture",                     OPEN_INFO_HEURISTIC, erf_open,                 "erf",      NULL, NULL, NULL },
+    { "IPFIX File Format",                      OPEN_INFO_HEURISTIC, ipfix_open,               "pfx;ipfix",NULL, NULL, NULL },
+    { "K12 text file",                          OPEN_INFO_HEURISTIC, k12text_open,             "txt",      NULL, NULL, NULL },
+    { "WildPackets classic",                    OPEN_INFO_HEURISTIC, peekclassic_open,         "pkt;tpc;apc;wpz", NULL, NULL, NULL },
+    { "pppd log (pppdump format)",              OPEN_INFO_HEURISTIC, pppdump_open,             NULL,       NULL, NULL, NULL },
+    { "IBM iSeries comm. trace",                OPEN_INFO_HEURISTIC, iseries_open,             "txt",      NULL, NULL, NULL },
+    { "I4B ISDN trace",                         OPEN_INFO_HEURISTIC, i4btrace_open,            NULL,       NULL, NULL, NULL },
+    { "MPEG2 transport stream",                 OPEN_INFO_HEURISTIC, mp2t_open,                "ts;mpg",   NULL, NULL, NULL },
+    { "CSIDS IPLog",                            OPEN_INFO_HEURISTIC, csids_open,               NULL,       NULL, NULL, NULL },
+    { "TCPIPtrace (VMS)",                       OPEN_INFO_HEURISTIC, vms_open,                 "txt",      NULL, NULL, NULL },
+    { "CoSine IPSX L2 capture",                 OPEN_INFO_HEURISTIC, cosine_open,              "txt",      NULL, NULL, NULL },
+    { "Bluetooth HCI dump",                     OPEN_INFO_HEURISTIC, hcidump_open,             NULL,       NULL, NULL, NULL },
+    { "TamoSoft CommView",                      OPEN_INFO_HEURISTIC, commview_open,            "ncf",      NULL, NULL, NULL },
+    { "NetScaler",                              OPEN_INFO_HEURISTIC, nstrace_open,             "cap",      NULL, NULL, NULL },
+    { "Android Logcat Binary format",           OPEN_INFO_HEURISTIC, logcat_open,              "logcat",   NULL, NULL, NULL },
     /* ASCII trace files from Telnet sessions. */
-    { "Lucent/Ascend access server trace",      OPEN_INFO_HEURISTIC, ascend_open,              "txt",      NULL, NULL },
-    { "Toshiba Compact ISDN Router snoop",      OPEN_INFO_HEURISTIC, toshiba_open,             "txt",      NULL, NULL },
+    { "Lucent/Ascend access server trace",      OPEN_INFO_HEURISTIC, ascend_open,              "txt",      NULL, NULL, NULL },
+    { "Toshiba Compact ISDN Router snoop",      OPEN_INFO_HEURISTIC, toshiba_open,             "txt",      NULL, NULL, NULL },
     /* Extremely weak heuristics - put them at the end. */
-    { "Ixia IxVeriWave .vwr Raw Capture",       OPEN_INFO_HEURISTIC, vwr_open,                 "vwr",      NULL, NULL },
-    { "CAM Inspector file",                     OPEN_INFO_HEURISTIC, camins_open,              "camins",   NULL, NULL },
-	{ "HW FPGA generator format",           	OPEN_INFO_MAGIC,     hwgen_open,               "simple",     NULL, NULL },
+    { "Ixia IxVeriWave .vwr Raw Capture",       OPEN_INFO_HEURISTIC, vwr_open,                 "vwr",      NULL, NULL, NULL },
+    { "CAM Inspector file",                     OPEN_INFO_HEURISTIC, camins_open,              "camins",   NULL, NULL, NULL },
+	{ "HW FPGA generator format",           	OPEN_INFO_MAGIC,     hwgen_open,               "simple",     NULL, NULL, NULL },
 };
 
 /* this is only used to build the dynamic array on load, do NOT use this
@@ -414,6 +508,120 @@ static void set_heuristic_routine(void) {
 	g_assert(heuristic_open_routine_idx > 0);
 }
 
+/*
+ * A trie of the magic numbers the open routines list.  Each node is one
+ * byte, with the other bytes that can be at that position chained off it
+ * through "sibling", and holds the indices into open_routines of the
+ * routines whose magic numbers end there.  It's rebuilt whenever a
+ * routine is registered or de-registered, as that moves the others.
+ */
+typedef struct magic_node {
+	guint8 byte;
+	struct magic_node *child;
+	struct magic_node *sibling;
+	GArray *routines;		/* NULL if no magic number ends here */
+} magic_node_t;
+
+static magic_node_t *magic_trie = NULL;
+static guint magic_probe_len = 0;	/* length of the longest magic number */
+static gboolean magic_dispatch = TRUE;
+
+void
+wtap_set_magic_dispatch(gboolean on)
+{
+	magic_dispatch = on;
+}
+
+static void
+free_magic_nodes(magic_node_t *node)
+{
+	magic_node_t *next;
+
+	for (; node != NULL; node = next) {
+		next = node->sibling;
+		free_magic_nodes(node->child);
+		if (node->routines != NULL)
+			g_array_free(node->routines, TRUE);
+		g_free(node);
+	}
+}
+
+static void
+build_magic_trie(void)
+{
+	const struct open_info_magic *magic;
+	magic_node_t **link, *node;
+	guint i, j;
+
+	free_magic_nodes(magic_trie);
+	magic_trie = NULL;
+	magic_probe_len = 0;
+
+	for (i = 0; i < open_info_arr->len; i++) {
+		for (magic = open_routines[i].magics;
+		    magic != NULL && magic->bytes != NULL; magic++) {
+			g_assert(magic->len != 0 &&
+			    magic->len <= OPEN_INFO_MAGIC_MAX_LEN);
+
+			node = NULL;
+			link = &magic_trie;
+			for (j = 0; j < magic->len; j++) {
+				while (*link != NULL &&
+				    (*link)->byte != (guint8)magic->bytes[j])
+					link = &(*link)->sibling;
+				if (*link == NULL) {
+					*link = g_new0(magic_node_t, 1);
+					(*link)->byte = (guint8)magic->bytes[j];
+				}
+				node = *link;
+				link = &node->child;
+			}
+
+			if (node->routines == NULL)
+				node->routines = g_array_new(FALSE, FALSE, sizeof(guint));
+			/* a routine may list the same magic number twice */
+			if (node->routines->len == 0 ||
+			    g_array_index(node->routines, guint, node->routines->len - 1) != i)
+				g_array_append_val(node->routines, i);
+			magic_probe_len = MAX(magic_probe_len, magic->len);
+		}
+	}
+}
+
+static gint
+compare_routine_idx(gconstpointer a, gconstpointer b)
+{
+	guint ia = *(const guint *)a, ib = *(const guint *)b;
+
+	return ia < ib ? -1 : ia > ib ? 1 : 0;
+}
+
+/*
+ * Returns the indices of the routines with a magic number that the len
+ * bytes at probe start with, in the order they're in open_routines.
+ */
+static GArray *
+magic_candidates(const guint8 *probe, guint len)
+{
+	GArray *candidates = g_array_new(FALSE, FALSE, sizeof(guint));
+	magic_node_t *node = magic_trie;
+	guint j;
+
+	for (j = 0; j < len && node != NULL; j++) {
+		while (node != NULL && node->byte != probe[j])
+			node = node->sibling;
+		if (node == NULL)
+			break;
+		if (node->routines != NULL)
+			g_array_append_vals(candidates, node->routines->data,
+			    node->routines->len);
+		node = node->child;
+	}
+	if (candidates->len > 1)
+		g_array_sort(candidates, compare_routine_idx);
+	return candidates;
+}
+
 void init_open_routines(void) {
     unsigned int i;
     struct open_info *i_open;
@@ -434,6 +642,7 @@ void init_open_routines(void) {
     }
 
     set_heuristic_routine();
+    build_magic_trie();
 }
 
 /* Registers a new file reader - currently only called by wslua code for Lua readers.
@@ -470,6 +679,7 @@ void wtap_register_open_info(struct open_info *oi, const gboolean first_routine)
 
     open_routines = (struct open_info *)(void*) open_info_arr->data;
     set_heuristic_routine();
+    build_magic_trie();
 }
 
 /* De-registers a file reader by removign it from the GArray based on its name.
@@ -492,6 +702,7 @@ void wtap_deregister_open_info(const gchar *name) {
                 g_strfreev(open_routines[i].extensions_set);
             open_info_arr = g_array_remove_index(open_info_arr, i);
             set_heuristic_routine();
+            build_magic_trie();
             return;
         }
     }
@@ -696,6 +907,7 @@ wtap* wtap_open_offline(const char *filename, unsigned int type, int *err, char
 	unsigned int	i;
 	gboolean use_stdin = FALSE;
 	gchar *extension;
+	gboolean skip_magic = FALSE;
 
 	init_open_routines();
 
@@ -808,6 +1020,7 @@ wtap* wtap_open_offline(const char *filename, unsigned int type, int *err, char
 
 	/* initialization */
 	wth->file_encap = WTAP_ENCAP_UNKNOWN;
+	wth->packet_count = -1;
 	wth->subtype_sequential_close = NULL;
 	wth->subtype_close = NULL;
 	wth->tsprecision = WTAP_FILE_TSPREC_USEC;
@@ -819,11 +1032,16 @@ wtap* wtap_open_offline(const char *filename, unsigned int type, int *err, char
 	 * Always initing it here saves checking for a NULL ptr later. */
 	wth->interface_data = g_array_new(FALSE, FALSE, sizeof(wtapng_if_descr_t));
 
-	if (wth->random_fh) {
+	/*
+	 * An index sidecar keeps the seek points too, so gather them even
+	 * if we're only reading the file through.
+	 */
+	if (wth->random_fh || (!use_stdin && capture_index_enabled())) {
 		wth->fast_seek = g_ptr_array_new();
 
 		file_set_random_access(wth->fh, FALSE, wth->fast_seek);
-		file_set_random_access(wth->random_fh, TRUE, wth->fast_seek);
+		if (wth->random_fh)
+			file_set_random_access(wth->random_fh, TRUE, wth->fast_seek);
 	}
 
 	/* 'type' is 1 greater than the array index */
@@ -860,8 +1078,70 @@ wtap* wtap_open_offline(const char *filename, unsigned int type, int *err, char
 		}
 	}
 
+	/*
+	 * Read the start of the file once, and try just the routines
+	 * whose magic numbers it starts with; the other routines that
+	 * list magic numbers can't handle it, so they're skipped below,
+	 * saving a read and a rewind for each.
+	 */
+	if (magic_dispatch && magic_probe_len != 0) {
+		guint8	probe[OPEN_INFO_MAGIC_MAX_LEN];
+		int	probe_len;
+		GArray	*candidates;
+		guint	k;
+
+		if (file_seek(wth->fh, 0, SEEK_SET, err) == -1) {
+			/* I/O error - give up */
+			wtap_close(wth);
+			return NULL;
+		}
+		probe_len = file_read(probe, magic_probe_len, wth->fh);
+		if (probe_len < 0) {
+			*err = file_error(wth->fh, err_info);
+			wtap_close(wth);
+			return NULL;
+		}
+
+		candidates = magic_candidates(probe, probe_len);
+		for (k = 0; k < candidates->len; k++) {
+			i = g_array_index(candidates, guint, k);
+
+			if (file_seek(wth->fh, 0, SEEK_SET, err) == -1) {
+				/* I/O error - give up */
+				g_array_free(candidates, TRUE);
+				wtap_close(wth);
+				return NULL;
+			}
+
+			wth->wslua_data = open_routines[i].wslua_data;
+
+			switch ((*open_routines[i].open_routine)(wth, err, err_info)) {
+
+			case -1:
+				/* I/O error - give up */
+				g_array_free(candidates, TRUE);
+				wtap_close(wth);
+				return NULL;
+
+			case 0:
+				/* No I/O error, but not that type of file */
+				break;
+
+			case 1:
+				/* We found the file type */
+				g_array_free(candidates, TRUE);
+				goto success;
+			}
+		}
+		g_array_free(candidates, TRUE);
+		skip_magic = TRUE;
+	}
+
 	/* Try all file types that support magic numbers */
 	for (i = 0; i < heuristic_open_routine_idx; i++) {
+		if (skip_magic && open_routines[i].magics != NULL)
+			continue;
+
 		/* Seek back to the beginning of the file; the open routine
 		   for the previous file type may have left the file
 		   position somewhere other than the beginning, and the
@@ -904,6 +1184,9 @@ wtap* wtap_open_offline(const char *filename, unsigned int type, int *err, char
 	if (extension != NULL) {
 		/* Yes - try the heuristic types that use that extension first. */
 		for (i = heuristic_open_routine_idx; i < open_info_arr->len; i++) {
+			if (skip_magic && open_routines[i].magics != NULL)
+				continue;
+
 			/* Does this type use that extension? */
 			if (heuristic_uses_extension(i, extension)) {
 				/* Yes. */
@@ -950,6 +1233,9 @@ wtap* wtap_open_offline(const char *filename, unsigned int type, int *err, char
 		 * *not* one of those files.
 		 */
 		for (i = heuristic_open_routine_idx; i < open_info_arr->len; i++) {
+			if (skip_magic && open_routines[i].magics != NULL)
+				continue;
+
 			/* Does this type have any extensions? */
 			if (open_routines[i].extensions == NULL) {
 				/* No. */
@@ -991,6 +1277,9 @@ wtap* wtap_open_offline(const char *filename, unsigned int type, int *err, char
 		 * them matches this file's extensions.
 		 */
 		for (i = heuristic_open_routine_idx; i < open_info_arr->len; i++) {
+			if (skip_magic && open_routines[i].magics != NULL)
+				continue;
+
 			/*
 			 * Does this type have extensions and is this file's
 			 * extension one of them?
@@ -1034,6 +1323,8 @@ wtap* wtap_open_offline(const char *filename, unsigned int type, int *err, char
 	} else {
 		/* No - try all the heuristics types in order. */
 		for (i = heuristic_open_routine_idx; i < open_info_arr->len; i++) {
+			if (skip_magic && open_routines[i].magics != NULL)
+				continue;
 
 			if (file_seek(wth->fh, 0, SEEK_SET, err) == -1) {
 				/* I/O error - give up */
@@ -1098,6 +1389,9 @@ success:
 		g_array_append_val(wth->interface_data, descr);
 
 	}
+
+	if (!use_stdin)
+		capture_index_open(wth, filename);
 	return wth;
 }
 
@@ -1546,6 +1840,11 @@ static const struct file_type_subtype_info dump_open_table_base[] = {
 	  FALSE, FALSE, 0,
 	  logcat_dump_can_write_encap, logcat_text_long_dump_open, NULL },
 	{ "HW FPGA generator format", "hw_gen", "simple", NULL,
+		  FALSE, FALSE, 0,
+		  hwgen_dump_can_write_encap, hwgen_dump_open, NULL },
+
+	/* WTAP_FILE_TYPE_SUBTYPE_HWGEN_V2 */
+	{ "HW FPGA generator format v2", "hw_gen_v2", "simple", NULL,
 		  FALSE, FALSE, 0,
 		  hwgen_dump_can_write_encap, hwgen_dump_open, NULL }
 };
@@ -2003,7 +2302,7 @@ gboolean wtap_dump_can_open(int file_type_subtype)
 	return TRUE;
 }
 
-#ifdef HAVE_LIBZ
+#if defined(HAVE_LIBZ) || defined(HAVE_ZSTD) || defined(HAVE_LZ4)
 gboolean wtap_dump_can_compress(int file_type_subtype)
 {
 	/*
@@ -2024,6 +2323,34 @@ gboolean wtap_dump_can_compress(int file_type_subtype _U_)
 }
 #endif
 
+gboolean wtap_can_write_compression_type(wtap_compression_type compression_type)
+{
+	switch (compression_type) {
+
+	case WTAP_UNCOMPRESSED:
+		return TRUE;
+
+#ifdef HAVE_LIBZ
+	case WTAP_GZIP_COMPRESSED:
+	case WTAP_BGZF_COMPRESSED:
+		return TRUE;
+#endif
+
+#ifdef HAVE_ZSTD
+	case WTAP_ZSTD_COMPRESSED:
+		return TRUE;
+#endif
+
+#ifdef HAVE_LZ4
+	case WTAP_LZ4_COMPRESSED:
+		return TRUE;
+#endif
+
+	default:
+		return FALSE;
+	}
+}
+
 gboolean wtap_dump_has_name_resolution(int file_type_subtype)
 {
 	if (file_type_subtype < 0 || file_type_subtype >= wtap_num_file_types_subtypes
@@ -2047,29 +2374,31 @@ gboolean wtap_dump_supports_comment_types(int file_type_subtype, guint32 comment
 	return FALSE;
 }
 
-static gboolean wtap_dump_open_check(int file_type_subtype, int encap, gboolean comressed, int *err);
+static gboolean wtap_dump_open_check(int file_type_subtype, int encap, wtap_compression_type compression_type, int *err);
 static wtap_dumper* wtap_dump_alloc_wdh(int file_type_subtype, int encap, int snaplen,
-					gboolean compressed, int *err);
-static gboolean wtap_dump_open_finish(wtap_dumper *wdh, int file_type_subtype, gboolean compressed, int *err);
+					wtap_compression_type compression_type, int *err);
+static gboolean wtap_dump_open_finish(wtap_dumper *wdh, int file_type_subtype, int *err);
 
 static WFILE_T wtap_dump_file_open(wtap_dumper *wdh, const char *filename);
 static WFILE_T wtap_dump_file_fdopen(wtap_dumper *wdh, int fd);
 static int wtap_dump_file_close(wtap_dumper *wdh);
+static gboolean wtap_dump_buffer_drain(wtap_dumper *wdh, gboolean everything, int *err);
+static gboolean wtap_dump_buffer_flush(wtap_dumper *wdh, int *err);
 
 wtap_dumper* wtap_dump_open(const char *filename, int file_type_subtype, int encap,
-				int snaplen, gboolean compressed, int *err)
+				int snaplen, wtap_compression_type compression_type, int *err)
 {
-	return wtap_dump_open_ng(filename, file_type_subtype, encap,snaplen, compressed, NULL, NULL, err);
+	return wtap_dump_open_ng(filename, file_type_subtype, encap,snaplen, compression_type, NULL, NULL, err);
 }
 
 static wtap_dumper *
-wtap_dump_init_dumper(int file_type_subtype, int encap, int snaplen, gboolean compressed,
+wtap_dump_init_dumper(int file_type_subtype, int encap, int snaplen, wtap_compression_type compression_type,
     wtapng_section_t *shb_hdr, wtapng_iface_descriptions_t *idb_inf, int *err)
 {
 	wtap_dumper *wdh;
 
 	/* Allocate a data structure for the output stream. */
-	wdh = wtap_dump_alloc_wdh(file_type_subtype, encap, snaplen, compressed, err);
+	wdh = wtap_dump_alloc_wdh(file_type_subtype, encap, snaplen, compression_type, err);
 	if (wdh == NULL)
 		return NULL;	/* couldn't allocate it */
 
@@ -2104,25 +2433,33 @@ wtap_dump_init_dumper(int file_type_subtype, int encap, int snaplen, gboolean co
 }
 
 wtap_dumper* wtap_dump_open_ng(const char *filename, int file_type_subtype, int encap,
-				int snaplen, gboolean compressed, wtapng_section_t *shb_hdr, wtapng_iface_descriptions_t *idb_inf, int *err)
+				int snaplen, wtap_compression_type compression_type, wtapng_section_t *shb_hdr, wtapng_iface_descriptions_t *idb_inf, int *err)
+{
+	return wtap_dump_open_hwgen(filename, file_type_subtype, encap, snaplen, compression_type,
+	    shb_hdr, idb_inf, NULL, NULL, err);
+}
+
+wtap_dumper* wtap_dump_open_hwgen(const char *filename, int file_type_subtype, int encap,
+				int snaplen, wtap_compression_type compression_type, wtapng_section_t *shb_hdr, wtapng_iface_descriptions_t *idb_inf,
+				const wtap_hwgen_params_t *params, const wtap_hwgen_encap_t *hwgen_encap, int *err)
 {
 	wtap_dumper *wdh;
 	WFILE_T fh;
 
 	/* Check whether we can open a capture file with that file type
 	   and that encapsulation. */
-	if (!wtap_dump_open_check(file_type_subtype, encap, compressed, err))
+	if (!wtap_dump_open_check(file_type_subtype, encap, compression_type, err))
 		return NULL;
 
 	/* Allocate and initialize a data structure for the output stream. */
-	wdh = wtap_dump_init_dumper(file_type_subtype, encap, snaplen, compressed,
+	wdh = wtap_dump_init_dumper(file_type_subtype, encap, snaplen, compression_type,
 	    shb_hdr, idb_inf, err);
 	if (wdh == NULL)
 		return NULL;
 
 	/* "-" means stdout */
 	if (strcmp(filename, "-") == 0) {
-		if (compressed) {
+		if (compression_type != WTAP_UNCOMPRESSED) {
 			*err = EINVAL;	/* XXX - return a Wiretap error code for this */
 			g_free(wdh);
 			return NULL;	/* compress won't work on stdout */
@@ -2149,7 +2486,9 @@ wtap_dumper* wtap_dump_open_ng(const char *filename, int file_type_subtype, int
 		wdh->fh = fh;
 	}
 
-	if (!wtap_dump_open_finish(wdh, file_type_subtype, compressed, err)) {
+	wdh->hwgen_params = params;
+	wdh->hwgen_encap = hwgen_encap;
+	if (!wtap_dump_open_finish(wdh, file_type_subtype, err)) {
 		/* Get rid of the file we created; we couldn't finish
 		   opening it. */
 		if (wdh->fh != stdout) {
@@ -2159,28 +2498,30 @@ wtap_dumper* wtap_dump_open_ng(const char *filename, int file_type_subtype, int
 		g_free(wdh);
 		return NULL;
 	}
+	wdh->hwgen_params = NULL;
+	wdh->hwgen_encap = NULL;
 	return wdh;
 }
 
 wtap_dumper* wtap_dump_fdopen(int fd, int file_type_subtype, int encap, int snaplen,
-				gboolean compressed, int *err)
+				wtap_compression_type compression_type, int *err)
 {
-	return wtap_dump_fdopen_ng(fd, file_type_subtype, encap, snaplen, compressed, NULL, NULL, err);
+	return wtap_dump_fdopen_ng(fd, file_type_subtype, encap, snaplen, compression_type, NULL, NULL, err);
 }
 
 wtap_dumper* wtap_dump_fdopen_ng(int fd, int file_type_subtype, int encap, int snaplen,
-				gboolean compressed, wtapng_section_t *shb_hdr, wtapng_iface_descriptions_t *idb_inf, int *err)
+				wtap_compression_type compression_type, wtapng_section_t *shb_hdr, wtapng_iface_descriptions_t *idb_inf, int *err)
 {
 	wtap_dumper *wdh;
 	WFILE_T fh;
 
 	/* Check whether we can open a capture file with that file type
 	   and that encapsulation. */
-	if (!wtap_dump_open_check(file_type_subtype, encap, compressed, err))
+	if (!wtap_dump_open_check(file_type_subtype, encap, compression_type, err))
 		return NULL;
 
 	/* Allocate and initialize a data structure for the output stream. */
-	wdh = wtap_dump_init_dumper(file_type_subtype, encap, snaplen, compressed,
+	wdh = wtap_dump_init_dumper(file_type_subtype, encap, snaplen, compression_type,
 	    shb_hdr, idb_inf, err);
 	if (wdh == NULL)
 		return NULL;
@@ -2207,7 +2548,7 @@ wtap_dumper* wtap_dump_fdopen_ng(int fd, int file_type_subtype, int encap, int s
 	}
 	wdh->fh = fh;
 
-	if (!wtap_dump_open_finish(wdh, file_type_subtype, compressed, err)) {
+	if (!wtap_dump_open_finish(wdh, file_type_subtype, err)) {
 		wtap_dump_file_close(wdh);
 		g_free(wdh);
 		return NULL;
@@ -2215,7 +2556,7 @@ wtap_dumper* wtap_dump_fdopen_ng(int fd, int file_type_subtype, int encap, int s
 	return wdh;
 }
 
-static gboolean wtap_dump_open_check(int file_type_subtype, int encap, gboolean compressed, int *err)
+static gboolean wtap_dump_open_check(int file_type_subtype, int encap, wtap_compression_type compression_type, int *err)
 {
 	if (!wtap_dump_can_open(file_type_subtype)) {
 		/* Invalid type, or type we don't know how to write. */
@@ -2238,8 +2579,11 @@ static gboolean wtap_dump_open_check(int file_type_subtype, int encap, gboolean
 	if (*err != 0)
 		return FALSE;
 
-	/* if compression is wanted, do we support this for this file_type_subtype? */
-	if(compressed && !wtap_dump_can_compress(file_type_subtype)) {
+	/* if compression is wanted, do we support it, and this file_type_subtype
+	   with it? */
+	if(compression_type != WTAP_UNCOMPRESSED &&
+	   (!wtap_can_write_compression_type(compression_type) ||
+	    !wtap_dump_can_compress(file_type_subtype))) {
 		*err = WTAP_ERR_COMPRESSION_NOT_SUPPORTED;
 		return FALSE;
 	}
@@ -2249,7 +2593,7 @@ static gboolean wtap_dump_open_check(int file_type_subtype, int encap, gboolean
 }
 
 static wtap_dumper* wtap_dump_alloc_wdh(int file_type_subtype, int encap, int snaplen,
-					gboolean compressed, int *err)
+					wtap_compression_type compression_type, int *err)
 {
 	wtap_dumper *wdh;
 
@@ -2262,19 +2606,20 @@ static wtap_dumper* wtap_dump_alloc_wdh(int file_type_subtype, int encap, int sn
 	wdh->file_type_subtype = file_type_subtype;
 	wdh->snaplen = snaplen;
 	wdh->encap = encap;
-	wdh->compressed = compressed;
+	wdh->compression_type = compression_type;
+	wdh->compressed = (compression_type != WTAP_UNCOMPRESSED);
 	wdh->wslua_data = NULL;
 	return wdh;
 }
 
-static gboolean wtap_dump_open_finish(wtap_dumper *wdh, int file_type_subtype, gboolean compressed, int *err)
+static gboolean wtap_dump_open_finish(wtap_dumper *wdh, int file_type_subtype, int *err)
 {
 	int fd;
 	gboolean cant_seek;
 
 	/* Can we do a seek on the file descriptor?
 	   If not, note that fact. */
-	if(compressed) {
+	if(wdh->compressed) {
 		cant_seek = TRUE;
 	} else {
 		fd = fileno((FILE *)wdh->fh);
@@ -2315,25 +2660,51 @@ gboolean wtap_dump(wtap_dumper *wdh, const struct wtap_pkthdr *phdr,
 
 void wtap_dump_flush(wtap_dumper *wdh)
 {
+	int	err;
+
+	if (wdh->wbuf != NULL)
+		(void)wtap_dump_buffer_flush(wdh, &err);
+	switch (wdh->compression_type) {
+
 #ifdef HAVE_LIBZ
-	if(wdh->compressed) {
+	case WTAP_GZIP_COMPRESSED:
+	case WTAP_BGZF_COMPRESSED:
 		gzwfile_flush((GZWFILE_T)wdh->fh);
-	} else
+		break;
 #endif
-	{
+
+#if defined(HAVE_ZSTD) || defined(HAVE_LZ4)
+	case WTAP_ZSTD_COMPRESSED:
+	case WTAP_LZ4_COMPRESSED:
+		/* Doesn't cut the frame short; see framewfile_flush(). */
+		framewfile_flush((FRAMEWFILE_T)wdh->fh);
+		break;
+#endif
+
+	default:
 		fflush((FILE *)wdh->fh);
+		break;
 	}
 }
 
 gboolean wtap_dump_close(wtap_dumper *wdh, int *err)
 {
 	gboolean ret = TRUE;
+	int	write_err = 0;
 
 	if (wdh->subtype_close != NULL) {
 		/* There's a close routine for this dump stream. */
 		if (!(wdh->subtype_close)(wdh, err))
 			ret = FALSE;
 	}
+	if (wdh->wbuf != NULL) {
+		if (!wtap_dump_buffer_drain(wdh, TRUE, &write_err) && ret) {
+			if (err != NULL)
+				*err = write_err;
+			ret = FALSE;
+		}
+		g_free(wdh->wbuf_alloc);
+	}
 	errno = WTAP_ERR_CANT_CLOSE;
 	/* Don't close stdout */
 	if (wdh->fh != stdout) {
@@ -2377,47 +2748,62 @@ gboolean wtap_dump_set_addrinfo_list(wtap_dumper *wdh, addrinfo_lists_t *addrinf
 }
 
 /* internally open a file for writing (compressed or not) */
-#ifdef HAVE_LIBZ
 static WFILE_T wtap_dump_file_open(wtap_dumper *wdh, const char *filename)
 {
-	if(wdh->compressed) {
+	switch (wdh->compression_type) {
+
+#ifdef HAVE_LIBZ
+	case WTAP_GZIP_COMPRESSED:
 		return gzwfile_open(filename);
-	} else {
+
+	case WTAP_BGZF_COMPRESSED:
+		return bgzfwfile_open(filename);
+#endif
+
+#if defined(HAVE_ZSTD) || defined(HAVE_LZ4)
+	case WTAP_ZSTD_COMPRESSED:
+	case WTAP_LZ4_COMPRESSED:
+		return framewfile_open(filename, wdh->compression_type);
+#endif
+
+	default:
 		return ws_fopen(filename, "wb");
 	}
 }
-#else
-static WFILE_T wtap_dump_file_open(wtap_dumper *wdh _U_, const char *filename)
-{
-	return ws_fopen(filename, "wb");
-}
-#endif
 
 /* internally open a file for writing (compressed or not) */
-#ifdef HAVE_LIBZ
 static WFILE_T wtap_dump_file_fdopen(wtap_dumper *wdh, int fd)
 {
-	if(wdh->compressed) {
+	switch (wdh->compression_type) {
+
+#ifdef HAVE_LIBZ
+	case WTAP_GZIP_COMPRESSED:
 		return gzwfile_fdopen(fd);
-	} else {
+
+	case WTAP_BGZF_COMPRESSED:
+		return bgzfwfile_fdopen(fd);
+#endif
+
+#if defined(HAVE_ZSTD) || defined(HAVE_LZ4)
+	case WTAP_ZSTD_COMPRESSED:
+	case WTAP_LZ4_COMPRESSED:
+		return framewfile_fdopen(fd, wdh->compression_type);
+#endif
+
+	default:
 		return fdopen(fd, "wb");
 	}
 }
-#else
-static WFILE_T wtap_dump_file_fdopen(wtap_dumper *wdh _U_, int fd)
-{
-	return fdopen(fd, "wb");
-}
-#endif
 
 /* internally writing raw bytes (compressed or not) */
-gboolean wtap_dump_file_write(wtap_dumper *wdh, const void *buf, size_t bufsize,
-		     int *err)
+static gboolean wtap_dump_file_write_raw(wtap_dumper *wdh, const void *buf,
+		     size_t bufsize, int *err)
 {
 	size_t nwritten;
 
 #ifdef HAVE_LIBZ
-	if (wdh->compressed) {
+	if (wdh->compression_type == WTAP_GZIP_COMPRESSED ||
+	    wdh->compression_type == WTAP_BGZF_COMPRESSED) {
 		nwritten = gzwfile_write((GZWFILE_T)wdh->fh, buf, (unsigned) bufsize);
 		/*
 		 * gzwfile_write() returns 0 on error.
@@ -2427,6 +2813,16 @@ gboolean wtap_dump_file_write(wtap_dumper *wdh, const void *buf, size_t bufsize,
 			return FALSE;
 		}
 	} else
+#endif
+#if defined(HAVE_ZSTD) || defined(HAVE_LZ4)
+	if (wdh->compressed) {
+		/* So does framewfile_write(). */
+		nwritten = framewfile_write((FRAMEWFILE_T)wdh->fh, buf, (unsigned) bufsize);
+		if (nwritten == 0) {
+			*err = framewfile_geterr((FRAMEWFILE_T)wdh->fh);
+			return FALSE;
+		}
+	} else
 #endif
 	{
 		nwritten = fwrite(buf, 1, bufsize, (FILE *)wdh->fh);
@@ -2445,33 +2841,330 @@ gboolean wtap_dump_file_write(wtap_dumper *wdh, const void *buf, size_t bufsize,
 	return TRUE;
 }
 
+/*
+ * Write-combining buffer.  Everything written to the file, with
+ * wtap_dump_file_write() or built in place with wtap_dump_file_reserve(),
+ * is gathered in wdh->wbuf and written out in whole pages as the buffer
+ * fills up; only the final partial page, or what is there when the
+ * writer seeks, goes out unaligned.  The buffer is page-aligned as well,
+ * so with O_DIRECT the pages go to the device as they are.
+ */
+#define WTAP_DUMP_ALIGN		4096
+#define WTAP_DUMP_MIN_BUFFER	(256 * 1024)
+
+#if defined(O_DIRECT) && defined(F_GETFL) && defined(F_SETFL)
+static gboolean wtap_dump_set_o_direct(int fd, gboolean on, int *err)
+{
+	int	flags = fcntl(fd, F_GETFL);
+
+	if (flags == -1 ||
+	    fcntl(fd, F_SETFL, on ? (flags | O_DIRECT) : (flags & ~O_DIRECT)) == -1) {
+		*err = errno;
+		return FALSE;
+	}
+	return TRUE;
+}
+#endif
+
+/* write() all of a buffer, bypassing stdio. */
+static gboolean wtap_dump_fd_write(int fd, const guint8 *buf, gsize len, int *err)
+{
+	int	n;
+
+	while (len != 0) {
+		n = (int)ws_write(fd, buf, (unsigned int)MIN(len, 1U << 30));
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			*err = errno;
+			return FALSE;
+		}
+		if (n == 0) {
+			*err = WTAP_ERR_SHORT_WRITE;
+			return FALSE;
+		}
+		buf += n;
+		len -= n;
+	}
+	return TRUE;
+}
+
+/* The first n bytes of the buffer are in the file; drop them. */
+static void wtap_dump_buffer_consume(wtap_dumper *wdh, gsize n)
+{
+	memmove(wdh->wbuf, wdh->wbuf + n, wdh->wbuf_len - n);
+	wdh->wbuf_len -= n;
+	if (wdh->wbuf_holding)
+		wdh->wbuf_hold -= n;
+	if (wdh->wbuf_pos != -1)
+		wdh->wbuf_pos += n;
+}
+
+/*
+ * Write out the buffer, up to the held bytes and in whole pages, or, if
+ * "everything" is set, all of it.
+ */
+static gboolean wtap_dump_buffer_drain(wtap_dumper *wdh, gboolean everything, int *err)
+{
+	gsize	n = wdh->wbuf_len;
+
+	if (!everything) {
+		if (wdh->wbuf_holding)
+			n = wdh->wbuf_hold;
+		n -= n % WTAP_DUMP_ALIGN;
+	}
+	if (n == 0)
+		return TRUE;
+
+	if (wdh->direct_io) {
+		int	fd = fileno((FILE *)wdh->fh);
+		gsize	whole = n - n % WTAP_DUMP_ALIGN;
+
+		if (whole != 0 && !wtap_dump_fd_write(fd, wdh->wbuf, whole, err))
+			return FALSE;
+		if (whole != n) {
+			/*
+			 * O_DIRECT only takes whole blocks, and anything
+			 * after this tail would be misaligned anyway.
+			 */
+#if defined(O_DIRECT) && defined(F_GETFL) && defined(F_SETFL)
+			if (!wtap_dump_set_o_direct(fd, FALSE, err))
+				return FALSE;
+#endif
+			wdh->direct_io = FALSE;
+			if (!wtap_dump_fd_write(fd, wdh->wbuf + whole, n - whole, err))
+				return FALSE;
+		}
+	} else if (!wtap_dump_file_write_raw(wdh, wdh->wbuf, n, err)) {
+		return FALSE;
+	}
+
+	if (everything)
+		wdh->wbuf_holding = FALSE;
+	wtap_dump_buffer_consume(wdh, n);
+	return TRUE;
+}
+
+/*
+ * Get everything up to the held bytes into the file, for
+ * wtap_dump_flush().  With O_DIRECT, the partial page after the whole
+ * ones is written with buffered I/O where it goes, without moving the
+ * file offset, and kept in the buffer; it's written again as part of a
+ * whole page once that fills, so the writes stay aligned.
+ */
+static gboolean wtap_dump_buffer_flush(wtap_dumper *wdh, int *err)
+{
+	gsize	n;
+
+	if (!wtap_dump_buffer_drain(wdh, FALSE, err))
+		return FALSE;
+	n = wdh->wbuf_holding ? wdh->wbuf_hold : wdh->wbuf_len;
+	if (n == 0)
+		return TRUE;
+
+	if (!wdh->direct_io) {
+		if (!wtap_dump_file_write_raw(wdh, wdh->wbuf, n, err))
+			return FALSE;
+		wtap_dump_buffer_consume(wdh, n);
+		return TRUE;
+	}
+
+#if defined(O_DIRECT) && defined(F_GETFL) && defined(F_SETFL)
+	{
+		int	fd = fileno((FILE *)wdh->fh);
+		int	restore_err;
+		gsize	done = 0;
+		ssize_t	w;
+
+		if (!wtap_dump_set_o_direct(fd, FALSE, err))
+			return FALSE;
+		while (done < n) {
+			w = pwrite(fd, wdh->wbuf + done, n - done,
+			    (off_t)(wdh->wbuf_pos + done));
+			if (w < 0 && errno == EINTR)
+				continue;
+			if (w <= 0) {
+				*err = w < 0 ? errno : WTAP_ERR_SHORT_WRITE;
+				(void)wtap_dump_set_o_direct(fd, TRUE, &restore_err);
+				return FALSE;
+			}
+			done += w;
+		}
+		if (!wtap_dump_set_o_direct(fd, TRUE, err))
+			return FALSE;
+	}
+#endif
+	return TRUE;
+}
+
+gboolean wtap_dump_set_write_buffer(wtap_dumper *wdh, gsize size, int *err)
+{
+	guint8	*alloc, *buf;
+
+	if (wdh->wbuf != NULL && !wtap_dump_buffer_drain(wdh, FALSE, err))
+		return FALSE;
+	size = MAX(size, WTAP_DUMP_MIN_BUFFER);
+	size = MAX(size, wdh->wbuf_len);
+	size = (size + WTAP_DUMP_ALIGN - 1) & ~(gsize)(WTAP_DUMP_ALIGN - 1);
+
+	/* From now on the buffer keeps track of where it is in the file. */
+	if (wdh->wbuf == NULL)
+		wdh->wbuf_pos = wdh->compressed ? -1 : (gint64)ftell((FILE *)wdh->fh);
+
+	alloc = (guint8 *)g_malloc(size + WTAP_DUMP_ALIGN - 1);
+	buf = (guint8 *)(((guintptr)alloc + WTAP_DUMP_ALIGN - 1) & ~(guintptr)(WTAP_DUMP_ALIGN - 1));
+	if (wdh->wbuf != NULL) {
+		memcpy(buf, wdh->wbuf, wdh->wbuf_len);
+		g_free(wdh->wbuf_alloc);
+	}
+	wdh->wbuf_alloc = alloc;
+	wdh->wbuf = buf;
+	wdh->wbuf_size = size;
+	return TRUE;
+}
+
+gboolean wtap_dump_set_direct_io(wtap_dumper *wdh, int *err)
+{
+#if defined(O_DIRECT) && defined(F_GETFL) && defined(F_SETFL)
+	int	fd;
+	gint64	pos;
+
+	if (wdh->wbuf == NULL || wdh->compressed) {
+		*err = EINVAL;
+		return FALSE;
+	}
+	if (wdh->direct_io)
+		return TRUE;
+
+	/* Anything stdio still has goes first. */
+	if (fflush((FILE *)wdh->fh) == EOF) {
+		*err = errno;
+		return FALSE;
+	}
+	fd = fileno((FILE *)wdh->fh);
+	pos = ws_lseek64(fd, 0, SEEK_CUR);
+	if (pos == -1) {
+		*err = errno;
+		return FALSE;
+	}
+	if (pos % WTAP_DUMP_ALIGN != 0) {
+		*err = EINVAL;
+		return FALSE;
+	}
+	if (!wtap_dump_set_o_direct(fd, TRUE, err))
+		return FALSE;
+	wdh->direct_io = TRUE;
+	return TRUE;
+#else
+	*err = WTAP_ERR_UNSUPPORTED;
+	return FALSE;
+#endif
+}
+
+guint8 *wtap_dump_file_reserve(wtap_dumper *wdh, gsize len, int *err)
+{
+	g_assert(wdh->wbuf != NULL);
+	if (wdh->wbuf_size - wdh->wbuf_len < len) {
+		if (!wtap_dump_buffer_drain(wdh, FALSE, err))
+			return NULL;
+		/* Held bytes and the partial page can still leave too little. */
+		if (wdh->wbuf_size - wdh->wbuf_len < len &&
+		    !wtap_dump_set_write_buffer(wdh, wdh->wbuf_len + len, err))
+			return NULL;
+	}
+	return wdh->wbuf + wdh->wbuf_len;
+}
+
+void wtap_dump_file_commit(wtap_dumper *wdh, gsize len)
+{
+	g_assert(len <= wdh->wbuf_size - wdh->wbuf_len);
+	wdh->wbuf_len += len;
+}
+
+void wtap_dump_file_hold(wtap_dumper *wdh)
+{
+	wdh->wbuf_hold = wdh->wbuf_len;
+	wdh->wbuf_holding = TRUE;
+}
+
+guint8 *wtap_dump_file_held(wtap_dumper *wdh)
+{
+	return wdh->wbuf_holding ? wdh->wbuf + wdh->wbuf_hold : NULL;
+}
+
+void wtap_dump_file_release(wtap_dumper *wdh)
+{
+	wdh->wbuf_holding = FALSE;
+}
+
+gboolean wtap_dump_file_write(wtap_dumper *wdh, const void *buf, size_t bufsize,
+		     int *err)
+{
+	const guint8 *p = (const guint8 *)buf;
+	guint8	*dst;
+	gsize	chunk;
+
+	if (wdh->wbuf == NULL)
+		return wtap_dump_file_write_raw(wdh, buf, bufsize, err);
+
+	while (bufsize != 0) {
+		chunk = MIN(bufsize, wdh->wbuf_size / 2);
+		if ((dst = wtap_dump_file_reserve(wdh, chunk, err)) == NULL)
+			return FALSE;
+		memcpy(dst, p, chunk);
+		wtap_dump_file_commit(wdh, chunk);
+		p += chunk;
+		bufsize -= chunk;
+	}
+	return TRUE;
+}
+
 /* internally close a file for writing (compressed or not) */
 static int wtap_dump_file_close(wtap_dumper *wdh)
 {
+	switch (wdh->compression_type) {
+
 #ifdef HAVE_LIBZ
-	if(wdh->compressed) {
+	case WTAP_GZIP_COMPRESSED:
+	case WTAP_BGZF_COMPRESSED:
 		return gzwfile_close((GZWFILE_T)wdh->fh);
-	} else
 #endif
-	{
+
+#if defined(HAVE_ZSTD) || defined(HAVE_LZ4)
+	case WTAP_ZSTD_COMPRESSED:
+	case WTAP_LZ4_COMPRESSED:
+		return framewfile_close((FRAMEWFILE_T)wdh->fh);
+#endif
+
+	default:
 		return fclose((FILE *)wdh->fh);
 	}
 }
 
 gint64 wtap_dump_file_seek(wtap_dumper *wdh, gint64 offset, int whence, int *err)
 {
-#ifdef HAVE_LIBZ
+	if (wdh->wbuf != NULL && !wtap_dump_buffer_drain(wdh, TRUE, err))
+		return -1;
+	if (wdh->direct_io) {
+		/* Writes after a seek needn't be aligned. */
+#if defined(O_DIRECT) && defined(F_GETFL) && defined(F_SETFL)
+		if (!wtap_dump_set_o_direct(fileno((FILE *)wdh->fh), FALSE, err))
+			return -1;
+#endif
+		wdh->direct_io = FALSE;
+	}
 	if(wdh->compressed) {
 		*err = WTAP_ERR_CANT_SEEK_COMPRESSED;
 		return -1;
 	} else
-#endif
 	{
 		if (-1 == fseek((FILE *)wdh->fh, (long)offset, whence)) {
 			*err = errno;
 			return -1;
 		} else
 		{
+			if (wdh->wbuf != NULL)
+				wdh->wbuf_pos = (gint64)ftell((FILE *)wdh->fh);
 			return 0;
 		}
 	}
@@ -2479,12 +3172,18 @@ gint64 wtap_dump_file_seek(wtap_dumper *wdh, gint64 offset, int whence, int *err
 gint64 wtap_dump_file_tell(wtap_dumper *wdh, int *err)
 {
 	gint64 rval;
-#ifdef HAVE_LIBZ
 	if(wdh->compressed) {
 		*err = WTAP_ERR_CANT_SEEK_COMPRESSED;
 		return -1;
+	} else if (wdh->wbuf != NULL && wdh->wbuf_pos != -1) {
+		/*
+		 * What's still in the write-combining buffer comes after
+		 * what's been written.  Kept track of here, as the file
+		 * offset and the stdio position needn't agree with that
+		 * once writes bypass stdio (see wtap_dump_buffer_drain()).
+		 */
+		return wdh->wbuf_pos + (gint64)wdh->wbuf_len;
 	} else
-#endif
 	{
 		if (-1 == (rval = ftell((FILE *)wdh->fh))) {
 			*err = errno;
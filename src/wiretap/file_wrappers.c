@@ -47,20 +47,38 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #ifdef HAVE_FCNTL_H
 #include <fcntl.h>
 #endif /* HAVE_FCNTL_H */
 #include <string.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif /* HAVE_MMAP */
 #include "wtap-int.h"
 #include "file_wrappers.h"
 #include <wsutil/file_util.h>
+#include <wsutil/pint.h>
 
 #ifdef HAVE_LIBZ
 #include <zlib.h>
 #endif /* HAVE_LIBZ */
 
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif /* HAVE_ZSTD */
+
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif /* HAVE_LZ4 */
+
 /*
- * See RFC 1952 for a description of the gzip file format.
+ * See RFC 1952 for a description of the gzip file format, RFC 8878 for
+ * the zstd format, and
+ *
+ *	https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md
+ *
+ * for the LZ4 frame format.
  *
  * Some other compressed file formats we might want to support:
  *
@@ -78,6 +96,12 @@
 static const char *compressed_file_extensions[] = {
 #ifdef HAVE_LIBZ
 	"gz",
+#endif
+#ifdef HAVE_ZSTD
+	"zst",
+#endif
+#ifdef HAVE_LZ4
+	"lz4",
 #endif
 	NULL
 };
@@ -103,14 +127,73 @@ wtap_get_compressed_file_extensions(void)
 /* #define GZBUFSIZE 8192 */
 #define GZBUFSIZE 4096
 
+#ifdef HAVE_LIBZ
+/*
+ * Files compressed with WTAP_BGZF_COMPRESSED are written as a series of
+ * gzip members holding BGZF_BLOCK_SIZE bytes of uncompressed data each,
+ * laid out as in the "BGZF" format of the SAM/BAM specification: each
+ * member's header has an extra subfield, "BC", giving the size of the
+ * member.  To gzip that's just a multi-member file; when reading one, we
+ * use the sizes to find the members without inflating them, so several
+ * can be inflated at once, and to seek straight to the member holding an
+ * offset.
+ */
+#define BGZF_BLOCK_SIZE		0xff00	/* uncompressed data written per member */
+#define BGZF_MAX_BLOCK		0x10000	/* biggest member, compressed or not */
+#define BGZF_HEADER_SIZE	18	/* of the members we write */
+#define BGZF_TRAILER_SIZE	8
+#define BGZF_MAX_DEPTH		32	/* most members being inflated at once */
+#endif
+
+/* largest file mapped into memory on a host with 32-bit pointers */
+#define MAX_MAP_SIZE_32 (256*1024*1024)
+
+#ifndef S_ISREG
+#define S_ISREG(mode)   (((mode) & S_IFMT) == S_IFREG)
+#endif
+
+/*
+ * Regular files being read from start to end are read through a buffer
+ * of read_buffer_size bytes, rather than a disk block at a time, and,
+ * if read_ahead is set, by a thread of their own ahead of the reader.
+ * Unless a program says otherwise, files are read ahead if the
+ * WIRESHARK_READ_AHEAD environment variable is set; it's a loss on
+ * files that are already in the page cache.
+ */
+static guint read_buffer_size = WTAP_DEFAULT_READ_BUFFER_SIZE;
+static gint read_ahead = -1;	/* -1 if not yet known */
+
+void
+wtap_set_read_buffer_size(guint size)
+{
+	read_buffer_size = size != 0 ? size : WTAP_DEFAULT_READ_BUFFER_SIZE;
+}
+
+void
+wtap_set_read_ahead(gboolean on)
+{
+#if !GLIB_CHECK_VERSION(2,31,0)
+	if (on && !g_thread_supported())
+		g_thread_init(NULL);
+#endif
+	read_ahead = on ? 1 : 0;
+}
+
 /* values for wtap_reader compression */
 typedef enum {
 	UNKNOWN,	/* unknown - look for a gzip header */
-	UNCOMPRESSED,	/* uncompressed - copy input directly */
 #ifdef HAVE_LIBZ
 	ZLIB,		/* decompress a zlib stream */
-	GZIP_AFTER_HEADER
+	GZIP_AFTER_HEADER,
+	BGZF,		/* decompress block-gzip members */
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD,		/* decompress a zstd frame */
+#endif
+#ifdef HAVE_LZ4
+	LZ4,		/* decompress an LZ4 frame */
 #endif
+	UNCOMPRESSED	/* uncompressed - copy input directly */
 } compression_t;
 
 struct wtap_reader {
@@ -121,6 +204,7 @@ struct wtap_reader {
 	unsigned char *in;         /* input buffer */
 	unsigned char *out;        /* output buffer (double-sized when reading) */
 	unsigned char *next;       /* next output data to deliver or write */
+	unsigned char *window;     /* start of what next points into: out, or part of map */
 
 	guint have;                /* amount of output data unused at next */
 	gboolean eof;              /* TRUE if end of input file reached */
@@ -141,18 +225,228 @@ struct wtap_reader {
 	/* zlib inflate stream */
 	z_stream strm;             /* stream structure in-place (not a pointer) */
 	gboolean dont_check_crc;   /* TRUE if we aren't supposed to check the CRC */
+	struct bgzf_reader *bgzf;  /* block-gzip members being inflated, if any */
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_DCtx *zstd;           /* zstd decompression context, once needed */
+#endif
+#ifdef HAVE_LZ4
+	LZ4F_dctx *lz4;            /* LZ4 decompression context, once needed */
 #endif
 	/* fast seeking */
 	GPtrArray *fast_seek;
 	void *fast_seek_cur;
+	/* sequential reading */
+	gboolean sequential;       /* TRUE if a regular file read from start to end */
+	gboolean random;           /* TRUE if read at random */
+	struct read_ahead *ahead;  /* thread reading ahead, if any */
+	/* memory mapping */
+	unsigned char *map;        /* the file mapped into memory, if it is */
+	gint64 map_size;           /* how much of it is mapped */
+};
+
+/*
+ * Reading ahead: a thread reads the file into two chunks of state->size
+ * bytes, one filling while raw_read() copies out of the other.  The file
+ * offset belongs to the thread while it runs; it's stopped, and the
+ * offset put back to raw_pos, before anything else touches the file.
+ */
+#define READ_AHEAD_CHUNKS	2
+
+struct read_ahead_chunk {
+	unsigned char *buf;
+	guint len;                 /* bytes read into buf */
+	int err;                   /* errno, if the read failed */
+	gboolean eof;              /* TRUE if the read was at end of file */
 };
 
+struct read_ahead {
+	int fd;
+	guint size;
+	GThread *thread;           /* NULL if not running */
+	GAsyncQueue *free_q;       /* chunks for the thread to fill */
+	GAsyncQueue *full_q;       /* chunks for raw_read() */
+	volatile gint stop;
+	struct read_ahead_chunk *cur;  /* chunk being copied out of */
+	guint cur_off;
+	struct read_ahead_chunk chunks[READ_AHEAD_CHUNKS];
+};
+
+static gpointer
+read_ahead_thread(gpointer data)
+{
+	struct read_ahead *ra = (struct read_ahead *)data;
+	struct read_ahead_chunk *chunk;
+	ssize_t ret;
+
+	do {
+		chunk = (struct read_ahead_chunk *)g_async_queue_pop(ra->free_q);
+		if (g_atomic_int_get(&ra->stop))
+			break;
+		ret = read(ra->fd, chunk->buf, ra->size);
+		chunk->len = ret > 0 ? (guint)ret : 0;
+		chunk->err = ret < 0 ? errno : 0;
+		chunk->eof = (ret == 0);
+		g_async_queue_push(ra->full_q, chunk);
+	} while (ret > 0);
+	return NULL;
+}
+
+static struct read_ahead *
+read_ahead_new(guint size)
+{
+	struct read_ahead *ra;
+	int i;
+
+	ra = g_new0(struct read_ahead, 1);
+	ra->size = size;
+	for (i = 0; i < READ_AHEAD_CHUNKS; i++) {
+		ra->chunks[i].buf = (unsigned char *)g_try_malloc(size);
+		if (ra->chunks[i].buf == NULL) {
+			while (i-- > 0)
+				g_free(ra->chunks[i].buf);
+			g_free(ra);
+			return NULL;
+		}
+	}
+	ra->free_q = g_async_queue_new();
+	ra->full_q = g_async_queue_new();
+	return ra;
+}
+
+static void
+read_ahead_start(FILE_T state)
+{
+	struct read_ahead *ra = state->ahead;
+	int i;
+
+	ra->fd = state->fd;
+	ra->stop = 0;
+	ra->cur = NULL;
+	for (i = 0; i < READ_AHEAD_CHUNKS; i++)
+		g_async_queue_push(ra->free_q, &ra->chunks[i]);
+#if GLIB_CHECK_VERSION(2,31,0)
+	ra->thread = g_thread_new("file read-ahead", read_ahead_thread, ra);
+#else
+	ra->thread = g_thread_create(read_ahead_thread, ra, TRUE, NULL);
+#endif
+}
+
+static void
+read_ahead_stop(FILE_T state)
+{
+	struct read_ahead *ra = state->ahead;
+
+	if (ra == NULL || ra->thread == NULL)
+		return;
+	g_atomic_int_set(&ra->stop, 1);
+	g_async_queue_push(ra->free_q, &ra->chunks[0]);	/* wake it up */
+	g_thread_join(ra->thread);
+	ra->thread = NULL;
+	while (g_async_queue_try_pop(ra->free_q) != NULL)
+		;
+	while (g_async_queue_try_pop(ra->full_q) != NULL)
+		;
+	ra->cur = NULL;
+
+	/* Forget what was read ahead. */
+	ws_lseek64(state->fd, state->raw_pos, SEEK_SET);
+}
+
+static void
+read_ahead_free(FILE_T state)
+{
+	struct read_ahead *ra = state->ahead;
+	int i;
+
+	if (ra == NULL)
+		return;
+	read_ahead_stop(state);
+	g_async_queue_unref(ra->free_q);
+	g_async_queue_unref(ra->full_q);
+	for (i = 0; i < READ_AHEAD_CHUNKS; i++)
+		g_free(ra->chunks[i].buf);
+	g_free(ra);
+	state->ahead = NULL;
+}
+
+/* raw_read() from the chunks the thread has read. */
+static int
+read_ahead_read(FILE_T state, unsigned char *buf, unsigned int count, guint *have)
+{
+	struct read_ahead *ra = state->ahead;
+	struct read_ahead_chunk *chunk;
+	guint n;
+	int err;
+
+	*have = 0;
+	if (ra->thread == NULL)
+		read_ahead_start(state);
+	while (*have < count) {
+		if (ra->cur == NULL) {
+			ra->cur = (struct read_ahead_chunk *)g_async_queue_pop(ra->full_q);
+			ra->cur_off = 0;
+		}
+		chunk = ra->cur;
+		if (chunk->err != 0 || chunk->eof) {
+			/*
+			 * The thread has finished; it's started again
+			 * if we're asked to read more, e.g. from a file
+			 * that's still being written.
+			 */
+			err = chunk->err;
+			read_ahead_stop(state);
+			if (err != 0) {
+				state->err = err;
+				state->err_info = NULL;
+				return -1;
+			}
+			state->eof = TRUE;
+			return 0;
+		}
+		n = MIN(chunk->len - ra->cur_off, count - *have);
+		memcpy(buf + *have, chunk->buf + ra->cur_off, n);
+		*have += n;
+		ra->cur_off += n;
+		state->raw_pos += n;
+		if (ra->cur_off == chunk->len) {
+			g_async_queue_push(ra->free_q, chunk);
+			ra->cur = NULL;
+		}
+	}
+	return 0;
+}
+
 static int	/* gz_load */
 raw_read(FILE_T state, unsigned char *buf, unsigned int count, guint *have)
 {
 	ssize_t ret;
 
+	if (state->ahead != NULL)
+		return read_ahead_read(state, buf, count, have);
+
 	*have = 0;
+#ifdef HAVE_MMAP
+	if (state->map != NULL) {
+		if (state->raw_pos < state->map_size) {
+			*have = (guint)MIN((gint64)count, state->map_size - state->raw_pos);
+			memcpy(buf, state->map + state->raw_pos, *have);
+			state->raw_pos += *have;
+			if (*have == count)
+				return 0;
+		}
+		/*
+		 * The file has grown since it was mapped; read the rest.
+		 * The file offset isn't kept up to date while reading
+		 * from the mapping.
+		 */
+		if (ws_lseek64(state->fd, state->raw_pos, SEEK_SET) == -1) {
+			state->err = errno;
+			state->err_info = NULL;
+			return -1;
+		}
+	}
+#endif
 	do {
 		ret = read(state->fd, buf + *have, count - *have);
 		if (ret <= 0)
@@ -167,6 +461,12 @@ raw_read(FILE_T state, unsigned char *buf, unsigned int count, guint *have)
 	}
 	if (ret == 0)
 		state->eof = TRUE;
+#ifdef HAVE_POSIX_FADVISE
+	else if (state->sequential) {
+		/* Have the kernel start on the next read while we use this one. */
+		(void)posix_fadvise(state->fd, state->raw_pos, count, POSIX_FADV_WILLNEED);
+	}
+#endif
 	return 0;
 }
 
@@ -183,6 +483,31 @@ fill_in_buffer(FILE_T state)
 	return 0;
 }
 
+/*
+ * Try to get at least need bytes of input in one piece at next_in,
+ * moving what's there to the start of the input buffer first.
+ */
+static int
+fill_in_peek(FILE_T state, guint need)
+{
+	guint got;
+
+	if (state->err)
+		return -1;
+	if (state->avail_in >= need || need > state->size)
+		return 0;
+	if (state->avail_in != 0)
+		memmove(state->in, state->next_in, state->avail_in);
+	state->next_in = state->in;
+	while (state->avail_in < need && !state->eof) {
+		if (raw_read(state, state->in + state->avail_in,
+		    state->size - state->avail_in, &got) == -1)
+			return -1;
+		state->avail_in += got;
+	}
+	return 0;
+}
+
 #define ZLIB_WINSIZE 32768
 
 struct fast_seek_point {
@@ -247,7 +572,11 @@ fast_seek_header(FILE_T file, gint64 in_pos, gint64 out_pos,
 		item = (struct fast_seek_point *)file->fast_seek->pdata[file->fast_seek->len - 1];
 
 	if (!item || item->out < out_pos) {
-		struct fast_seek_point *val = g_new(struct fast_seek_point,1);
+		/*
+		 * Only zlib points need the window; leave it off the
+		 * others, as there's one for every block-gzip member.
+		 */
+		struct fast_seek_point *val = (struct fast_seek_point *)g_malloc(G_STRUCT_OFFSET(struct fast_seek_point, data));
 		val->in = in_pos;
 		val->out = out_pos;
 		val->compression = compression;
@@ -256,6 +585,604 @@ fast_seek_header(FILE_T file, gint64 in_pos, gint64 out_pos,
 	}
 }
 
+/*
+ * Is here the start of a block-gzip member, or a zstd or LZ4 frame, from
+ * which decompression can start afresh?
+ */
+static gboolean
+fast_seek_is_frame(const struct fast_seek_point *here)
+{
+	switch (here->compression) {
+
+#ifdef HAVE_LIBZ
+	case BGZF:
+#endif
+#ifdef HAVE_ZSTD
+	case ZSTD:
+#endif
+#ifdef HAVE_LZ4
+	case LZ4:
+#endif
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+
+/*
+ * Seek points as they're saved in an index sidecar (see capture_index.c).
+ * The compression codes don't depend on which libraries we were built
+ * with, and zlib windows are saved deflated.
+ */
+#define FAST_SEEK_SAVED_UNCOMPRESSED	0
+#define FAST_SEEK_SAVED_ZLIB		1
+#define FAST_SEEK_SAVED_GZIP_AFTER_HEADER	2
+#define FAST_SEEK_SAVED_BGZF		3
+#define FAST_SEEK_SAVED_ZSTD		4
+#define FAST_SEEK_SAVED_LZ4		5
+
+#define FAST_SEEK_SAVED_HDR_SIZE	(1 + 1 + 8 + 8)
+
+static void
+byte_array_append_le(GByteArray *buf, guint64 val, guint len)
+{
+	guint8 b[8];
+	guint i;
+
+	for (i = 0; i < len; i++, val >>= 8)
+		b[i] = (guint8)val;
+	g_byte_array_append(buf, b, len);
+}
+
+void
+file_fast_seek_save(GPtrArray *seek, GByteArray *buf)
+{
+	struct fast_seek_point *point;
+	guint i;
+	guint8 code;
+
+	byte_array_append_le(buf, seek->len, 4);
+	for (i = 0; i < seek->len; i++) {
+		point = (struct fast_seek_point *)seek->pdata[i];
+		switch (point->compression) {
+
+#ifdef HAVE_LIBZ
+		case ZLIB:
+			code = FAST_SEEK_SAVED_ZLIB;
+			break;
+
+		case GZIP_AFTER_HEADER:
+			code = FAST_SEEK_SAVED_GZIP_AFTER_HEADER;
+			break;
+
+		case BGZF:
+			code = FAST_SEEK_SAVED_BGZF;
+			break;
+#endif
+#ifdef HAVE_ZSTD
+		case ZSTD:
+			code = FAST_SEEK_SAVED_ZSTD;
+			break;
+#endif
+#ifdef HAVE_LZ4
+		case LZ4:
+			code = FAST_SEEK_SAVED_LZ4;
+			break;
+#endif
+		default:
+			code = FAST_SEEK_SAVED_UNCOMPRESSED;
+			break;
+		}
+		g_byte_array_append(buf, &code, 1);
+#ifdef HAVE_INFLATEPRIME
+		byte_array_append_le(buf, point->compression == ZLIB ? point->data.zlib.bits : 0, 1);
+#else
+		byte_array_append_le(buf, 0, 1);
+#endif
+		byte_array_append_le(buf, (guint64)point->in, 8);
+		byte_array_append_le(buf, (guint64)point->out, 8);
+
+#ifdef HAVE_LIBZ
+		if (point->compression == ZLIB) {
+			uLongf len = compressBound(ZLIB_WINSIZE);
+			guint before = buf->len;
+
+			byte_array_append_le(buf, point->data.zlib.adler, 4);
+			byte_array_append_le(buf, point->data.zlib.total_out, 4);
+			g_byte_array_set_size(buf, before + 12 + (guint)len);
+			if (compress2(buf->data + before + 12, &len,
+			    point->data.zlib.window, ZLIB_WINSIZE, Z_BEST_SPEED) != Z_OK)
+				len = 0;	/* reads back as a bad point */
+			buf->data[before + 8] = (guint8)len;
+			buf->data[before + 9] = (guint8)(len >> 8);
+			buf->data[before + 10] = (guint8)(len >> 16);
+			buf->data[before + 11] = (guint8)(len >> 24);
+			g_byte_array_set_size(buf, before + 12 + (guint)len);
+		}
+#endif
+	}
+}
+
+GPtrArray *
+file_fast_seek_load(const guint8 *p, gsize len)
+{
+	GPtrArray *seek;
+	struct fast_seek_point *point;
+	const guint8 *hdr;
+	guint32 count, i;
+	compression_t compression;
+	gint64 in, out, last_out = -1;
+
+	if (len < 4)
+		return NULL;
+	count = pletoh32(p);
+	p += 4;
+	len -= 4;
+	/* the sidecar's body isn't checked, so don't let it size the array */
+	if (count > len / FAST_SEEK_SAVED_HDR_SIZE)
+		return NULL;
+	seek = g_ptr_array_sized_new(count);
+	for (i = 0; i < count; i++) {
+		if (len < FAST_SEEK_SAVED_HDR_SIZE)
+			goto bad;
+		hdr = p;
+		in = (gint64)pletoh64(hdr + 2);
+		out = (gint64)pletoh64(hdr + 10);
+		if (in < 0 || out <= last_out)
+			goto bad;
+
+		/* a file this build can't read has no use for its index */
+		switch (hdr[0]) {
+
+		case FAST_SEEK_SAVED_UNCOMPRESSED:
+			compression = UNCOMPRESSED;
+			break;
+
+#ifdef HAVE_LIBZ
+		case FAST_SEEK_SAVED_ZLIB:
+			compression = ZLIB;
+			break;
+
+		case FAST_SEEK_SAVED_GZIP_AFTER_HEADER:
+			compression = GZIP_AFTER_HEADER;
+			break;
+
+		case FAST_SEEK_SAVED_BGZF:
+			compression = BGZF;
+			break;
+#endif
+#ifdef HAVE_ZSTD
+		case FAST_SEEK_SAVED_ZSTD:
+			compression = ZSTD;
+			break;
+#endif
+#ifdef HAVE_LZ4
+		case FAST_SEEK_SAVED_LZ4:
+			compression = LZ4;
+			break;
+#endif
+		default:
+			goto bad;
+		}
+		p += FAST_SEEK_SAVED_HDR_SIZE;
+		len -= FAST_SEEK_SAVED_HDR_SIZE;
+
+#ifdef HAVE_LIBZ
+		if (compression == ZLIB) {
+			guint32 wlen;
+			uLongf got = ZLIB_WINSIZE;
+
+			if (len < 12 || (wlen = pletoh32(p + 8)) > len - 12 ||
+			    hdr[1] > 7)
+				goto bad;
+			point = g_new(struct fast_seek_point, 1);
+			point->data.zlib.adler = pletoh32(p);
+			point->data.zlib.total_out = pletoh32(p + 4);
+			if (uncompress(point->data.zlib.window, &got, p + 12,
+			    wlen) != Z_OK || got != ZLIB_WINSIZE) {
+				g_free(point);
+				goto bad;
+			}
+			p += 12 + wlen;
+			len -= 12 + wlen;
+#ifdef HAVE_INFLATEPRIME
+			point->data.zlib.bits = hdr[1];
+#else
+			/* we can't resume mid-byte; go from an earlier point */
+			if (hdr[1] != 0) {
+				g_free(point);
+				continue;
+			}
+#endif
+		} else
+#endif
+			point = (struct fast_seek_point *)g_malloc(G_STRUCT_OFFSET(struct fast_seek_point, data));
+		point->in = in;
+		point->out = out;
+		point->compression = compression;
+		g_ptr_array_add(seek, point);
+		last_out = out;
+	}
+	return seek;
+
+bad:
+	for (i = 0; i < seek->len; i++)
+		g_free(seek->pdata[i]);
+	g_ptr_array_free(seek, TRUE);
+	return NULL;
+}
+
+#ifdef HAVE_LIBZ
+/*
+ * Reading block-gzip: the members are read in order, and handed to a
+ * pool of threads to inflate, up to "depth" of them at a time; they're
+ * delivered, in order, out of the blocks they're inflated into.  Files
+ * read at random inflate the one member they're in, themselves.
+ */
+struct bgzf_block {
+	unsigned char *raw;        /* the member, header and all */
+	guint raw_len;
+	guint hlen;                /* size of its header */
+	gint64 in_pos;             /* where it is in the file */
+	unsigned char *out;        /* what it inflates to */
+	guint out_len;
+	gboolean check_crc;
+	int err;                   /* error inflating it, if any */
+	const char *err_info;
+	gboolean done;             /* TRUE once inflated; only the reader looks */
+	z_stream strm;
+	struct bgzf_reader *reader;
+};
+
+struct bgzf_reader {
+	guint depth;               /* size of the ring of blocks */
+	guint want;                /* blocks to have in flight; grows to depth */
+	guint head;                /* block being delivered, or to be next */
+	guint queued;              /* blocks in flight, counting head */
+	gboolean delivering;       /* TRUE if the file's next points into head */
+	gboolean eof;              /* end of input seen, not yet passed on */
+	int err;                   /* read error to pass on after what's queued */
+	const char *err_info;
+	GAsyncQueue *done_q;       /* blocks the pool has inflated; NULL if no pool */
+	struct bgzf_block blocks[BGZF_MAX_DEPTH];
+};
+
+static GThreadPool *bgzf_pool;
+static guint bgzf_threads;
+
+/*
+ * If a block-gzip member starts at next_in, return its size, and put the
+ * size of its header in *hlen, without consuming anything; return 0 if
+ * there's something else, or nothing, there, and -1 on a read error.
+ */
+static int
+bgzf_peek(FILE_T state, guint *hlen)
+{
+	unsigned char *p;
+	guint xlen, off, slen, bsize;
+
+	/* ID1, ID2, CM, and FLG with just FEXTRA set, then up to XLEN */
+	if (fill_in_peek(state, 12) == -1)
+		return -1;
+	p = state->next_in;
+	if (state->avail_in < 12 || p[0] != 31 || p[1] != 139 || p[2] != 8 ||
+	    p[3] != 4)
+		return 0;
+	xlen = p[10] | (p[11] << 8);
+	if (fill_in_peek(state, 12 + xlen) == -1)
+		return -1;
+	p = state->next_in;
+	if (state->avail_in < 12 + xlen)
+		return 0;
+
+	/* look for the BC subfield */
+	for (off = 12; off + 4 <= 12 + xlen; off += 4 + slen) {
+		slen = p[off + 2] | (p[off + 3] << 8);
+		if (p[off] == 'B' && p[off + 1] == 'C' && slen == 2 &&
+		    off + 6 <= 12 + xlen) {
+			bsize = (p[off + 4] | (p[off + 5] << 8)) + 1;
+			*hlen = 12 + xlen;
+			if (bsize < *hlen + BGZF_TRAILER_SIZE)
+				return 0;
+			return (int)bsize;
+		}
+	}
+	return 0;
+}
+
+/* Copy the size bytes of the member bgzf_peek() found into blk. */
+static int
+bgzf_read_member(FILE_T state, struct bgzf_block *blk, guint size, guint hlen)
+{
+	guint got = 0, n;
+
+	blk->in_pos = state->raw_pos - state->avail_in;
+	while (got < size) {
+		if (state->avail_in == 0) {
+			if (fill_in_buffer(state) == -1)
+				return -1;
+			if (state->avail_in == 0) {
+				state->err = WTAP_ERR_SHORT_READ;
+				state->err_info = NULL;
+				return -1;
+			}
+		}
+		n = MIN(state->avail_in, size - got);
+		memcpy(blk->raw + got, state->next_in, n);
+		state->next_in += n;
+		state->avail_in -= n;
+		got += n;
+	}
+	blk->raw_len = size;
+	blk->hlen = hlen;
+	return 0;
+}
+
+static void
+bgzf_inflate(struct bgzf_block *blk)
+{
+	z_streamp strm = &blk->strm;
+	const unsigned char *trailer = blk->raw + blk->raw_len - BGZF_TRAILER_SIZE;
+	guint32 crc, len;
+	int ret;
+
+	crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((guint32)trailer[3] << 24);
+	len = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) | ((guint32)trailer[7] << 24);
+	blk->out_len = 0;
+	blk->err = 0;
+	blk->err_info = NULL;
+
+	inflateReset(strm);
+	strm->next_in = blk->raw + blk->hlen;
+	strm->avail_in = blk->raw_len - blk->hlen - BGZF_TRAILER_SIZE;
+	strm->next_out = blk->out;
+	strm->avail_out = BGZF_MAX_BLOCK;
+	ret = inflate(strm, Z_FINISH);
+	blk->out_len = BGZF_MAX_BLOCK - strm->avail_out;
+	if (ret == Z_MEM_ERROR) {
+		/* This means "not enough memory". */
+		blk->err = ENOMEM;
+	} else if (ret != Z_STREAM_END) {
+		blk->err = WTAP_ERR_DECOMPRESS;
+		if (strm->msg != NULL)
+			blk->err_info = strm->msg;
+		else if (strm->avail_out == 0)
+			blk->err_info = "block-gzip member too big";
+		else
+			blk->err_info = "block-gzip member cut short";
+	} else if (blk->check_crc &&
+	    crc != (guint32)crc32(0L, blk->out, blk->out_len)) {
+		blk->err = WTAP_ERR_DECOMPRESS;
+		blk->err_info = "bad CRC";
+	} else if (len != blk->out_len) {
+		blk->err = WTAP_ERR_DECOMPRESS;
+		blk->err_info = "length field wrong";
+	}
+}
+
+static void
+bgzf_inflate_thread(gpointer data, gpointer user_data _U_)
+{
+	struct bgzf_block *blk = (struct bgzf_block *)data;
+
+	bgzf_inflate(blk);
+	g_async_queue_push(blk->reader->done_q, blk);
+}
+
+static gpointer
+bgzf_pool_new(gpointer data _U_)
+{
+#if GLIB_CHECK_VERSION(2,36,0)
+	bgzf_threads = MIN(g_get_num_processors(), BGZF_MAX_DEPTH / 2);
+#else
+	bgzf_threads = 4;
+#endif
+	if (bgzf_threads < 2)
+		return NULL;
+#if !GLIB_CHECK_VERSION(2,31,0)
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+#endif
+	bgzf_pool = g_thread_pool_new(bgzf_inflate_thread, NULL,
+	    (gint)bgzf_threads, FALSE, NULL);
+	return bgzf_pool;
+}
+
+static struct bgzf_reader *
+bgzf_reader_new(FILE_T state)
+{
+	static GOnce pool_once = G_ONCE_INIT;
+	struct bgzf_reader *r;
+
+	r = g_new0(struct bgzf_reader, 1);
+	r->depth = 1;
+	r->want = 1;
+	if (!state->random && g_once(&pool_once, bgzf_pool_new, NULL) != NULL) {
+		/* stay within about what the file's read buffers take */
+		r->depth = MIN(2 * bgzf_threads, BGZF_MAX_DEPTH);
+		r->depth = MIN(r->depth, MAX(read_buffer_size / BGZF_MAX_BLOCK, 2));
+		r->done_q = g_async_queue_new();
+	}
+	return r;
+}
+
+/* Get the buffers for a block the first time it's used. */
+static int
+bgzf_block_init(struct bgzf_reader *r, struct bgzf_block *blk)
+{
+	if (blk->raw != NULL)
+		return 0;
+	blk->reader = r;
+	blk->strm.zalloc = Z_NULL;
+	blk->strm.zfree = Z_NULL;
+	blk->strm.opaque = Z_NULL;
+	blk->strm.avail_in = 0;
+	blk->strm.next_in = Z_NULL;
+	if (inflateInit2(&blk->strm, -15) != Z_OK)    /* raw inflate */
+		return -1;
+	blk->raw = (unsigned char *)g_try_malloc(BGZF_MAX_BLOCK);
+	blk->out = (unsigned char *)g_try_malloc(BGZF_MAX_BLOCK);
+	if (blk->raw == NULL || blk->out == NULL) {
+		g_free(blk->out);
+		g_free(blk->raw);
+		blk->out = blk->raw = NULL;
+		inflateEnd(&blk->strm);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+bgzf_wait(struct bgzf_reader *r, struct bgzf_block *blk)
+{
+	struct bgzf_block *done;
+
+	while (!blk->done) {
+		done = (struct bgzf_block *)g_async_queue_pop(r->done_q);
+		done->done = TRUE;
+	}
+}
+
+/* Forget the members in flight, once the pool is through with them. */
+static void
+bgzf_reset(FILE_T state)
+{
+	struct bgzf_reader *r = state->bgzf;
+	guint i;
+
+	if (r == NULL)
+		return;
+	for (i = 0; i < r->queued; i++)
+		bgzf_wait(r, &r->blocks[(r->head + i) % r->depth]);
+	r->want = 1;
+	r->head = 0;
+	r->queued = 0;
+	r->delivering = FALSE;
+	r->eof = FALSE;
+	r->err = 0;
+	r->err_info = NULL;
+}
+
+static void
+bgzf_free(FILE_T state)
+{
+	struct bgzf_reader *r = state->bgzf;
+	guint i;
+
+	if (r == NULL)
+		return;
+	bgzf_reset(state);
+	for (i = 0; i < r->depth; i++) {
+		if (r->blocks[i].raw != NULL) {
+			inflateEnd(&r->blocks[i].strm);
+			g_free(r->blocks[i].out);
+			g_free(r->blocks[i].raw);
+		}
+	}
+	if (r->done_q != NULL)
+		g_async_queue_unref(r->done_q);
+	g_free(r);
+	state->bgzf = NULL;
+}
+
+/*
+ * Deliver the next member's data, reading and queueing up the ones after
+ * it.  If there are no more members, but there's more data, switch back
+ * to looking for a gzip header.
+ */
+static int
+bgzf_fill(FILE_T state)
+{
+	struct bgzf_reader *r = state->bgzf;
+	struct bgzf_block *blk;
+	guint hlen;
+	int size;
+
+	if (r == NULL)
+		r = state->bgzf = bgzf_reader_new(state);
+
+	do {
+		/* we're through with the member we were delivering */
+		if (r->delivering) {
+			r->delivering = FALSE;
+			r->head = (r->head + 1) % r->depth;
+			r->queued--;
+		}
+
+		while (r->queued < r->want && !r->eof && r->err == 0) {
+			blk = &r->blocks[(r->head + r->queued) % r->depth];
+			size = bgzf_peek(state, &hlen);
+			if (size == 0)
+				break;
+			if (size != -1) {
+				if (bgzf_block_init(r, blk) == -1) {
+					state->err = ENOMEM;
+					state->err_info = NULL;
+				} else
+					(void)bgzf_read_member(state, blk, (guint)size, hlen);
+			}
+			if (state->err) {
+				/* pass it on after what we've already got */
+				r->err = state->err;
+				r->err_info = state->err_info;
+				state->err = 0;
+				state->err_info = NULL;
+				break;
+			}
+			blk->check_crc = !state->dont_check_crc;
+			blk->done = FALSE;
+			if (r->done_q != NULL)
+				g_thread_pool_push(bgzf_pool, blk, NULL);
+			else {
+				bgzf_inflate(blk);
+				blk->done = TRUE;
+			}
+			r->queued++;
+		}
+		if (r->want < r->depth)
+			r->want = MIN(r->want * 2, r->depth);
+
+		/*
+		 * Don't let end of input be seen until what was read
+		 * before it has been delivered.
+		 */
+		if (state->eof) {
+			r->eof = TRUE;
+			state->eof = FALSE;
+		}
+		if (r->queued == 0) {
+			state->eof = r->eof;
+			r->eof = FALSE;
+			if (r->err) {
+				state->err = r->err;
+				state->err_info = r->err_info;
+				r->err = 0;
+				return -1;
+			}
+			if (state->avail_in != 0 || !state->eof)
+				state->compression = UNKNOWN;
+			return 0;
+		}
+
+		blk = &r->blocks[r->head];
+		bgzf_wait(r, blk);
+		r->delivering = TRUE;
+		if (state->fast_seek)
+			fast_seek_header(state, blk->in_pos, state->pos, BGZF);
+		state->next = blk->out;
+		state->window = blk->out;
+		state->have = blk->out_len;
+		if (blk->err) {
+			/* deliver what we got, then fail */
+			state->err = blk->err;
+			state->err_info = blk->err_info;
+		}
+	} while (state->have == 0 && !state->err);
+	return 0;
+}
+#endif
+
 static void
 fast_seek_reset(FILE_T state _U_)
 {
@@ -265,6 +1192,7 @@ fast_seek_reset(FILE_T state _U_)
 
 		cur->have = 0;
 	}
+	bgzf_reset(state);
 #endif
 }
 
@@ -549,6 +1477,7 @@ zlib_read(FILE_T state, unsigned char *buf, unsigned int count)
 
 	/* update available output and crc check value */
 	state->next = buf;
+	state->window = buf;
 	state->have = count - strm->avail_out;
 
 	/* Check gzip trailer if at end of deflate stream.
@@ -574,6 +1503,170 @@ zlib_read(FILE_T state, unsigned char *buf, unsigned int count)
 }
 #endif
 
+#if defined(HAVE_ZSTD) || defined(HAVE_LZ4)
+/*
+ * If a zstd or LZ4 frame starts at next_in, get ready to decompress it,
+ * leaving its magic number for the decompressor, and return 1; return 0
+ * if there's something else there, and -1 on an error.
+ */
+static int
+frame_head(FILE_T state)
+{
+	const unsigned char *p;
+	guint32 magic;
+	compression_t compression;
+
+	if (fill_in_peek(state, 4) == -1)
+		return -1;
+	if (state->avail_in < 4)
+		return 0;
+	p = state->next_in;
+	magic = p[0] | (p[1] << 8) | (p[2] << 16) | ((guint32)p[3] << 24);
+
+	if (magic == 0xFD2FB528) {
+#ifdef HAVE_ZSTD
+		compression = ZSTD;
+#else
+		return 0;
+#endif
+	} else if (magic == 0x184D2204) {
+#ifdef HAVE_LZ4
+		compression = LZ4;
+#else
+		return 0;
+#endif
+	} else if ((magic & 0xFFFFFFF0) == 0x184D2A50) {
+		/* a skippable frame, as pzstd puts before each frame */
+#ifdef HAVE_ZSTD
+		compression = ZSTD;
+#else
+		compression = LZ4;
+#endif
+	} else
+		return 0;
+
+#ifdef HAVE_ZSTD
+	if (compression == ZSTD) {
+		if (state->zstd == NULL && (state->zstd = ZSTD_createDCtx()) == NULL) {
+			state->err = ENOMEM;
+			state->err_info = NULL;
+			return -1;
+		}
+		ZSTD_DCtx_reset(state->zstd, ZSTD_reset_session_only);
+	}
+#endif
+#ifdef HAVE_LZ4
+	if (compression == LZ4) {
+		if (state->lz4 == NULL &&
+		    LZ4F_isError(LZ4F_createDecompressionContext(&state->lz4, LZ4F_VERSION))) {
+			state->lz4 = NULL;
+			state->err = ENOMEM;
+			state->err_info = NULL;
+			return -1;
+		}
+		LZ4F_resetDecompressionContext(state->lz4);
+	}
+#endif
+	state->compression = compression;
+	state->is_compressed = TRUE;
+	if (state->fast_seek)
+		fast_seek_header(state, state->raw_pos - state->avail_in, state->pos, compression);
+	return 1;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static void
+zstd_read(FILE_T state, unsigned char *buf, unsigned int count)
+{
+	ZSTD_outBuffer output;
+	ZSTD_inBuffer input;
+	size_t ret;
+
+	output.dst = buf;
+	output.size = count;
+	output.pos = 0;
+
+	/* fill output buffer up to end of frame or error */
+	do {
+		/* get more input */
+		if (state->avail_in == 0 && fill_in_buffer(state) == -1)
+			break;
+		if (state->avail_in == 0) {
+			/* EOF */
+			state->err = WTAP_ERR_SHORT_READ;
+			state->err_info = NULL;
+			break;
+		}
+
+		input.src = state->next_in;
+		input.size = state->avail_in;
+		input.pos = 0;
+		ret = ZSTD_decompressStream(state->zstd, &output, &input);
+		state->next_in += input.pos;
+		state->avail_in -= (guint)input.pos;
+		if (ZSTD_isError(ret)) {
+			state->err = WTAP_ERR_DECOMPRESS;
+			state->err_info = ZSTD_getErrorName(ret);
+			break;
+		}
+		if (ret == 0) {
+			/* ready for the next frame, once have is 0 */
+			state->compression = UNKNOWN;
+			break;
+		}
+	} while (output.pos < output.size);
+
+	state->next = buf;
+	state->window = buf;
+	state->have = (guint)output.pos;
+}
+#endif
+
+#ifdef HAVE_LZ4
+static void
+lz4_read(FILE_T state, unsigned char *buf, unsigned int count)
+{
+	size_t ret, in_len, out_len;
+	guint have = 0;
+
+	/* fill output buffer up to end of frame or error */
+	do {
+		/* get more input */
+		if (state->avail_in == 0 && fill_in_buffer(state) == -1)
+			break;
+		if (state->avail_in == 0) {
+			/* EOF */
+			state->err = WTAP_ERR_SHORT_READ;
+			state->err_info = NULL;
+			break;
+		}
+
+		in_len = state->avail_in;
+		out_len = count - have;
+		ret = LZ4F_decompress(state->lz4, buf + have, &out_len,
+		    state->next_in, &in_len, NULL);
+		state->next_in += in_len;
+		state->avail_in -= (guint)in_len;
+		have += (guint)out_len;
+		if (LZ4F_isError(ret)) {
+			state->err = WTAP_ERR_DECOMPRESS;
+			state->err_info = LZ4F_getErrorName(ret);
+			break;
+		}
+		if (ret == 0) {
+			/* ready for the next frame, once have is 0 */
+			state->compression = UNKNOWN;
+			break;
+		}
+	} while (have < count);
+
+	state->next = buf;
+	state->window = buf;
+	state->have = have;
+}
+#endif
+
 static int
 gz_head(FILE_T state)
 {
@@ -585,9 +1678,37 @@ gz_head(FILE_T state)
 			return 0;
 	}
 
+#if defined(HAVE_ZSTD) || defined(HAVE_LZ4)
+	switch (frame_head(state)) {
+
+	case -1:
+		return -1;
+
+	case 1:
+		return 0;
+	}
+#endif
+
 	/* look for the gzip magic header bytes 31 and 139 */
 #ifdef HAVE_LIBZ
 	if (state->next_in[0] == 31) {
+		guint hlen;
+
+		/* block-gzip members are read whole, header and all */
+		switch (bgzf_peek(state, &hlen)) {
+
+		case -1:
+			return -1;
+
+		case 0:
+			break;
+
+		default:
+			state->compression = BGZF;
+			state->is_compressed = TRUE;
+			return 0;
+		}
+
 		state->avail_in--;
 		state->next_in++;
 		if (state->avail_in == 0 && fill_in_buffer(state) == -1)
@@ -696,6 +1817,7 @@ gz_head(FILE_T state)
 	   the input buffer, which also assures space for gzungetc() */
 	state->raw = state->pos;
 	state->next = state->out;
+	state->window = state->out;
 	if (state->avail_in) {
 		memcpy(state->next + state->have, state->next_in, state->avail_in);
 		state->have += state->avail_in;
@@ -715,15 +1837,49 @@ fill_out_buffer(FILE_T state)
 			return 0;
 	}
 	if (state->compression == UNCOMPRESSED) {           /* straight copy */
+#ifdef HAVE_MMAP
+		if (state->map != NULL && state->raw_pos < state->map_size) {
+			/* Or no copy at all: deliver straight from the mapping. */
+			state->next = state->map + state->raw_pos;
+			state->window = state->next;
+			state->have = (guint)MIN(state->map_size - state->raw_pos, G_MAXINT);
+			state->raw_pos += state->have;
+			return 0;
+		}
+#endif
 		if (raw_read(state, state->out, state->size /* << 1 */, &(state->have)) == -1)
 			return -1;
 		state->next = state->out;
+		state->window = state->out;
 	}
 #ifdef HAVE_LIBZ
 	else if (state->compression == ZLIB) {      /* decompress */
 		zlib_read(state, state->out, state->size << 1);
 	}
+	else if (state->compression == BGZF) {
+		if (bgzf_fill(state) == -1)
+			return -1;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	else if (state->compression == ZSTD) {
+		zstd_read(state, state->out, state->size << 1);
+	}
+#endif
+#ifdef HAVE_LZ4
+	else if (state->compression == LZ4) {
+		lz4_read(state, state->out, state->size << 1);
+	}
 #endif
+
+	/*
+	 * If we've come to the end of a stream, member, or frame without
+	 * getting anything, look at what's after it, rather than have
+	 * nothing look like the end of the file.
+	 */
+	if (state->have == 0 && state->compression == UNKNOWN && !state->err &&
+	    !(state->eof && state->avail_in == 0))
+		return fill_out_buffer(state);
 	return 0;
 }
 
@@ -780,9 +1936,7 @@ gz_reset(FILE_T state)
 FILE_T
 file_fdopen(int fd)
 {
-#ifdef _STATBUF_ST_BLKSIZE	/* XXX, _STATBUF_ST_BLKSIZE portable? */
 	struct stat st;
-#endif
 	int want = GZBUFSIZE;
 	FILE_T state;
 
@@ -796,6 +1950,22 @@ file_fdopen(int fd)
 
 	state->fast_seek_cur = NULL;
 	state->fast_seek = NULL;
+	state->sequential = FALSE;
+	state->random = FALSE;
+	state->ahead = NULL;
+#ifdef HAVE_LIBZ
+	state->bgzf = NULL;
+#endif
+#ifdef HAVE_ZSTD
+	state->zstd = NULL;
+#endif
+#ifdef HAVE_LZ4
+	state->lz4 = NULL;
+#endif
+	state->map = NULL;
+	state->map_size = 0;
+	state->next = NULL;
+	state->window = NULL;
 
 	/* open the file with the appropriate mode (or just use fd) */
 	state->fd = fd;
@@ -811,8 +1981,17 @@ file_fdopen(int fd)
 	/* initialize stream */
 	gz_reset(state);
 
-#ifdef _STATBUF_ST_BLKSIZE
 	if (fstat(fd, &st) >= 0) {
+		if (S_ISREG(st.st_mode) && read_buffer_size <= G_MAXINT / 2) {
+			/*
+			 * Read regular files in big pieces; if the file
+			 * turns out to be read at random, the buffers are
+			 * shrunk again by file_set_random_access().
+			 */
+			want = (int)read_buffer_size;
+			state->sequential = TRUE;
+		}
+#ifdef _STATBUF_ST_BLKSIZE	/* XXX, _STATBUF_ST_BLKSIZE portable? */
 		/*
 		 * Yes, st_blksize can be bigger than an int; apparently,
 		 * it's a long on LP64 Linux, for example.
@@ -820,10 +1999,14 @@ file_fdopen(int fd)
 		 * If the value is too big to fit into an int, just
 		 * use the default.
 		 */
-		if (st.st_blksize <= G_MAXINT)
+		else if (st.st_blksize <= G_MAXINT)
 			want = (int)st.st_blksize;
 		/* XXX, verify result? */
+#endif
 	}
+#ifdef HAVE_POSIX_FADVISE
+	if (state->sequential)
+		(void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 #endif
 
 	/* allocate buffers */
@@ -856,6 +2039,35 @@ file_fdopen(int fd)
 	/* for now, assume we should check the crc */
 	state->dont_check_crc = FALSE;
 #endif
+#ifdef HAVE_MMAP
+	/*
+	 * Map regular files into memory, so that uncompressed data can be
+	 * handed out without copying it, or even reading it, if it's never
+	 * looked at.  The mapping is private and writable, as callers may
+	 * scribble on the packet data they're handed.  If it can't be
+	 * mapped, it's read; big files aren't mapped if that would use up
+	 * a 32-bit address space.
+	 */
+	if (state->sequential && st.st_size > 0 &&
+	    (sizeof (void *) > 4 || st.st_size <= MAX_MAP_SIZE_32)) {
+		void *map = mmap(NULL, (size_t)st.st_size,
+		    PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+		if (map != MAP_FAILED) {
+			state->map = (unsigned char *)map;
+			state->map_size = st.st_size;
+#ifdef MADV_SEQUENTIAL
+			(void)madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+		}
+	}
+#endif
+	/* if we can't get the memory to read ahead, just don't */
+	if (read_ahead == -1)
+		read_ahead = getenv("WIRESHARK_READ_AHEAD") != NULL;
+	if (read_ahead && state->map == NULL)
+		state->ahead = read_ahead_new(want);
+
 	/* return stream */
 	return state;
 }
@@ -913,9 +2125,43 @@ file_open(const char *path)
 }
 
 void
-file_set_random_access(FILE_T stream, gboolean random_flag _U_, GPtrArray *seek)
+file_set_random_access(FILE_T stream, gboolean random_flag, GPtrArray *seek)
 {
+	unsigned char *in, *out;
+
 	stream->fast_seek = seek;
+	stream->random = random_flag;
+	if (!random_flag || !stream->sequential)
+		return;
+
+	/*
+	 * Each random read starts with an empty buffer, so a big one would
+	 * only make every one of them read more than it needs.  Nothing's
+	 * been read yet, so the buffers can still be swapped.
+	 */
+	stream->sequential = FALSE;
+	read_ahead_free(stream);
+#ifdef HAVE_POSIX_FADVISE
+	(void)posix_fadvise(stream->fd, 0, 0, POSIX_FADV_NORMAL);
+#endif
+#if defined(HAVE_MMAP) && defined(MADV_NORMAL)
+	if (stream->map != NULL)
+		(void)madvise(stream->map, (size_t)stream->map_size, MADV_NORMAL);
+#endif
+	if (stream->size <= GZBUFSIZE || stream->have != 0 || stream->avail_in != 0)
+		return;
+	in = (unsigned char *)g_try_malloc(GZBUFSIZE);
+	out = (unsigned char *)g_try_malloc(GZBUFSIZE << 1);
+	if (in == NULL || out == NULL) {
+		g_free(out);
+		g_free(in);
+		return;
+	}
+	g_free(stream->out);
+	g_free(stream->in);
+	stream->in = in;
+	stream->out = out;
+	stream->size = GZBUFSIZE;
 }
 
 gint64
@@ -946,7 +2192,7 @@ file_seek(FILE_T file, gint64 offset, int whence, int *err)
 		 * To squelch compiler warnings, we cast the
 		 * result.
 		 */
-		guint had = (unsigned)(file->next - file->out);
+		guint had = (unsigned)(file->next - file->window);
 		if (-offset <= had) {
 			/*
 			 * Offset is negative, so -offset is
@@ -969,7 +2215,14 @@ file_seek(FILE_T file, gint64 offset, int whence, int *err)
 	}
 
 	/* XXX, profile */
-	if ((here = fast_seek_find(file, file->pos + offset)) && (offset < 0 || offset > SPAN || here->compression == UNCOMPRESSED)) {
+	/*
+	 * Skipping forward a little is cheaper than starting over from a
+	 * seek point, unless it's past the start of a block-gzip member,
+	 * and we're not reading ahead of ourselves.
+	 */
+	if ((here = fast_seek_find(file, file->pos + offset)) &&
+	    (offset < 0 || offset > SPAN || here->compression == UNCOMPRESSED ||
+	     (fast_seek_is_frame(here) && file->random && here->out > file->pos))) {
 		gint64 off, off2;
 
 #ifdef HAVE_LIBZ
@@ -985,11 +2238,15 @@ file_seek(FILE_T file, gint64 offset, int whence, int *err)
 			off2 = here->out;
 		} else
 #endif
-		{
+		if (fast_seek_is_frame(here)) {
+			off = here->in;
+			off2 = here->out;
+		} else {
 			off2 = (file->pos + offset);
 			off = here->in + (off2 - here->out);
 		}
 
+		read_ahead_stop(file);
 		if (ws_lseek64(file->fd, off, SEEK_SET) == -1) {
 			*err = errno;
 			return -1;
@@ -998,6 +2255,7 @@ file_seek(FILE_T file, gint64 offset, int whence, int *err)
 
 		file->raw_pos = off;
 		file->have = 0;
+		file->next = NULL;	/* what's been delivered isn't behind us */
 		file->eof = FALSE;
 		file->seek_pending = FALSE;
 		file->err = 0;
@@ -1037,6 +2295,10 @@ file_seek(FILE_T file, gint64 offset, int whence, int *err)
 			file->compression = ZLIB;
 		} else
 #endif
+		if (fast_seek_is_frame(here)) {
+			/* look at the member or frame header afresh */
+			file->compression = UNKNOWN;
+		} else
 			file->compression = here->compression;
 
 		offset = (file->pos + offset) - off2;
@@ -1055,12 +2317,16 @@ file_seek(FILE_T file, gint64 offset, int whence, int *err)
 			&& (offset < 0 || offset >= file->have) /* seek only when we don't have that offset in buffer */
 			&& (file->fast_seek) /* seek only when random access is supported */)
 	{
-		if (ws_lseek64(file->fd, offset - file->have, SEEK_CUR) == -1) {
+		read_ahead_stop(file);
+		/* reads from the mapping seek for themselves */
+		if (file->map == NULL &&
+		    ws_lseek64(file->fd, offset - file->have, SEEK_CUR) == -1) {
 			*err = errno;
 			return -1;
 		}
 		file->raw_pos += (offset - file->have);
 		file->have = 0;
+		file->next = NULL;	/* what's been delivered isn't behind us */
 		file->eof = FALSE;
 		file->seek_pending = FALSE;
 		file->err = 0;
@@ -1080,6 +2346,7 @@ file_seek(FILE_T file, gint64 offset, int whence, int *err)
 		/* rewind, then skip to offset */
 
 		/* back up and start over */
+		read_ahead_stop(file);
 		if (ws_lseek64(file->fd, file->start, SEEK_SET) == -1) {
 			*err = errno;
 			return -1;
@@ -1207,6 +2474,53 @@ file_read(void *buf, unsigned int len, FILE_T file)
 	return (int)got;
 }
 
+/*
+ * If the next len bytes of the file are uncompressed and in its mapping,
+ * return a pointer to them there, good until the file is closed, and move
+ * past them; otherwise return NULL without moving, and let the caller
+ * file_read() them.
+ */
+unsigned char *
+file_read_mapped(FILE_T file, unsigned int len)
+{
+	unsigned char *p;
+
+	if (file->map == NULL || file->compression != UNCOMPRESSED ||
+	    file->err)
+		return NULL;
+
+	/* process a skip request */
+	if (file->seek_pending) {
+		file->seek_pending = FALSE;
+		if (gz_skip(file, file->skip) == -1)
+			return NULL;
+	}
+
+	/*
+	 * What's left over in the output buffer from working out that
+	 * the file isn't compressed is in the mapping, too; deliver it,
+	 * and everything after it, from there.
+	 */
+	if (file->window == file->out && file->raw_pos <= file->map_size) {
+		gint64 off = file->raw_pos - file->have;
+
+		file->next = file->map + off;
+		file->window = file->next;
+		file->have = (guint)MIN(file->map_size - off, G_MAXINT);
+		file->raw_pos = off + file->have;
+	}
+	if (file->have == 0 && fill_out_buffer(file) == -1)
+		return NULL;
+	if (file->window == file->out || file->have < len)
+		return NULL;
+
+	p = file->next;
+	file->next += len;
+	file->have -= len;
+	file->pos += len;
+	return p;
+}
+
 /*
  * XXX - this *peeks* at next byte, not a character.
  */
@@ -1380,6 +2694,7 @@ file_clearerr(FILE_T stream)
 void
 file_fdclose(FILE_T file)
 {
+	read_ahead_stop(file);
 	ws_close(file->fd);
 	file->fd = -1;
 }
@@ -1401,6 +2716,21 @@ file_close(FILE_T file)
 	int fd = file->fd;
 
 	/* free memory and close file */
+	read_ahead_free(file);
+#ifdef HAVE_LIBZ
+	bgzf_free(file);
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_freeDCtx(file->zstd);
+#endif
+#ifdef HAVE_LZ4
+	if (file->lz4 != NULL)
+		LZ4F_freeDecompressionContext(file->lz4);
+#endif
+#ifdef HAVE_MMAP
+	if (file->map != NULL)
+		munmap(file->map, (size_t)file->map_size);
+#endif
 	if (file->size) {
 #ifdef HAVE_LIBZ
 		inflateEnd(&(file->strm));
@@ -1425,12 +2755,13 @@ file_close(FILE_T file)
 /* internal gzip file state data structure for writing */
 struct wtap_writer {
     int fd;                 /* file descriptor */
+    gboolean bgzf;          /* written as block-gzip members */
     gint64 pos;             /* current position in uncompressed data */
-    guint size;          /* buffer size, zero if not allocated yet */
-    guint want;          /* requested buffer size, default is GZBUFSIZE */
-    unsigned char *in;      /* input buffer */
-    unsigned char *out;     /* output buffer (double-sized when reading) */
-    unsigned char *next;    /* next output data to deliver or write */
+    guint size;             /* buffer size, zero if not allocated yet */
+    guint want;             /* requested buffer size, default is GZBUFSIZE */
+    unsigned char *in;      /* input buffer; for BGZF, the member being put together */
+    unsigned char *out;     /* output buffer; for BGZF, the member, once compressed */
+    unsigned char *next;    /* next output data to write */
     int level;              /* compression level */
     int strategy;           /* compression strategy */
     int err;                /* error code */
@@ -1438,8 +2769,34 @@ struct wtap_writer {
     z_stream strm;          /* stream structure in-place (not a pointer) */
 };
 
-GZWFILE_T
-gzwfile_open(const char *path)
+static GZWFILE_T
+gzw_fdopen(int fd, gboolean bgzf)
+{
+    GZWFILE_T state;
+
+    /* allocate wtap_writer structure to return */
+    state = (GZWFILE_T)g_try_malloc(sizeof *state);
+    if (state == NULL)
+        return NULL;
+    state->fd = fd;
+    state->bgzf = bgzf;
+    state->size = 0;            /* no buffers allocated yet */
+    state->want = bgzf ? BGZF_BLOCK_SIZE : GZBUFSIZE; /* requested buffer size */
+
+    state->level = Z_DEFAULT_COMPRESSION;
+    state->strategy = Z_DEFAULT_STRATEGY;
+
+    /* initialize stream */
+    state->err = Z_OK;              /* clear error */
+    state->pos = 0;                 /* no uncompressed data yet */
+    state->strm.avail_in = 0;       /* no input data yet */
+
+    /* return stream */
+    return state;
+}
+
+static GZWFILE_T
+gzw_open(const char *path, gboolean bgzf)
 {
     int fd;
     GZWFILE_T state;
@@ -1448,7 +2805,7 @@ gzwfile_open(const char *path)
     fd = ws_open(path, O_BINARY|O_WRONLY|O_CREAT|O_TRUNC, 0666);
     if (fd == -1)
         return NULL;
-    state = gzwfile_fdopen(fd);
+    state = gzw_fdopen(fd, bgzf);
     if (state == NULL) {
         save_errno = errno;
         close(fd);
@@ -1458,28 +2815,27 @@ gzwfile_open(const char *path)
 }
 
 GZWFILE_T
-gzwfile_fdopen(int fd)
+gzwfile_open(const char *path)
 {
-    GZWFILE_T state;
-
-    /* allocate wtap_writer structure to return */
-    state = (GZWFILE_T)g_try_malloc(sizeof *state);
-    if (state == NULL)
-        return NULL;
-    state->fd = fd;
-    state->size = 0;            /* no buffers allocated yet */
-    state->want = GZBUFSIZE;    /* requested buffer size */
+    return gzw_open(path, FALSE);
+}
 
-    state->level = Z_DEFAULT_COMPRESSION;
-    state->strategy = Z_DEFAULT_STRATEGY;
+GZWFILE_T
+gzwfile_fdopen(int fd)
+{
+    return gzw_fdopen(fd, FALSE);
+}
 
-    /* initialize stream */
-    state->err = Z_OK;              /* clear error */
-    state->pos = 0;                 /* no uncompressed data yet */
-    state->strm.avail_in = 0;       /* no input data yet */
+GZWFILE_T
+bgzfwfile_open(const char *path)
+{
+    return gzw_open(path, TRUE);
+}
 
-    /* return stream */
-    return state;
+GZWFILE_T
+bgzfwfile_fdopen(int fd)
+{
+    return gzw_fdopen(fd, TRUE);
 }
 
 /* Initialize state for writing a gzip file.  Mark initialization by setting
@@ -1491,9 +2847,9 @@ gz_init(GZWFILE_T state)
     int ret;
     z_streamp strm = &(state->strm);
 
-    /* allocate input and output buffers */
+    /* allocate input and output buffers; a BGZF member always fits */
     state->in = (unsigned char *)g_try_malloc(state->want);
-    state->out = (unsigned char *)g_try_malloc(state->want);
+    state->out = (unsigned char *)g_try_malloc(state->bgzf ? BGZF_MAX_BLOCK : state->want);
     if (state->in == NULL || state->out == NULL) {
         g_free(state->out);
         g_free(state->in);
@@ -1501,12 +2857,13 @@ gz_init(GZWFILE_T state)
         return -1;
     }
 
-    /* allocate deflate memory, set up for gzip compression */
+    /* allocate deflate memory, set up for gzip compression, or for raw
+       deflate if we do the headers */
     strm->zalloc = Z_NULL;
     strm->zfree = Z_NULL;
     strm->opaque = Z_NULL;
     ret = deflateInit2(strm, state->level, Z_DEFLATED,
-                       15 + 16, 8, state->strategy);
+                       state->bgzf ? -15 : 15 + 16, 8, state->strategy);
     if (ret != Z_OK) {
         g_free(state->out);
         g_free(state->in);
@@ -1524,9 +2881,14 @@ gz_init(GZWFILE_T state)
     state->size = state->want;
 
     /* initialize write buffer */
-    strm->avail_out = state->size;
-    strm->next_out = state->out;
-    state->next = strm->next_out;
+    if (state->bgzf) {
+        strm->avail_in = 0;
+        strm->next_in = state->in;
+    } else {
+        strm->avail_out = state->size;
+        strm->next_out = state->out;
+        state->next = strm->next_out;
+    }
     return 0;
 }
 
@@ -1592,6 +2954,68 @@ gz_comp(GZWFILE_T state, int flush)
     return 0;
 }
 
+static void
+gz_put4(unsigned char *p, guint32 val)
+{
+    p[0] = (unsigned char)val;
+    p[1] = (unsigned char)(val >> 8);
+    p[2] = (unsigned char)(val >> 16);
+    p[3] = (unsigned char)(val >> 24);
+}
+
+/* Compress the avail_in bytes in the input buffer into a BGZF member, and
+   write it to the output file; with no bytes, that's the empty member BGZF
+   readers expect at the end.  Return -1, and set state->err, if there is
+   an error writing to the output file; return 0 on success. */
+static int
+bgzf_comp(GZWFILE_T state)
+{
+    /* ID1, ID2, CM, FLG (FEXTRA), MTIME, XFL, OS (unknown), XLEN, BC, SLEN */
+    static const unsigned char header[BGZF_HEADER_SIZE - 2] = {
+        31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0
+    };
+    int ret;
+    ssize_t got;
+    guint len, bsize;
+    z_streamp strm = &(state->strm);
+
+    /* allocate memory if this is the first time through */
+    if (state->size == 0 && gz_init(state) == -1)
+        return -1;
+
+    /* a member's worth of data always fits, even if it won't compress */
+    len = strm->avail_in;
+    strm->next_in = state->in;
+    strm->next_out = state->out + BGZF_HEADER_SIZE;
+    strm->avail_out = BGZF_MAX_BLOCK - BGZF_HEADER_SIZE - BGZF_TRAILER_SIZE;
+    ret = deflate(strm, Z_FINISH);
+    if (ret != Z_STREAM_END) {
+        /* This "shouldn't happen". */
+        state->err = WTAP_ERR_INTERNAL;
+        return -1;
+    }
+    bsize = (guint)(strm->next_out - state->out) + BGZF_TRAILER_SIZE;
+    gz_put4(strm->next_out, (guint32)crc32(0L, state->in, len));
+    gz_put4(strm->next_out + 4, len);
+    memcpy(state->out, header, sizeof header);
+    state->out[16] = (unsigned char)(bsize - 1);
+    state->out[17] = (unsigned char)((bsize - 1) >> 8);
+    deflateReset(strm);
+    strm->avail_in = 0;
+    strm->next_in = state->in;
+
+    got = write(state->fd, state->out, bsize);
+    if (got < 0) {
+        state->err = errno;
+        return -1;
+    }
+    if ((guint)got != bsize) {
+        state->err = WTAP_ERR_SHORT_WRITE;
+        return -1;
+    }
+    return 0;
+}
+
 /* Write out len bytes from buf.  Return 0, and set state->err, on
    failure or on an attempt to write 0 bytes (in which case state->err
    is Z_OK); return the number of bytes written on success. */
@@ -1616,8 +3040,23 @@ gzwfile_write(GZWFILE_T state, const void *buf, guint len)
     if (state->size == 0 && gz_init(state) == -1)
         return 0;
 
+    if (state->bgzf) {
+        /* copy to input buffer, compress a member whenever it's full */
+        do {
+            n = state->size - strm->avail_in;
+            if (n > len)
+                n = len;
+            memcpy(state->in + strm->avail_in, buf, n);
+            strm->avail_in += n;
+            state->pos += n;
+            buf = (const char *)buf + n;
+            len -= n;
+            if (strm->avail_in == state->size && bgzf_comp(state) == -1)
+                return 0;
+        } while (len);
+    }
     /* for small len, copy to input buffer, otherwise compress directly */
-    if (len < state->size) {
+    else if (len < state->size) {
         /* copy to input buffer, compress when full */
         do {
             if (strm->avail_in == 0)
@@ -1651,8 +3090,8 @@ gzwfile_write(GZWFILE_T state, const void *buf, guint len)
     return (int)put;
 }
 
-/* Flush out what we've written so far.  Returns -1, and sets state->err,
-   on failure; returns 0 on success. */
+/* Flush out what we've written so far; for BGZF, as a member of its own.
+   Returns -1, and sets state->err, on failure; returns 0 on success. */
 int
 gzwfile_flush(GZWFILE_T state)
 {
@@ -1660,6 +3099,12 @@ gzwfile_flush(GZWFILE_T state)
     if (state->err != Z_OK)
         return -1;
 
+    if (state->bgzf) {
+        if (state->strm.avail_in != 0 && bgzf_comp(state) == -1)
+            return -1;
+        return 0;
+    }
+
     /* compress remaining data with Z_SYNC_FLUSH */
     gz_comp(state, Z_SYNC_FLUSH);
     if (state->err != Z_OK)
@@ -1674,12 +3119,21 @@ gzwfile_close(GZWFILE_T state)
 {
     int ret = 0;
 
-    /* flush, free memory, and close file */
-    if (gz_comp(state, Z_FINISH) == -1 && ret == 0)
+    /* flush (for BGZF, adding the empty last member), free memory, and
+       close file */
+    if (state->bgzf) {
+        if (state->err != Z_OK)
+            ret = state->err;
+        else if ((state->strm.avail_in != 0 && bgzf_comp(state) == -1) ||
+                 bgzf_comp(state) == -1)
+            ret = state->err;
+    } else if (gz_comp(state, Z_FINISH) == -1)
         ret = state->err;
-    (void)deflateEnd(&(state->strm));
-    g_free(state->out);
-    g_free(state->in);
+    if (state->size != 0) {
+        (void)deflateEnd(&(state->strm));
+        g_free(state->out);
+        g_free(state->in);
+    }
     state->err = Z_OK;
     if (close(state->fd) == -1 && ret == 0)
         ret = errno;
@@ -1693,3 +3147,224 @@ gzwfile_geterr(GZWFILE_T state)
     return state->err;
 }
 #endif
+
+#if defined(HAVE_ZSTD) || defined(HAVE_LZ4)
+/*
+ * Writing zstd or LZ4: what's written is buffered, and compressed a
+ * frame at a time, each frame with its content size and a checksum,
+ * so that a reader can start decompressing at any frame boundary.
+ */
+#define FRAME_WRITE_SIZE	(1024 * 1024)	/* uncompressed data per frame */
+
+struct wtap_frame_writer {
+    int fd;                 /* file descriptor */
+    wtap_compression_type type; /* WTAP_ZSTD_COMPRESSED or WTAP_LZ4_COMPRESSED */
+    guint have;             /* bytes waiting in the input buffer */
+    unsigned char *in;      /* data for the frame being put together */
+    unsigned char *out;     /* the frame, once compressed */
+    size_t out_size;        /* size of the output buffer */
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *zstd;        /* zstd compression context */
+#endif
+#ifdef HAVE_LZ4
+    LZ4F_preferences_t lz4_prefs; /* LZ4 frame options */
+#endif
+    int err;                /* error code */
+};
+
+FRAMEWFILE_T
+framewfile_open(const char *path, wtap_compression_type type)
+{
+    int fd;
+    FRAMEWFILE_T state;
+    int save_errno;
+
+    fd = ws_open(path, O_BINARY|O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (fd == -1)
+        return NULL;
+    state = framewfile_fdopen(fd, type);
+    if (state == NULL) {
+        save_errno = errno;
+        close(fd);
+        errno = save_errno;
+    }
+    return state;
+}
+
+FRAMEWFILE_T
+framewfile_fdopen(int fd, wtap_compression_type type)
+{
+    FRAMEWFILE_T state;
+
+    switch (type) {
+
+#ifdef HAVE_ZSTD
+    case WTAP_ZSTD_COMPRESSED:
+        break;
+#endif
+
+#ifdef HAVE_LZ4
+    case WTAP_LZ4_COMPRESSED:
+        break;
+#endif
+
+    default:
+        errno = WTAP_ERR_COMPRESSION_NOT_SUPPORTED;
+        return NULL;
+    }
+
+    state = (FRAMEWFILE_T)g_try_malloc0(sizeof *state);
+    if (state == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    state->fd = fd;
+    state->type = type;
+    state->in = (unsigned char *)g_try_malloc(FRAME_WRITE_SIZE);
+#ifdef HAVE_ZSTD
+    if (type == WTAP_ZSTD_COMPRESSED) {
+        state->out_size = ZSTD_compressBound(FRAME_WRITE_SIZE);
+        state->zstd = ZSTD_createCCtx();
+        if (state->zstd != NULL) {
+            ZSTD_CCtx_setParameter(state->zstd, ZSTD_c_compressionLevel,
+                                   ZSTD_CLEVEL_DEFAULT);
+            ZSTD_CCtx_setParameter(state->zstd, ZSTD_c_checksumFlag, 1);
+        }
+    }
+#endif
+#ifdef HAVE_LZ4
+    if (type == WTAP_LZ4_COMPRESSED) {
+        state->lz4_prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+        state->lz4_prefs.frameInfo.contentSize = FRAME_WRITE_SIZE;
+        state->out_size = LZ4F_compressFrameBound(FRAME_WRITE_SIZE, &state->lz4_prefs);
+    }
+#endif
+    state->out = (unsigned char *)g_try_malloc(state->out_size);
+    if (state->in == NULL || state->out == NULL
+#ifdef HAVE_ZSTD
+        || (type == WTAP_ZSTD_COMPRESSED && state->zstd == NULL)
+#endif
+        ) {
+#ifdef HAVE_ZSTD
+        ZSTD_freeCCtx(state->zstd);
+#endif
+        g_free(state->out);
+        g_free(state->in);
+        g_free(state);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return state;
+}
+
+/* Compress what's in the input buffer into a frame, and write it to the
+   output file.  Return -1, and set state->err, on failure; return 0 on
+   success. */
+static int
+frame_comp(FRAMEWFILE_T state)
+{
+    size_t len = 0;
+    ssize_t got;
+
+#ifdef HAVE_ZSTD
+    if (state->type == WTAP_ZSTD_COMPRESSED) {
+        len = ZSTD_compress2(state->zstd, state->out, state->out_size,
+                             state->in, state->have);
+        if (ZSTD_isError(len)) {
+            /* This "shouldn't happen". */
+            state->err = WTAP_ERR_INTERNAL;
+            return -1;
+        }
+    }
+#endif
+#ifdef HAVE_LZ4
+    if (state->type == WTAP_LZ4_COMPRESSED) {
+        state->lz4_prefs.frameInfo.contentSize = state->have;
+        len = LZ4F_compressFrame(state->out, state->out_size,
+                                 state->in, state->have, &state->lz4_prefs);
+        if (LZ4F_isError(len)) {
+            /* This "shouldn't happen". */
+            state->err = WTAP_ERR_INTERNAL;
+            return -1;
+        }
+    }
+#endif
+    state->have = 0;
+
+    got = write(state->fd, state->out, len);
+    if (got < 0) {
+        state->err = errno;
+        return -1;
+    }
+    if ((size_t)got != len) {
+        state->err = WTAP_ERR_SHORT_WRITE;
+        return -1;
+    }
+    return 0;
+}
+
+/* Write out len bytes from buf.  Return 0, and set state->err, on
+   failure; return the number of bytes written on success. */
+guint
+framewfile_write(FRAMEWFILE_T state, const void *buf, guint len)
+{
+    guint put = len;
+    guint n;
+
+    /* check that there's no error */
+    if (state->err != 0)
+        return 0;
+
+    /* copy to input buffer, compress a frame whenever it's full */
+    while (len) {
+        n = MIN(FRAME_WRITE_SIZE - state->have, len);
+        memcpy(state->in + state->have, buf, n);
+        state->have += n;
+        buf = (const char *)buf + n;
+        len -= n;
+        if (state->have == FRAME_WRITE_SIZE && frame_comp(state) == -1)
+            return 0;
+    }
+    return put;
+}
+
+/* Frames are only written when the input buffer is full or the file is
+   closed: one for each flush would make a file written a packet or so at
+   a time (as by dumpcap) mostly frame headers and checksums, and much
+   slower to read.  So this writes nothing; what's been written so far
+   can't be read back until the frame it's in is complete.  Returns -1 if
+   there has been an error, 0 otherwise. */
+int
+framewfile_flush(FRAMEWFILE_T state)
+{
+    return state->err != 0 ? -1 : 0;
+}
+
+/* Flush out all data written, and close the file.  Returns a Wiretap
+   error on failure; returns 0 on success. */
+int
+framewfile_close(FRAMEWFILE_T state)
+{
+    int ret = 0;
+
+    if (state->err != 0)
+        ret = state->err;
+    else if (state->have != 0 && frame_comp(state) == -1)
+        ret = state->err;
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx(state->zstd);
+#endif
+    g_free(state->out);
+    g_free(state->in);
+    if (close(state->fd) == -1 && ret == 0)
+        ret = errno;
+    g_free(state);
+    return ret;
+}
+
+int
+framewfile_geterr(FRAMEWFILE_T state)
+{
+    return state->err;
+}
+#endif
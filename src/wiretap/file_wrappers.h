@@ -36,6 +36,7 @@ extern gint64 file_tell_raw(FILE_T stream);
 extern int file_fstat(FILE_T stream, ws_statb64 *statb, int *err);
 WS_DLL_PUBLIC gboolean file_iscompressed(FILE_T stream);
 WS_DLL_PUBLIC int file_read(void *buf, unsigned int count, FILE_T file);
+extern unsigned char *file_read_mapped(FILE_T file, unsigned int count);
 WS_DLL_PUBLIC int file_peekc(FILE_T stream);
 WS_DLL_PUBLIC int file_getc(FILE_T stream);
 WS_DLL_PUBLIC char *file_gets(char *buf, int len, FILE_T stream);
@@ -45,16 +46,31 @@ extern void file_clearerr(FILE_T stream);
 extern void file_fdclose(FILE_T file);
 extern int file_fdreopen(FILE_T file, const char *path);
 extern void file_close(FILE_T file);
+extern void file_fast_seek_save(GPtrArray *seek, GByteArray *buf);
+extern GPtrArray *file_fast_seek_load(const guint8 *p, gsize len);
 
 #ifdef HAVE_LIBZ
 typedef struct wtap_writer *GZWFILE_T;
 
 extern GZWFILE_T gzwfile_open(const char *path);
 extern GZWFILE_T gzwfile_fdopen(int fd);
+extern GZWFILE_T bgzfwfile_open(const char *path);
+extern GZWFILE_T bgzfwfile_fdopen(int fd);
 extern guint gzwfile_write(GZWFILE_T state, const void *buf, guint len);
 extern int gzwfile_flush(GZWFILE_T state);
 extern int gzwfile_close(GZWFILE_T state);
 extern int gzwfile_geterr(GZWFILE_T state);
 #endif /* HAVE_LIBZ */
 
+#if defined(HAVE_ZSTD) || defined(HAVE_LZ4)
+typedef struct wtap_frame_writer *FRAMEWFILE_T;
+
+extern FRAMEWFILE_T framewfile_open(const char *path, wtap_compression_type type);
+extern FRAMEWFILE_T framewfile_fdopen(int fd, wtap_compression_type type);
+extern guint framewfile_write(FRAMEWFILE_T state, const void *buf, guint len);
+extern int framewfile_flush(FRAMEWFILE_T state);
+extern int framewfile_close(FRAMEWFILE_T state);
+extern int framewfile_geterr(FRAMEWFILE_T state);
+#endif /* HAVE_ZSTD || HAVE_LZ4 */
+
 #endif /* __FILE_H__ */
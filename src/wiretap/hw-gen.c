@@ -9,114 +9,179 @@
 #include <string.h>
 #include <wtap-int.h>
 #include <file_wrappers.h>
+#include <wsutil/file_util.h>
+#include <wsutil/crc32-ieee.h>
+#include <wsutil/pint.h>
 
 #include "hw-gen.h"
 
 
 
-#define max(x, y) (((x) > (y)) ? (x) : (y))
-#define min(x, y) (((x) < (y)) ? (x) : (y))
+#define HWGEN_WRITE_BUFFER_SIZE (4 * 1024 * 1024)  /**< Write-combining buffer of a writer. */
 
-#define ceil(a) ( ((a) - (int)(a))==0 ? (int)(a) : (int)(a)+1 )
+#define DEFAULT_LINE_RATE       10000000     /**< Default line rate in kbit/s, 10 Gb/s. */
+#define DEFAULT_WORD_WIDTH      4            /**< Default generator word, 32 bits. */
+#define MIN_IFP                 3            /**< Minimum interframe gap. 10 Gbits needs at least a 12 Bytes ifp, 3 words of 32 bits.*/
+#define MAX_IFP                 100000       /**< Maximum interframe gap. 10 Gbits needs at least a 12 Bytes ifp, 3 words of 32 bits.*/
 
+#define DEFAULT_DST_MAC         {0x01,0x02,0x03,0x04,0x05,0x06}  /**< Of the Ethernet headers the writer builds... */
+#define DEFAULT_SRC_MAC         {0x2c,0xb0,0x5d,0xb5,0x47,0x3e}  /**< ...see wtap_hwgen_encap_init(). */
 
+#define MAX_LINE_RATE           1000000000   /**< 1 Tb/s, in kbit/s; keeps the IFG arithmetic within 64 bits. */
+#define MAX_WORD_WIDTH          64
+#define MAX_IFG_DELTA_SECS      100000       /**< Deltas this long saturate any gap we can write. */
+#define SPEEDUP_ONE             1000000      /**< speedup value for the recorded timing. */
+#define MAX_SPEEDUP             G_GUINT64_CONSTANT(1000000000000)
+#define MAX_SCALED_DELTA_SECS   10000        /**< Longer deltas are left alone; they saturate anyway. */
 
-#define HWGEN_MAX_PACKET_SIZE 0xFFFF
+#define HWGEN_V2_INDEX_INTERVAL 128          /**< Records per v2 index entry. */
 
-#define MIN_IFP                 3            /**< Minimum interframe gap. 10 Gbits needs at least a 12 Bytes ifp, 3 words of 32 bits.*/
-#define MAX_IFP                 100000       /**< Maximum interframe gap. 10 Gbits needs at least a 12 Bytes ifp, 3 words of 32 bits.*/
-#define DEFAULT_IFG             3 
-
-
-static guint64 npackets = 0;
-static guint64 lsize    = 0;
-static nstime_t ltime;
-static guint8  lpacket[HWGEN_MAX_PACKET_SIZE];
-
-
-static guint32 crc32_tab[] = {
-        0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
-        0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
-        0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
-        0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-        0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
-        0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
-        0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
-        0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-        0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
-        0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
-        0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
-        0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-        0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
-        0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
-        0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
-        0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-        0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
-        0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
-        0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
-        0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-        0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
-        0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
-        0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
-        0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-        0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
-        0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
-        0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
-        0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-        0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
-        0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
-        0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
-        0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-        0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
-        0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
-        0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
-        0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-        0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
-        0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
-        0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
-        0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-        0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
-        0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
-        0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
-};
-
-static guint32
-crc32(guint32 crc, const void *buf, size_t size)
-{
-        const guint8 *p;
-
-        p = (const guint8 *)buf;
-        crc = crc ^ ~0U;
-
-        while (size--)
-                crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
-
-
-
-        return crc ^ ~0U;
+/* Padding after a frame of the given size; always at least one byte. */
+#define HWGEN_PADDING(size)     (4 - ((size) % 4))
+
+/* WTAP_HWGEN_RECORD_MAX() counts on this; fails to compile if it's wrong. */
+typedef char hwgen_rec_hdr_len_check[sizeof(struct hwgen_hdr) == WTAP_HWGEN_REC_HDR_LEN ? 1 : -1];
+
+#define HWGEN_ETHERTYPE_IPv4    0x0800
+#define HWGEN_ETHERTYPE_IPv6    0x86dd
+#define HWGEN_ETHERTYPE_VLAN    0x8100
+#define HWGEN_ETHERTYPE_QINQ    0x88a8
+#define HWGEN_ETHERTYPE_QINQ_OLD 0x9100
+#define HWGEN_ETHERTYPE_MPLS    0x8847
+#define HWGEN_ETHERTYPE_MPLS_MC 0x8848
+
+#ifndef S_ISREG
+#define S_ISREG(mode)   (((mode) & S_IFMT) == S_IFREG)
+#endif
+
+
+/*
+ * Per-file reader state, hung off wth->priv.
+ *
+ * Time stamps are rebuilt from the gaps: a record starts at the line
+ * position, in words, that all the records and gaps before it take, and
+ * its time stamp is that position at the file's line rate.  Reading at
+ * an arbitrary offset thus needs the position of some earlier record;
+ * v2 index entries carry one, and for other files a checkpoint is taken
+ * every HWGEN_V2_INDEX_INTERVAL records of the sequential pass.
+ */
+typedef struct {
+  guint64  npackets;                        /**< Records read so far; checked against the trailer. */
+  guint64  words;                           /**< Line position of the next sequential record. */
+  guint32  word_width;                      /**< Line model the gaps are in: bytes per word... */
+  guint64  line_rate;                       /**< ...and kbit/s. */
+  GArray  *checkpoints;                     /**< struct hwgen_v2_index_entry, host order, by offset; */
+                                            /**< NULL if there is a v2 index. */
+  gboolean have_last;                       /**< The fields below are valid. */
+  gint64   last_offset;                     /**< End of the last record seek_read returned... */
+  guint64  last_words;                      /**< ...and the line position there. */
+  /* v2 only */
+  guint32  hdr_len;                         /**< Offset of the first record. */
+  guint32  index_interval;                  /**< Records per index entry, 0 if no index. */
+  gboolean have_footer;                     /**< The fields below come from a usable footer. */
+  guint64  packet_count;                    /**< Record count from the footer. */
+  guint64  index_offset;                    /**< Offset of the index, just past the end-of-records marker. */
+  guint64  index_entries;                   /**< Number of index entries. */
+  struct hwgen_v2_index_entry *index;       /**< Host order; loaded on the first seek, NULL until then. */
+} hwgen_t;
+
+/*
+ * Per-file writer state, hung off wdh->priv.  Records are built in place
+ * in the dumper's write-combining buffer, and every record is held there
+ * until the next one arrives, so that its IFG can be computed from the
+ * timestamp delta before it is written out.
+ */
+typedef struct {
+  guint64  npackets;                        /**< Records accepted so far; written as the trailer. */
+  wtap_hwgen_params_t params;               /**< Line model, copied at open time. */
+  wtap_hwgen_encap_t encap;                 /**< Header rewriting, copied at open time. */
+  guint64  ifg_carry;                       /**< Rounding remainder of the last gap, in 1/(8e6 * word_width) words. */
+  guint64  scale_carry;                     /**< Rounding remainder of the last scaled delta, in 1/speedup ns. */
+  /* Statistics of the flushed records, see wtap_dump_hwgen_stats() */
+  guint64  stat_bytes;                      /**< Frame bytes, FCS included. */
+  guint64  stat_words;                      /**< Words the records and their gaps take on the line. */
+  guint64  stat_saturated;                  /**< Gaps held at min_ifg. */
+  guint64  win_len;                         /**< Peak-rate window, in words: about 1 ms of line time. */
+  guint64  win_start;                       /**< Start of the current window, in words. */
+  guint64  win_bytes;                       /**< Frame bytes starting in the current window. */
+  guint64  peak_bytes;                      /**< Most frame bytes in a complete window; */
+  gboolean have_peak;                       /**< ...valid once a window has completed. */
+  guint64  stat_skipped;                    /**< Frames left out, see hwgen_rewrite_l2(). */
+  guint32  index_interval;                  /**< v2: records per index entry. */
+  GArray  *index;                           /**< v2: little-endian entries for records 0, K, 2K...; NULL for v1. */
+  guint32  lsize;                           /**< Size of the held record, 0 if none. */
+  nstime_t ltime;                           /**< Timestamp of the staged record. */
+} hwgen_dump_t;
+
+
+/* Line time, in words, that a record with a frame of the given size takes. */
+static guint64 hwgen_rec_words(const hwgen_t *hwgen, guint32 size)
+{
+  guint32 len = (guint32)sizeof(struct hwgen_hdr) + size + HWGEN_PADDING(size);
+
+  return (len + hwgen->word_width - 1) / hwgen->word_width;
 }
 
+/* Time stamp of the given line position. */
+static void hwgen_words_to_ts(const hwgen_t *hwgen, guint64 words, nstime_t *ts)
+{
+  guint64 bytes = words * hwgen->word_width;
+  guint64 bytes_per_sec = hwgen->line_rate * 125;
+
+  ts->secs  = (time_t)(bytes / bytes_per_sec);
+  ts->nsecs = (int)((bytes % bytes_per_sec) * 8000000 / hwgen->line_rate);
+}
 
+/*
+ * Read one record.  "npackets" is the running record count of a sequential
+ * pass, used to validate the trailer; random-access reads pass NULL, since
+ * they never land on the trailer and must not disturb the count.  "words"
+ * is the line position of the record, and is advanced past it and its gap.
+ * "pd" is pointed at the packet data, which is left in the file's mapping
+ * rather than copied into "buf" (or "batch", if that's not NULL) if it
+ * can be.
+ */
 static gboolean
 hwgen_read_packet(wtap *wth, FILE_T fh, struct wtap_pkthdr *phdr,
-    Buffer *buf, int *err, gchar **err_info)
+    Buffer *buf, wtap_batch *batch, guint8 **pd, guint64 *npackets,
+    guint64 *words, int *err, gchar **err_info)
 {
+  hwgen_t *hwgen = (hwgen_t *)wth->priv;
   guint packet_size;
   guint orig_size;
   struct hwgen_hdr hdr;
+  guint64 trailer;
   guint32 padding = 0;
   wth->file_encap = WTAP_ENCAP_ETHERNET;
+  phdr->pkt_encap = WTAP_ENCAP_ETHERNET;
 
 
   /*
    * Read the header.
    */
   if (file_read(&hdr, sizeof hdr, fh) != sizeof hdr) {
+    *err = file_error(fh, err_info);
     return FALSE;
   }
 
-  if(hdr.magic_word!=0x6969) {
-    if(npackets!= *((guint64 *)&hdr)) {
+  if(hdr.magic_word!=HWGEN_MAGIC_WORD) {
+    if (wth->file_type_subtype == WTAP_FILE_TYPE_SUBTYPE_HWGEN_V2) {
+      if (hdr.size == 0 && hdr.magic_word == HWGEN_V2_EOR_MAGIC && npackets != NULL &&
+          (!hwgen->have_footer || *npackets == hwgen->packet_count)) {
+        /* End-of-records marker; the index and footer follow. */
+        *err = 0;
+        return FALSE;
+      }
+      *err = WTAP_ERR_BAD_FILE;
+      if (err_info != NULL) {
+        *err_info = g_strdup_printf("hwgen format: bad record header or unexpected end of records after %" G_GINT64_MODIFIER "u records",
+                                    npackets != NULL ? *npackets : 0);
+      }
+      return FALSE;
+    }
+
+    memcpy(&trailer, &hdr, sizeof trailer);
+    if(npackets == NULL || *npackets != trailer) {
 	*err = WTAP_ERR_BAD_FILE;
 	if (err_info != NULL) {
     	  *err_info = g_strdup_printf("hwgen format: It was impossible to locate the magic word in the header");
@@ -124,25 +189,20 @@ hwgen_read_packet(wtap *wth, FILE_T fh, struct wtap_pkthdr *phdr,
 
         return FALSE; // We expect to receive the number of packets at the end.
     }
+    /* That was the packet count trailer; we're at the end of the file. */
     *err = 0;
-    return TRUE;    
+    return FALSE;
   }
 
   packet_size = hdr.size;
   orig_size   = hdr.size;
-  npackets++;
-
- /* phdr_len = pcap_process_pseudo_header(fh, wth->file_type_subtype,
-      wth->file_encap, packet_size, TRUE, phdr, err, err_info);
-  if (phdr_len < 0)
-    return FALSE;  */
-
-
+  if (npackets != NULL)
+    (*npackets)++;
 
   phdr->rec_type = REC_TYPE_PACKET;
-//  phdr->presence_flags = WTAP_HAS_TS|WTAP_HAS_CAP_LEN; //We dont provide of timestamp or caplen
-//  phdr->ts.secs = 0;
-//  phdr->ts.nsecs = hdr.ifg; //hdr.hdr.ts_usec;
+  phdr->presence_flags = WTAP_HAS_TS;
+  hwgen_words_to_ts(hwgen, *words, &phdr->ts);
+  *words += hwgen_rec_words(hwgen, hdr.size) + (hdr.ifg > 0 ? hdr.ifg : 0);
 
   phdr->caplen = packet_size;
   phdr->len    = orig_size;
@@ -150,45 +210,278 @@ hwgen_read_packet(wtap *wth, FILE_T fh, struct wtap_pkthdr *phdr,
   /*
    * Read the packet data.
    */
-  if (!wtap_read_packet_bytes(fh, buf, packet_size, err, err_info))
+  if (batch != NULL) {
+    if (!wtap_batch_packet_bytes(batch, fh, packet_size, TRUE, pd, err, err_info))
+      return FALSE; /* failed */
+  } else if (!wtap_map_packet_bytes(fh, buf, packet_size, pd, err, err_info))
     return FALSE; /* failed */
 
   /*
    * Read the padding.
    */
-  if (file_read(&padding, 4 - (phdr->caplen%4), fh) != (int)(4 - (phdr->caplen%4)))
-    return FALSE; 
+  if (file_read(&padding, HWGEN_PADDING(phdr->caplen), fh) != (int)HWGEN_PADDING(phdr->caplen)) {
+    *err = file_error(fh, err_info);
+    if (*err == 0)
+      *err = WTAP_ERR_SHORT_READ;
+    return FALSE;
+  }
 
   *err = 0;
   return TRUE;
 }
 
 
+/* Note where a sequential pass is, every HWGEN_V2_INDEX_INTERVAL records. */
+static void hwgen_checkpoint(hwgen_t *hwgen, gint64 data_offset)
+{
+  if (hwgen->checkpoints != NULL && hwgen->npackets % HWGEN_V2_INDEX_INTERVAL == 0) {
+    struct hwgen_v2_index_entry *last = NULL;
+
+    if (hwgen->checkpoints->len != 0)
+      last = &g_array_index(hwgen->checkpoints, struct hwgen_v2_index_entry,
+                            hwgen->checkpoints->len - 1);
+    if (last == NULL || (guint64)data_offset > last->offset) {
+      struct hwgen_v2_index_entry cp;
+
+      cp.offset = (guint64)data_offset;
+      cp.words = hwgen->words;
+      g_array_append_val(hwgen->checkpoints, cp);
+    }
+  }
+}
+
 static gboolean hwgen_read(wtap *wth, int *err, gchar **err_info,
     gint64 *data_offset)
 {
+  hwgen_t *hwgen = (hwgen_t *)wth->priv;
+
   *data_offset = file_tell(wth->fh);
+  hwgen_checkpoint(hwgen, *data_offset);
+
+  return hwgen_read_packet(wth, wth->fh, &wth->phdr, wth->frame_buffer, NULL,
+      &wth->pkt_data, &hwgen->npackets, &hwgen->words, err, err_info);
+}
+
+static gboolean hwgen_read_batch(wtap *wth, wtap_batch *batch, guint n,
+    int *err, gchar **err_info)
+{
+  hwgen_t *hwgen = (hwgen_t *)wth->priv;
+  struct wtap_pkthdr *phdr;
+  gint64 data_offset;
+  guint8 *pd;
+
+  while (!wtap_batch_full(batch, n)) {
+    data_offset = file_tell(wth->fh);
+    hwgen_checkpoint(hwgen, data_offset);
+    phdr = wtap_batch_begin(wth, batch);
+    if (!hwgen_read_packet(wth, wth->fh, phdr, NULL, batch, &pd,
+        &hwgen->npackets, &hwgen->words, err, err_info))
+      return FALSE;
+    wtap_batch_end(wth, batch, data_offset, pd);
+  }
+  return TRUE;
+}
 
-  return hwgen_read_packet(wth, wth->fh, &wth->phdr,
-      wth->frame_buffer, err, err_info);
+/*
+ * Read the v2 index into memory, checking that every entry points into
+ * the record area.
+ */
+static gboolean hwgen_v2_load_index(FILE_T fh, hwgen_t *hwgen, int *err,
+    gchar **err_info)
+{
+  struct hwgen_v2_index_entry *index;
+  guint    len = (guint)(hwgen->index_entries * sizeof *index);
+  guint64  i;
+
+  if (file_seek(fh, hwgen->index_offset, SEEK_SET, err) == -1)
+    return FALSE;
+
+  index = (struct hwgen_v2_index_entry *)g_malloc(len);
+  if (file_read(index, len, fh) != (int)len) {
+    *err = file_error(fh, err_info);
+    if (*err == 0)
+      *err = WTAP_ERR_SHORT_READ;
+    g_free(index);
+    return FALSE;
+  }
+
+  for (i = 0; i < hwgen->index_entries; i++) {
+    index[i].offset = GUINT64_FROM_LE(index[i].offset);
+    index[i].words = GUINT64_FROM_LE(index[i].words);
+    if (index[i].offset < hwgen->hdr_len ||
+        index[i].offset >= hwgen->index_offset - sizeof(struct hwgen_hdr) ||
+        (i > 0 && (index[i].offset <= index[i - 1].offset ||
+                   index[i].words <= index[i - 1].words))) {
+      *err = WTAP_ERR_BAD_FILE;
+      *err_info = g_strdup_printf("hwgen format: index entry %" G_GINT64_MODIFIER "u is out of range", i);
+      g_free(index);
+      return FALSE;
+    }
+  }
+
+  hwgen->index = index;
+  return TRUE;
+}
+
+/*
+ * Step over the records from the current position of "fh" up to
+ * "count" records or the offset "stop", whichever comes first, adding
+ * their line time to "words".  Only the record headers are read.
+ */
+static gboolean hwgen_skip_records(FILE_T fh, hwgen_t *hwgen, guint64 count,
+    gint64 stop, guint64 *words, int *err, gchar **err_info)
+{
+  struct hwgen_hdr hdr;
+  gint64 offset = file_tell(fh);
+  guint64 recno;
+
+  for (recno = 0; recno < count && offset < stop; recno++) {
+    if (file_read(&hdr, sizeof hdr, fh) != sizeof hdr) {
+      *err = file_error(fh, err_info);
+      if (*err == 0)
+        *err = WTAP_ERR_SHORT_READ;
+      return FALSE;
+    }
+    if (hdr.magic_word != HWGEN_MAGIC_WORD) {
+      *err = WTAP_ERR_BAD_FILE;
+      *err_info = g_strdup_printf("hwgen format: record at offset %" G_GINT64_MODIFIER "d has no magic word", offset);
+      return FALSE;
+    }
+    if (file_seek(fh, hdr.size + HWGEN_PADDING(hdr.size), SEEK_CUR, err) == -1)
+      return FALSE;
+    offset += sizeof hdr + hdr.size + HWGEN_PADDING(hdr.size);
+    *words += hwgen_rec_words(hwgen, hdr.size) + (hdr.ifg > 0 ? hdr.ifg : 0);
+  }
+  return TRUE;
+}
+
+/* Index of the last of "n" entries at or before "offset", or -1 if none. */
+static gint64 hwgen_find_entry(const struct hwgen_v2_index_entry *entries,
+    guint64 n, guint64 offset)
+{
+  guint64 lo = 0, hi = n;
+
+  while (lo < hi) {
+    guint64 mid = lo + (hi - lo) / 2;
+
+    if (entries[mid].offset <= offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return (gint64)lo - 1;
 }
 
 static gboolean hwgen_seek_read(wtap *wth, gint64 seek_off, struct wtap_pkthdr *phdr,
     Buffer *buf, int *err, gchar **err_info)
 {
-  if (file_seek(wth->random_fh, seek_off, SEEK_SET, err) == -1)
+  hwgen_t *hwgen = (hwgen_t *)wth->priv;
+  const struct hwgen_v2_index_entry *entries = NULL;
+  guint64 n = 0;
+  gint64  i;
+  gint64  offset = hwgen->hdr_len;
+  guint64 words = 0;
+
+  /*
+   * Start from the closest record at or before seek_off whose line
+   * position we know, and walk the headers from there.
+   */
+  if (hwgen->checkpoints == NULL) {
+    if (hwgen->index == NULL && hwgen->index_entries != 0 &&
+        !hwgen_v2_load_index(wth->random_fh, hwgen, err, err_info))
+      return FALSE;
+    entries = hwgen->index;
+    n = hwgen->index_entries;
+  } else {
+    entries = (const struct hwgen_v2_index_entry *)(void *)hwgen->checkpoints->data;
+    n = hwgen->checkpoints->len;
+  }
+  i = hwgen_find_entry(entries, n, (guint64)seek_off);
+  if (i >= 0) {
+    offset = (gint64)entries[i].offset;
+    words = entries[i].words;
+  }
+  if (hwgen->have_last && hwgen->last_offset <= seek_off && hwgen->last_offset > offset) {
+    /* Reading forward from the last record read is cheaper. */
+    offset = hwgen->last_offset;
+    words = hwgen->last_words;
+  }
+
+  if (file_seek(wth->random_fh, offset, SEEK_SET, err) == -1)
     return FALSE;
+  if (offset != seek_off) {
+    if (!hwgen_skip_records(wth->random_fh, hwgen, G_MAXUINT64, seek_off, &words,
+                            err, err_info))
+      return FALSE;
+    if (file_tell(wth->random_fh) != seek_off) {
+      *err = WTAP_ERR_BAD_FILE;
+      *err_info = g_strdup_printf("hwgen format: offset %" G_GINT64_MODIFIER "d is not the start of a record", seek_off);
+      return FALSE;
+    }
+  }
 
-  if (!hwgen_read_packet(wth, wth->random_fh, phdr, buf, err,
-      err_info)) {
+  if (!hwgen_read_packet(wth, wth->random_fh, phdr, buf, NULL,
+      &wth->seek_pkt_data, NULL, &words, err, err_info)) {
     if (*err == 0)
       *err = WTAP_ERR_SHORT_READ;
     return FALSE;
   }
+  hwgen->have_last = TRUE;
+  hwgen->last_offset = file_tell(wth->random_fh);
+  hwgen->last_words = words;
+  *err = 0;
+  return TRUE;
+}
+
+/*
+ * Position the sequential reader at record "packet_num": jump to the
+ * closest index entry at or before it, then step over the records in
+ * between by their headers alone.
+ */
+static gboolean hwgen_seek_packet(wtap *wth, guint64 packet_num, int *err,
+    gchar **err_info)
+{
+  hwgen_t *hwgen = (hwgen_t *)wth->priv;
+  const struct hwgen_v2_index_entry *entry;
+  guint64 recno;
+
   *err = 0;
+  if (!hwgen->have_footer || hwgen->index_interval == 0)
+    return FALSE;
+
+  if (packet_num >= hwgen->packet_count) {
+    /* Park on the end-of-records marker, so the next read hits EOF. */
+    if (file_seek(wth->fh, hwgen->index_offset - sizeof(struct hwgen_hdr), SEEK_SET, err) == -1)
+      return FALSE;
+    hwgen->npackets = hwgen->packet_count;
+    return TRUE;
+  }
+
+  if (hwgen->index == NULL && !hwgen_v2_load_index(wth->fh, hwgen, err, err_info))
+    return FALSE;
+
+  recno = packet_num - packet_num % hwgen->index_interval;
+  entry = &hwgen->index[recno / hwgen->index_interval];
+  if (file_seek(wth->fh, entry->offset, SEEK_SET, err) == -1)
+    return FALSE;
+  hwgen->words = entry->words;
+  if (!hwgen_skip_records(wth->fh, hwgen, packet_num - recno, G_MAXINT64,
+                          &hwgen->words, err, err_info))
+    return FALSE;
+
+  hwgen->npackets = packet_num;
   return TRUE;
 }
 
+static void hwgen_read_close(wtap *wth)
+{
+  hwgen_t *hwgen = (hwgen_t *)wth->priv;
+
+  g_free(hwgen->index);
+  if (hwgen->checkpoints != NULL)
+    g_array_free(hwgen->checkpoints, TRUE);
+}
+
 
 int hwgen_dump_can_write_encap(int encap)
 {
@@ -197,6 +490,13 @@ int hwgen_dump_can_write_encap(int encap)
     case WTAP_ENCAP_NULL:
     case WTAP_ENCAP_ETHERNET:
     case WTAP_ENCAP_RAW_IP:
+    case WTAP_ENCAP_RAW_IP4:
+    case WTAP_ENCAP_RAW_IP6:
+    case WTAP_ENCAP_SLL:
+    case WTAP_ENCAP_PPP:
+    case WTAP_ENCAP_PPP_WITH_PHDR:
+    case WTAP_ENCAP_ERF:
+    case WTAP_ENCAP_PER_PACKET:     /* Each frame is checked as it is written */
       return 0;
       break;
     default:
@@ -207,185 +507,948 @@ int hwgen_dump_can_write_encap(int encap)
 }
 
 
-static void calculateInterFrameGap (guint32 *ifp, const struct nstime_t *ts)
+void wtap_hwgen_params_init(wtap_hwgen_params_t *params)
 {
-  double ttime;
-  ttime = ts->secs * 1e09 + ts->nsecs;
-  /*
-    10 Gbits/s = 10*1024*1024*1024/8 B/S = 10*128*1024*1024 B/S
+  params->line_rate  = DEFAULT_LINE_RATE;
+  params->word_width = DEFAULT_WORD_WIDTH;
+  params->min_ifg    = MIN_IFP;
+  params->max_ifg    = MAX_IFP;
+  params->speedup    = SPEEDUP_ONE;
+}
 
-    1 us = 1e-09 s
-    1 W (word) = 4 bytes
+void wtap_hwgen_encap_init(wtap_hwgen_encap_t *encap)
+{
+  static const wtap_hwgen_encap_t defaults = {
+    DEFAULT_DST_MAC, DEFAULT_SRC_MAC, 0, {0, 0}
+  };
 
+  *encap = defaults;
+}
 
-    1/(10*128*1024*1024) s/B = 1/(10*128*1024*1024) * 1e06 us / B
-                 = 4 * 1e06/(10*128*1024*1024)  us / W = 1e06/(10.0*32*1024*1024) us / W
-   */
-  *ifp =  max (MIN_IFP, min (ceil (ttime / (1e09 / (10.0 * 32 * 1024 * 1024))),  MAX_IFP));
-  if( (*ifp) >= (MIN_IFP + lsize/4) ) 
-    *ifp -=  (guint32)(lsize / 4);
-  else 
-    *ifp = MIN_IFP; 
+gboolean wtap_hwgen_encap_valid(const wtap_hwgen_encap_t *encap)
+{
+  return encap->n_vlan_tags <= WTAP_HWGEN_MAX_VLAN_TAGS;
+}
 
-  return;
+gboolean wtap_hwgen_params_valid(const wtap_hwgen_params_t *params)
+{
+  return params->line_rate != 0 && params->line_rate <= MAX_LINE_RATE &&
+         params->word_width != 0 && params->word_width <= MAX_WORD_WIDTH &&
+         params->min_ifg != 0 && params->min_ifg <= params->max_ifg &&
+         params->max_ifg <= G_MAXINT32 &&
+         params->speedup != 0 && params->speedup <= MAX_SPEEDUP;
 }
-static unsigned char etherbuffer[] = {0x01,0x02,0x03,0x04,0x05,0x06,0x2c,0xb0,0x5d,0xb5,0x47,0x3e,0x08,0x00};
-static unsigned char buffer[65536]; 
-static gboolean hwgen_dump(wtap_dumper *wdh,
-  const struct wtap_pkthdr *phdr,
-  const guint8 *pd, int *err)
+
+/*
+ * Replay faster or slower than recorded by dividing the delta by
+ * speedup / 1e6.  As with the gaps, the remainder is carried into the
+ * next delta.
+ */
+static void hwgen_scale_delta(hwgen_dump_t *hwgen, nstime_t *delta)
 {
-  //const union wtap_pseudo_header *pseudo_header = &phdr->pseudo_header;
-  struct hwgen_hdr rec_hdr;
-  guint32 padding = 0, lpadding = 0;
-  unsigned int i, offset = 0;
-  guint32 crc = 0;
+  guint64 num, scaled;
+
+  if (hwgen->params.speedup == SPEEDUP_ONE ||
+      delta->secs < 0 || (delta->secs == 0 && delta->nsecs <= 0) ||
+      delta->secs >= MAX_SCALED_DELTA_SECS)
+    return;
+
+  num = ((guint64)delta->secs * 1000000000 + delta->nsecs) * SPEEDUP_ONE + hwgen->scale_carry;
+  scaled = num / hwgen->params.speedup;
+  hwgen->scale_carry = num % hwgen->params.speedup;
+  delta->secs = (time_t)(scaled / 1000000000);
+  delta->nsecs = (int)(scaled % 1000000000);
+}
 
-  /* We can only write packet records. */
-  if (phdr->rec_type != REC_TYPE_PACKET) {
-    return FALSE;
+/*
+ * Turn the time between the starts of two frames into the gap, in words,
+ * to leave after the first of them, whose record is lsize bytes long.
+ *
+ * With the line rate R in kbit/s and w-byte words the generator moves
+ * R / (8e6 * w) words per nanosecond, so the delta is converted exactly
+ * in units of 1/(8e6 * w) word.  The whole words are used and the rest is
+ * carried into the next gap, so that rounding doesn't accumulate over a
+ * long trace.
+ */
+static void calculateInterFrameGap (hwgen_dump_t *hwgen, guint32 *ifp, const struct nstime_t *ts, guint32 lsize)
+{
+  const wtap_hwgen_params_t *params = &hwgen->params;
+  guint64 denom = G_GUINT64_CONSTANT(8000000) * params->word_width;
+  guint64 words, per_sec, frac;
+  guint32 rec_words;
+
+  if (ts->secs < 0 || (ts->secs == 0 && ts->nsecs <= 0)) {
+    /* Out of order or simultaneous; send them back to back. */
+    words = 0;
+  } else if (ts->secs >= MAX_IFG_DELTA_SECS) {
+    words = params->max_ifg;
+  } else {
+    /* Whole seconds: R * 1e9 / (8e6 * w) = R * 125 / w words each. */
+    per_sec = (guint64)ts->secs * params->line_rate * 125;
+    words = per_sec / params->word_width;
+    frac = (guint64)ts->nsecs * params->line_rate +
+           (per_sec % params->word_width) * G_GUINT64_CONSTANT(8000000) +
+           hwgen->ifg_carry;
+    words += frac / denom;
+    hwgen->ifg_carry = frac % denom;
   }
 
-  /* Don't write anything we're not willing to read. */
-  if (phdr->caplen + phdr->caplen + sizeof rec_hdr  > WTAP_MAX_PACKET_SIZE) {
-    return FALSE;
+  if (words > params->max_ifg)
+    words = params->max_ifg;
+  if (words < params->min_ifg)
+    words = params->min_ifg;
+
+  /* The record itself takes up part of the delta. */
+  rec_words = (lsize + params->word_width - 1) / params->word_width;
+  if (words >= (guint64)params->min_ifg + rec_words) {
+    *ifp = (guint32)(words - rec_words);
+  } else {
+    /* Back to back: the line can't keep up with the trace. */
+    *ifp = params->min_ifg;
+    hwgen->stat_saturated++;
   }
+}
 
-  if(npackets) {
-    struct hwgen_hdr *prec_hdr = (struct hwgen_hdr *)lpacket;
-    //Calculate the IFG of the previous packet and dump to disk
-    if(phdr->presence_flags & WTAP_HAS_TS) {  
-      
-      nstime_t delta;
-      guint32 ifg;
+/*
+ * Write out the staged record with the given IFG, noting its offset and
+ * line position in the v2 index if it starts an index interval.
+ */
+static gboolean hwgen_dump_flush(wtap_dumper *wdh, hwgen_dump_t *hwgen,
+  gint32 ifg, int *err)
+{
+  struct hwgen_hdr *rec_hdr = (struct hwgen_hdr *)wtap_dump_file_held(wdh);
+  guint64 recno = hwgen->npackets - 1;
+  guint64 pos = hwgen->stat_words;
+
+  rec_hdr->ifg = ifg;
+
+  /* Close the peak-rate window if this record starts past its end. */
+  if (pos - hwgen->win_start >= hwgen->win_len) {
+    if (hwgen->win_bytes > hwgen->peak_bytes)
+      hwgen->peak_bytes = hwgen->win_bytes;
+    hwgen->have_peak = TRUE;
+    hwgen->win_start = pos - (pos - hwgen->win_start) % hwgen->win_len;
+    hwgen->win_bytes = 0;
+  }
+  hwgen->win_bytes += rec_hdr->size;
+  hwgen->stat_bytes += rec_hdr->size;
+  hwgen->stat_words += (hwgen->lsize + hwgen->params.word_width - 1) / hwgen->params.word_width + ifg;
 
-      nstime_delta (&delta, &(phdr->ts), &ltime);
-      calculateInterFrameGap (&ifg, &delta);
+  if (hwgen->index != NULL && recno % hwgen->index_interval == 0) {
+    struct hwgen_v2_index_entry entry;
 
-      prec_hdr->ifg = ifg;
-    } else {
-      prec_hdr->ifg = DEFAULT_IFG;
-    }
-    // Write the last packet after calculate the IFG
-    if (!wtap_dump_file_write(wdh, lpacket, lsize, err))
+    entry.offset = GUINT64_TO_LE((guint64)wdh->bytes_dumped);
+    entry.words = GUINT64_TO_LE(pos);
+    g_array_append_val(hwgen->index, entry);
+  }
+
+  /* Patched; it can go out with the rest of the buffer now. */
+  wtap_dump_file_release(wdh);
+  wdh->bytes_dumped += hwgen->lsize;
+  hwgen->lsize = 0;
+  return TRUE;
+}
+
+/*
+ * How a frame becomes an Ethernet II frame: unless it is kept as it is,
+ * the first "strip" bytes of it, and "fcs" bytes of FCS at its end, are
+ * replaced with a header built from the addresses, the tags and, unless
+ * the frame is already an Ethernet one, "ethertype".
+ */
+typedef struct {
+  gboolean keep;          /**< Ethernet with nothing to add; write it as it is. */
+  const guint8 *dst;      /**< Destination and... */
+  const guint8 *src;      /**< ...source address of the header built. */
+  guint16  ethertype;     /**< Type of what follows "strip", 0 for Ethernet. */
+  guint32  strip;
+  guint32  fcs;
+} hwgen_l2_t;
+
+/* Ethernet type of a raw IP packet, from its version; 0 if it isn't one. */
+static guint16 hwgen_ip_ethertype(const guint8 *pd, guint32 caplen)
+{
+  if (caplen == 0)
+    return 0;
+  switch (pd[0] >> 4) {
+    case 4:  return HWGEN_ETHERTYPE_IPv4;
+    case 6:  return HWGEN_ETHERTYPE_IPv6;
+    default: return 0;
+  }
+}
+
+/*
+ * Find a frame's link-layer header: for Ethernet frames, the addresses
+ * and the FCS, with "strip" covering the addresses only, as tags go
+ * between them and the type; for the others, the type of what follows
+ * it, and the addresses it has, the others being left NULL.  Returns
+ * FALSE for frames that don't carry anything with an Ethernet type (PPP
+ * LCP, 802.2 over Linux cooked, ERF ATM...) or are too short to tell.
+ */
+static gboolean hwgen_parse_l2(const struct wtap_pkthdr *phdr, const guint8 *pd,
+  hwgen_l2_t *l2)
+{
+  guint32 caplen = phdr->caplen;
+  guint32 af, proto;
+
+  l2->keep = FALSE;
+  l2->dst = NULL;
+  l2->src = NULL;
+  l2->ethertype = 0;
+  l2->strip = 0;
+  l2->fcs = 0;
+
+  switch (phdr->pkt_encap) {
+    case WTAP_ENCAP_ETHERNET:
+      if (caplen < 14)
+        return FALSE;
+      l2->dst = pd;
+      l2->src = pd + 6;
+      l2->strip = 12;
+      if (phdr->pseudo_header.eth.fcs_len > 0)
+        l2->fcs = phdr->pseudo_header.eth.fcs_len;
+      break;
+
+    case WTAP_ENCAP_RAW_IP:
+    case WTAP_ENCAP_RAW_IP4:
+    case WTAP_ENCAP_RAW_IP6:
+      l2->ethertype = hwgen_ip_ethertype(pd, caplen);
+      if (l2->ethertype == 0)
+        return FALSE;
+      break;
+
+    case WTAP_ENCAP_SLL:
+      /* Packet type, ARPHRD_ type, address length, address, protocol */
+      if (caplen < 16)
+        return FALSE;
+      proto = pntoh16(pd + 14);
+      if (proto < 0x0600)
+        return FALSE;       /* Not an Ethernet type */
+      /* The address is the sender's; use it if it's a MAC address. */
+      if (pntoh16(pd + 2) == 1 && pntoh16(pd + 4) == 6)
+        l2->src = pd + 6;
+      l2->ethertype = (guint16)proto;
+      l2->strip = 16;
+      break;
+
+    case WTAP_ENCAP_PPP:
+    case WTAP_ENCAP_PPP_WITH_PHDR:
+      /* Address and control, unless compressed away */
+      if (caplen >= 2 && pd[0] == 0xff && pd[1] == 0x03)
+        l2->strip = 2;
+      /* The protocol field is a single byte if compressed (odd). */
+      if (caplen < l2->strip + 1)
+        return FALSE;
+      if (pd[l2->strip] & 0x01) {
+        proto = pd[l2->strip];
+        l2->strip += 1;
+      } else {
+        if (caplen < l2->strip + 2)
+          return FALSE;
+        proto = pntoh16(pd + l2->strip);
+        l2->strip += 2;
+      }
+      switch (proto) {
+        case 0x0021: l2->ethertype = HWGEN_ETHERTYPE_IPv4; break;
+        case 0x0057: l2->ethertype = HWGEN_ETHERTYPE_IPv6; break;
+        case 0x0281: l2->ethertype = HWGEN_ETHERTYPE_MPLS; break;
+        case 0x0283: l2->ethertype = HWGEN_ETHERTYPE_MPLS_MC; break;
+        default:     return FALSE;
+      }
+      break;
+
+    case WTAP_ENCAP_NULL:
+      /*
+       * The address family, in the byte order of the machine that
+       * captured it (DLT_NULL) or big-endian (OpenBSD DLT_LOOP); the
+       * values are small enough to tell which.
+       */
+      if (caplen < 4)
+        return FALSE;
+      af = pletoh32(pd);
+      if (af > 0xFFFF)
+        af = pntoh32(pd);
+      switch (af) {
+        case 2:             /* AF_INET everywhere */
+          l2->ethertype = HWGEN_ETHERTYPE_IPv4;
+          break;
+        case 10:            /* AF_INET6: Linux */
+        case 24:            /* NetBSD, OpenBSD, BSD/OS */
+        case 28:            /* FreeBSD, DragonFly BSD */
+        case 30:            /* Darwin */
+          l2->ethertype = HWGEN_ETHERTYPE_IPv6;
+          break;
+        default:
+          return FALSE;
+      }
+      l2->strip = 4;
+      break;
+
+    case WTAP_ENCAP_ERF:
+      /* The ERF header is in the pseudo-header; the frame is what follows. */
+      switch (phdr->pseudo_header.erf.phdr.type & 0x7F) {
+        case 2:             /* ERF_TYPE_ETH */
+        case 11:            /* ERF_TYPE_COLOR_ETH */
+        case 16:            /* ERF_TYPE_DSM_COLOR_ETH */
+          /* ERF Ethernet records always have the FCS. */
+          if (caplen < 14)
+            return FALSE;
+          l2->dst = pd;
+          l2->src = pd + 6;
+          l2->strip = 12;
+          l2->fcs = 4;
+          break;
+        case 22:            /* ERF_TYPE_IPV4 */
+        case 23:            /* ERF_TYPE_IPV6 */
+          l2->ethertype = hwgen_ip_ethertype(pd, caplen);
+          if (l2->ethertype == 0)
+            return FALSE;
+          break;
+        default:
+          return FALSE;
+      }
+      break;
+
+    default:
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/*
+ * Work out how to turn a frame into an Ethernet II frame.  Returns FALSE
+ * for frames to leave out, see hwgen_parse_l2().
+ */
+static gboolean hwgen_rewrite_l2(const wtap_hwgen_encap_t *encap,
+  const struct wtap_pkthdr *phdr, const guint8 *pd, hwgen_l2_t *l2)
+{
+  if (phdr->pkt_encap == WTAP_ENCAP_ETHERNET && encap->n_vlan_tags == 0) {
+    l2->keep = TRUE;
+  } else {
+    if (!hwgen_parse_l2(phdr, pd, l2))
+      return FALSE;
+    if (l2->dst == NULL)
+      l2->dst = encap->dst_mac;
+    if (l2->src == NULL)
+      l2->src = encap->src_mac;
+  }
+
+  /* The record has room for "len" bytes of frame, not "caplen". */
+  return phdr->len >= phdr->caplen;
+}
+
+gboolean wtap_hwgen_l3_offset(const struct wtap_pkthdr *phdr, const guint8 *pd,
+  guint32 *offset, guint16 *ethertype, const guint8 **mac)
+{
+  hwgen_l2_t l2;
+  guint32 off;
+  guint16 type;
+  guint   i;
+
+  if (!hwgen_parse_l2(phdr, pd, &l2))
+    return FALSE;
+  if (l2.ethertype != 0) {
+    *offset = l2.strip;
+    *ethertype = l2.ethertype;
+    *mac = NULL;
+    return TRUE;
+  }
+
+  /* Ethernet: the type is after the addresses and up to two tags. */
+  type = pntoh16(pd + 12);
+  off = 14;
+  for (i = 0; i < 2 && (type == HWGEN_ETHERTYPE_VLAN || type == HWGEN_ETHERTYPE_QINQ ||
+                        type == HWGEN_ETHERTYPE_QINQ_OLD); i++) {
+    if (phdr->caplen < off + 4)
       return FALSE;
-    wdh->bytes_dumped += lsize;
+    type = pntoh16(pd + off + 2);
+    off += 4;
+  }
+  *offset = off;
+  *ethertype = type;
+  *mac = pd;
+  return TRUE;
+}
+
+/* Build the Ethernet header described by "l2"; returns its length. */
+static guint32 hwgen_build_l2(const wtap_hwgen_encap_t *encap, const hwgen_l2_t *l2,
+  guint8 *p)
+{
+  guint32 len = 12;
+  guint   i;
+
+  memmove(p, l2->dst, 6);
+  memmove(p + 6, l2->src, 6);
+  for (i = 0; i < encap->n_vlan_tags; i++) {
+    phtons(p + len, (i == 0 && encap->n_vlan_tags > 1) ?
+                    HWGEN_ETHERTYPE_QINQ : HWGEN_ETHERTYPE_VLAN);
+    phtons(p + len + 2, encap->vlan_tci[i]);
+    len += 4;
+  }
+  if (l2->ethertype != 0) {
+    phtons(p + len, l2->ethertype);
+    len += 2;
+  }
+  return len;
+}
+
+/*
+ * Can the frame go in a record at all?  Sets "*err" if not.
+ */
+static gboolean hwgen_frame_ok(const struct wtap_pkthdr *phdr, int *err)
+{
+  /* We can only write packet records. */
+  if (phdr->rec_type != REC_TYPE_PACKET) {
+    *err = WTAP_ERR_REC_TYPE_UNSUPPORTED;
+    return FALSE;
   }
 
-  // Store the packet for the next iteration
-  //rec_hdr.ifg = 3;  
-  rec_hdr.magic_word = 0x6969;
-  rec_hdr.size = phdr->len; 
+  /* Don't write anything we're not willing to read. */
+  if (phdr->caplen + phdr->caplen + sizeof(struct hwgen_hdr) > WTAP_MAX_PACKET_SIZE ||
+      phdr->len + WTAP_HWGEN_MAX_L2_HDR + 4 > 0xFFFF) {   /* The size field is 16 bits. */
+    *err = WTAP_ERR_PACKET_TOO_LARGE;
+    return FALSE;
+  }
+  return TRUE;
+}
 
+/*
+ * Build the record for a frame at "lpacket", which has room for
+ * WTAP_HWGEN_RECORD_MAX(phdr->len) bytes; returns its length.  The gap
+ * is filled in when the next frame arrives, see hwgen_dump_flush().
+ */
+static guint32 hwgen_build_record(const wtap_hwgen_encap_t *encap,
+  const hwgen_l2_t *l2, const struct wtap_pkthdr *phdr, const guint8 *pd,
+  guint8 *lpacket)
+{
+  struct hwgen_hdr rec_hdr;
+  guint32 padding = 0, lpadding = 0;
+  guint32 wire_len, cap_len;
+  unsigned int i, offset = 0;
+  guint32 crc = 0;
+  gboolean add_fcs;
 
+  rec_hdr.ifg = 0;      /* see hwgen_dump_flush() */
+  rec_hdr.magic_word = HWGEN_MAGIC_WORD;
   offset = (guint32) sizeof rec_hdr;
-  // Obtain the correct size:
-  // 1) Add the Ethernet encap if IP RAW data is being processed.
-  if(phdr->pkt_encap == WTAP_ENCAP_RAW_IP) {
-    rec_hdr.size  += sizeof etherbuffer;
-  } 
-  // 2) Add the FCS if none CRC is provided.
-  if(phdr->pkt_encap == WTAP_ENCAP_RAW_IP) {
-    memcpy(lpacket+offset, etherbuffer,sizeof etherbuffer ); 
-    offset += (guint32) sizeof etherbuffer;
-  }  
-
-  memcpy(lpacket+offset, pd, phdr->caplen); 
-  offset += phdr->caplen;
-
-  if( (phdr->presence_flags & WTAP_HAS_CAP_LEN) && (phdr->caplen!=phdr->len)) {
-    for(i=0; i<(phdr->len-phdr->caplen); i++) {
-      lpacket[offset] = 0;
-      offset++;
-    }
-  }  
 
-  if((phdr->pseudo_header.eth.fcs_len <= 0) || (phdr->caplen!=phdr->len)) {
+  if (l2->keep) {
+    // Ethernet frames are written as they are
+    rec_hdr.size = phdr->len; 
+
+    memcpy(lpacket+offset, pd, phdr->caplen); 
+    offset += phdr->caplen;
+
+    if( (phdr->presence_flags & WTAP_HAS_CAP_LEN) && (phdr->caplen!=phdr->len)) {
+      for(i=0; i<(phdr->len-phdr->caplen); i++) {
+        lpacket[offset] = 0;
+        offset++;
+      }
+    }  
+    // Add the FCS if none CRC is provided.
+    add_fcs = (phdr->pseudo_header.eth.fcs_len <= 0) || (phdr->caplen!=phdr->len);
+  } else {
+    // Anything else gets a new Ethernet header, and a new FCS
+    wire_len = phdr->len - l2->strip;
+    wire_len -= MIN(l2->fcs, wire_len);
+    cap_len = MIN(phdr->caplen - l2->strip, wire_len);
+
+    offset += hwgen_build_l2(encap, l2, lpacket + offset);
+    memcpy(lpacket+offset, pd+l2->strip, cap_len);
+    offset += cap_len;
+    memset(lpacket+offset, 0, wire_len-cap_len);
+    offset += wire_len-cap_len;
+
+    rec_hdr.size = offset - (guint32) sizeof rec_hdr;
+    add_fcs = TRUE;
+  }
+
+  if(add_fcs) {
     rec_hdr.size  += 4;
-    offset += rec_hdr.size < 64 ? 64-rec_hdr.size : 0;
+    if (rec_hdr.size < 64) {
+      memset(lpacket+offset, 0, 64-rec_hdr.size);
+      offset += 64-rec_hdr.size;
+    }
     rec_hdr.size = rec_hdr.size < 64 ? 64 : rec_hdr.size;
-    crc = crc32(0, lpacket+sizeof rec_hdr, rec_hdr.size-4); // Substract 4, the FCS size
+    crc = crc32_ieee(lpacket+sizeof rec_hdr, rec_hdr.size-4); // Substract 4, the FCS size
   }   
 
 
   memcpy( lpacket, &rec_hdr, sizeof rec_hdr );
-  if((phdr->pseudo_header.eth.fcs_len <= 0) || (phdr->caplen!=phdr->len)) {
+  if(add_fcs) {
     memcpy(lpacket+offset, &crc, 4);
     offset += 4;
   } 
-  lpadding = 4 - (rec_hdr.size%4);
+  lpadding = HWGEN_PADDING(rec_hdr.size);
   memcpy(lpacket+offset, &padding, lpadding);
   offset += lpadding ;
-  lsize = offset;
-  ltime = phdr->ts;
-  npackets++;
+  return offset;
+}
+
+/*
+ * Write out the held record, now that the time stamp of the next one is
+ * known, and make room for the next one; returns where to put it.
+ */
+static guint8 *hwgen_dump_begin(wtap_dumper *wdh, hwgen_dump_t *hwgen,
+  const struct wtap_pkthdr *phdr, guint32 size, int *err)
+{
+  if(hwgen->npackets) {
+    guint32 ifg = hwgen->params.min_ifg;
+
+    //Calculate the IFG of the previous packet and dump to disk
+    if(phdr->presence_flags & WTAP_HAS_TS) {  
+      nstime_t delta;
+
+      nstime_delta (&delta, &(phdr->ts), &hwgen->ltime);
+      hwgen_scale_delta (hwgen, &delta);
+      calculateInterFrameGap (hwgen, &ifg, &delta, hwgen->lsize);
+    }
+    // Write the last packet after calculate the IFG
+    if (!hwgen_dump_flush(wdh, hwgen, ifg, err))
+      return NULL;
+  }
+
+  // The record is built in place and held for the next iteration
+  wtap_dump_file_hold(wdh);
+  return (guint8 *)wtap_dump_file_reserve(wdh, size, err);
+}
+
+/* The record of "size" bytes put where hwgen_dump_begin() said is complete. */
+static void hwgen_dump_end(wtap_dumper *wdh, hwgen_dump_t *hwgen,
+  const struct wtap_pkthdr *phdr, guint32 size)
+{
+  wtap_dump_file_commit(wdh, size);
+  hwgen->lsize = size;
+  hwgen->ltime = phdr->ts;
+  hwgen->npackets++;
+}
+
+static gboolean hwgen_dump(wtap_dumper *wdh,
+  const struct wtap_pkthdr *phdr,
+  const guint8 *pd, int *err)
+{
+  hwgen_dump_t *hwgen = (hwgen_dump_t *)wdh->priv;
+  guint8 *lpacket;
+  hwgen_l2_t l2;
+
+  if (!hwgen_frame_ok(phdr, err))
+    return FALSE;
+
+  /*
+   * Leave out what we can't send before the previous record is flushed,
+   * so that its gap runs up to the next frame that is sent.
+   */
+  if (!hwgen_rewrite_l2(&hwgen->encap, phdr, pd, &l2)) {
+    hwgen->stat_skipped++;
+    *err = 0;
+    return TRUE;
+  }
+
+  lpacket = hwgen_dump_begin(wdh, hwgen, phdr, WTAP_HWGEN_RECORD_MAX(phdr->len), err);
+  if (lpacket == NULL)
+    return FALSE;
+  hwgen_dump_end(wdh, hwgen, phdr,
+                 hwgen_build_record(&hwgen->encap, &l2, phdr, pd, lpacket));
   *err = 0;
   return TRUE;
 }
 
-static gboolean hwgen_close(wtap_dumper *wdh,
+gint wtap_hwgen_build_record(const wtap_hwgen_encap_t *encap,
+  const struct wtap_pkthdr *phdr, const guint8 *pd, guint8 *rec, int *err)
+{
+  hwgen_l2_t l2;
+
+  if (!hwgen_frame_ok(phdr, err))
+    return -1;
+  *err = 0;
+  if (!hwgen_rewrite_l2(encap, phdr, pd, &l2))
+    return 0;
+  return (gint)hwgen_build_record(encap, &l2, phdr, pd, rec);
+}
+
+gboolean wtap_dump_hwgen_record(wtap_dumper *wdh,
+  const struct wtap_pkthdr *phdr, const guint8 *rec, gint rec_len, int *err)
+{
+  hwgen_dump_t *hwgen = (hwgen_dump_t *)wdh->priv;
+  guint8 *lpacket;
+
+  if (wdh->file_type_subtype != WTAP_FILE_TYPE_SUBTYPE_HWGEN_V1 &&
+      wdh->file_type_subtype != WTAP_FILE_TYPE_SUBTYPE_HWGEN_V2) {
+    *err = WTAP_ERR_UNSUPPORTED_FILE_TYPE;
+    return FALSE;
+  }
+
+  *err = 0;
+  if (rec_len == 0) {
+    hwgen->stat_skipped++;
+    return TRUE;
+  }
+
+  lpacket = hwgen_dump_begin(wdh, hwgen, phdr, (guint32)rec_len, err);
+  if (lpacket == NULL)
+    return FALSE;
+  memcpy(lpacket, rec, rec_len);
+  hwgen_dump_end(wdh, hwgen, phdr, (guint32)rec_len);
+  return TRUE;
+}
+
+/*
+ * Finish a v2 file: end-of-records marker, index and footer.
+ */
+static gboolean hwgen_dump_v2_trailer(wtap_dumper *wdh, hwgen_dump_t *hwgen,
   int *err)
 {
-  if(lsize) {
-  	struct hwgen_hdr *rec_hdr = (struct hwgen_hdr *)lpacket;
-  	rec_hdr->ifg = DEFAULT_IFG;
+  struct hwgen_hdr eor;
+  struct hwgen_v2_footer footer;
+
+  eor.size = 0;
+  eor.magic_word = HWGEN_V2_EOR_MAGIC;
+  eor.ifg = 0;
+  if (!wtap_dump_file_write(wdh, &eor, sizeof eor, err))
+    return FALSE;
+  wdh->bytes_dumped += sizeof eor;
 
-	  if (!wtap_dump_file_write(wdh, lpacket, lsize, err))
-	    return FALSE;
-	  wdh->bytes_dumped += lsize;
-	  if (!wtap_dump_file_write(wdh, &npackets, sizeof(guint64), err))
-	    return FALSE;
-	  wdh->bytes_dumped += sizeof(guint64);
+  footer.npackets = GUINT64_TO_LE(hwgen->npackets);
+  footer.index_offset = GUINT64_TO_LE((guint64)wdh->bytes_dumped);
+  footer.index_entries = GUINT64_TO_LE((guint64)hwgen->index->len);
+  footer.index_interval = GUINT32_TO_LE(hwgen->index_interval);
+  footer.magic = GUINT32_TO_LE(HWGEN_V2_FOOTER_MAGIC);
 
+  if (hwgen->index->len != 0) {
+    if (!wtap_dump_file_write(wdh, hwgen->index->data,
+                              hwgen->index->len * sizeof(struct hwgen_v2_index_entry), err))
+      return FALSE;
+    wdh->bytes_dumped += hwgen->index->len * sizeof(struct hwgen_v2_index_entry);
   }
-  lsize = 0;
+
+  if (!wtap_dump_file_write(wdh, &footer, sizeof footer, err))
+    return FALSE;
+  wdh->bytes_dumped += sizeof footer;
+  return TRUE;
+}
+
+static gboolean hwgen_close(wtap_dumper *wdh,
+  int *err)
+{
+  hwgen_dump_t *hwgen = (hwgen_dump_t *)wdh->priv;
+  gboolean ret = TRUE;
+
   *err = 0;
+  if(hwgen->lsize) {
+    ret = hwgen_dump_flush(wdh, hwgen, hwgen->params.min_ifg, err);
+    if (ret && hwgen->index == NULL) {
+      if (!wtap_dump_file_write(wdh, &hwgen->npackets, sizeof(guint64), err))
+        ret = FALSE;
+      else
+        wdh->bytes_dumped += sizeof(guint64);
+    }
+  }
+
+  if (hwgen->index != NULL) {
+    if (ret)
+      ret = hwgen_dump_v2_trailer(wdh, hwgen, err);
+    g_array_free(hwgen->index, TRUE);
+    hwgen->index = NULL;
+  }
+  return ret;
+}
+gboolean wtap_dump_hwgen_stats(wtap_dumper *wdh, wtap_hwgen_stats_t *stats)
+{
+  hwgen_dump_t *hwgen = (hwgen_dump_t *)wdh->priv;
+  guint64 bytes, words;
+  double  word_time;
+
+  if (wdh->file_type_subtype != WTAP_FILE_TYPE_SUBTYPE_HWGEN_V1 &&
+      wdh->file_type_subtype != WTAP_FILE_TYPE_SUBTYPE_HWGEN_V2)
+    return FALSE;
+
+  bytes = hwgen->stat_bytes;
+  words = hwgen->stat_words;
+  if (hwgen->lsize) {
+    /* The staged record will go out with the minimum gap. */
+    bytes += ((struct hwgen_hdr *)wtap_dump_file_held(wdh))->size;
+    words += (hwgen->lsize + hwgen->params.word_width - 1) / hwgen->params.word_width +
+             hwgen->params.min_ifg;
+  }
+
+  /* Seconds per word */
+  word_time = 8.0 * hwgen->params.word_width / (hwgen->params.line_rate * 1000.0);
+
+  stats->frames = hwgen->npackets;
+  stats->saturated = hwgen->stat_saturated;
+  stats->duration = words * word_time;
+  if (stats->duration > 0.0) {
+    stats->avg_bps = bytes * 8.0 / stats->duration;
+    stats->avg_pps = hwgen->npackets / stats->duration;
+  } else {
+    stats->avg_bps = 0.0;
+    stats->avg_pps = 0.0;
+  }
+  if (hwgen->have_peak)
+    stats->peak_bps = hwgen->peak_bytes * 8.0 / (hwgen->win_len * word_time);
+  else
+    stats->peak_bps = stats->avg_bps;
+  stats->skipped = hwgen->stat_skipped;
   return TRUE;
 }
+
 /* Returns TRUE on success, FALSE on failure; sets "*err" to an error code on
    failure */
 gboolean hwgen_dump_open(wtap_dumper *wdh, int *err)
 {
-  
+  hwgen_dump_t *hwgen;
+
+  if ((wdh->hwgen_params != NULL && !wtap_hwgen_params_valid(wdh->hwgen_params)) ||
+      (wdh->hwgen_encap != NULL && !wtap_hwgen_encap_valid(wdh->hwgen_encap))) {
+    *err = WTAP_ERR_INTERNAL;
+    return FALSE;
+  }
   *err = 0;
 
+  /* freed by wtap_dump_close() */
+  hwgen = (hwgen_dump_t *)g_malloc0(sizeof(hwgen_dump_t));
+  wdh->priv = hwgen;
+  if (wdh->hwgen_params != NULL)
+    hwgen->params = *wdh->hwgen_params;
+  else
+    wtap_hwgen_params_init(&hwgen->params);
+  if (wdh->hwgen_encap != NULL)
+    hwgen->encap = *wdh->hwgen_encap;
+  else
+    wtap_hwgen_encap_init(&hwgen->encap);
+  hwgen->win_len = hwgen->params.line_rate / (8 * hwgen->params.word_width);
+  if (hwgen->win_len == 0)
+    hwgen->win_len = 1;
+
   wdh->subtype_write = hwgen_dump;
   wdh->subtype_close = hwgen_close;
 
+  /* Records are built in place in this, and go out in whole pages. */
+  if (!wtap_dump_set_write_buffer(wdh, HWGEN_WRITE_BUFFER_SIZE, err))
+    return FALSE;
+
+  if (wdh->file_type_subtype == WTAP_FILE_TYPE_SUBTYPE_HWGEN_V2) {
+    struct hwgen_v2_file_hdr file_hdr;
+
+    file_hdr.magic = GUINT32_TO_LE(HWGEN_V2_MAGIC);
+    file_hdr.version = GUINT16_TO_LE(HWGEN_V2_VERSION);
+    file_hdr.hdr_len = GUINT16_TO_LE(sizeof file_hdr);
+    file_hdr.index_interval = GUINT32_TO_LE(HWGEN_V2_INDEX_INTERVAL);
+    file_hdr.word_width = GUINT32_TO_LE(hwgen->params.word_width);
+    file_hdr.line_rate = GUINT32_TO_LE((guint32)hwgen->params.line_rate);
+    file_hdr.reserved = 0;
+    if (!wtap_dump_file_write(wdh, &file_hdr, sizeof file_hdr, err))
+      return FALSE;
+    wdh->bytes_dumped += sizeof file_hdr;
+
+    hwgen->index_interval = HWGEN_V2_INDEX_INTERVAL;
+    hwgen->index = g_array_new(FALSE, FALSE, sizeof(struct hwgen_v2_index_entry));
+  }
 
   return TRUE;  
 }
 
 
 
-int hwgen_open(wtap *wth, int *err, gchar **err_info _U_)
+/*
+ * Look for the v2 footer at the end of the file.  Only a footer that
+ * agrees with the file header and the file size is used; if there is
+ * none, e.g. because the file is still being written, the file can
+ * still be read sequentially.  Returns FALSE only on an I/O error.
+ */
+static gboolean hwgen_v2_read_footer(wtap *wth, hwgen_t *hwgen, int *err,
+    gchar **err_info)
+{
+  struct hwgen_v2_footer footer;
+  gint64  size;
+  guint64 npackets, index_offset, index_entries;
+  guint32 index_interval;
+
+  size = wtap_file_size(wth, err);
+  if (size == -1)
+    return FALSE;
+  if ((guint64)size < hwgen->hdr_len + sizeof(struct hwgen_hdr) + sizeof footer)
+    return TRUE;
+
+  if (file_seek(wth->fh, size - sizeof footer, SEEK_SET, err) == -1)
+    return FALSE;
+  if (file_read(&footer, sizeof footer, wth->fh) != sizeof footer) {
+    *err = file_error(wth->fh, err_info);
+    return *err == 0;
+  }
+
+  if (GUINT32_FROM_LE(footer.magic) != HWGEN_V2_FOOTER_MAGIC)
+    return TRUE;
+  npackets = GUINT64_FROM_LE(footer.npackets);
+  index_offset = GUINT64_FROM_LE(footer.index_offset);
+  index_entries = GUINT64_FROM_LE(footer.index_entries);
+  index_interval = GUINT32_FROM_LE(footer.index_interval);
+
+  if (index_interval != hwgen->index_interval ||
+      index_offset < hwgen->hdr_len + sizeof(struct hwgen_hdr) ||
+      index_offset > (guint64)size - sizeof footer ||
+      index_entries != ((guint64)size - sizeof footer - index_offset) / sizeof(struct hwgen_v2_index_entry) ||
+      index_offset + index_entries * sizeof(struct hwgen_v2_index_entry) + sizeof footer != (guint64)size ||
+      index_entries != (index_interval == 0 ? 0 : (npackets + index_interval - 1) / index_interval) ||
+      index_entries > G_MAXUINT / sizeof(struct hwgen_v2_index_entry))
+    return TRUE;
+
+  hwgen->have_footer = TRUE;
+  hwgen->packet_count = npackets;
+  hwgen->index_offset = index_offset;
+  hwgen->index_entries = index_entries;
+  wth->packet_count = (gint64)npackets;
+  return TRUE;
+}
+
+/*
+ * Is the file a regular file, i.e. not a pipe, so that the v2 footer can
+ * be looked for without consuming the records?
+ */
+static gboolean hwgen_is_regular_file(FILE_T fh)
+{
+  ws_statb64 statb;
+
+  return file_fstat(fh, &statb, NULL) == 0 && S_ISREG(statb.st_mode);
+}
+
+/*
+ * The v2 file header starts with a 32-bit magic number, so this is one of
+ * the magic-number open routines; those run before the heuristics, which
+ * may read too far into a pipe to rewind it.  Everything here only reads
+ * forward, except for the footer probe, which needs a regular file.
+ */
+int hwgen_v2_open(wtap *wth, int *err, gchar **err_info)
+{
+  struct hwgen_v2_file_hdr file_hdr;
+  hwgen_t *hwgen;
+  guint16  version, hdr_len;
+
+  if (file_read(&file_hdr, sizeof file_hdr, wth->fh) != sizeof file_hdr) {
+    *err = file_error(wth->fh, err_info);
+    if (*err != 0 && *err != WTAP_ERR_SHORT_READ)
+      return -1;
+    return 0;
+  }
+
+  if (GUINT32_FROM_LE(file_hdr.magic) != HWGEN_V2_MAGIC)
+    return 0;
+
+  version = GUINT16_FROM_LE(file_hdr.version);
+  hdr_len = GUINT16_FROM_LE(file_hdr.hdr_len);
+  if (version != HWGEN_V2_VERSION) {
+    *err = WTAP_ERR_UNSUPPORTED;
+    *err_info = g_strdup_printf("hwgen format: version %u unsupported", version);
+    return -1;
+  }
+  if (hdr_len < sizeof file_hdr || hdr_len % 4 != 0) {
+    *err = WTAP_ERR_BAD_FILE;
+    *err_info = g_strdup_printf("hwgen format: file header length %u is invalid", hdr_len);
+    return -1;
+  }
+
+  /* freed by wtap_close() */
+  hwgen = (hwgen_t *)g_malloc0(sizeof(hwgen_t));
+  wth->priv = hwgen;
+  hwgen->hdr_len = hdr_len;
+  hwgen->index_interval = GUINT32_FROM_LE(file_hdr.index_interval);
+  hwgen->word_width = GUINT32_FROM_LE(file_hdr.word_width);
+  hwgen->line_rate = GUINT32_FROM_LE(file_hdr.line_rate);
+  if (hwgen->word_width == 0 || hwgen->word_width > MAX_WORD_WIDTH || hwgen->line_rate == 0) {
+    *err = WTAP_ERR_BAD_FILE;
+    *err_info = g_strdup_printf("hwgen format: line model of %u-byte words at %" G_GINT64_MODIFIER "u kbit/s is invalid",
+                                hwgen->word_width, hwgen->line_rate);
+    return -1;
+  }
+
+  /*
+   * Seeking to the footer of a compressed file means decompressing all
+   * of it, which is what we are trying to avoid, and a pipe can't be
+   * seeked at all; read those sequentially.
+   */
+  if (!file_iscompressed(wth->fh) && hwgen_is_regular_file(wth->fh) &&
+      !hwgen_v2_read_footer(wth, hwgen, err, err_info))
+    return -1;
+
+  if (file_seek(wth->fh, hdr_len, SEEK_SET, err) == -1)
+    return -1;
+
+  if (!hwgen->have_footer || hwgen->index_interval == 0)
+    hwgen->checkpoints = g_array_new(FALSE, FALSE, sizeof(struct hwgen_v2_index_entry));
+
+  wth->file_encap = WTAP_ENCAP_HW_GENERATOR;
+  wth->snapshot_length = 0;
+  wth->tsprecision = WTAP_FILE_TSPREC_NSEC;
+
+  wth->subtype_read = hwgen_read;
+  wth->subtype_read_batch = hwgen_read_batch;
+  wth->subtype_seek_read = hwgen_seek_read;
+  wth->subtype_seek_packet = hwgen_seek_packet;
+  wth->subtype_close = hwgen_read_close;
+  wth->file_type_subtype = WTAP_FILE_TYPE_SUBTYPE_HWGEN_V2;
+
+  *err = 0;
+  return 1;
+}
+
+gboolean wtap_set_hwgen_read_params(wtap *wth, const wtap_hwgen_params_t *params)
+{
+  hwgen_t *hwgen = (hwgen_t *)wth->priv;
+
+  /* The checkpoints taken so far are in the old words. */
+  if (wth->file_type_subtype != WTAP_FILE_TYPE_SUBTYPE_HWGEN_V1 ||
+      hwgen->npackets != 0 || !wtap_hwgen_params_valid(params))
+    return FALSE;
+
+  hwgen->word_width = params->word_width;
+  hwgen->line_rate = params->line_rate;
+  return TRUE;
+}
+
+int hwgen_open(wtap *wth, int *err, gchar **err_info)
 {
-  guint8  block[4];
+  struct hwgen_hdr hdr;
+  hwgen_t *hwgen;
 
-  if (file_read(block, sizeof(block),wth->fh)!=sizeof(block)) {
+  /*
+   * Peek at the first record header.  Stepping back over it stays
+   * within the FILE_T buffer, so this works on a pipe as well.
+   */
+  if (file_read(&hdr, sizeof hdr, wth->fh) != sizeof hdr) {
       *err = file_error(wth->fh, err_info);
 	if (*err != 0 && *err != WTAP_ERR_SHORT_READ)
 		return -1;
 	return 0;
   }
+  if (file_seek(wth->fh, 0, SEEK_SET, err) == -1)
+    return -1;
 
-  if (!(block[2]==0x69 && block[3] == 0x69)) {
-    return 2; 
-  }
-
+  /* Opened by type rather than by probing. */
+  if (pletoh32(&hdr) == HWGEN_V2_MAGIC)
+    return hwgen_v2_open(wth, err, err_info);
 
-  /* rewind the fh so we re-read from the beginning */
-  if (-1 == file_seek(wth->fh, 0, SEEK_SET, err))
-      return 0;
+  if (hdr.magic_word != HWGEN_MAGIC_WORD || hdr.ifg < 0) {
+    return 0; 
+  }
 
   wth->file_encap = WTAP_ENCAP_HW_GENERATOR;
   wth->snapshot_length = 0;
- // wth->file_tsprec = WTAP_TSPREC_NSEC;
+  wth->tsprecision = WTAP_FILE_TSPREC_NSEC;
 
-  wth->priv = NULL;
+  /*
+   * v1 files don't say what line model their gaps are for; assume
+   * the default one, unless wtap_set_hwgen_read_params() says otherwise.
+   */
+  /* freed by wtap_close() */
+  hwgen = (hwgen_t *)g_malloc0(sizeof(hwgen_t));
+  wth->priv = hwgen;
+  hwgen->word_width = DEFAULT_WORD_WIDTH;
+  hwgen->line_rate = DEFAULT_LINE_RATE;
+  hwgen->checkpoints = g_array_new(FALSE, FALSE, sizeof(struct hwgen_v2_index_entry));
 
   wth->subtype_read = hwgen_read;
+  wth->subtype_read_batch = hwgen_read_batch;
   wth->subtype_seek_read = hwgen_seek_read;
+  wth->subtype_close = hwgen_read_close;
   wth->file_type_subtype = WTAP_FILE_TYPE_SUBTYPE_HWGEN_V1;
 
   *err = 0;
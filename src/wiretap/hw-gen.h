@@ -8,13 +8,67 @@
 #include <glib.h>
 #include <wtap.h>
 
+#define HWGEN_MAGIC_WORD	0x6969
+
 struct hwgen_hdr {
 	guint16	size;	
 	guint16	magic_word;	
 	gint32	ifg;	
 }; 
 
+/*
+ * hw-gen v2 container.  A v2 file is
+ *
+ *	struct hwgen_v2_file_hdr
+ *	records, exactly as in v1 (struct hwgen_hdr, frame, FCS, padding)
+ *	end-of-records marker: a struct hwgen_hdr with size 0 and
+ *	    magic_word HWGEN_V2_EOR_MAGIC
+ *	index: index_entries struct hwgen_v2_index_entry, entry i
+ *	    locating record i * index_interval
+ *	struct hwgen_v2_footer
+ *
+ * The file header, index and footer are little-endian; the records keep
+ * the host byte order v1 uses.  The footer sits at the very end of the
+ * file so a reader can find the index, and the record count, without
+ * walking the records; the end-of-records marker lets a sequential
+ * reader stop without knowing where the footer is.
+ *
+ * The IFGs are in words of word_width bytes at line_rate; the header
+ * records the line model they were computed for, so that a reader can
+ * turn them back into time stamps.  Each index entry carries the line
+ * position of its record, i.e. the words taken by all the records and
+ * gaps before it, so that a reader starting there knows the time too.
+ */
+#define HWGEN_V2_MAGIC		0x32475748	/* "HWG2" */
+#define HWGEN_V2_FOOTER_MAGIC	0x45475748	/* "HWGE" */
+#define HWGEN_V2_EOR_MAGIC	0x9696
+#define HWGEN_V2_VERSION	2
+
+struct hwgen_v2_file_hdr {
+	guint32	magic;			/* HWGEN_V2_MAGIC */
+	guint16	version;		/* HWGEN_V2_VERSION */
+	guint16	hdr_len;		/* length of this header; records follow it */
+	guint32	index_interval;		/* K: one index entry every K records, 0 if no index */
+	guint32	word_width;		/* bytes per generator word */
+	guint32	line_rate;		/* line rate, in kbit/s */
+	guint32	reserved;
+};
+
+struct hwgen_v2_index_entry {
+	guint64	offset;			/* file offset of the record */
+	guint64	words;			/* line position of the record, in words */
+};
+
+struct hwgen_v2_footer {
+	guint64	npackets;		/* number of records */
+	guint64	index_offset;		/* file offset of the index */
+	guint64	index_entries;		/* number of index entries */
+	guint32	index_interval;		/* copy of the file header's */
+	guint32	magic;			/* HWGEN_V2_FOOTER_MAGIC */
+};
+
 int hwgen_open(wtap *wth, int *err, gchar **err_info);
+int hwgen_v2_open(wtap *wth, int *err, gchar **err_info);
 gboolean hwgen_dump_open(wtap_dumper *wdh, int *err);
 int hwgen_dump_can_write_encap(int encap);
 
@@ -65,13 +65,16 @@ static libpcap_try_t libpcap_try(wtap *wth, int *err, gchar **err_info);
 
 static gboolean libpcap_read(wtap *wth, int *err, gchar **err_info,
     gint64 *data_offset);
+static gboolean libpcap_read_batch(wtap *wth, wtap_batch *batch, guint n,
+    int *err, gchar **err_info);
 static gboolean libpcap_seek_read(wtap *wth, gint64 seek_off,
     struct wtap_pkthdr *phdr, Buffer *buf, int *err, gchar **err_info);
 static int libpcap_read_header(wtap *wth, FILE_T fh, int *err, gchar **err_info,
     struct pcaprec_ss990915_hdr *hdr);
 static void adjust_header(wtap *wth, struct pcaprec_hdr *hdr);
 static gboolean libpcap_read_packet(wtap *wth, FILE_T fh,
-    struct wtap_pkthdr *phdr, Buffer *buf, int *err, gchar **err_info);
+    struct wtap_pkthdr *phdr, Buffer *buf, wtap_batch *batch, guint8 **pd,
+    int *err, gchar **err_info);
 static gboolean libpcap_dump(wtap_dumper *wdh, const struct wtap_pkthdr *phdr,
     const guint8 *pd, int *err);
 
@@ -259,6 +262,7 @@ int libpcap_open(wtap *wth, int *err, gchar **err_info)
 	wth->priv = (void *)libpcap;
 	wth->subtype_read = libpcap_read;
 	wth->subtype_seek_read = libpcap_seek_read;
+	wth->subtype_read_batch = libpcap_read_batch;
 	wth->file_encap = file_encap;
 	wth->snapshot_length = hdr.snaplen;
 
@@ -596,7 +600,26 @@ static gboolean libpcap_read(wtap *wth, int *err, gchar **err_info,
 	*data_offset = file_tell(wth->fh);
 
 	return libpcap_read_packet(wth, wth->fh, &wth->phdr,
-	    wth->frame_buffer, err, err_info);
+	    wth->frame_buffer, NULL, &wth->pkt_data, err, err_info);
+}
+
+/* Read packets straight into a batch */
+static gboolean libpcap_read_batch(wtap *wth, wtap_batch *batch, guint n,
+    int *err, gchar **err_info)
+{
+	struct wtap_pkthdr *phdr;
+	gint64 data_offset;
+	guint8 *pd;
+
+	while (!wtap_batch_full(batch, n)) {
+		data_offset = file_tell(wth->fh);
+		phdr = wtap_batch_begin(wth, batch);
+		if (!libpcap_read_packet(wth, wth->fh, phdr, NULL, batch, &pd,
+		    err, err_info))
+			return FALSE;
+		wtap_batch_end(wth, batch, data_offset, pd);
+	}
+	return TRUE;
 }
 
 static gboolean
@@ -606,8 +629,8 @@ libpcap_seek_read(wtap *wth, gint64 seek_off, struct wtap_pkthdr *phdr,
 	if (file_seek(wth->random_fh, seek_off, SEEK_SET, err) == -1)
 		return FALSE;
 
-	if (!libpcap_read_packet(wth, wth->random_fh, phdr, buf, err,
-	    err_info)) {
+	if (!libpcap_read_packet(wth, wth->random_fh, phdr, buf, NULL,
+	    &wth->seek_pkt_data, err, err_info)) {
 		if (*err == 0)
 			*err = WTAP_ERR_SHORT_READ;
 		return FALSE;
@@ -615,9 +638,14 @@ libpcap_seek_read(wtap *wth, gint64 seek_off, struct wtap_pkthdr *phdr,
 	return TRUE;
 }
 
+/*
+ * Read a packet.  Its data goes into batch, if that's not NULL, and
+ * otherwise into buf; either way, *pd is pointed at it, which may be in
+ * the file's mapping.
+ */
 static gboolean
 libpcap_read_packet(wtap *wth, FILE_T fh, struct wtap_pkthdr *phdr,
-    Buffer *buf, int *err, gchar **err_info)
+    Buffer *buf, wtap_batch *batch, guint8 **pd, int *err, gchar **err_info)
 {
 	struct pcaprec_ss990915_hdr hdr;
 	guint packet_size;
@@ -688,14 +716,29 @@ libpcap_read_packet(wtap *wth, FILE_T fh, struct wtap_pkthdr *phdr,
 	phdr->len = orig_size;
 
 	/*
-	 * Read the packet data.
+	 * Read the packet data, or find it in the file's mapping if
+	 * it's not to be rewritten.
 	 */
-	if (!wtap_read_packet_bytes(fh, buf, packet_size, err, err_info))
-		return FALSE;	/* failed */
-
 	libpcap = (libpcap_t *)wth->priv;
+	if (batch != NULL) {
+		if (!wtap_batch_packet_bytes(batch, fh, packet_size,
+		    !pcap_read_post_process_writes(wth->file_encap,
+		    libpcap->byte_swapped), pd, err, err_info))
+			return FALSE;	/* failed */
+	} else if (pcap_read_post_process_writes(wth->file_encap,
+	    libpcap->byte_swapped)) {
+		if (!wtap_read_packet_bytes(fh, buf, packet_size, err,
+		    err_info))
+			return FALSE;	/* failed */
+		*pd = buffer_start_ptr(buf);
+	} else {
+		if (!wtap_map_packet_bytes(fh, buf, packet_size, pd, err,
+		    err_info))
+			return FALSE;	/* failed */
+	}
+
 	pcap_read_post_process(wth->file_type_subtype, wth->file_encap,
-	    phdr, buffer_start_ptr(buf), libpcap->byte_swapped, -1);
+	    phdr, *pd, libpcap->byte_swapped, -1);
 	return TRUE;
 }
 
@@ -40,6 +40,10 @@
 #endif
 
 #include <string.h>
+#include "wtap-int.h"
+#include "file_wrappers.h"
+#include <wsutil/buffer.h>
+#include <wsutil/file_util.h>
 #include "merge.h"
 
 /*
@@ -64,6 +68,7 @@ merge_open_in_files(int in_file_count, char *const *in_file_names,
     files[i].data_offset = 0;
     files[i].state       = PACKET_NOT_PRESENT;
     files[i].packet_num  = 0;
+    files[i].winner      = 0;
     if (!files[i].wth) {
       /* Close the files we've already opened. */
       for (j = 0; j < i; j++)
@@ -145,21 +150,71 @@ merge_max_snapshot_length(int count, merge_in_file_t in_files[])
 }
 
 /*
- * returns TRUE if first argument is earlier than second
+ * merge_read_packet() keeps the files in a tournament tree, so that
+ * finding the file with the earliest packet costs O(log in_file_count)
+ * rather than a scan of every file.  With n files, the tree has the
+ * leaves n..2n-1, leaf n+i standing for file i, and the internal nodes
+ * 1..n-1, node k having the children 2k and 2k+1; in_files[k].winner is
+ * the file that won node k.  Node 1 is the root, which is also the only
+ * leaf when there's just one file.  in_files[0].winner, which no node
+ * uses, is set once the tree has been built.
+ *
+ * Files without a packet present lose to every file with one.  Packets
+ * are ordered by time stamp, and packets with the same time stamp by
+ * descending file index, which is the order in which the scan that
+ * this replaced picked them.
  */
 static gboolean
-is_earlier(nstime_t *l, nstime_t *r) /* XXX, move to nstime.c */
+beats(merge_in_file_t in_files[], guint a, guint b)
 {
-  if (l->secs > r->secs) {  /* left is later */
+  nstime_t *ta, *tb;
+
+  if (in_files[a].state != PACKET_PRESENT)
     return FALSE;
-  } else if (l->secs < r->secs) { /* left is earlier */
+  if (in_files[b].state != PACKET_PRESENT)
     return TRUE;
-  } else if (l->nsecs > r->nsecs) { /* tv_sec equal, l.usec later */
-    return FALSE;
-  }
-  /* either one < two or one == two
-   * either way, return one
-   */
+  ta = &wtap_phdr(in_files[a].wth)->ts;
+  tb = &wtap_phdr(in_files[b].wth)->ts;
+  if (ta->secs != tb->secs)
+    return ta->secs < tb->secs;
+  if (ta->nsecs != tb->nsecs)
+    return ta->nsecs < tb->nsecs;
+  return a > b;
+}
+
+static guint
+node_winner(guint count, merge_in_file_t in_files[], guint node)
+{
+  return node >= count ? node - count : in_files[node].winner;
+}
+
+static void
+play_node(guint count, merge_in_file_t in_files[], guint node)
+{
+  guint l = node_winner(count, in_files, 2 * node);
+  guint r = node_winner(count, in_files, 2 * node + 1);
+
+  in_files[node].winner = beats(in_files, r, l) ? r : l;
+}
+
+/*
+ * If no packet is available from the file, and we haven't seen an error
+ * or EOF on it yet, try to read the next one.  Returns FALSE, with the
+ * file in GOT_ERROR state, on a read error.
+ */
+static gboolean
+fill_in_file(merge_in_file_t *in_file, int *err, gchar **err_info)
+{
+  if (in_file->state != PACKET_NOT_PRESENT)
+    return TRUE;
+  if (!wtap_read(in_file->wth, err, err_info, &in_file->data_offset)) {
+    if (*err != 0) {
+      in_file->state = GOT_ERROR;
+      return FALSE;
+    }
+    in_file->state = AT_EOF;
+  } else
+    in_file->state = PACKET_PRESENT;
   return TRUE;
 }
 
@@ -180,42 +235,41 @@ merge_in_file_t *
 merge_read_packet(int in_file_count, merge_in_file_t in_files[],
                   int *err, gchar **err_info)
 {
-  int i;
-  int ei = -1;
-  nstime_t tv = { sizeof(time_t) > sizeof(int) ? LONG_MAX : INT_MAX, INT_MAX };
-  struct wtap_pkthdr *phdr;
+  guint count = (guint)in_file_count;
+  guint i, node;
+  guint ei;
 
-  /*
-   * Make sure we have a packet available from each file, if there are any
-   * packets left in the file in question, and search for the packet
-   * with the earliest time stamp.
-   */
-  for (i = 0; i < in_file_count; i++) {
-    if (in_files[i].state == PACKET_NOT_PRESENT) {
-      /*
-       * No packet available, and we haven't seen an error or EOF yet,
-       * so try to read the next packet.
-       */
-      if (!wtap_read(in_files[i].wth, err, err_info, &in_files[i].data_offset)) {
-        if (*err != 0) {
-          in_files[i].state = GOT_ERROR;
-          return &in_files[i];
-        }
-        in_files[i].state = AT_EOF;
-      } else
-        in_files[i].state = PACKET_PRESENT;
-    }
+  if (count == 0) {
+    *err = 0;
+    return NULL;
+  }
 
-    if (in_files[i].state == PACKET_PRESENT) {
-      phdr = wtap_phdr(in_files[i].wth);
-      if (is_earlier(&phdr->ts, &tv)) {
-        tv = phdr->ts;
-        ei = i;
-      }
+  if (!in_files[0].winner) {
+    /*
+     * First call: read a packet from each file, then play every match
+     * of the tournament, bottom up.
+     */
+    for (i = 0; i < count; i++) {
+      if (!fill_in_file(&in_files[i], err, err_info))
+        return &in_files[i];
     }
+    for (node = count - 1; node >= 1; node--)
+      play_node(count, in_files, node);
+    in_files[0].winner = 1;
+  } else {
+    /*
+     * Only the file that won last time has moved on; read its next
+     * packet and replay the matches from its leaf up to the root.
+     */
+    ei = node_winner(count, in_files, 1);
+    if (!fill_in_file(&in_files[ei], err, err_info))
+      return &in_files[ei];
+    for (node = (count + ei) / 2; node >= 1; node /= 2)
+      play_node(count, in_files, node);
   }
 
-  if (ei == -1) {
+  ei = node_winner(count, in_files, 1);
+  if (in_files[ei].state != PACKET_PRESENT) {
     /* All the streams are at EOF.  Return an EOF indication. */
     *err = 0;
     return NULL;
@@ -283,3 +337,701 @@ merge_append_read_packet(int in_file_count, merge_in_file_t in_files[],
   *err = 0;
   return &in_files[i];
 }
+
+/*
+ * Merging more files than can be open at once.
+ *
+ * merge_open_in_files_in_runs() merges the files in groups of at most
+ * max_open into temporary "run" files, and the runs in groups of at
+ * most max_open into longer runs, until no more than max_open are left;
+ * those are handed back as the files to merge.  The groups are runs of
+ * consecutive files, so a packet's position in the merge is the same as
+ * it would have been if all the files had been merged at once, as long
+ * as each file is in time stamp order.
+ *
+ * A run file is a sequence of records, each a run_rec_hdr_t, the
+ * pseudo-header, the comment and the packet data, in host byte order;
+ * it's read back by this process only, through a wtap that isn't
+ * any of the registered file types.
+ */
+typedef struct {
+  guint32  rec_type;
+  guint32  presence_flags;
+  gint64   secs;
+  gint32   nsecs;
+  guint32  caplen;
+  guint32  len;
+  gint32   pkt_encap;
+  guint32  interface_id;
+  guint32  pack_flags;
+  guint64  drop_count;
+  guint32  comment_len;
+  guint32  pad;
+} run_rec_hdr_t;
+
+typedef struct {
+  char    *path;
+  int      encap;
+  int      snaplen;
+} merge_run_t;
+
+typedef struct {
+  char    *path;
+  gchar   *comment;
+  guint32  comment_size;
+} run_reader_t;
+
+#define RUN_WRITE_BUF_SIZE  (1024 * 1024)
+
+static gboolean
+run_read(wtap *wth, int *err, gchar **err_info, gint64 *data_offset)
+{
+  run_reader_t       *run = (run_reader_t *)wth->priv;
+  struct wtap_pkthdr *phdr = &wth->phdr;
+  run_rec_hdr_t       hdr;
+
+  *data_offset = file_tell(wth->fh);
+  wtap_file_read_expected_bytes(&hdr, sizeof hdr, wth->fh, err, err_info);
+  if (hdr.caplen > WTAP_MAX_PACKET_SIZE) {
+    *err = WTAP_ERR_BAD_FILE;
+    *err_info = g_strdup_printf("merge: run file has a %u-byte record", hdr.caplen);
+    return FALSE;
+  }
+  phdr->rec_type       = hdr.rec_type;
+  phdr->presence_flags = hdr.presence_flags;
+  phdr->ts.secs        = (time_t)hdr.secs;
+  phdr->ts.nsecs       = hdr.nsecs;
+  phdr->caplen         = hdr.caplen;
+  phdr->len            = hdr.len;
+  phdr->pkt_encap      = hdr.pkt_encap;
+  phdr->interface_id   = hdr.interface_id;
+  phdr->pack_flags     = hdr.pack_flags;
+  phdr->drop_count     = hdr.drop_count;
+  wtap_file_read_expected_bytes(&phdr->pseudo_header, sizeof phdr->pseudo_header,
+                                wth->fh, err, err_info);
+
+  phdr->opt_comment = NULL;
+  if (hdr.comment_len != 0) {
+    if (hdr.comment_len >= run->comment_size) {
+      run->comment_size = hdr.comment_len + 1;
+      run->comment = (gchar *)g_realloc(run->comment, run->comment_size);
+    }
+    wtap_file_read_expected_bytes(run->comment, hdr.comment_len, wth->fh, err, err_info);
+    run->comment[hdr.comment_len] = '\0';
+    phdr->opt_comment = run->comment;
+  }
+
+  return wtap_map_packet_bytes(wth->fh, wth->frame_buffer, hdr.caplen,
+                               &wth->pkt_data, err, err_info);
+}
+
+static void
+run_close(wtap *wth)
+{
+  run_reader_t *run = (run_reader_t *)wth->priv;
+
+  /* wtap_close() has already closed the file. */
+  ws_unlink(run->path);
+  g_free(run->path);
+  g_free(run->comment);
+}
+
+/*
+ * Open a run for reading.  The wtap takes over the run's path, and removes
+ * the file when it's closed.
+ */
+static wtap *
+run_open(merge_run_t *mrun, int *err)
+{
+  wtap         *wth;
+  run_reader_t *run;
+
+  wth = (wtap *)g_malloc0(sizeof(wtap));
+  wth->fh = file_open(mrun->path);
+  if (wth->fh == NULL) {
+    *err = errno;
+    g_free(wth);
+    return NULL;
+  }
+  run = (run_reader_t *)g_malloc0(sizeof(run_reader_t));
+  run->path = mrun->path;
+  mrun->path = NULL;
+  wth->priv = run;
+  wth->file_type_subtype = WTAP_FILE_TYPE_SUBTYPE_UNKNOWN;
+  wth->file_encap = mrun->encap;
+  wth->snapshot_length = mrun->snaplen;
+  wth->tsprecision = WTAP_FILE_TSPREC_NSEC;
+  wth->packet_count = -1;
+  wth->subtype_read = run_read;
+  wth->subtype_close = run_close;
+  wth->interface_data = g_array_new(FALSE, FALSE, sizeof(wtapng_if_descr_t));
+  wth->frame_buffer = (struct Buffer *)g_malloc(sizeof(struct Buffer));
+  buffer_init(wth->frame_buffer, 1500);
+  return wth;
+}
+
+static gboolean
+run_write(FILE *fp, const struct wtap_pkthdr *phdr, const guint8 *pd,
+          int *err, gchar **err_info)
+{
+  run_rec_hdr_t hdr;
+
+  /*
+   * These pseudo-headers point into the state of the file the packet
+   * was read from, which will have been closed by the time the run is
+   * read.
+   */
+  if (phdr->pkt_encap == WTAP_ENCAP_K12 ||
+      phdr->pkt_encap == WTAP_ENCAP_CATAPULT_DCT2000) {
+    *err = WTAP_ERR_UNSUPPORTED_ENCAP;
+    *err_info = g_strdup_printf("merge: %s packets can't be merged in runs",
+                                wtap_encap_string(phdr->pkt_encap));
+    return FALSE;
+  }
+
+  memset(&hdr, 0, sizeof hdr);
+  hdr.rec_type       = phdr->rec_type;
+  hdr.presence_flags = phdr->presence_flags;
+  hdr.secs           = (gint64)phdr->ts.secs;
+  hdr.nsecs          = phdr->ts.nsecs;
+  hdr.caplen         = phdr->caplen;
+  hdr.len            = phdr->len;
+  hdr.pkt_encap      = phdr->pkt_encap;
+  hdr.interface_id   = phdr->interface_id;
+  hdr.pack_flags     = phdr->pack_flags;
+  hdr.drop_count     = phdr->drop_count;
+  if (phdr->opt_comment != NULL)
+    hdr.comment_len  = (guint32)strlen(phdr->opt_comment);
+
+  if (fwrite(&hdr, sizeof hdr, 1, fp) != 1 ||
+      fwrite(&phdr->pseudo_header, sizeof phdr->pseudo_header, 1, fp) != 1 ||
+      (hdr.comment_len != 0 && fwrite(phdr->opt_comment, hdr.comment_len, 1, fp) != 1) ||
+      (phdr->caplen != 0 && fwrite(pd, phdr->caplen, 1, fp) != 1)) {
+    *err = errno;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/*
+ * Create an empty run in tmpdir, open for writing.
+ */
+static FILE *
+run_create(const char *tmpdir, merge_run_t *run, int *err)
+{
+  FILE *fp;
+  int   fd;
+
+  run->path = g_strdup_printf("%s" G_DIR_SEPARATOR_S "mergecap_run_XXXXXX", tmpdir);
+  fd = g_mkstemp(run->path);
+  if (fd == -1) {
+    *err = errno;
+    g_free(run->path);
+    run->path = NULL;
+    return NULL;
+  }
+  fp = ws_fdopen(fd, "wb");
+  if (fp == NULL) {
+    *err = errno;
+    ws_close(fd);
+    ws_unlink(run->path);
+    g_free(run->path);
+    run->path = NULL;
+    return NULL;
+  }
+  setvbuf(fp, NULL, _IOFBF, RUN_WRITE_BUF_SIZE);
+  return fp;
+}
+
+/*
+ * Merge, or append, count files into a new run in tmpdir.  On a read
+ * error, *err_in_file is set to the index of the file; on an error with
+ * the run file, to -1.
+ */
+static gboolean
+merge_to_run(int count, merge_in_file_t files[], gboolean do_append,
+             const char *tmpdir, merge_run_t *run, int *err, gchar **err_info,
+             int *err_in_file)
+{
+  merge_in_file_t *in_file;
+  FILE            *fp;
+
+  *err_in_file = -1;
+  run->encap = merge_select_frame_type(count, files);
+  run->snaplen = merge_max_snapshot_length(count, files);
+  fp = run_create(tmpdir, run, err);
+  if (fp == NULL)
+    return FALSE;
+
+  for (;;) {
+    if (do_append)
+      in_file = merge_append_read_packet(count, files, err, err_info);
+    else
+      in_file = merge_read_packet(count, files, err, err_info);
+    if (in_file == NULL)
+      break;
+    if (*err != 0) {
+      *err_in_file = (int)(in_file - files);
+      fclose(fp);
+      goto fail;
+    }
+    if (!run_write(fp, wtap_phdr(in_file->wth), wtap_buf_ptr(in_file->wth),
+                   err, err_info)) {
+      fclose(fp);
+      goto fail;
+    }
+  }
+
+  if (fclose(fp) != 0) {
+    *err = errno;
+    goto fail;
+  }
+  return TRUE;
+
+fail:
+  ws_unlink(run->path);
+  g_free(run->path);
+  run->path = NULL;
+  return FALSE;
+}
+
+/*
+ * Open runs as merge input files.  The runs that are opened are no
+ * longer the caller's to remove, even on failure.
+ */
+static gboolean
+open_runs(int count, merge_run_t runs[], merge_in_file_t **in_files, int *err)
+{
+  merge_in_file_t *files;
+  int              i, j;
+  gint64           size;
+
+  files = g_new(merge_in_file_t, count);
+  *in_files = files;
+  for (i = 0; i < count; i++) {
+    files[i].wth          = run_open(&runs[i], err);
+    files[i].data_offset  = 0;
+    files[i].state        = PACKET_NOT_PRESENT;
+    files[i].packet_num   = 0;
+    files[i].interface_id = 0;
+    files[i].winner       = 0;
+    if (files[i].wth == NULL) {
+      for (j = 0; j < i; j++)
+        wtap_close(files[j].wth);
+      return FALSE;
+    }
+    files[i].filename     = ((run_reader_t *)files[i].wth->priv)->path;
+    size = wtap_file_size(files[i].wth, err);
+    if (size == -1) {
+      for (j = 0; j <= i; j++)
+        wtap_close(files[j].wth);
+      return FALSE;
+    }
+    files[i].size = size;
+  }
+  return TRUE;
+}
+
+static void
+remove_runs(int count, merge_run_t runs[])
+{
+  int i;
+
+  for (i = 0; i < count; i++) {
+    if (runs[i].path != NULL) {
+      ws_unlink(runs[i].path);
+      g_free(runs[i].path);
+    }
+  }
+  g_free(runs);
+}
+
+/*
+ * Split count files into groups of at most max_open; the groups are
+ * spread evenly, rather than leaving a short last one.  Returns the
+ * number of groups.
+ */
+static int
+plan_groups(int count, int max_open, int *group_size)
+{
+  int ngroups = (count + max_open - 1) / max_open;
+
+  *group_size = (count + ngroups - 1) / ngroups;
+  return ngroups;
+}
+
+/*
+ * Merge runs in groups into longer runs until no more than max_open are
+ * left.  On failure, all of the runs are removed.
+ */
+static gboolean
+reduce_runs(int *count, merge_run_t **runs, int max_open, const char *tmpdir,
+            gboolean do_append, int *err, gchar **err_info)
+{
+  int              ngroups, group_size, start, n, g, err_in_file;
+  merge_run_t     *new_runs;
+  merge_in_file_t *files;
+  gboolean         ok;
+
+  while (*count > max_open) {
+    ngroups = plan_groups(*count, max_open, &group_size);
+    new_runs = g_new0(merge_run_t, ngroups);
+    for (g = 0, start = 0; start < *count; g++, start += n) {
+      n = MIN(group_size, *count - start);
+      ok = open_runs(n, &(*runs)[start], &files, err);
+      if (ok) {
+        ok = merge_to_run(n, files, do_append, tmpdir, &new_runs[g], err,
+                          err_info, &err_in_file);
+        merge_close_in_files(n, files);
+      }
+      g_free(files);
+      if (!ok) {
+        remove_runs(*count, *runs);
+        remove_runs(ngroups, new_runs);
+        *runs = NULL;
+        return FALSE;
+      }
+    }
+    g_free(*runs);
+    *runs = new_runs;
+    *count = ngroups;
+  }
+  return TRUE;
+}
+
+gboolean
+merge_open_in_files_in_runs(int *in_file_count, char *const *in_file_names,
+                            int max_open, const char *tmpdir,
+                            gboolean do_append, merge_in_file_t **in_files,
+                            int *err, gchar **err_info, int *err_fileno)
+{
+  int              count = *in_file_count;
+  int              ngroups, group_size, start, n, g, err_in_file;
+  merge_run_t     *runs;
+  merge_in_file_t *files;
+  gboolean         ok;
+
+  if (max_open < 2 || count <= max_open)
+    return merge_open_in_files(count, in_file_names, in_files, err,
+                               err_info, err_fileno);
+  if (tmpdir == NULL)
+    tmpdir = g_get_tmp_dir();
+
+  *err_fileno = -1;
+  *in_files = NULL;
+
+  /* Merge the files into runs, and then the runs into fewer. */
+  ngroups = plan_groups(count, max_open, &group_size);
+  runs = g_new0(merge_run_t, ngroups);
+  for (g = 0, start = 0; start < count; g++, start += n) {
+    n = MIN(group_size, count - start);
+    ok = merge_open_in_files(n, &in_file_names[start], &files, err,
+                             err_info, &err_in_file);
+    if (!ok)
+      *err_fileno = start + err_in_file;
+    else {
+      ok = merge_to_run(n, files, do_append, tmpdir, &runs[g], err,
+                        err_info, &err_in_file);
+      if (!ok && err_in_file != -1)
+        *err_fileno = start + err_in_file;
+      merge_close_in_files(n, files);
+    }
+    g_free(files);
+    if (!ok) {
+      remove_runs(ngroups, runs);
+      return FALSE;
+    }
+  }
+  count = ngroups;
+  if (!reduce_runs(&count, &runs, max_open, tmpdir, do_append, err, err_info))
+    return FALSE;
+
+  ok = open_runs(count, runs, in_files, err);
+  remove_runs(count, runs);
+  *in_file_count = count;
+  return ok;
+}
+
+/*
+ * Runs written by the caller, for sorting more packets than fit in
+ * memory: each run is a sorted batch of them, and the runs are merged.
+ */
+struct merge_runs_s {
+  char        *tmpdir;
+  int          encap;
+  int          snaplen;
+  GArray      *runs;            /* of merge_run_t, in the order written */
+  merge_run_t  cur;             /* the run being written, if fp != NULL */
+  FILE        *fp;
+};
+
+merge_runs_t *
+merge_runs_new(const char *tmpdir, int encap, int snaplen)
+{
+  merge_runs_t *mruns = g_new0(merge_runs_t, 1);
+
+  mruns->tmpdir = g_strdup(tmpdir != NULL ? tmpdir : g_get_tmp_dir());
+  mruns->encap = encap;
+  mruns->snaplen = snaplen;
+  mruns->runs = g_array_new(FALSE, FALSE, sizeof(merge_run_t));
+  return mruns;
+}
+
+gboolean
+merge_runs_start(merge_runs_t *mruns, int *err)
+{
+  mruns->cur.encap = mruns->encap;
+  mruns->cur.snaplen = mruns->snaplen;
+  mruns->fp = run_create(mruns->tmpdir, &mruns->cur, err);
+  return mruns->fp != NULL;
+}
+
+gboolean
+merge_runs_write(merge_runs_t *mruns, const struct wtap_pkthdr *phdr,
+                 const guint8 *pd, int *err, gchar **err_info)
+{
+  return run_write(mruns->fp, phdr, pd, err, err_info);
+}
+
+gboolean
+merge_runs_end(merge_runs_t *mruns, int *err)
+{
+  int ret = fclose(mruns->fp);
+
+  mruns->fp = NULL;
+  if (ret != 0) {
+    *err = errno;
+    ws_unlink(mruns->cur.path);
+    g_free(mruns->cur.path);
+    return FALSE;
+  }
+  g_array_append_val(mruns->runs, mruns->cur);
+  return TRUE;
+}
+
+gboolean
+merge_runs_open(merge_runs_t *mruns, int max_open, int *in_file_count,
+                merge_in_file_t **in_files, int *err, gchar **err_info)
+{
+  int          count = (int)mruns->runs->len;
+  merge_run_t *runs;
+  int          i;
+  gboolean     ok;
+
+  /*
+   * merge_read_packet() takes the file with the higher index first on a
+   * tie, so put the runs in reverse order for the earlier run to win.
+   */
+  runs = g_new(merge_run_t, count);
+  for (i = 0; i < count; i++)
+    runs[i] = g_array_index(mruns->runs, merge_run_t, count - 1 - i);
+  g_array_set_size(mruns->runs, 0);
+
+  *in_files = NULL;
+  if (max_open >= 2 &&
+      !reduce_runs(&count, &runs, max_open, mruns->tmpdir, FALSE, err, err_info))
+    return FALSE;
+  ok = open_runs(count, runs, in_files, err);
+  remove_runs(count, runs);
+  *in_file_count = count;
+  return ok;
+}
+
+void
+merge_runs_free(merge_runs_t *mruns)
+{
+  guint        i;
+  merge_run_t *run;
+
+  if (mruns->fp != NULL) {
+    fclose(mruns->fp);
+    ws_unlink(mruns->cur.path);
+    g_free(mruns->cur.path);
+  }
+  for (i = 0; i < mruns->runs->len; i++) {
+    run = &g_array_index(mruns->runs, merge_run_t, i);
+    ws_unlink(run->path);
+    g_free(run->path);
+  }
+  g_array_free(mruns->runs, TRUE);
+  g_free(mruns->tmpdir);
+  g_free(mruns);
+}
+
+/*
+ * Read-ahead.
+ *
+ * merge_prefetch_in_files() gives each input file a thread that reads
+ * packets ahead, in batches, into a small ring, so that decompression
+ * and I/O for all the files can go on while the merge thread compares
+ * time stamps and writes.  The file's wtap is swapped for one that
+ * hands out the packets of the ring; it's not one of the registered
+ * file types either.
+ *
+ * K12 and DCT2000 files are left alone: the pseudo-headers of their
+ * packets point into the state of the file, which the thread would
+ * change while the merge is still writing the packets it handed out
+ * (see run_write()).
+ */
+#define PREFETCH_BATCHES         4
+#define PREFETCH_BATCH_RECORDS   64
+#define PREFETCH_BATCH_BYTES     (64 * 1024)
+
+typedef struct {
+  wtap_batch        *records;
+  gboolean           eof;               /* last batch, with no records; err is the reason */
+  int                err;
+  gchar             *err_info;
+} prefetch_batch_t;
+
+typedef struct {
+  wtap              *src;
+  GThread           *thread;
+  GAsyncQueue       *free_q;            /* batches for the thread to fill */
+  GAsyncQueue       *full_q;            /* batches for the merge to read */
+  volatile gint      stop;
+  prefetch_batch_t  *cur;
+  guint              cur_rec;
+  prefetch_batch_t   batches[PREFETCH_BATCHES];
+} prefetch_t;
+
+static gpointer
+prefetch_thread(gpointer data)
+{
+  prefetch_t         *pf = (prefetch_t *)data;
+  prefetch_batch_t   *batch;
+
+  do {
+    batch = (prefetch_batch_t *)g_async_queue_pop(pf->free_q);
+    if (g_atomic_int_get(&pf->stop))
+      break;
+
+    if (!wtap_read_batch(pf->src, batch->records, PREFETCH_BATCH_RECORDS,
+                         &batch->err, &batch->err_info))
+      batch->eof = TRUE;
+    g_async_queue_push(pf->full_q, batch);
+  } while (!batch->eof);
+
+  return NULL;
+}
+
+static gboolean
+prefetch_read(wtap *wth, int *err, gchar **err_info, gint64 *data_offset)
+{
+  prefetch_t     *pf = (prefetch_t *)wth->priv;
+  wtap_batch     *records;
+  guint           i;
+
+  while (pf->cur == NULL || pf->cur_rec == pf->cur->records->count) {
+    if (pf->cur != NULL) {
+      if (pf->cur->eof) {
+        /* The thread is done with the file, so wtap_read() may look at it. */
+        *err = pf->cur->err;
+        *err_info = pf->cur->err_info;
+        pf->cur->err_info = NULL;
+        return FALSE;
+      }
+      g_async_queue_push(pf->free_q, pf->cur);
+    }
+    pf->cur = (prefetch_batch_t *)g_async_queue_pop(pf->full_q);
+    pf->cur_rec = 0;
+  }
+
+  /*
+   * The data stays where the batch has it; the batch only goes back to
+   * the thread once a later read has moved past it.
+   */
+  records = pf->cur->records;
+  i = pf->cur_rec++;
+  wth->phdr = records->phdrs[i];
+  wth->pkt_data = (guint8 *)records->data[i];
+  *data_offset = records->offsets[i];
+  return TRUE;
+}
+
+static void
+prefetch_sequential_close(wtap *wth)
+{
+  prefetch_t *pf = (prefetch_t *)wth->priv;
+
+  if (pf->thread != NULL) {
+    /* Wake the thread if it's waiting for a batch to fill. */
+    g_atomic_int_set(&pf->stop, 1);
+    g_async_queue_push(pf->free_q, &pf->batches[0]);
+    g_thread_join(pf->thread);
+    pf->thread = NULL;
+  }
+  /* The file is the source's, closed with it. */
+  wth->fh = NULL;
+}
+
+static void
+prefetch_close(wtap *wth)
+{
+  prefetch_t *pf = (prefetch_t *)wth->priv;
+  int         i;
+
+  wtap_close(pf->src);
+  g_async_queue_unref(pf->free_q);
+  g_async_queue_unref(pf->full_q);
+  for (i = 0; i < PREFETCH_BATCHES; i++) {
+    wtap_batch_free(pf->batches[i].records);
+    g_free(pf->batches[i].err_info);
+  }
+}
+
+void
+merge_prefetch_in_files(int in_file_count, merge_in_file_t in_files[])
+{
+  wtap       *src, *wth;
+  prefetch_t *pf;
+  int         i, j;
+
+#if !GLIB_CHECK_VERSION(2,31,0)
+  if (!g_thread_supported())
+    g_thread_init(NULL);
+#endif
+
+  for (i = 0; i < in_file_count; i++) {
+    src = in_files[i].wth;
+    if (src->file_encap == WTAP_ENCAP_K12 ||
+        src->file_encap == WTAP_ENCAP_CATAPULT_DCT2000)
+      continue;
+
+    pf = g_new0(prefetch_t, 1);
+    pf->src = src;
+    pf->free_q = g_async_queue_new();
+    pf->full_q = g_async_queue_new();
+    for (j = 0; j < PREFETCH_BATCHES; j++) {
+      pf->batches[j].records = wtap_batch_new(PREFETCH_BATCH_RECORDS,
+                                              PREFETCH_BATCH_BYTES);
+      g_async_queue_push(pf->free_q, &pf->batches[j]);
+    }
+
+    wth = (wtap *)g_malloc0(sizeof(wtap));
+    /*
+     * wtap_read() looks at the file for a deferred error at EOF, and
+     * wtap_file_size() looks at its size.
+     */
+    wth->fh = src->fh;
+    wth->priv = pf;
+    wth->file_type_subtype = src->file_type_subtype;
+    wth->file_encap = src->file_encap;
+    wth->snapshot_length = src->snapshot_length;
+    wth->tsprecision = src->tsprecision;
+    wth->packet_count = src->packet_count;
+    wth->subtype_read = prefetch_read;
+    wth->subtype_sequential_close = prefetch_sequential_close;
+    wth->subtype_close = prefetch_close;
+    wth->interface_data = g_array_new(FALSE, FALSE, sizeof(wtapng_if_descr_t));
+    wth->frame_buffer = (struct Buffer *)g_malloc(sizeof(struct Buffer));
+    buffer_init(wth->frame_buffer, 1500);
+    in_files[i].wth = wth;
+
+#if GLIB_CHECK_VERSION(2,31,0)
+    pf->thread = g_thread_new("merge read-ahead", prefetch_thread, pf);
+#else
+    pf->thread = g_thread_create(prefetch_thread, pf, TRUE, NULL);
+#endif
+  }
+}
@@ -48,6 +48,8 @@ typedef struct merge_in_file_s {
   gint64          size;		      /* file size */
   guint32         interface_id;   /* identifier of the interface.
 								   * Used for fake interfaces when writing WTAP_ENCAP_PER_PACKET */
+  guint           winner;         /* merge_read_packet() tournament tree
+                                   * node; see merge.c */
 } merge_in_file_t;
 
 /** Open a number of input files to merge.
@@ -65,6 +67,124 @@ merge_open_in_files(int in_file_count, char *const *in_file_names,
                     merge_in_file_t **in_files, int *err, gchar **err_info,
                     int *err_fileno);
 
+/** Open a number of input files to merge, with no more than max_open of
+ * them open at a time.  If there are more than max_open files, they're
+ * merged (or, if do_append is set, appended) in groups of consecutive
+ * files into temporary files in tmpdir, and those in groups into longer
+ * ones, until no more than max_open are left; in_files and in_file_count
+ * are set to those, which are removed when they're closed.  Packets come
+ * out of the merge in the same order as they would have otherwise, as
+ * long as each input file is in time stamp order.
+ *
+ * @param in_file_count [in,out] number of entries in in_file_names; set
+ * to the number of entries in in_files
+ * @param in_file_names filenames of the input files
+ * @param max_open most files to open at once (at least 2); one more is
+ * open while writing a temporary file
+ * @param tmpdir directory for the temporary files, or NULL for the
+ * system's temporary directory
+ * @param do_append TRUE if the files are to be appended, not merged
+ * @param in_files input file array to be allocated and filled
+ * @param err wiretap error, if failed
+ * @param err_info wiretap error string, if failed
+ * @param err_fileno entry in in_file_names on which opening or reading
+ * failed, or -1 if the failure was with a temporary file
+ * @return TRUE if the files could be opened, FALSE otherwise
+ */
+WS_DLL_PUBLIC gboolean
+merge_open_in_files_in_runs(int *in_file_count, char *const *in_file_names,
+                            int max_open, const char *tmpdir,
+                            gboolean do_append, merge_in_file_t **in_files,
+                            int *err, gchar **err_info, int *err_fileno);
+
+/** A set of temporary files of packets, each in time stamp order, to be
+ * merged; for sorting more packets than fit in memory. */
+typedef struct merge_runs_s merge_runs_t;
+
+/** Create an empty set of runs.
+ *
+ * @param tmpdir directory for the run files, or NULL for the system's
+ * temporary directory
+ * @param encap encapsulation type of the runs, as for wtap_file_encap()
+ * @param snaplen snapshot length of the runs
+ * @return the set of runs
+ */
+WS_DLL_PUBLIC merge_runs_t *
+merge_runs_new(const char *tmpdir, int encap, int snaplen);
+
+/** Start writing a new run.
+ *
+ * @param mruns set of runs
+ * @param err error, if failed
+ * @return TRUE if the run file could be created, FALSE otherwise
+ */
+WS_DLL_PUBLIC gboolean
+merge_runs_start(merge_runs_t *mruns, int *err);
+
+/** Add a packet to the run being written; packets must be added in time
+ * stamp order.  Packets of WTAP_ENCAP_K12 and WTAP_ENCAP_CATAPULT_DCT2000,
+ * whose pseudo-headers refer to the state of the file they were read
+ * from, are refused with WTAP_ERR_UNSUPPORTED_ENCAP.
+ *
+ * @param mruns set of runs
+ * @param phdr packet header
+ * @param pd packet data
+ * @param err error, if failed
+ * @param err_info error string, if failed
+ * @return TRUE if the packet was written, FALSE otherwise
+ */
+WS_DLL_PUBLIC gboolean
+merge_runs_write(merge_runs_t *mruns, const struct wtap_pkthdr *phdr,
+                 const guint8 *pd, int *err, gchar **err_info);
+
+/** Finish writing the current run.
+ *
+ * @param mruns set of runs
+ * @param err error, if failed
+ * @return TRUE if the run was written, FALSE (and the run dropped) otherwise
+ */
+WS_DLL_PUBLIC gboolean
+merge_runs_end(merge_runs_t *mruns, int *err);
+
+/** Open the runs written so far as files to merge with merge_read_packet(),
+ * first merging them in groups if there are more than max_open.  Packets
+ * with the same time stamp come out in the order in which they were
+ * written.  The runs are removed when the files are closed, and the set
+ * is left empty.
+ *
+ * @param mruns set of runs
+ * @param max_open most runs to open at once (at least 2), or 0 for no limit
+ * @param in_file_count set to the number of entries in in_files
+ * @param in_files input file array to be allocated and filled
+ * @param err error, if failed
+ * @param err_info error string, if failed
+ * @return TRUE if the runs could be opened, FALSE otherwise
+ */
+WS_DLL_PUBLIC gboolean
+merge_runs_open(merge_runs_t *mruns, int max_open, int *in_file_count,
+                merge_in_file_t **in_files, int *err, gchar **err_info);
+
+/** Free a set of runs, removing any run files that haven't been opened.
+ *
+ * @param mruns set of runs
+ */
+WS_DLL_PUBLIC void
+merge_runs_free(merge_runs_t *mruns);
+
+/** Read each of the input files ahead on a thread of its own, so that
+ * reading and decompressing them is spread over several cores rather
+ * than done in turn by the merge.  Call it after opening the files and
+ * before reading any packets; the files are closed, and the threads
+ * stopped, by merge_close_in_files().  The packets read and their order
+ * are unchanged.  K12 and Catapult DCT2000 files, whose packets depend
+ * on the state of the file, are still read by the merge.
+ *
+ * @param in_file_count number of entries in in_files
+ * @param in_files input file array
+ */
+WS_DLL_PUBLIC void
+merge_prefetch_in_files(int in_file_count, merge_in_file_t in_files[]);
+
 /** Close the input files again.
  *
  * @param in_file_count number of entries in in_files
@@ -92,7 +212,9 @@ WS_DLL_PUBLIC int
 merge_max_snapshot_length(int in_file_count, merge_in_file_t in_files[]);
 
 /** Read the next packet, in chronological order, from the set of files to
- * be merged.
+ * be merged.  Packets with the same time stamp come from the file with the
+ * higher index first.  in_files must have been filled by
+ * merge_open_in_files(), and not been read with merge_append_read_packet().
  *
  * @param in_file_count number of entries in in_files
  * @param in_files input file array
@@ -60,6 +60,9 @@ static gboolean
 pcapng_read(wtap *wth, int *err, gchar **err_info,
     gint64 *data_offset);
 static gboolean
+pcapng_read_batch(wtap *wth, wtap_batch *batch, guint n, int *err,
+    gchar **err_info);
+static gboolean
 pcapng_seek_read(wtap *wth, gint64 seek_off,
     struct wtap_pkthdr *phdr, Buffer *buf, int *err, gchar **err_info);
 static void
@@ -355,6 +358,9 @@ typedef struct wtapng_block_s {
          */
         struct wtap_pkthdr *packet_header;
         Buffer *frame_buffer;
+        guint8 **pkt_data;      /* set to the packet data if it's not in frame_buffer; may be NULL */
+        wtap_batch *batch;      /* if not NULL, the packet data goes here instead */
+        guint8 *batch_pd;       /* ...and this is set to point to it */
         int *file_encap;
 } wtapng_block_t;
 
@@ -978,6 +984,39 @@ pcapng_read_if_descr_block(FILE_T fh, pcapng_block_header_t *bh, pcapng_t *pn,
 }
 
 
+/*
+ * Read the data of a packet block into wblock->frame_buffer, or, if the
+ * file is mapped into memory and the data won't be rewritten, point
+ * *wblock->pkt_data at it there; either way, set *pd to point to it.
+ * If wblock->batch is set, the data goes there instead.
+ */
+static gboolean
+pcapng_read_packet_data(FILE_T fh, pcapng_t *pn, wtapng_block_t *wblock,
+    int wtap_encap, guint length, guint8 **pd, int *err, gchar **err_info)
+{
+        if (wblock->batch != NULL) {
+                if (!wtap_batch_packet_bytes(wblock->batch, fh, length,
+                    !pcap_read_post_process_writes(wtap_encap, pn->byte_swapped),
+                    pd, err, err_info))
+                        return FALSE;
+                wblock->batch_pd = *pd;
+                return TRUE;
+        }
+        if (wblock->pkt_data != NULL &&
+            !pcap_read_post_process_writes(wtap_encap, pn->byte_swapped)) {
+                if (!wtap_map_packet_bytes(fh, wblock->frame_buffer, length,
+                    pd, err, err_info))
+                        return FALSE;
+                *wblock->pkt_data = *pd;
+                return TRUE;
+        }
+        if (!wtap_read_packet_bytes(fh, wblock->frame_buffer, length, err,
+            err_info))
+                return FALSE;
+        *pd = buffer_start_ptr(wblock->frame_buffer);
+        return TRUE;
+}
+
 static int
 pcapng_read_packet_block(FILE_T fh, pcapng_block_header_t *bh, pcapng_t *pn, wtapng_block_t *wblock, int *err, gchar **err_info, gboolean enhanced)
 {
@@ -996,6 +1035,7 @@ pcapng_read_packet_block(FILE_T fh, pcapng_block_header_t *bh, pcapng_t *pn, wta
         int pseudo_header_len;
         char *option_content = NULL; /* Allocate as large as the options block */
         int fcslen;
+        guint8 *pd;
 
         /* Don't try to allocate memory for a huge number of options, as
            that might fail and, even if it succeeds, it might not leave
@@ -1193,8 +1233,8 @@ pcapng_read_packet_block(FILE_T fh, pcapng_block_header_t *bh, pcapng_t *pn, wta
 
         /* "(Enhanced) Packet Block" read capture data */
         errno = WTAP_ERR_CANT_READ;
-	if (!wtap_read_packet_bytes(fh, wblock->frame_buffer,
-	    packet.cap_len - pseudo_header_len, err, err_info))
+	if (!pcapng_read_packet_data(fh, pn, wblock, iface_info.wtap_encap,
+	    packet.cap_len - pseudo_header_len, &pd, err, err_info))
 		return 0;
         block_read += packet.cap_len - pseudo_header_len;
 
@@ -1311,8 +1351,7 @@ pcapng_read_packet_block(FILE_T fh, pcapng_block_header_t *bh, pcapng_t *pn, wta
         g_free(option_content);
 
         pcap_read_post_process(WTAP_FILE_TYPE_SUBTYPE_PCAPNG, iface_info.wtap_encap,
-            wblock->packet_header, buffer_start_ptr(wblock->frame_buffer),
-            pn->byte_swapped, fcslen);
+            wblock->packet_header, pd, pn->byte_swapped, fcslen);
         return block_read;
 }
 
@@ -1329,6 +1368,7 @@ pcapng_read_simple_packet_block(FILE_T fh, pcapng_block_header_t *bh, pcapng_t *
         guint32 block_total_length;
         guint32 padding;
         int pseudo_header_len;
+        guint8 *pd;
 
         /*
          * Is this block long enough to be an SPB?
@@ -1471,8 +1511,8 @@ pcapng_read_simple_packet_block(FILE_T fh, pcapng_block_header_t *bh, pcapng_t *
 
         /* "Simple Packet Block" read capture data */
         errno = WTAP_ERR_CANT_READ;
-	if (!wtap_read_packet_bytes(fh, wblock->frame_buffer,
-	    simple_packet.cap_len, err, err_info))
+	if (!pcapng_read_packet_data(fh, pn, wblock, iface_info.wtap_encap,
+	    simple_packet.cap_len, &pd, err, err_info))
 		return 0;
         block_read += simple_packet.cap_len;
 
@@ -1488,8 +1528,7 @@ pcapng_read_simple_packet_block(FILE_T fh, pcapng_block_header_t *bh, pcapng_t *
         }
 
         pcap_read_post_process(WTAP_FILE_TYPE_SUBTYPE_PCAPNG, iface_info.wtap_encap,
-            wblock->packet_header, buffer_start_ptr(wblock->frame_buffer),
-            pn->byte_swapped, pn->if_fcslen);
+            wblock->packet_header, pd, pn->byte_swapped, pn->if_fcslen);
         return block_read;
 }
 
@@ -2222,6 +2261,8 @@ pcapng_open(wtap *wth, int *err, gchar **err_info)
 
         /* we don't expect any packet blocks yet */
         wblock.frame_buffer = NULL;
+        wblock.pkt_data = NULL;
+        wblock.batch = NULL;
         wblock.packet_header = NULL;
         wblock.file_encap = &wth->file_encap;
 
@@ -2269,6 +2310,7 @@ pcapng_open(wtap *wth, int *err, gchar **err_info)
 
         wth->subtype_read = pcapng_read;
         wth->subtype_seek_read = pcapng_seek_read;
+        wth->subtype_read_batch = pcapng_read_batch;
         wth->subtype_close = pcapng_close;
         wth->file_type_subtype = WTAP_FILE_TYPE_SUBTYPE_PCAPNG;
 
@@ -2323,40 +2365,36 @@ pcapng_open(wtap *wth, int *err, gchar **err_info)
 }
 
 
-/* classic wtap: read packet */
+/*
+ * Read blocks up to and including the next packet block, into wblock,
+ * which says where the packet goes.
+ */
 static gboolean
-pcapng_read(wtap *wth, int *err, gchar **err_info, gint64 *data_offset)
+pcapng_read_packet(wtap *wth, wtapng_block_t *wblock, int *err,
+    gchar **err_info, gint64 *data_offset)
 {
         pcapng_t *pcapng = (pcapng_t *)wth->priv;
         int bytes_read;
-        wtapng_block_t wblock;
         wtapng_if_descr_t *wtapng_if_descr;
         wtapng_if_stats_t if_stats;
 
         *data_offset = file_tell(wth->fh);
         pcapng_debug1("pcapng_read: data_offset is initially %" G_GINT64_MODIFIER "d", *data_offset);
 
-        wblock.frame_buffer  = wth->frame_buffer;
-        wblock.packet_header = &wth->phdr;
-        wblock.file_encap    = &wth->file_encap;
-
-        pcapng->add_new_ipv4 = wth->add_new_ipv4;
-        pcapng->add_new_ipv6 = wth->add_new_ipv6;
-
         /* read next block */
         while (1) {
-                bytes_read = pcapng_read_block(wth->fh, FALSE, pcapng, &wblock, err, err_info);
+                bytes_read = pcapng_read_block(wth->fh, FALSE, pcapng, wblock, err, err_info);
                 if (bytes_read <= 0) {
                         pcapng_debug1("pcapng_read: data_offset is finally %" G_GINT64_MODIFIER "d", *data_offset);
                         pcapng_debug0("pcapng_read: couldn't read packet block");
                         return FALSE;
                 }
 
-                switch (wblock.type) {
+                switch (wblock->type) {
 
                 case(BLOCK_TYPE_SHB):
                         /* We don't currently support multi-section files. */
-                        wth->phdr.pkt_encap = WTAP_ENCAP_UNKNOWN;
+                        wblock->packet_header->pkt_encap = WTAP_ENCAP_UNKNOWN;
                         *err = WTAP_ERR_UNSUPPORTED;
                         *err_info = g_strdup_printf("pcapng: multi-section files not currently supported");
                         return FALSE;
@@ -2371,7 +2409,7 @@ pcapng_read(wtap *wth, int *err, gchar **err_info, gint64 *data_offset)
                         /* A new interface */
                         pcapng_debug0("pcapng_read: block type BLOCK_TYPE_IDB");
                         *data_offset += bytes_read;
-                        pcapng_process_idb(wth, pcapng, &wblock);
+                        pcapng_process_idb(wth, pcapng, wblock);
                         break;
 
                 case(BLOCK_TYPE_NRB):
@@ -2385,29 +2423,29 @@ pcapng_read(wtap *wth, int *err, gchar **err_info, gint64 *data_offset)
                         pcapng_debug0("pcapng_read: block type BLOCK_TYPE_ISB");
                         *data_offset += bytes_read;
                         pcapng_debug1("pcapng_read: *data_offset is updated to %" G_GINT64_MODIFIER "d", *data_offset);
-                        if (wth->interface_data->len <= wblock.data.if_stats.interface_id) {
-                                pcapng_debug1("pcapng_read: BLOCK_TYPE_ISB wblock.if_stats.interface_id %u > number_of_interfaces", wblock.data.if_stats.interface_id);
+                        if (wth->interface_data->len <= wblock->data.if_stats.interface_id) {
+                                pcapng_debug1("pcapng_read: BLOCK_TYPE_ISB wblock->if_stats.interface_id %u > number_of_interfaces", wblock->data.if_stats.interface_id);
                         } else {
                                 /* Get the interface description */
-                                wtapng_if_descr = &g_array_index(wth->interface_data, wtapng_if_descr_t, wblock.data.if_stats.interface_id);
+                                wtapng_if_descr = &g_array_index(wth->interface_data, wtapng_if_descr_t, wblock->data.if_stats.interface_id);
                                 if (wtapng_if_descr->num_stat_entries == 0) {
                                     /* First ISB found, no previous entry */
                                     pcapng_debug0("pcapng_read: block type BLOCK_TYPE_ISB. First ISB found, no previous entry");
                                     wtapng_if_descr->interface_statistics = g_array_new(FALSE, FALSE, sizeof(wtapng_if_stats_t));
                                 }
 
-                                if_stats.interface_id       = wblock.data.if_stats.interface_id;
-                                if_stats.ts_high            = wblock.data.if_stats.ts_high;
-                                if_stats.ts_low             = wblock.data.if_stats.ts_low;
+                                if_stats.interface_id       = wblock->data.if_stats.interface_id;
+                                if_stats.ts_high            = wblock->data.if_stats.ts_high;
+                                if_stats.ts_low             = wblock->data.if_stats.ts_low;
                                 /* options */
-                                if_stats.opt_comment        = wblock.data.if_stats.opt_comment;	/* NULL if not available */
-                                if_stats.isb_starttime      = wblock.data.if_stats.isb_starttime;
-                                if_stats.isb_endtime        = wblock.data.if_stats.isb_endtime;
-                                if_stats.isb_ifrecv         = wblock.data.if_stats.isb_ifrecv;
-                                if_stats.isb_ifdrop         = wblock.data.if_stats.isb_ifdrop;
-                                if_stats.isb_filteraccept   = wblock.data.if_stats.isb_filteraccept;
-                                if_stats.isb_osdrop         = wblock.data.if_stats.isb_osdrop;
-                                if_stats.isb_usrdeliv       = wblock.data.if_stats.isb_usrdeliv;
+                                if_stats.opt_comment        = wblock->data.if_stats.opt_comment;	/* NULL if not available */
+                                if_stats.isb_starttime      = wblock->data.if_stats.isb_starttime;
+                                if_stats.isb_endtime        = wblock->data.if_stats.isb_endtime;
+                                if_stats.isb_ifrecv         = wblock->data.if_stats.isb_ifrecv;
+                                if_stats.isb_ifdrop         = wblock->data.if_stats.isb_ifdrop;
+                                if_stats.isb_filteraccept   = wblock->data.if_stats.isb_filteraccept;
+                                if_stats.isb_osdrop         = wblock->data.if_stats.isb_osdrop;
+                                if_stats.isb_usrdeliv       = wblock->data.if_stats.isb_usrdeliv;
 
                                 g_array_append_val(wtapng_if_descr->interface_statistics, if_stats);
                                 wtapng_if_descr->num_stat_entries++;
@@ -2416,7 +2454,7 @@ pcapng_read(wtap *wth, int *err, gchar **err_info, gint64 *data_offset)
 
                 default:
                         /* XXX - improve handling of "unknown" blocks */
-                        pcapng_debug1("pcapng_read: Unknown block type 0x%08x", wblock.type);
+                        pcapng_debug1("pcapng_read: Unknown block type 0x%08x", wblock->type);
                         *data_offset += bytes_read;
                         pcapng_debug1("pcapng_read: *data_offset is updated to %" G_GINT64_MODIFIER "d", *data_offset);
                         break;
@@ -2425,13 +2463,61 @@ pcapng_read(wtap *wth, int *err, gchar **err_info, gint64 *data_offset)
 
 got_packet:
 
-        /*pcapng_debug2("Read length: %u Packet length: %u", bytes_read, wth->phdr.caplen);*/
+        /*pcapng_debug2("Read length: %u Packet length: %u", bytes_read, wblock->packet_header->caplen);*/
         pcapng_debug1("pcapng_read: data_offset is finally %" G_GINT64_MODIFIER "d", *data_offset + bytes_read);
 
         return TRUE;
 }
 
 
+/* classic wtap: read packet */
+static gboolean
+pcapng_read(wtap *wth, int *err, gchar **err_info, gint64 *data_offset)
+{
+        pcapng_t *pcapng = (pcapng_t *)wth->priv;
+        wtapng_block_t wblock;
+
+        wblock.frame_buffer  = wth->frame_buffer;
+        wblock.pkt_data      = &wth->pkt_data;
+        wblock.batch         = NULL;
+        wblock.packet_header = &wth->phdr;
+        wblock.file_encap    = &wth->file_encap;
+
+        pcapng->add_new_ipv4 = wth->add_new_ipv4;
+        pcapng->add_new_ipv6 = wth->add_new_ipv6;
+
+        return pcapng_read_packet(wth, &wblock, err, err_info, data_offset);
+}
+
+
+/* read packets straight into a batch */
+static gboolean
+pcapng_read_batch(wtap *wth, wtap_batch *batch, guint n, int *err,
+    gchar **err_info)
+{
+        pcapng_t *pcapng = (pcapng_t *)wth->priv;
+        wtapng_block_t wblock;
+        gint64 data_offset;
+
+        /* Blocks other than packet blocks still use the frame buffer. */
+        wblock.frame_buffer  = wth->frame_buffer;
+        wblock.pkt_data      = NULL;
+        wblock.batch         = batch;
+        wblock.file_encap    = &wth->file_encap;
+
+        pcapng->add_new_ipv4 = wth->add_new_ipv4;
+        pcapng->add_new_ipv6 = wth->add_new_ipv6;
+
+        while (!wtap_batch_full(batch, n)) {
+                wblock.packet_header = wtap_batch_begin(wth, batch);
+                if (!pcapng_read_packet(wth, &wblock, err, err_info, &data_offset))
+                        return FALSE;
+                wtap_batch_end(wth, batch, data_offset, wblock.batch_pd);
+        }
+        return TRUE;
+}
+
+
 /* classic wtap: seek to file position and read packet */
 static gboolean
 pcapng_seek_read(wtap *wth, gint64 seek_off,
@@ -2452,6 +2538,8 @@ pcapng_seek_read(wtap *wth, gint64 seek_off,
         pcapng_debug1("pcapng_seek_read: reading at offset %" G_GINT64_MODIFIER "u", seek_off);
 
         wblock.frame_buffer = buf;
+        wblock.pkt_data = &wth->seek_pkt_data;
+        wblock.batch = NULL;
         wblock.packet_header = phdr;
         wblock.file_encap = &wth->file_encap;
 
@@ -44,6 +44,10 @@ typedef gboolean (*subtype_read_func)(struct wtap*, int*, char**, gint64*);
 typedef gboolean (*subtype_seek_read_func)(struct wtap*, gint64,
                                            struct wtap_pkthdr *, Buffer *buf,
                                            int *, char **);
+typedef gboolean (*subtype_seek_packet_func)(struct wtap*, guint64,
+                                             int *, char **);
+typedef gboolean (*subtype_read_batch_func)(struct wtap*, wtap_batch*, guint,
+                                            int *, char **);
 /**
  * Struct holding data of the currently read file.
  */
@@ -53,6 +57,8 @@ struct wtap {
     int                         file_type_subtype;
     guint                       snapshot_length;
     struct Buffer               *frame_buffer;
+    guint8                      *pkt_data;      /**< Packet data from subtype_read, if not in frame_buffer */
+    guint8                      *seek_pkt_data; /**< Packet data from subtype_seek_read, if not in its Buffer */
     struct wtap_pkthdr          phdr;
     struct wtapng_section_s     shb_hdr;
     guint                       number_of_interfaces;   /**< The number of interfaces a capture was made on, number of IDB:s in a pcapng file or equivalent(?)*/
@@ -63,6 +69,8 @@ struct wtap {
 
     subtype_read_func           subtype_read;
     subtype_seek_read_func      subtype_seek_read;
+    subtype_seek_packet_func    subtype_seek_packet;    /**< Position fh at a record number; NULL if the format can't */
+    subtype_read_batch_func     subtype_read_batch;     /**< Read records into a batch; NULL to do it with subtype_read */
     void                        (*subtype_sequential_close)(struct wtap*);
     void                        (*subtype_close)(struct wtap*);
     int                         file_encap;    /* per-file, for those
@@ -76,6 +84,11 @@ struct wtap {
     wtap_new_ipv4_callback_t    add_new_ipv4;
     wtap_new_ipv6_callback_t    add_new_ipv6;
     GPtrArray                   *fast_seek;
+    gint64                      packet_count;  /**< Number of records, if the file says so up front; -1 if unknown */
+    struct capture_index        *index;        /**< Index sidecar, if any; see capture_index.c */
+    gboolean                    batch_eof;     /**< wtap_read_batch() got to the end of the file, */
+    int                         batch_err;     /**< or this error, after the records it returned */
+    gchar                       *batch_err_info;
 };
 
 struct wtap_dumper;
@@ -95,7 +108,8 @@ struct wtap_dumper {
     int                     file_type_subtype;
     int                     snaplen;
     int                     encap;
-    gboolean                compressed;
+    gboolean                compressed;     /**< compression_type != WTAP_UNCOMPRESSED */
+    wtap_compression_type   compression_type;
     gint64                  bytes_dumped;
 
     void                    *priv;       /* this one holds per-file state and is free'd automatically by wtap_dump_close() */
@@ -109,7 +123,20 @@ struct wtap_dumper {
                                              */
     addrinfo_lists_t        *addrinfo_lists;        /**< Struct containing lists of resolved addresses */
     struct wtapng_section_s *shb_hdr;
+    const wtap_hwgen_params_t *hwgen_params;        /**< hw-gen line model to open with, NULL for the default; */
+                                                    /**< only valid while dump_open runs */
+    const wtap_hwgen_encap_t *hwgen_encap;          /**< hw-gen header rewriting to open with, likewise */
     GArray                  *interface_data;        /**< An array holding the interface data from pcapng IDB:s or equivalent(?) NULL if not present.*/
+
+    /* Write-combining buffer; see wtap_dump_set_write_buffer() */
+    guint8                  *wbuf;          /**< Page-aligned buffer, NULL if not in use */
+    guint8                  *wbuf_alloc;    /**< Allocation wbuf lies in */
+    gsize                   wbuf_size;
+    gsize                   wbuf_len;       /**< Bytes waiting in wbuf */
+    gint64                  wbuf_pos;       /**< Where in the file wbuf starts; -1 if unknown */
+    gsize                   wbuf_hold;      /**< Bytes from this offset on can't be written yet... */
+    gboolean                wbuf_holding;   /**< ...if this is set */
+    gboolean                direct_io;      /**< The descriptor of fh has O_DIRECT set */
 };
 
 WS_DLL_PUBLIC gboolean wtap_dump_file_write(wtap_dumper *wdh, const void *buf,
@@ -117,6 +144,25 @@ WS_DLL_PUBLIC gboolean wtap_dump_file_write(wtap_dumper *wdh, const void *buf,
 WS_DLL_PUBLIC gint64 wtap_dump_file_seek(wtap_dumper *wdh, gint64 offset, int whence, int *err);
 WS_DLL_PUBLIC gint64 wtap_dump_file_tell(wtap_dumper *wdh, int *err);
 
+/*
+ * Building records in the write-combining buffer.  wtap_dump_file_reserve()
+ * returns room for up to "len" bytes at the end of the buffer, and
+ * wtap_dump_file_commit() appends the "len" bytes actually built there.
+ * Nothing may be written to the file in between.
+ *
+ * A writer that has to patch a record after building it, e.g. with a
+ * value that depends on the next record, calls wtap_dump_file_hold()
+ * before reserving room for it; from then on that record, and anything
+ * after it, stays in the buffer until wtap_dump_file_release().  The
+ * buffer moves as it is written out, so the record must be looked up
+ * with wtap_dump_file_held() rather than kept as a pointer.
+ */
+WS_DLL_PUBLIC guint8 *wtap_dump_file_reserve(wtap_dumper *wdh, gsize len, int *err);
+WS_DLL_PUBLIC void wtap_dump_file_commit(wtap_dumper *wdh, gsize len);
+WS_DLL_PUBLIC void wtap_dump_file_hold(wtap_dumper *wdh);
+WS_DLL_PUBLIC guint8 *wtap_dump_file_held(wtap_dumper *wdh);
+WS_DLL_PUBLIC void wtap_dump_file_release(wtap_dumper *wdh);
+
 
 extern gint wtap_num_file_types;
 
@@ -286,6 +332,41 @@ gboolean
 wtap_read_packet_bytes(FILE_T fh, Buffer *buf, guint length, int *err,
     gchar **err_info);
 
+/*
+ * As wtap_read_packet_bytes(), but set *pd to point to the packet data,
+ * which, if the file is memory-mapped, is left where it is rather than
+ * being copied into buf.  Read routines that use it pass &wth->pkt_data
+ * or &wth->seek_pkt_data, and mustn't modify the data in place, as the
+ * same bytes are handed out again if the packet is read again.
+ */
+WS_DLL_PUBLIC
+gboolean
+wtap_map_packet_bytes(FILE_T fh, Buffer *buf, guint length, guint8 **pd,
+    int *err, gchar **err_info);
+
+/*
+ * For subtype_read_batch routines, which add records to the batch until
+ * wtap_batch_full() says it's full: wtap_batch_begin() returns the header
+ * to fill in for the next record, with pkt_encap set as wtap_read() sets
+ * it, wtap_batch_packet_bytes() puts its data at the end of the batch's
+ * arena, or, if can_map is set and the file is mapped into memory, finds
+ * it in the mapping, setting *pd to point to it either way, and
+ * wtap_batch_end() adds the record to the batch.
+ */
+gboolean
+wtap_batch_full(wtap_batch *batch, guint n);
+
+struct wtap_pkthdr *
+wtap_batch_begin(wtap *wth, wtap_batch *batch);
+
+gboolean
+wtap_batch_packet_bytes(wtap_batch *batch, FILE_T fh, guint length,
+    gboolean can_map, guint8 **pd, int *err, gchar **err_info);
+
+void
+wtap_batch_end(wtap *wth, wtap_batch *batch, gint64 data_offset,
+    const guint8 *pd);
+
 #endif /* __WTAP_INT_H__ */
 
 /*
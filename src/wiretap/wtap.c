@@ -38,6 +38,7 @@
 #include "wtap-int.h"
 
 #include "file_wrappers.h"
+#include "capture_index.h"
 #include <wsutil/file_util.h>
 #include <wsutil/buffer.h>
 
@@ -137,6 +138,12 @@ wtap_fstat(wtap *wth, ws_statb64 *statb, int *err)
 	return 0;
 }
 
+gint64
+wtap_packet_count(wtap *wth)
+{
+	return wth->packet_count;
+}
+
 int
 wtap_file_type_subtype(wtap *wth)
 {
@@ -930,6 +937,8 @@ wtap_close(wtap *wth)
 		g_ptr_array_foreach(wth->fast_seek, g_fast_seek_item_free, NULL);
 		g_ptr_array_free(wth->fast_seek, TRUE);
 	}
+	capture_index_free(wth);
+	g_free(wth->batch_err_info);
 	for(i = 0; i < wth->interface_data->len; i++) {
 		wtapng_if_descr = &g_array_index(wth->interface_data, wtapng_if_descr_t, i);
 		if(wtapng_if_descr->opt_comment != NULL){
@@ -968,6 +977,10 @@ void
 wtap_cleareof(wtap *wth) {
 	/* Reset EOF */
 	file_clearerr(wth->fh);
+
+	/* It's growing, so what we know of where things are won't last */
+	capture_index_free(wth);
+	wth->batch_eof = FALSE;
 }
 
 void wtap_set_cb_new_ipv4(wtap *wth, wtap_new_ipv4_callback_t add_new_ipv4) {
@@ -980,6 +993,31 @@ void wtap_set_cb_new_ipv6(wtap *wth, wtap_new_ipv6_callback_t add_new_ipv6) {
 		wth->add_new_ipv6 = add_new_ipv6;
 }
 
+/*
+ * What wtap_read() does with each record it gets from the file's read
+ * routine.
+ */
+static void
+wtap_read_done(wtap *wth, struct wtap_pkthdr *phdr, gint64 data_offset)
+{
+	/*
+	 * It makes no sense for the captured data length to be bigger
+	 * than the actual data length.
+	 */
+	if (phdr->caplen > phdr->len)
+		phdr->caplen = phdr->len;
+
+	/*
+	 * Make sure that it's not WTAP_ENCAP_PER_PACKET, as that
+	 * probably means the file has that encapsulation type
+	 * but the read routine didn't set this packet's
+	 * encapsulation type.
+	 */
+	g_assert(phdr->pkt_encap != WTAP_ENCAP_PER_PACKET);
+
+	capture_index_add(wth, phdr, data_offset);
+}
+
 gboolean
 wtap_read(wtap *wth, int *err, gchar **err_info, gint64 *data_offset)
 {
@@ -992,6 +1030,7 @@ wtap_read(wtap *wth, int *err, gchar **err_info, gint64 *data_offset)
 	 * anyway.
 	 */
 	wth->phdr.pkt_encap = wth->file_encap;
+	wth->pkt_data = NULL;
 
 	if (!wth->subtype_read(wth, err, err_info, data_offset)) {
 		/*
@@ -1005,25 +1044,218 @@ wtap_read(wtap *wth, int *err, gchar **err_info, gint64 *data_offset)
 		 */
 		if (*err == 0)
 			*err = file_error(wth->fh, err_info);
+		if (*err == 0)
+			capture_index_eof(wth);
 		return FALSE;	/* failure */
 	}
 
-	/*
-	 * It makes no sense for the captured data length to be bigger
-	 * than the actual data length.
-	 */
-	if (wth->phdr.caplen > wth->phdr.len)
-		wth->phdr.caplen = wth->phdr.len;
+	wtap_read_done(wth, &wth->phdr, *data_offset);
+	return TRUE;	/* success */
+}
 
-	/*
-	 * Make sure that it's not WTAP_ENCAP_PER_PACKET, as that
-	 * probably means the file has that encapsulation type
-	 * but the read routine didn't set this packet's
-	 * encapsulation type.
-	 */
-	g_assert(wth->phdr.pkt_encap != WTAP_ENCAP_PER_PACKET);
+wtap_batch *
+wtap_batch_new(guint max_records, gsize max_bytes)
+{
+	wtap_batch *batch;
+
+	g_assert(max_records != 0);
+	batch = g_new0(wtap_batch, 1);
+	batch->phdrs = g_new0(struct wtap_pkthdr, max_records);
+	batch->offsets = g_new(gint64, max_records);
+	batch->data = g_new(const guint8 *, max_records);
+	batch->arena_offs = g_new(gsize, max_records);
+	batch->extra_offs = g_new(gsize, max_records);
+	batch->max_records = max_records;
+	batch->max_bytes = max_bytes;
+	/* grown as needed; mapped files may never use it */
+	buffer_init(&batch->arena, MIN(max_bytes, 64 * 1024));
+	return batch;
+}
 
-	return TRUE;	/* success */
+void
+wtap_batch_free(wtap_batch *batch)
+{
+	if (batch == NULL)
+		return;
+	g_free(batch->phdrs);
+	g_free(batch->offsets);
+	g_free(batch->data);
+	g_free(batch->arena_offs);
+	g_free(batch->extra_offs);
+	buffer_free(&batch->arena);
+	g_free(batch);
+}
+
+gboolean
+wtap_batch_full(wtap_batch *batch, guint n)
+{
+	return batch->count >= n ||
+	    (batch->count != 0 &&
+	     buffer_length(&batch->arena) >= batch->max_bytes);
+}
+
+struct wtap_pkthdr *
+wtap_batch_begin(wtap *wth, wtap_batch *batch)
+{
+	struct wtap_pkthdr *phdr = &batch->phdrs[batch->count];
+
+	/* see wtap_read() */
+	phdr->pkt_encap = wth->file_encap;
+	batch->arena_offs[batch->count] = G_MAXSIZE;
+	batch->extra_offs[batch->count] = G_MAXSIZE;
+	return phdr;
+}
+
+gboolean
+wtap_batch_packet_bytes(wtap_batch *batch, FILE_T fh, guint length,
+    gboolean can_map, guint8 **pd, int *err, gchar **err_info)
+{
+	gsize	off;
+	int	bytes_read;
+
+	if (can_map) {
+		*pd = file_read_mapped(fh, length);
+		if (*pd != NULL)
+			return TRUE;
+	}
+
+	/* The arena never has data removed from its start; see wtap_read_batch(). */
+	off = buffer_length(&batch->arena);
+	buffer_assure_space(&batch->arena, length);
+	errno = WTAP_ERR_CANT_READ;
+	bytes_read = file_read(buffer_end_ptr(&batch->arena), length, fh);
+	if (bytes_read < 0 || (guint)bytes_read != length) {
+		*err = file_error(fh, err_info);
+		if (*err == 0)
+			*err = WTAP_ERR_SHORT_READ;
+		return FALSE;
+	}
+	*pd = buffer_end_ptr(&batch->arena);
+	buffer_increase_length(&batch->arena, length);
+	batch->arena_offs[batch->count] = off;
+	return TRUE;
+}
+
+void
+wtap_batch_end(wtap *wth, wtap_batch *batch, gint64 data_offset,
+    const guint8 *pd)
+{
+	/* Arena data gets its pointer once the arena has stopped moving. */
+	batch->offsets[batch->count] = data_offset;
+	batch->data[batch->count] = pd;
+	wtap_read_done(wth, &batch->phdrs[batch->count], data_offset);
+	batch->count++;
+}
+
+/*
+ * For formats without a subtype_read_batch routine: read the records
+ * one at a time, and copy them into the batch.
+ */
+static gboolean
+wtap_read_batch_records(wtap *wth, wtap_batch *batch, guint n, int *err,
+    gchar **err_info)
+{
+	gint64	data_offset;
+	guint	i;
+
+	while (!wtap_batch_full(batch, n)) {
+		if (!wtap_read(wth, err, err_info, &data_offset))
+			return FALSE;
+		i = batch->count++;
+		batch->phdrs[i] = wth->phdr;
+		batch->offsets[i] = data_offset;
+		if (wth->pkt_data != NULL &&
+		    wth->pkt_data != buffer_start_ptr(wth->frame_buffer)) {
+			/* in the file's mapping, which lasts until it's closed */
+			batch->data[i] = wth->pkt_data;
+			batch->arena_offs[i] = G_MAXSIZE;
+		} else {
+			batch->arena_offs[i] = buffer_length(&batch->arena);
+			buffer_append(&batch->arena,
+			    buffer_start_ptr(wth->frame_buffer), wth->phdr.caplen);
+		}
+		/*
+		 * The K12 reader reuses one buffer for the extra
+		 * information of every packet.  (DCT2000 pseudo-headers
+		 * also point into the file's state, but only to what's
+		 * kept until it's closed.)
+		 */
+		batch->extra_offs[i] = G_MAXSIZE;
+		if (wth->phdr.pkt_encap == WTAP_ENCAP_K12 &&
+		    wth->phdr.pseudo_header.k12.extra_length != 0) {
+			batch->extra_offs[i] = buffer_length(&batch->arena);
+			buffer_append(&batch->arena,
+			    wth->phdr.pseudo_header.k12.extra_info,
+			    wth->phdr.pseudo_header.k12.extra_length);
+		}
+	}
+	return TRUE;
+}
+
+/* Whatever stopped the last batch short is behind the new read position. */
+static void
+batch_moved(wtap *wth)
+{
+	wth->batch_eof = FALSE;
+	wth->batch_err = 0;
+	g_free(wth->batch_err_info);
+	wth->batch_err_info = NULL;
+}
+
+gboolean
+wtap_read_batch(wtap *wth, wtap_batch *batch, guint n, int *err,
+    gchar **err_info)
+{
+	gboolean	ok;
+	guint	i;
+
+	batch->count = 0;
+	buffer_clean(&batch->arena);
+	*err = 0;
+
+	/* Hand on what stopped the last batch short. */
+	if (wth->batch_eof)
+		return FALSE;
+	if (wth->batch_err != 0) {
+		*err = wth->batch_err;
+		*err_info = wth->batch_err_info;
+		wth->batch_err = 0;
+		wth->batch_err_info = NULL;
+		return FALSE;
+	}
+
+	n = CLAMP(n, 1, batch->max_records);
+	if (wth->subtype_read_batch != NULL)
+		ok = wth->subtype_read_batch(wth, batch, n, err, err_info);
+	else
+		ok = wtap_read_batch_records(wth, batch, n, err, err_info);
+	if (!ok) {
+		/* see wtap_read() */
+		if (*err == 0)
+			*err = file_error(wth->fh, err_info);
+		if (*err == 0)
+			capture_index_eof(wth);
+		if (batch->count == 0)
+			return FALSE;
+		if (*err == 0) {
+			wth->batch_eof = TRUE;
+		} else {
+			wth->batch_err = *err;
+			wth->batch_err_info = *err_info;
+			*err = 0;
+			*err_info = NULL;
+		}
+	}
+
+	for (i = 0; i < batch->count; i++) {
+		if (batch->arena_offs[i] != G_MAXSIZE)
+			batch->data[i] = buffer_start_ptr(&batch->arena) +
+			    batch->arena_offs[i];
+		if (batch->extra_offs[i] != G_MAXSIZE)
+			batch->phdrs[i].pseudo_header.k12.extra_info =
+			    buffer_start_ptr(&batch->arena) + batch->extra_offs[i];
+	}
+	return TRUE;
 }
 
 /*
@@ -1054,6 +1286,19 @@ wtap_read_packet_bytes(FILE_T fh, Buffer *buf, guint length, int *err,
 	return TRUE;
 }
 
+gboolean
+wtap_map_packet_bytes(FILE_T fh, Buffer *buf, guint length, guint8 **pd,
+    int *err, gchar **err_info)
+{
+	*pd = file_read_mapped(fh, length);
+	if (*pd != NULL)
+		return TRUE;
+	if (!wtap_read_packet_bytes(fh, buf, length, err, err_info))
+		return FALSE;
+	*pd = buffer_start_ptr(buf);
+	return TRUE;
+}
+
 /*
  * Return an approximation of the amount of data we've read sequentially
  * from the file so far.  (gint64, in case that's 64 bits.)
@@ -1073,6 +1318,8 @@ wtap_phdr(wtap *wth)
 guint8 *
 wtap_buf_ptr(wtap *wth)
 {
+	if (wth->pkt_data != NULL)
+		return wth->pkt_data;
 	return buffer_start_ptr(wth->frame_buffer);
 }
 
@@ -1080,8 +1327,30 @@ gboolean
 wtap_seek_read(wtap *wth, gint64 seek_off,
 	struct wtap_pkthdr *phdr, Buffer *buf, int *err, gchar **err_info)
 {
+	const guint8 *pd;
+
+	if (!wtap_seek_read_mapped(wth, seek_off, phdr, buf, &pd, err,
+	    err_info))
+		return FALSE;
+
+	/* Callers of this expect the data in buf. */
+	if (pd != buffer_start_ptr(buf)) {
+		buffer_assure_space(buf, phdr->caplen);
+		memcpy(buffer_start_ptr(buf), pd, phdr->caplen);
+	}
+	return TRUE;
+}
+
+gboolean
+wtap_seek_read_mapped(wtap *wth, gint64 seek_off,
+	struct wtap_pkthdr *phdr, Buffer *buf, const guint8 **pd, int *err,
+	gchar **err_info)
+{
+	wth->seek_pkt_data = NULL;
 	if (!wth->subtype_seek_read(wth, seek_off, phdr, buf, err, err_info))
 		return FALSE;
+	*pd = wth->seek_pkt_data != NULL ? wth->seek_pkt_data :
+	    buffer_start_ptr(buf);
 
 	/*
 	 * It makes no sense for the captured data length to be bigger
@@ -1100,3 +1369,44 @@ wtap_seek_read(wtap *wth, gint64 seek_off,
 
 	return TRUE;
 }
+
+gboolean
+wtap_seek_to_packet(wtap *wth, guint64 packet_num, int *err, gchar **err_info)
+{
+	*err = 0;
+	if (wth->fh == NULL)
+		return FALSE;
+
+	/* Formats with an index of their own know best */
+	if (wth->subtype_seek_packet == NULL) {
+		if (!capture_index_seek_packet(wth, packet_num, err, err_info))
+			return FALSE;
+	} else if (!wth->subtype_seek_packet(wth, packet_num, err, err_info)) {
+		if (*err != 0)
+			capture_index_moved(wth, -1);
+		return FALSE;
+	} else
+		capture_index_moved(wth, (gint64)packet_num);
+	batch_moved(wth);
+	return TRUE;
+}
+
+gboolean
+wtap_seek_to_time(wtap *wth, const nstime_t *ts, guint64 *packet_num,
+	int *err, gchar **err_info)
+{
+	*err = 0;
+	if (wth->fh == NULL)
+		return FALSE;
+
+	if (!capture_index_seek_time(wth, ts, packet_num, err, err_info))
+		return FALSE;
+	batch_moved(wth);
+	return TRUE;
+}
+
+gint64
+wtap_time_stop_packet(wtap *wth, const nstime_t *ts)
+{
+	return capture_index_time_stop_packet(wth, ts);
+}
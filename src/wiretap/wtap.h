@@ -351,6 +351,7 @@ extern "C" {
 #define WTAP_FILE_TYPE_SUBTYPE_LOGCAT_THREADTIME             73
 #define WTAP_FILE_TYPE_SUBTYPE_LOGCAT_LONG                   74
 #define WTAP_FILE_TYPE_SUBTYPE_HWGEN_V1			     75
+#define WTAP_FILE_TYPE_SUBTYPE_HWGEN_V2			     76
 #define WTAP_NUM_FILE_TYPES_SUBTYPES  wtap_get_num_file_types_subtypes()
 
 /* timestamp precision (currently only these values are supported) */
@@ -1301,6 +1302,23 @@ typedef int (*wtap_open_routine_t)(struct wtap*, int *, char **);
 
 WS_DLL_PUBLIC void init_open_routines(void);
 
+/*
+ * A routine may also list the bytes every file it handles starts with,
+ * ended by an entry with NULL bytes.  wtap_open_offline() reads the start
+ * of the file once and only calls such a routine if the file starts with
+ * one of them; the routine must still check for itself, as it's also
+ * called when its type is asked for explicitly.  Routines whose magic
+ * isn't at the start of the file, or isn't fixed, leave this NULL and are
+ * tried in order as before.
+ */
+#define OPEN_INFO_MAGIC_MAX_LEN 32
+
+struct open_info_magic {
+    const char *bytes;
+    guint len;
+};
+#define OPEN_INFO_MAGIC_BYTES(s) { s, sizeof s - 1 }
+
 struct open_info {
     const char *name;
     int type;
@@ -1308,6 +1326,7 @@ struct open_info {
     const char *extensions;
     gchar **extensions_set; /* populated using extensions member during initialization */
     void* wslua_data; /* should be NULL for C-code file readers */
+    const struct open_info_magic *magics; /* must outlive the registration */
 };
 WS_DLL_PUBLIC struct open_info *open_routines;
 
@@ -1378,6 +1397,48 @@ WS_DLL_PUBLIC
 struct wtap* wtap_open_offline(const char *filename, unsigned int type, int *err,
     gchar **err_info, gboolean do_random);
 
+/**
+ * Whether wtap_open_offline() goes straight to the routines whose magic
+ * bytes the file starts with (the default), or tries every routine in
+ * turn; the latter is only useful for comparing the two.
+ */
+WS_DLL_PUBLIC
+void wtap_set_magic_dispatch(gboolean magic_dispatch);
+
+/**
+ * Set the size of the buffer through which regular files opened from then
+ * on are read from start to end; 0 restores the default of
+ * WTAP_DEFAULT_READ_BUFFER_SIZE.  Pipes, and the streams used for random
+ * access, get a small buffer regardless, so that packets arriving on a pipe
+ * aren't held up and a random read doesn't read more than it needs.  Each
+ * file takes about three times this in buffers, which matters when opening
+ * many at once.
+ */
+#define WTAP_DEFAULT_READ_BUFFER_SIZE	(1024 * 1024)
+WS_DLL_PUBLIC
+void wtap_set_read_buffer_size(guint size);
+
+/**
+ * Have files opened from then on read ahead, in a thread of their own per
+ * file, while they're read from start to end, so that waiting for the disk
+ * overlaps with processing the packets.  Until this is called, files are
+ * read ahead if the WIRESHARK_READ_AHEAD environment variable is set.
+ */
+WS_DLL_PUBLIC
+void wtap_set_read_ahead(gboolean read_ahead);
+
+/**
+ * Have files opened from then on keep an index sidecar, named after the
+ * file with ".wtidx" appended: it's written when a file has been read
+ * from start to end, if its directory is writable, and used when the
+ * file is opened again, unless the file has changed since.  It gives
+ * wtap_packet_count(), wtap_seek_to_packet() for pcap and pcapng files,
+ * and wtap_seek_to_time().  Until this is called, files are indexed if
+ * the WIRESHARK_INDEX_SIDECAR environment variable is set.
+ */
+WS_DLL_PUBLIC
+void wtap_set_index_sidecar(gboolean index_sidecar);
+
 /**
  * If we were compiled with zlib and we're at EOF, unset EOF so that
  * wtap_read/gzread has a chance to succeed. This is necessary if
@@ -1405,10 +1466,86 @@ WS_DLL_PUBLIC
 gboolean wtap_read(wtap *wth, int *err, gchar **err_info,
     gint64 *data_offset);
 
+/** Records read with wtap_read_batch().  Record i has the header
+ * phdrs[i], the data offset wtap_read() would have given it in
+ * offsets[i], and its data at data[i].  The data of records that had to
+ * be read, rather than found in the file's mapping, lies one after the
+ * other in the batch's arena, as does the extra information of K12
+ * packets.  All of it is good until the batch is read into again or
+ * freed, and mustn't be written through. */
+typedef struct wtap_batch {
+	guint               count;      /**< Records in the batch */
+	struct wtap_pkthdr *phdrs;
+	gint64             *offsets;
+	const guint8      **data;
+
+	/* for wiretap's use */
+	guint               max_records;
+	gsize               max_bytes;  /**< The arena takes no more records once it holds this much */
+	Buffer              arena;
+	gsize              *arena_offs; /**< Where data[i] is in the arena; G_MAXSIZE if it's not */
+	gsize              *extra_offs; /**< Where the K12 extra information of phdrs[i] is; likewise */
+} wtap_batch;
+
+/** Allocate a batch for up to max_records records at a time, whose
+ * arena is handed back once it holds max_bytes of packet data. */
+WS_DLL_PUBLIC
+wtap_batch *wtap_batch_new(guint max_records, gsize max_bytes);
+
+WS_DLL_PUBLIC
+void wtap_batch_free(wtap_batch *batch);
+
+/** Read up to n records (no more than the batch was allocated for)
+ * into batch, replacing what was in it, as that many wtap_read() calls
+ * would; wtap_phdr() and wtap_buf_ptr() are left undefined.  Returns
+ * FALSE only if no records were read: at EOF with *err set to 0, or on
+ * an error.  An error met after some records is held back, and returned
+ * by the next call. */
+WS_DLL_PUBLIC
+gboolean wtap_read_batch(wtap *wth, wtap_batch *batch, guint n, int *err,
+    gchar **err_info);
+
 WS_DLL_PUBLIC
 gboolean wtap_seek_read (wtap *wth, gint64 seek_off,
 	struct wtap_pkthdr *phdr, Buffer *buf, int *err, gchar **err_info);
 
+/** As wtap_seek_read(), but set *pd to point to the packet data rather
+ * than leaving it in buf; for uncompressed files that are mapped into
+ * memory, and formats that support it, that saves copying it.  *pd is
+ * good until the next read into buf, or, if it's not in buf, until the
+ * file is closed, and mustn't be written through. */
+WS_DLL_PUBLIC
+gboolean wtap_seek_read_mapped (wtap *wth, gint64 seek_off,
+	struct wtap_pkthdr *phdr, Buffer *buf, const guint8 **pd, int *err,
+	gchar **err_info);
+
+/** Position the sequential reader so that the next wtap_read() returns
+ * record number packet_num (counting from 0), for formats that carry an
+ * index of their records, and files with an index sidecar (see
+ * wtap_set_index_sidecar()).  Several wtap handles open on the same file
+ * can use this to read disjoint chunks of it in parallel.  Returns FALSE
+ * with *err set to 0, and the read position unchanged, if the format
+ * can't do it; the caller then has to read its way there. */
+WS_DLL_PUBLIC
+gboolean wtap_seek_to_packet(wtap *wth, guint64 packet_num, int *err,
+	gchar **err_info);
+
+/** Skip the sequential reader ahead over records stamped earlier than
+ * *ts, as far as the file's index sidecar says it can, and set
+ * *packet_num to the number of the record the next wtap_read() returns.
+ * Every record skipped is stamped earlier than *ts, but records that
+ * aren't may be left for the caller to read past.  Returns FALSE with
+ * *err set to 0, and the read position unchanged, if there's no index. */
+WS_DLL_PUBLIC
+gboolean wtap_seek_to_time(wtap *wth, const nstime_t *ts,
+	guint64 *packet_num, int *err, gchar **err_info);
+
+/** Return the number of a record from which on every record is stamped
+ * at or after *ts, going by the file's index sidecar, so that a reader
+ * looking for earlier ones can stop there; -1 if there's no index. */
+WS_DLL_PUBLIC
+gint64 wtap_time_stop_packet(wtap *wth, const nstime_t *ts);
+
 /*** get various information snippets about the current packet ***/
 WS_DLL_PUBLIC
 struct wtap_pkthdr *wtap_phdr(wtap *wth);
@@ -1423,6 +1560,10 @@ WS_DLL_PUBLIC
 gint64 wtap_read_so_far(wtap *wth);
 WS_DLL_PUBLIC
 gint64 wtap_file_size(wtap *wth, int *err);
+/** Return the number of records in the file, if the file records it
+ * somewhere we can get at without reading all of them; -1 otherwise. */
+WS_DLL_PUBLIC
+gint64 wtap_packet_count(wtap *wth);
 WS_DLL_PUBLIC
 gboolean wtap_iscompressed(wtap *wth);
 WS_DLL_PUBLIC
@@ -1465,6 +1606,18 @@ gboolean wtap_dump_can_open(int filetype);
 WS_DLL_PUBLIC
 int wtap_dump_file_encap_type(const GArray *file_encaps);
 
+/**
+ * How a capture file is compressed when it's written out.
+ */
+typedef enum {
+    WTAP_UNCOMPRESSED,
+    WTAP_GZIP_COMPRESSED,       /**< gzip */
+    WTAP_ZSTD_COMPRESSED,       /**< Zstandard frames */
+    WTAP_LZ4_COMPRESSED,        /**< LZ4 frames */
+    WTAP_BGZF_COMPRESSED        /**< gzip, as block-gzip (BGZF) members, which
+                                     can be inflated in parallel and seeked in */
+} wtap_compression_type;
+
 /**
  * Return TRUE if we can write this capture file format out in
  * compressed form, FALSE if not.
@@ -1472,6 +1625,13 @@ int wtap_dump_file_encap_type(const GArray *file_encaps);
 WS_DLL_PUBLIC
 gboolean wtap_dump_can_compress(int filetype);
 
+/**
+ * Return TRUE if this build can write files compressed this way,
+ * FALSE if not.
+ */
+WS_DLL_PUBLIC
+gboolean wtap_can_write_compression_type(wtap_compression_type compression_type);
+
 /**
  * Return TRUE if this capture file format supports storing name
  * resolution information in it, FALSE if not.
@@ -1488,23 +1648,27 @@ gboolean wtap_dump_supports_comment_types(int filetype, guint32 comment_types);
 
 WS_DLL_PUBLIC
 wtap_dumper* wtap_dump_open(const char *filename, int filetype, int encap,
-    int snaplen, gboolean compressed, int *err);
+    int snaplen, wtap_compression_type compression_type, int *err);
 
 WS_DLL_PUBLIC
 wtap_dumper* wtap_dump_open_ng(const char *filename, int filetype, int encap,
-    int snaplen, gboolean compressed, wtapng_section_t *shb_hdr, wtapng_iface_descriptions_t *idb_inf, int *err);
+    int snaplen, wtap_compression_type compression_type, wtapng_section_t *shb_hdr, wtapng_iface_descriptions_t *idb_inf, int *err);
 
 WS_DLL_PUBLIC
 wtap_dumper* wtap_dump_fdopen(int fd, int filetype, int encap, int snaplen,
-    gboolean compressed, int *err);
+    wtap_compression_type compression_type, int *err);
 
 WS_DLL_PUBLIC
 wtap_dumper* wtap_dump_fdopen_ng(int fd, int filetype, int encap, int snaplen,
-                gboolean compressed, wtapng_section_t *shb_hdr, wtapng_iface_descriptions_t *idb_inf, int *err);
+                wtap_compression_type compression_type, wtapng_section_t *shb_hdr, wtapng_iface_descriptions_t *idb_inf, int *err);
 
 
 WS_DLL_PUBLIC
 gboolean wtap_dump(wtap_dumper *, const struct wtap_pkthdr *, const guint8 *, int *err);
+/** Write out what's been handed to wtap_dump() so far.  zstd and LZ4
+ * output is the exception: it's only written a whole 1 MB frame at a
+ * time, so what's in the frame being filled stays in memory until the
+ * frame is full or the file is closed. */
 WS_DLL_PUBLIC
 void wtap_dump_flush(wtap_dumper *);
 WS_DLL_PUBLIC
@@ -1517,6 +1681,154 @@ gboolean wtap_dump_set_addrinfo_list(wtap_dumper *wdh, addrinfo_lists_t *addrinf
 WS_DLL_PUBLIC
 gboolean wtap_dump_close(wtap_dumper *, int *);
 
+/** Gather what is written to the file in a write-combining buffer of
+ * "size" bytes, written out in page-aligned chunks, instead of handing
+ * every record to stdio or zlib; or resize the buffer if there is one.
+ * Some writers, e.g. hw-gen, turn it on themselves.  Returns FALSE, with
+ * "*err" set, on an error writing out what the old buffer held. */
+WS_DLL_PUBLIC
+gboolean wtap_dump_set_write_buffer(wtap_dumper *wdh, gsize size, int *err);
+
+/** Write the file with O_DIRECT, bypassing the page cache; this needs
+ * a write-combining buffer and an uncompressed file on which nothing
+ * but whole pages has been written yet.  Returns FALSE, with "*err" set,
+ * if that isn't the case or the platform has no O_DIRECT. */
+WS_DLL_PUBLIC
+gboolean wtap_dump_set_direct_io(wtap_dumper *wdh, int *err);
+
+/**
+ * Line model the hw-gen writers use to turn time stamp deltas into
+ * inter-frame gaps; each hw-gen file is given its own when it's opened
+ * with wtap_dump_open_hwgen().
+ */
+typedef struct {
+	guint64	line_rate;	/**< Generator line rate, in kbit/s */
+	guint	word_width;	/**< Bytes the generator moves per word */
+	guint	min_ifg;	/**< Smallest gap written, in words */
+	guint	max_ifg;	/**< Largest gap written, in words */
+	guint64	speedup;	/**< Time stamp deltas are divided by speedup / 1000000
+				     before they become gaps; 1000000 keeps the
+				     recorded timing */
+} wtap_hwgen_params_t;
+
+/** What a hw-gen file will play like on the generator. */
+typedef struct {
+	guint64	frames;		/**< Frames written */
+	guint64	saturated;	/**< Gaps held at min_ifg because the frames were closer
+				     together than the line allows */
+	double	duration;	/**< Seconds the file plays for */
+	double	avg_bps;	/**< Average frame rate, in bit/s */
+	double	avg_pps;	/**< Average frame rate, in frames/s */
+	double	peak_bps;	/**< Highest rate over a 1 ms window, in bit/s */
+	guint64	skipped;	/**< Frames left out because they carry nothing an
+				     Ethernet II frame could */
+} wtap_hwgen_stats_t;
+
+#define WTAP_HWGEN_MAX_VLAN_TAGS 2
+
+/**
+ * How the hw-gen writers turn frames of other link types into the
+ * Ethernet II frames the generator sends.  Linux cooked, PPP, BSD
+ * null/loopback, raw IP and ERF frames get a new Ethernet header with
+ * these addresses; the VLAN tags are pushed onto every frame, Ethernet
+ * ones included.  As with the line model, each hw-gen file is given its
+ * own when it's opened with wtap_dump_open_hwgen().
+ */
+typedef struct {
+	guint8	dst_mac[6];	/**< Destination of the headers written */
+	guint8	src_mac[6];	/**< Source of the headers written, unless the
+				     frame has one (Linux cooked) */
+	guint	n_vlan_tags;	/**< Tags to push, up to WTAP_HWGEN_MAX_VLAN_TAGS */
+	guint16	vlan_tci[WTAP_HWGEN_MAX_VLAN_TAGS];
+				/**< Their TCIs, outermost first; the outer one of
+				     two is an 802.1ad S-tag */
+} wtap_hwgen_encap_t;
+
+/** Fill in the default hw-gen line model: 10 Gb/s with 4-byte words,
+ * gaps of 3 to 100000 words and the recorded timing. */
+WS_DLL_PUBLIC
+void wtap_hwgen_params_init(wtap_hwgen_params_t *params);
+
+/** Returns FALSE if a setting of a hw-gen line model is out of range. */
+WS_DLL_PUBLIC
+gboolean wtap_hwgen_params_valid(const wtap_hwgen_params_t *params);
+
+/** Fill in the default hw-gen header rewriting: the addresses
+ * 01:02:03:04:05:06 and 2c:b0:5d:b5:47:3e, and no VLAN tags. */
+WS_DLL_PUBLIC
+void wtap_hwgen_encap_init(wtap_hwgen_encap_t *encap);
+
+/** Returns FALSE if there are too many VLAN tags in hw-gen header
+ * rewriting. */
+WS_DLL_PUBLIC
+gboolean wtap_hwgen_encap_valid(const wtap_hwgen_encap_t *encap);
+
+/** wtap_dump_open_ng(), writing a hw-gen file with the line model
+ * "params" and the header rewriting "hwgen_encap" rather than the default
+ * ones; either may be NULL for the default.  Both are copied; other file
+ * types don't use them.  Fails with WTAP_ERR_INTERNAL if one isn't valid. */
+WS_DLL_PUBLIC
+wtap_dumper* wtap_dump_open_hwgen(const char *filename, int filetype, int encap,
+    int snaplen, wtap_compression_type compression_type, wtapng_section_t *shb_hdr,
+    wtapng_iface_descriptions_t *idb_inf, const wtap_hwgen_params_t *params,
+    const wtap_hwgen_encap_t *hwgen_encap, int *err);
+
+/** hw-gen (v1) files don't record the line model their gaps are for, so
+ * their time stamps are rebuilt for the default one; read "wth" with the
+ * line rate and word width of "params" instead.  Call it before the first
+ * packet is read.  Returns FALSE if "wth" isn't such a file or "params"
+ * isn't valid. */
+WS_DLL_PUBLIC
+gboolean wtap_set_hwgen_read_params(wtap *wth, const wtap_hwgen_params_t *params);
+
+/** Get the statistics of a hw-gen file being written, counting every
+ * frame handed to wtap_dump() so far; call it before wtap_dump_close().
+ * Returns FALSE if the dumper isn't writing a hw-gen file. */
+WS_DLL_PUBLIC
+gboolean wtap_dump_hwgen_stats(wtap_dumper *wdh, wtap_hwgen_stats_t *stats);
+
+/** Size of the header of a hw-gen record */
+#define WTAP_HWGEN_REC_HDR_LEN		8
+
+/** Longest Ethernet header the hw-gen writers build: the addresses, the
+ * VLAN tags and the type */
+#define WTAP_HWGEN_MAX_L2_HDR		(12 + 4 * WTAP_HWGEN_MAX_VLAN_TAGS + 2)
+
+/** Room wtap_hwgen_build_record() needs for a frame of "len" bytes on the
+ * wire: the record header, the longest Ethernet header built, the frame,
+ * padding up to the 60-byte minimum frame, the FCS and up to 4 bytes of
+ * alignment padding. */
+#define WTAP_HWGEN_RECORD_MAX(len) \
+	(WTAP_HWGEN_REC_HDR_LEN + WTAP_HWGEN_MAX_L2_HDR + (len) + 60 + 4 + 4)
+
+/** Build the hw-gen record of a frame into "rec", which has room for
+ * WTAP_HWGEN_RECORD_MAX(phdr->len) bytes, rewriting its header with
+ * "encap", which must be the one the file it's for was opened with.
+ * This is the work of writing a frame, the FCS included, that doesn't
+ * depend on the frames before it, so it can be done ahead of time and on
+ * any thread.  Returns the length of the record, 0 if the frame is to be
+ * left out, or -1, with "*err" set, if it can't be written at all. */
+WS_DLL_PUBLIC
+gint wtap_hwgen_build_record(const wtap_hwgen_encap_t *encap,
+    const struct wtap_pkthdr *phdr, const guint8 *pd, guint8 *rec, int *err);
+
+/** Find where what follows the link-layer header of a frame starts, past
+ * any VLAN tags, as the hw-gen writers find it: "*offset" is set to that,
+ * "*ethertype" to its Ethernet type, and "*mac" to the frame's
+ * destination address, followed by its source address, or NULL if it
+ * hasn't got them.  Returns FALSE for the frames the hw-gen writers leave
+ * out. */
+WS_DLL_PUBLIC
+gboolean wtap_hwgen_l3_offset(const struct wtap_pkthdr *phdr, const guint8 *pd,
+    guint32 *offset, guint16 *ethertype, const guint8 **mac);
+
+/** Write a record built by wtap_hwgen_build_record(), with the length it
+ * returned, to a hw-gen file; the file is the same as if wtap_dump() had
+ * been handed the frame.  Returns FALSE, with "*err" set, on failure. */
+WS_DLL_PUBLIC
+gboolean wtap_dump_hwgen_record(wtap_dumper *wdh, const struct wtap_pkthdr *phdr,
+    const guint8 *rec, gint rec_len, int *err);
+
 /**
  * Return TRUE if we can write a file out with the given GArray of file
  * encapsulations and the given bitmask of comment types.
@@ -0,0 +1,84 @@
+/* crc32-ieee.h
+ * Declaration of the runtime-dispatched IEEE 802.3 CRC-32 engine
+ *
+ * Wireshark - Network traffic analyzer
+ * By Gerald Combs <gerald@wireshark.org>
+ * Copyright 1998 Gerald Combs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CRC32_IEEE_H__
+#define __CRC32_IEEE_H__
+
+#include <glib.h>
+#include "ws_symbol_export.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * This is the reflected 0x04C11DB7 polynomial used by Ethernet, 802.11,
+ * zlib and friends; it is the same CRC that crc32_ccitt_seed() computes.
+ * The fastest implementation the CPU supports is picked on first use.
+ */
+typedef enum {
+	CRC32_IEEE_IMPL_TABLE,		/**< byte-at-a-time table lookup */
+	CRC32_IEEE_IMPL_SLICE8,		/**< slicing-by-8 table lookup */
+	CRC32_IEEE_IMPL_PCLMUL,		/**< x86 PCLMULQDQ carry-less multiply folding */
+	CRC32_IEEE_IMPL_ARMV8,		/**< ARMv8 CRC32 instructions */
+	CRC32_IEEE_NUM_IMPLS
+} crc32_ieee_impl_e;
+
+/** Update a CRC-32 register with a buffer of data.  No pre- or
+ *  post-conditioning is applied, so partial results can be chained.
+ @param crc The current register value.
+ @param buf The buffer containing the data.
+ @param len The number of bytes to include in the computation.
+ @return The updated register value. */
+WS_DLL_PUBLIC guint32 crc32_ieee_update(guint32 crc, const guint8 *buf, gsize len);
+
+/** Compute the CRC-32 (e.g. the Ethernet FCS) of a buffer of data, i.e.
+ *  ~crc32_ieee_update(0xFFFFFFFF, buf, len).
+ @param buf The buffer containing the data.
+ @param len The number of bytes to include in the computation.
+ @return The CRC-32 checksum. */
+WS_DLL_PUBLIC guint32 crc32_ieee(const guint8 *buf, gsize len);
+
+/** Return the implementation crc32_ieee_update() dispatches to. */
+WS_DLL_PUBLIC crc32_ieee_impl_e crc32_ieee_get_impl(void);
+
+/** Is the given implementation built in and supported by this CPU? */
+WS_DLL_PUBLIC gboolean crc32_ieee_impl_available(crc32_ieee_impl_e impl);
+
+/** Return a short printable name for the given implementation. */
+WS_DLL_PUBLIC const char *crc32_ieee_impl_name(crc32_ieee_impl_e impl);
+
+/** Like crc32_ieee_update(), but with an explicit implementation; this is
+ *  meant for tests and benchmarks.  The implementation must be available.
+ @param impl The implementation to use.
+ @param crc The current register value.
+ @param buf The buffer containing the data.
+ @param len The number of bytes to include in the computation.
+ @return The updated register value. */
+WS_DLL_PUBLIC guint32 crc32_ieee_update_impl(crc32_ieee_impl_e impl, guint32 crc,
+    const guint8 *buf, gsize len);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* crc32-ieee.h */
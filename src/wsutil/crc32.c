@@ -29,6 +29,7 @@
 
 #include <glib.h>
 #include <wsutil/crc32.h>
+#include <wsutil/crc32-ieee.h>
 
 /*****************************************************************/
 /*                                                               */
@@ -333,13 +334,9 @@ crc32_ccitt(const guint8 *buf, guint len)
 guint32
 crc32_ccitt_seed(const guint8 *buf, guint len, guint32 seed)
 {
-	guint i;
-	guint32 crc32 = seed;
-
-	for (i = 0; i < len; i++)
-		crc32 = crc32_ccitt_table[(crc32 ^ buf[i]) & 0xff] ^ (crc32 >> 8);
-
-	return ( ~crc32 );
+	/* Same polynomial as crc32_ccitt_table; let the engine pick the
+	 * fastest implementation this CPU has. */
+	return ( ~crc32_ieee_update(seed, buf, len) );
 }
 
 guint32
@@ -0,0 +1,154 @@
+/* crc32_bench.c
+ * Cross-checks and times the CRC-32 engine implementations
+ *
+ * Wireshark - Network traffic analyzer
+ * By Gerald Combs <gerald@wireshark.org>
+ * Copyright 1998 Gerald Combs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Usage: crc32_bench [<buffer size> [<passes>]]
+ *
+ * Every available implementation is first checked against the table
+ * implementation on all lengths up to 1 KiB at every alignment, then
+ * timed over <passes> passes of a <buffer size> buffer.  The buffer is
+ * hashed in Ethernet-frame-sized slices as well as in one piece, since
+ * that is how the hw-gen writer and the FCS dissectors use it.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib.h>
+#include <wsutil/crc32-ieee.h>
+
+#define DEFAULT_BUF_SIZE    (64 * 1024 * 1024)
+#define DEFAULT_PASSES      8
+#define FRAME_SIZE          1514
+
+static gboolean
+check_impl(crc32_ieee_impl_e impl, const guint8 *buf)
+{
+	gsize    off, len;
+	guint32  expected, got;
+
+	for (off = 0; off < 16; off++) {
+		for (len = 0; len <= 1024; len++) {
+			expected = crc32_ieee_update_impl(CRC32_IEEE_IMPL_TABLE, 0xFFFFFFFFU, buf + off, len);
+			got = crc32_ieee_update_impl(impl, 0xFFFFFFFFU, buf + off, len);
+			if (got != expected) {
+				fprintf(stderr, "crc32_bench: %s: offset %u length %u: got 0x%08x, expected 0x%08x\n",
+				    crc32_ieee_impl_name(impl), (guint)off, (guint)len, got, expected);
+				return FALSE;
+			}
+		}
+	}
+	return TRUE;
+}
+
+static double
+time_impl(crc32_ieee_impl_e impl, const guint8 *buf, gsize buf_size,
+    int passes, gsize slice, guint32 *result)
+{
+	GTimer  *timer;
+	gsize    off, len;
+	guint32  crc = 0;
+	double   elapsed;
+	int      pass;
+
+	timer = g_timer_new();
+	g_timer_start(timer);
+	for (pass = 0; pass < passes; pass++) {
+		for (off = 0; off < buf_size; off += slice) {
+			len = MIN(slice, buf_size - off);
+			crc ^= crc32_ieee_update_impl(impl, 0xFFFFFFFFU, buf + off, len);
+		}
+	}
+	elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	/* Hand the result back so the work can't be optimized away. */
+	*result = crc;
+	return elapsed;
+}
+
+int
+main(int argc, char **argv)
+{
+	gsize    buf_size = DEFAULT_BUF_SIZE;
+	int      passes = DEFAULT_PASSES;
+	guint8  *buf;
+	gsize    i;
+	int      impl;
+	int      ret = 0;
+	guint32  whole, framed;
+	double   t_whole, t_framed;
+
+	if (argc > 1)
+		buf_size = (gsize)strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		passes = atoi(argv[2]);
+	if (buf_size < 1024 + 16 || passes <= 0) {
+		fprintf(stderr, "Usage: crc32_bench [<buffer size> [<passes>]]\n");
+		return 1;
+	}
+
+	buf = (guint8 *)g_malloc(buf_size);
+	srand(1);
+	for (i = 0; i < buf_size; i++)
+		buf[i] = (guint8)rand();
+
+	printf("Buffer %" G_GSIZE_FORMAT " bytes, %d passes, dispatching to %s\n",
+	    buf_size, passes, crc32_ieee_impl_name(crc32_ieee_get_impl()));
+	printf("%-12s %14s %14s\n", "impl", "MB/s (whole)", "MB/s (frames)");
+
+	for (impl = 0; impl < CRC32_IEEE_NUM_IMPLS; impl++) {
+		if (!crc32_ieee_impl_available((crc32_ieee_impl_e)impl)) {
+			printf("%-12s %14s %14s\n", crc32_ieee_impl_name((crc32_ieee_impl_e)impl),
+			    "n/a", "n/a");
+			continue;
+		}
+		if (!check_impl((crc32_ieee_impl_e)impl, buf)) {
+			ret = 1;
+			continue;
+		}
+
+		t_whole = time_impl((crc32_ieee_impl_e)impl, buf, buf_size, passes, buf_size, &whole);
+		t_framed = time_impl((crc32_ieee_impl_e)impl, buf, buf_size, passes, FRAME_SIZE, &framed);
+		printf("%-12s %14.1f %14.1f\n", crc32_ieee_impl_name((crc32_ieee_impl_e)impl),
+		    (double)buf_size * passes / t_whole / 1e6,
+		    (double)buf_size * passes / t_framed / 1e6);
+	}
+
+	g_free(buf);
+	return ret;
+}
+
+/*
+ * Editor modelines  -  http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
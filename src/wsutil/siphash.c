@@ -0,0 +1,116 @@
+/* siphash.c
+ * SipHash-2-4 keyed hash function
+ *
+ * Wireshark - Network traffic analyzer
+ * By Gerald Combs <gerald@wireshark.org>
+ * Copyright 1998 Gerald Combs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Credits:
+ *
+ * Jean-Philippe Aumasson and Daniel J. Bernstein, "SipHash: a fast
+ * short-input PRF", INDOCRYPT 2012; the 128-bit output variant is the
+ * one of their reference implementation.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <wsutil/pint.h>
+#include <wsutil/siphash.h>
+
+#define ROTL64(x, b)	(guint64)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND \
+	do { \
+		v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+		v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+	} while (0)
+
+static void
+put_le64(guint8 *p, guint64 v)
+{
+	int	i;
+
+	for (i = 0; i < 8; i++)
+		p[i] = (guint8)(v >> (8 * i));
+}
+
+void
+siphash128(const guint8 *key, const guint8 *buf, gsize len, guint8 *digest)
+{
+	guint64	k0 = pletoh64(key);
+	guint64	k1 = pletoh64(key + 8);
+	guint64	v0 = G_GUINT64_CONSTANT(0x736f6d6570736575) ^ k0;
+	guint64	v1 = G_GUINT64_CONSTANT(0x646f72616e646f6d) ^ k1 ^ 0xee;
+	guint64	v2 = G_GUINT64_CONSTANT(0x6c7967656e657261) ^ k0;
+	guint64	v3 = G_GUINT64_CONSTANT(0x7465646279746573) ^ k1;
+	guint64	m, b = (guint64)len << 56;
+	gsize	left = len & 7;
+	const guint8 *end = buf + len - left;
+
+	for (; buf != end; buf += 8) {
+		m = pletoh64(buf);
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+
+	/* The last 0 to 7 bytes, and the length */
+	switch (left) {
+	case 7: b |= (guint64)buf[6] << 48;	/* FALL THROUGH */
+	case 6: b |= (guint64)buf[5] << 40;	/* FALL THROUGH */
+	case 5: b |= (guint64)buf[4] << 32;	/* FALL THROUGH */
+	case 4: b |= (guint64)buf[3] << 24;	/* FALL THROUGH */
+	case 3: b |= (guint64)buf[2] << 16;	/* FALL THROUGH */
+	case 2: b |= (guint64)buf[1] << 8;	/* FALL THROUGH */
+	case 1: b |= (guint64)buf[0];
+	}
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+
+	v2 ^= 0xee;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	put_le64(digest, v0 ^ v1 ^ v2 ^ v3);
+
+	v1 ^= 0xdd;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	put_le64(digest + 8, v0 ^ v1 ^ v2 ^ v3);
+}
+
+/*
+ * Editor modelines  -  http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
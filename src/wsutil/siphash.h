@@ -0,0 +1,63 @@
+/* siphash.h
+ * Declaration of the SipHash-2-4 keyed hash function
+ *
+ * Wireshark - Network traffic analyzer
+ * By Gerald Combs <gerald@wireshark.org>
+ * Copyright 1998 Gerald Combs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __SIPHASH_H__
+#define __SIPHASH_H__
+
+#include <glib.h>
+#include "ws_symbol_export.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define SIPHASH_KEY_LEN		16
+#define SIPHASH128_LEN		16
+
+/** Compute the 128-bit SipHash-2-4 of a buffer of data.  SipHash is
+ *  much faster than a cryptographic digest such as MD5, while with a
+ *  secret key it still keeps anyone from making collisions on purpose.
+ @param key The 16-byte key.
+ @param buf The buffer containing the data.
+ @param len The number of bytes to include in the computation.
+ @param digest Where to put the 16-byte result. */
+WS_DLL_PUBLIC void siphash128(const guint8 *key, const guint8 *buf, gsize len,
+    guint8 *digest);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* siphash.h */
+
+/*
+ * Editor modelines  -  http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */